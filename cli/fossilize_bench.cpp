@@ -23,9 +23,14 @@
 #include "fossilize.hpp"
 #include "fossilize_db.hpp"
 #include "layer/utils.hpp"
+#include "layer/pipeline_usage.hpp"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <memory>
 #include <random>
+#include <thread>
 #include <vector>
 #include "fossilize_inttypes.h"
 
@@ -192,6 +197,428 @@ static void bench_recorder(const char *path, bool compressed, bool checksum)
 	}
 }
 
+// Records from several threads at once, like a game which creates pipelines from its loader threads.
+// Only the latency of record_* calls on the calling threads is measured, not the recording thread.
+static void bench_concurrent_recording(unsigned thread_count)
+{
+	const char *path = ".test.concurrent.foz";
+	remove(path);
+	auto iface = std::unique_ptr<DatabaseInterface>(create_database(path, DatabaseMode::OverWrite));
+	StateRecorder recorder;
+	recorder.init_recording_thread(iface.get());
+
+	VkPipelineLayoutCreateInfo layout_info = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	if (!recorder.record_pipeline_layout((VkPipelineLayout)uint64_t(1), layout_info))
+		abort();
+
+	VkAttachmentDescription attachment = {};
+	attachment.format = VK_FORMAT_R8G8B8A8_UNORM;
+	attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	VkAttachmentReference color = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkSubpassDescription subpass = {};
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &color;
+	VkRenderPassCreateInfo pass_info = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+	pass_info.attachmentCount = 1;
+	pass_info.pAttachments = &attachment;
+	pass_info.subpassCount = 1;
+	pass_info.pSubpasses = &subpass;
+	if (!recorder.record_render_pass((VkRenderPass)uint64_t(1), pass_info))
+		abort();
+
+	const unsigned modules_per_thread = 64;
+	const unsigned pipelines_per_thread = 2048;
+
+	std::mt19937 rnd(1);
+	std::uniform_int_distribution<int> dist(1, 500);
+
+	// 64 KB SPIR-V modules.
+	std::vector<uint32_t> dummy_spirv(16 * 1024);
+	for (auto &d : dummy_spirv)
+		d = dist(rnd);
+
+	std::vector<std::vector<int64_t>> latencies(thread_count);
+
+	const auto record_thread = [&](unsigned thread_index) {
+		std::vector<uint32_t> spirv = dummy_spirv;
+		uint64_t handle_base = uint64_t(thread_index) * pipelines_per_thread;
+		auto &thread_latencies = latencies[thread_index];
+		thread_latencies.reserve(modules_per_thread + pipelines_per_thread);
+
+		const auto timed = [&](const std::function<bool ()> &func) {
+			auto call_begin = std::chrono::steady_clock::now();
+			if (!func())
+				abort();
+			auto call_end = std::chrono::steady_clock::now();
+			thread_latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(call_end - call_begin).count());
+		};
+
+		for (unsigned i = 0; i < modules_per_thread; i++)
+		{
+			spirv[0] = thread_index * modules_per_thread + i;
+			VkShaderModuleCreateInfo info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+			info.codeSize = spirv.size() * sizeof(uint32_t);
+			info.pCode = spirv.data();
+			timed([&]() { return recorder.record_shader_module((VkShaderModule)(handle_base + i + 1), info); });
+		}
+
+		for (unsigned i = 0; i < pipelines_per_thread; i++)
+		{
+			VkGraphicsPipelineCreateInfo info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+			info.layout = (VkPipelineLayout)uint64_t(1);
+			info.renderPass = (VkRenderPass)uint64_t(1);
+
+			VkPipelineShaderStageCreateInfo stages[2] = {};
+			stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+			stages[0].pName = "main";
+			stages[0].module = (VkShaderModule)(handle_base + (i % modules_per_thread) + 1);
+			stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+			stages[1].pName = "main";
+			stages[1].module = (VkShaderModule)(handle_base + ((3 * i) % modules_per_thread) + 1);
+			info.stageCount = 2;
+			info.pStages = stages;
+
+			VkPipelineRasterizationStateCreateInfo rs = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+			rs.lineWidth = float(i);
+			info.pRasterizationState = &rs;
+
+			VkPipelineColorBlendAttachmentState blend_attachment = {};
+			blend_attachment.colorWriteMask = 0xf;
+			VkPipelineColorBlendStateCreateInfo cb = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+			cb.attachmentCount = 1;
+			cb.pAttachments = &blend_attachment;
+			info.pColorBlendState = &cb;
+
+			timed([&]() { return recorder.record_graphics_pipeline((VkPipeline)(handle_base + i + 1), info, nullptr, 0); });
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < thread_count; i++)
+		threads.emplace_back(record_thread, i);
+	for (auto &thread : threads)
+		thread.join();
+
+	std::vector<int64_t> all_latencies;
+	for (auto &thread_latencies : latencies)
+		all_latencies.insert(all_latencies.end(), thread_latencies.begin(), thread_latencies.end());
+	std::sort(all_latencies.begin(), all_latencies.end());
+
+	const auto percentile = [&](double p) -> double {
+		return all_latencies[size_t(p * double(all_latencies.size() - 1))] * 1e-3;
+	};
+
+	LOGI("[RECORD] %2u threads: p50 %.3f us, p90 %.3f us, p99 %.3f us, p99.9 %.3f us, max %.3f us\n",
+	     thread_count, percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999),
+	     all_latencies.back() * 1e-3);
+}
+
+// Measures what counting vkCmdBindPipeline in the layer costs the threads recording command buffers,
+// optionally while another thread destroys a pipeline every millisecond, and what each of those destroys costs.
+static void bench_pipeline_usage(unsigned thread_count, bool concurrent_destroy)
+{
+	StateRecorder recorder;
+	recorder.init_recording_thread(nullptr);
+
+	// A frame worth of distinct pipelines, bound over and over like a render loop would.
+	const unsigned pipeline_count = 256;
+	const unsigned binds_per_thread = 4 * 1024 * 1024;
+
+	std::atomic<bool> done(false);
+	std::thread destroyer;
+	int64_t destroy_ns = 0;
+	unsigned destroy_count = 0;
+	if (concurrent_destroy)
+	{
+		destroyer = std::thread([&]() {
+			while (!done.load(std::memory_order_relaxed))
+			{
+				auto begin_time = std::chrono::steady_clock::now();
+				PipelineUsage::forgetPipeline((VkPipeline)uint64_t(1 + (destroy_count % pipeline_count)));
+				auto end_time = std::chrono::steady_clock::now();
+				destroy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - begin_time).count();
+				destroy_count++;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		});
+	}
+
+	// Aggregate throughput, so that time slicing on hosts with fewer cores than threads does not inflate the cost.
+	auto begin_time = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < thread_count; t++)
+	{
+		threads.emplace_back([&]() {
+			for (unsigned i = 0; i < binds_per_thread; i++)
+				PipelineUsage::countBind(&recorder, (VkPipeline)uint64_t(1 + (i % pipeline_count)));
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+	auto end_time = std::chrono::steady_clock::now();
+	done = true;
+	if (destroyer.joinable())
+		destroyer.join();
+	PipelineUsage::flushAllThreads();
+	recorder.tear_down_recording_thread();
+
+	int64_t total_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - begin_time).count();
+	LOGI("[USAGE] %u threads%s: %.2f ns / vkCmdBindPipeline.\n", thread_count,
+	     concurrent_destroy ? ", destroying a pipeline every ms" : "",
+	     double(total_ns) / (double(thread_count) * binds_per_thread));
+	if (destroy_count)
+		LOGI("[USAGE] %u threads: %.2f us / vkDestroyPipeline.\n", thread_count, destroy_ns * 1e-3 / destroy_count);
+}
+
+static void bench_duplicate_recording(HashScheme scheme, bool early_duplicate_check)
+{
+	const char *path = ".test.duplicates.foz";
+	const unsigned module_count = 256;
+	const unsigned sampler_count = 1024;
+
+	std::mt19937 rnd(1);
+	std::uniform_int_distribution<int> dist(1, 500);
+
+	// 64 KB SPIR-V modules.
+	std::vector<uint32_t> spirv(16 * 1024);
+	for (auto &d : spirv)
+		d = dist(rnd);
+
+	const auto record = [&](StateRecorder &recorder, int64_t *module_time, int64_t *sampler_time) {
+		auto begin_time = std::chrono::steady_clock::now();
+		for (unsigned i = 0; i < module_count; i++)
+		{
+			spirv[0] = i;
+			VkShaderModuleCreateInfo info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+			info.codeSize = spirv.size() * sizeof(uint32_t);
+			info.pCode = spirv.data();
+			if (!recorder.record_shader_module((VkShaderModule)uint64_t(i + 1), info))
+				abort();
+		}
+		auto end_time = std::chrono::steady_clock::now();
+		*module_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - begin_time).count();
+
+		begin_time = std::chrono::steady_clock::now();
+		for (unsigned i = 0; i < sampler_count; i++)
+		{
+			VkSamplerCreateInfo info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+			info.maxLod = float(i);
+			if (!recorder.record_sampler((VkSampler)uint64_t(i + 1), info))
+				abort();
+		}
+		end_time = std::chrono::steady_clock::now();
+		*sampler_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - begin_time).count();
+	};
+
+	int64_t module_time, sampler_time;
+	remove(path);
+	{
+		auto iface = std::unique_ptr<DatabaseInterface>(create_database(path, DatabaseMode::OverWrite));
+		StateRecorder recorder;
+		recorder.set_hash_scheme(scheme);
+		recorder.init_recording_thread(iface.get());
+		record(recorder, &module_time, &sampler_time);
+	}
+
+	{
+		auto iface = std::unique_ptr<DatabaseInterface>(create_database(path, DatabaseMode::Append));
+		StateRecorder recorder;
+		recorder.set_hash_scheme(scheme);
+		recorder.set_database_enable_early_duplicate_check(early_duplicate_check);
+		recorder.init_recording_thread(iface.get());
+
+		// An application would spend this time creating its device.
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		record(recorder, &module_time, &sampler_time);
+	}
+	remove(path);
+
+	LOGI("[DUPLICATES] %s, early check %s: %u modules %.3f ms, %u samplers %.3f ms\n",
+	     Hashing::get_hash_scheme_name(scheme), early_duplicate_check ? "on" : "off",
+	     module_count, module_time * 1e-6, sampler_count, sampler_time * 1e-6);
+}
+
+static void bench_hashing(HashScheme scheme)
+{
+	std::mt19937 rnd(1);
+	std::uniform_int_distribution<int> dist(1, 500);
+
+	// 1 MB SPIR-V module.
+	std::vector<uint32_t> dummy_spirv(256 * 1024);
+	for (auto &d : dummy_spirv)
+		d = dist(rnd);
+
+	VkShaderModuleCreateInfo module_info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+	module_info.codeSize = dummy_spirv.size() * sizeof(uint32_t);
+	module_info.pCode = dummy_spirv.data();
+
+	const unsigned module_iterations = 256;
+	Hash hash_sum = 0;
+	auto begin_time = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < module_iterations; i++)
+	{
+		dummy_spirv[0] = i;
+		Hash hash;
+		if (!Hashing::compute_hash_shader_module(module_info, &hash, scheme))
+			abort();
+		hash_sum += hash;
+	}
+	auto end_time = std::chrono::steady_clock::now();
+	auto len = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - begin_time).count();
+	LOGI("[HASH] %s: 1 MB SPIR-V module: %.3f us / module (%.3f GB/s)\n",
+	     Hashing::get_hash_scheme_name(scheme),
+	     len * 1e-3 / module_iterations,
+	     double(module_info.codeSize) * module_iterations / double(len));
+
+	// A typical pipeline. Hashing it requires the dependent objects to be known by the recorder,
+	// so record those inline first.
+	StateRecorder recorder;
+	recorder.set_hash_scheme(scheme);
+
+	dummy_spirv.resize(4096);
+	module_info.codeSize = dummy_spirv.size() * sizeof(uint32_t);
+	for (unsigned i = 0; i < 2; i++)
+	{
+		dummy_spirv[0] = i;
+		if (!recorder.record_shader_module((VkShaderModule)uint64_t(i + 1), module_info))
+			abort();
+	}
+
+	VkDescriptorSetLayoutBinding bindings[8] = {};
+	for (unsigned i = 0; i < 8; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorCount = 1;
+		bindings[i].descriptorType = i < 4 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[i].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+	}
+	VkDescriptorSetLayoutCreateInfo set_layout = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	set_layout.bindingCount = 8;
+	set_layout.pBindings = bindings;
+	if (!recorder.record_descriptor_set_layout((VkDescriptorSetLayout)uint64_t(1), set_layout))
+		abort();
+
+	VkDescriptorSetLayout set_layout_handle = (VkDescriptorSetLayout)uint64_t(1);
+	VkPipelineLayoutCreateInfo layout = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	layout.setLayoutCount = 1;
+	layout.pSetLayouts = &set_layout_handle;
+	if (!recorder.record_pipeline_layout((VkPipelineLayout)uint64_t(1), layout))
+		abort();
+
+	VkAttachmentDescription attachments[2] = {};
+	attachments[0].format = VK_FORMAT_R8G8B8A8_UNORM;
+	attachments[1].format = VK_FORMAT_D32_SFLOAT;
+	for (auto &att : attachments)
+	{
+		att.samples = VK_SAMPLE_COUNT_1_BIT;
+		att.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		att.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		att.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		att.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+	}
+	VkAttachmentReference color_ref = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference depth_ref = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	VkSubpassDescription subpass = {};
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &color_ref;
+	subpass.pDepthStencilAttachment = &depth_ref;
+	VkRenderPassCreateInfo pass = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+	pass.attachmentCount = 2;
+	pass.pAttachments = attachments;
+	pass.subpassCount = 1;
+	pass.pSubpasses = &subpass;
+	if (!recorder.record_render_pass((VkRenderPass)uint64_t(1), pass))
+		abort();
+
+	VkGraphicsPipelineCreateInfo info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	info.layout = (VkPipelineLayout)uint64_t(1);
+	info.renderPass = (VkRenderPass)uint64_t(1);
+
+	VkPipelineShaderStageCreateInfo stages[2] = {};
+	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	stages[0].pName = "main";
+	stages[0].module = (VkShaderModule)uint64_t(1);
+	stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	stages[1].pName = "main";
+	stages[1].module = (VkShaderModule)uint64_t(2);
+	info.stageCount = 2;
+	info.pStages = stages;
+
+	VkVertexInputAttributeDescription attributes[4] = {};
+	for (unsigned i = 0; i < 4; i++)
+	{
+		attributes[i].location = i;
+		attributes[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributes[i].offset = 16 * i;
+	}
+	VkVertexInputBindingDescription binding = { 0, 64, VK_VERTEX_INPUT_RATE_VERTEX };
+	VkPipelineVertexInputStateCreateInfo vi = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+	vi.vertexAttributeDescriptionCount = 4;
+	vi.pVertexAttributeDescriptions = attributes;
+	vi.vertexBindingDescriptionCount = 1;
+	vi.pVertexBindingDescriptions = &binding;
+	info.pVertexInputState = &vi;
+
+	VkPipelineInputAssemblyStateCreateInfo ia = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+	ia.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	info.pInputAssemblyState = &ia;
+
+	VkPipelineViewportStateCreateInfo vp = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+	vp.viewportCount = 1;
+	vp.scissorCount = 1;
+	info.pViewportState = &vp;
+
+	VkPipelineRasterizationStateCreateInfo rs = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+	rs.cullMode = VK_CULL_MODE_BACK_BIT;
+	rs.lineWidth = 1.0f;
+	info.pRasterizationState = &rs;
+
+	VkPipelineMultisampleStateCreateInfo ms = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+	ms.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	info.pMultisampleState = &ms;
+
+	VkPipelineDepthStencilStateCreateInfo ds = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+	ds.depthTestEnable = VK_TRUE;
+	ds.depthWriteEnable = VK_TRUE;
+	ds.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	info.pDepthStencilState = &ds;
+
+	VkPipelineColorBlendAttachmentState blend_attachment = {};
+	blend_attachment.colorWriteMask = 0xf;
+	VkPipelineColorBlendStateCreateInfo cb = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+	cb.attachmentCount = 1;
+	cb.pAttachments = &blend_attachment;
+	info.pColorBlendState = &cb;
+
+	static const VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dyn = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+	dyn.dynamicStateCount = 2;
+	dyn.pDynamicStates = dynamic_states;
+	info.pDynamicState = &dyn;
+
+	const unsigned pipeline_iterations = 1000000;
+	begin_time = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < pipeline_iterations; i++)
+	{
+		rs.depthBiasConstantFactor = float(i);
+		Hash hash;
+		if (!Hashing::compute_hash_graphics_pipeline(recorder, info, &hash))
+			abort();
+		hash_sum += hash;
+	}
+	end_time = std::chrono::steady_clock::now();
+	len = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - begin_time).count();
+	LOGI("[HASH] %s: graphics pipeline: %.3f ns / pipeline (checksum %016" PRIx64 ")\n",
+	     Hashing::get_hash_scheme_name(scheme),
+	     double(len) / pipeline_iterations, hash_sum);
+}
+
 struct ReplayInterface : StateCreatorInterface
 {
 	bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override
@@ -296,6 +723,32 @@ static bool dummy_replay_archive(const char *path)
 
 int main()
 {
+	LOGI("=== Testing hash schemes ===\n");
+	bench_hashing(HASH_SCHEME_FNV1);
+	bench_hashing(HASH_SCHEME_STRIPED);
+	LOGI("===================\n\n");
+
+	LOGI("=== Testing pipeline usage counting ===\n");
+	for (unsigned thread_count : { 1, 4 })
+	{
+		bench_pipeline_usage(thread_count, false);
+		bench_pipeline_usage(thread_count, true);
+	}
+	LOGI("===================\n\n");
+
+	LOGI("=== Testing recording of known objects ===\n");
+	for (auto scheme : { HASH_SCHEME_FNV1, HASH_SCHEME_STRIPED })
+	{
+		bench_duplicate_recording(scheme, false);
+		bench_duplicate_recording(scheme, true);
+	}
+	LOGI("===================\n\n");
+
+	LOGI("=== Testing concurrent recording ===\n");
+	for (unsigned thread_count : { 1, 2, 4, 8, 16 })
+		bench_concurrent_recording(thread_count);
+	LOGI("===================\n\n");
+
 	for (unsigned i = 0; i < 2; i++)
 	{
 		const char *path_compressed = i ? ".test.compressed.zip" : ".test.compressed.foz";
@@ -0,0 +1,258 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "fossilize_inttypes.h"
+#include "fossilize_db.hpp"
+#include "fossilize.hpp"
+#include "cli_parser.hpp"
+#include "layer/utils.hpp"
+#include <memory>
+#include <vector>
+#include <string>
+
+using namespace Fossilize;
+using namespace std;
+
+static void print_help()
+{
+	LOGI("Usage: fossilize-index\n"
+	     "\t<database path>\n"
+	     "\t[--output path]\n");
+}
+
+template <typename T>
+static inline T fake_handle(uint64_t v)
+{
+	return (T)v;
+}
+
+// Handles are the hashes of the objects, so the create infos of pipelines refer to their dependencies by hash.
+struct IndexReplayer : StateCreatorInterface
+{
+	struct Entry
+	{
+		ResourceTag tag;
+		Hash hash;
+		Hash layout;
+		Hash render_pass;
+		Hash base_pipeline;
+		vector<Hash> modules;
+	};
+	vector<Entry> entries;
+
+	bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *, VkSampler *sampler) override
+	{
+		*sampler = fake_handle<VkSampler>(hash);
+		return true;
+	}
+
+	bool enqueue_create_descriptor_set_layout(Hash hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *layout) override
+	{
+		*layout = fake_handle<VkDescriptorSetLayout>(hash);
+		return true;
+	}
+
+	bool enqueue_create_pipeline_layout(Hash hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *layout) override
+	{
+		*layout = fake_handle<VkPipelineLayout>(hash);
+		return true;
+	}
+
+	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *, VkShaderModule *module) override
+	{
+		*module = fake_handle<VkShaderModule>(hash);
+		return true;
+	}
+
+	bool enqueue_create_render_pass(Hash hash, const VkRenderPassCreateInfo *, VkRenderPass *render_pass) override
+	{
+		*render_pass = fake_handle<VkRenderPass>(hash);
+		return true;
+	}
+
+	bool enqueue_create_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	{
+		*pipeline = fake_handle<VkPipeline>(hash);
+
+		Entry entry = { RESOURCE_COMPUTE_PIPELINE, hash, (Hash) create_info->layout, 0, 0, {} };
+		if ((create_info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
+			entry.base_pipeline = (Hash) create_info->basePipelineHandle;
+		entry.modules.push_back((Hash) create_info->stage.module);
+		entries.push_back(move(entry));
+		return true;
+	}
+
+	bool enqueue_create_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	{
+		*pipeline = fake_handle<VkPipeline>(hash);
+
+		Entry entry = { RESOURCE_GRAPHICS_PIPELINE, hash, (Hash) create_info->layout, (Hash) create_info->renderPass, 0, {} };
+		if ((create_info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
+			entry.base_pipeline = (Hash) create_info->basePipelineHandle;
+		for (uint32_t i = 0; i < create_info->stageCount; i++)
+			entry.modules.push_back((Hash) create_info->pStages[i].module);
+		entries.push_back(move(entry));
+		return true;
+	}
+};
+
+int main(int argc, char **argv)
+{
+	CLICallbacks cbs;
+	string db_path;
+	string output_path;
+	cbs.default_handler = [&](const char *path) { db_path = path; };
+	cbs.add("--help", [&](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--output", [&](CLIParser &parser) { output_path = parser.next_string(); });
+	cbs.error_handler = [] { print_help(); };
+	CLIParser parser(move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (db_path.empty())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	auto input_db = unique_ptr<DatabaseInterface>(create_database(db_path.c_str(), DatabaseMode::ReadOnly));
+	if (!input_db || !input_db->prepare())
+	{
+		LOGE("Failed to load database: %s\n", db_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	StateReplayer replayer;
+	replayer.set_resolve_shader_module_handles(false);
+	replayer.set_resolve_derivative_pipeline_handles(false);
+	IndexReplayer index_replayer;
+
+	static const ResourceTag playback_order[] = {
+		RESOURCE_SAMPLER,
+		RESOURCE_DESCRIPTOR_SET_LAYOUT,
+		RESOURCE_PIPELINE_LAYOUT,
+		RESOURCE_RENDER_PASS,
+		RESOURCE_GRAPHICS_PIPELINE,
+		RESOURCE_COMPUTE_PIPELINE,
+	};
+
+	vector<uint8_t> state_json;
+	unsigned failed_pipelines = 0;
+
+	for (auto tag : playback_order)
+	{
+		size_t hash_count = 0;
+		if (!input_db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+		{
+			LOGE("Failed to get hashes.\n");
+			return EXIT_FAILURE;
+		}
+
+		vector<Hash> hashes(hash_count);
+		if (!input_db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+		{
+			LOGE("Failed to get hashes.\n");
+			return EXIT_FAILURE;
+		}
+
+		bool is_pipeline = tag == RESOURCE_GRAPHICS_PIPELINE || tag == RESOURCE_COMPUTE_PIPELINE;
+
+		for (auto hash : hashes)
+		{
+			size_t state_json_size = 0;
+			if (!input_db->read_entry(tag, hash, &state_json_size, nullptr, 0))
+			{
+				LOGE("Failed to load blob from cache.\n");
+				return EXIT_FAILURE;
+			}
+
+			state_json.resize(state_json_size);
+
+			if (!input_db->read_entry(tag, hash, &state_json_size, state_json.data(), 0))
+			{
+				LOGE("Failed to load blob from cache.\n");
+				return EXIT_FAILURE;
+			}
+
+			// Pipelines which cannot be parsed are left out. Users of the index fall back to parsing them.
+			if (!replayer.parse(index_replayer, input_db.get(), state_json.data(), state_json.size()))
+			{
+				LOGE("Failed to parse blob (tag: %d, hash: 0x%" PRIx64 ").\n", tag, hash);
+				if (is_pipeline)
+					failed_pipelines++;
+			}
+
+			// Pipeline create infos are not needed after they have been indexed.
+			if (is_pipeline)
+				replayer.get_allocator().reset();
+		}
+	}
+
+	vector<PipelineDependencies> dependencies;
+	dependencies.reserve(index_replayer.entries.size());
+	for (auto &entry : index_replayer.entries)
+	{
+		dependencies.push_back({ entry.tag, entry.hash, entry.layout, entry.render_pass, entry.base_pipeline,
+		                         entry.modules.data(), uint32_t(entry.modules.size()) });
+	}
+
+	uint8_t *serialized = nullptr;
+	size_t serialized_size = 0;
+	Hash index_hash = 0;
+	if (!StateRecorder::serialize_pipeline_dependencies(dependencies.data(), dependencies.size(),
+	                                                    &serialized, &serialized_size, &index_hash))
+	{
+		LOGE("Failed to serialize pipeline dependencies.\n");
+		return EXIT_FAILURE;
+	}
+
+	// Archives are append-only, so the index can be added to the input database in place.
+	input_db.reset();
+	unique_ptr<DatabaseInterface> output_db;
+	if (output_path.empty())
+		output_db.reset(create_database(db_path.c_str(), DatabaseMode::Append));
+	else
+		output_db.reset(create_database(output_path.c_str(), DatabaseMode::OverWrite));
+
+	if (!output_db || !output_db->prepare())
+	{
+		LOGE("Failed to open database for writing: %s\n", output_path.empty() ? db_path.c_str() : output_path.c_str());
+		StateRecorder::free_serialized(serialized);
+		return EXIT_FAILURE;
+	}
+
+	bool ret = output_db->write_entry(RESOURCE_PIPELINE_DEPENDENCIES, index_hash, serialized, serialized_size,
+	                                  PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT);
+	StateRecorder::free_serialized(serialized);
+	if (!ret)
+	{
+		LOGE("Failed to write pipeline dependencies.\n");
+		return EXIT_FAILURE;
+	}
+
+	LOGI("Indexed %u pipelines (%u failed to parse), %" PRIu64 " bytes.\n",
+	     unsigned(dependencies.size()), failed_pipelines, uint64_t(serialized_size));
+	return EXIT_SUCCESS;
+}
@@ -22,10 +22,13 @@
 
 #include "fossilize_inttypes.h"
 #include "fossilize_db.hpp"
+#include "fossilize.hpp"
 #include "cli_parser.hpp"
 #include "layer/utils.hpp"
 #include <memory>
 #include <vector>
+#include <unordered_map>
+#include <algorithm>
 
 using namespace Fossilize;
 using namespace std;
@@ -34,7 +37,102 @@ static void print_help()
 {
 	LOGI("Usage: fossilize-list\n"
 	     "\t<database path>\n"
-	     "\t[--tag index]\n");
+	     "\t[--tag index]\n"
+	     "\t[--pipeline-feedback]\n"
+	     "\t[--pipeline-usage]\n");
+}
+
+// Every recorder run writes its own metadata blobs, so combine them per pipeline.
+struct MetadataCollector : StateCreatorInterface
+{
+	unordered_map<Hash, PipelineFeedback> feedback;
+	unordered_map<Hash, StateRecorderPipelineUsage> usage;
+
+	void notify_pipeline_feedback(const PipelineFeedback &info) override
+	{
+		merge_pipeline_feedback(feedback[info.hash], info);
+	}
+
+	void notify_pipeline_usage(Hash, const StateRecorderPipelineUsage &info) override
+	{
+		auto &entry = usage[info.hash];
+		entry.tag = info.tag;
+		entry.hash = info.hash;
+		entry.bind_count += info.bind_count;
+	}
+
+	bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override { return true; }
+	bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override { return true; }
+	bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override { return true; }
+	bool enqueue_create_shader_module(Hash, const VkShaderModuleCreateInfo *, VkShaderModule *) override { return true; }
+	bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override { return true; }
+	bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *, VkPipeline *) override { return true; }
+	bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *) override { return true; }
+};
+
+static bool collect_metadata(DatabaseInterface &db, ResourceTag tag, const vector<Hash> &hashes,
+                             MetadataCollector &collector)
+{
+	StateReplayer replayer;
+	vector<uint8_t> blob;
+
+	for (auto hash : hashes)
+	{
+		size_t blob_size = 0;
+		if (!db.read_entry(tag, hash, &blob_size, nullptr, 0))
+			return false;
+		blob.resize(blob_size);
+		if (!db.read_entry(tag, hash, &blob_size, blob.data(), 0))
+			return false;
+		if (!replayer.parse(collector, nullptr, blob.data(), blob.size()))
+			return false;
+	}
+
+	return true;
+}
+
+static bool list_pipeline_feedback(DatabaseInterface &db, const vector<Hash> &hashes)
+{
+	MetadataCollector collector;
+	if (!collect_metadata(db, RESOURCE_PIPELINE_FEEDBACK, hashes, collector))
+		return false;
+
+	printf("%-16s %-8s %8s %12s %12s %12s %10s\n", "pipeline", "type", "count", "min (us)", "avg (us)", "max (us)", "cache hits");
+	for (auto &itr : collector.feedback)
+	{
+		auto &info = itr.second;
+		printf("%016" PRIx64 " %-8s %8" PRIu64 " %12.1f %12.1f %12.1f %4" PRIu64 " / %-4" PRIu64 "\n",
+		       info.hash, info.tag == RESOURCE_GRAPHICS_PIPELINE ? "graphics" : "compute", info.count,
+		       1e-3 * double(info.min_duration_ns), 1e-3 * double(info.total_duration_ns) / double(info.count),
+		       1e-3 * double(info.max_duration_ns), info.cache_hit_count, info.valid_feedback_count);
+	}
+
+	return true;
+}
+
+// Hottest pipelines first.
+static bool list_pipeline_usage(DatabaseInterface &db, const vector<Hash> &hashes)
+{
+	MetadataCollector collector;
+	if (!collect_metadata(db, RESOURCE_PIPELINE_USAGE, hashes, collector))
+		return false;
+
+	vector<StateRecorderPipelineUsage> usage;
+	usage.reserve(collector.usage.size());
+	for (auto &itr : collector.usage)
+		usage.push_back(itr.second);
+	sort(usage.begin(), usage.end(), [](const StateRecorderPipelineUsage &a, const StateRecorderPipelineUsage &b) {
+		return a.bind_count > b.bind_count;
+	});
+
+	printf("%-16s %-8s %12s\n", "pipeline", "type", "binds");
+	for (auto &info : usage)
+	{
+		printf("%016" PRIx64 " %-8s %12" PRIu64 "\n",
+		       info.hash, info.tag == RESOURCE_GRAPHICS_PIPELINE ? "graphics" : "compute", info.bind_count);
+	}
+
+	return true;
 }
 
 int main(int argc, char **argv)
@@ -42,9 +140,19 @@ int main(int argc, char **argv)
 	CLICallbacks cbs;
 	string db_path;
 	unsigned tag_uint = 0;
+	bool pipeline_feedback = false;
+	bool pipeline_usage = false;
 	cbs.default_handler = [&](const char *path) { db_path = path; };
 	cbs.add("--help", [&](CLIParser &parser) { print_help(); parser.end(); });
 	cbs.add("--tag", [&](CLIParser &parser) { tag_uint = parser.next_uint(); });
+	cbs.add("--pipeline-feedback", [&](CLIParser &) {
+		tag_uint = RESOURCE_PIPELINE_FEEDBACK;
+		pipeline_feedback = true;
+	});
+	cbs.add("--pipeline-usage", [&](CLIParser &) {
+		tag_uint = RESOURCE_PIPELINE_USAGE;
+		pipeline_usage = true;
+	});
 	cbs.error_handler = [] { print_help(); };
 	CLIParser parser(move(cbs), argc - 1, argv + 1);
 
@@ -88,6 +196,26 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	if (pipeline_feedback)
+	{
+		if (!list_pipeline_feedback(*input_db, hashes))
+		{
+			LOGE("Failed to parse pipeline feedback.\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (pipeline_usage)
+	{
+		if (!list_pipeline_usage(*input_db, hashes))
+		{
+			LOGE("Failed to parse pipeline usage.\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
 	for (auto hash : hashes)
 	{
 		printf("%016" PRIx64 "\n", hash);
@@ -27,6 +27,7 @@
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
+#include <algorithm>
 #include "layer/utils.hpp"
 #include "cli_parser.hpp"
 
@@ -64,6 +65,14 @@ struct PruneReplayer : StateCreatorInterface
 	unordered_set<Hash> accessed_render_passes;
 	unordered_set<Hash> accessed_graphics_pipelines;
 	unordered_set<Hash> accessed_compute_pipelines;
+	unordered_set<Hash> accessed_pipeline_sub_states;
+	// Feedback blobs for pipelines which are kept, and usage blobs for applications which are kept.
+	unordered_set<Hash> accessed_pipeline_feedback;
+	unordered_set<Hash> accessed_pipeline_usage;
+	// Dependency index entries, rewritten for the pipelines which are kept.
+	vector<PipelineDependencies> pipeline_dependencies;
+	vector<unique_ptr<Hash[]>> pipeline_dependency_modules;
+	Hash current_blob_hash = 0;
 	unordered_set<Hash> filter_graphics;
 	unordered_set<Hash> filter_compute;
 	unordered_set<Hash> filter_modules;
@@ -73,9 +82,15 @@ struct PruneReplayer : StateCreatorInterface
 
 	unordered_map<Hash, const VkDescriptorSetLayoutCreateInfo *> descriptor_sets;
 	unordered_map<Hash, const VkPipelineLayoutCreateInfo *> pipeline_layouts;
+	unordered_map<Hash, vector<Hash>> pipeline_sub_states;
 
 	unordered_set<Hash> filtered_blob_hashes[RESOURCE_COUNT];
 
+	// Links which were found in RESOURCE_APPLICATION_LINK_TABLE blobs, to be written back as new tables.
+	unordered_map<Hash, vector<StateRecorderApplicationLink>> application_link_tables;
+	unordered_set<Hash> application_link_table_hashes;
+	bool parsing_application_link_table = false;
+
 	Hash filter_application_hash = 0;
 	bool should_filter_application_hash = false;
 
@@ -110,13 +125,43 @@ struct PruneReplayer : StateCreatorInterface
 		if (skip_application_info_links)
 			return;
 
-		if (should_filter_application_hash && app_hash == filter_application_hash)
-		{
+		if (should_filter_application_hash && app_hash != filter_application_hash)
+			return;
+
+		if (should_filter_application_hash)
 			filtered_blob_hashes[tag].insert(hash);
+
+		if (!parsing_application_link_table)
 			filtered_blob_hashes[RESOURCE_APPLICATION_BLOB_LINK].insert(link_hash);
-		}
-		else if (!should_filter_application_hash)
-			filtered_blob_hashes[RESOURCE_APPLICATION_BLOB_LINK].insert(link_hash);
+		else if (application_link_table_hashes.insert(link_hash).second)
+			application_link_tables[app_hash].push_back({ tag, hash });
+	}
+
+	void notify_pipeline_feedback(const PipelineFeedback &feedback) override
+	{
+		auto &pipelines = feedback.tag == RESOURCE_GRAPHICS_PIPELINE ? accessed_graphics_pipelines : accessed_compute_pipelines;
+		if (pipelines.count(feedback.hash))
+			accessed_pipeline_feedback.insert(current_blob_hash);
+	}
+
+	void notify_pipeline_usage(Hash app_hash, const StateRecorderPipelineUsage &) override
+	{
+		if (!should_filter_application_hash || app_hash == filter_application_hash)
+			accessed_pipeline_usage.insert(current_blob_hash);
+	}
+
+	void notify_pipeline_dependencies(const PipelineDependencies &deps) override
+	{
+		auto *modules = new Hash[deps.module_count];
+		copy(deps.modules, deps.modules + deps.module_count, modules);
+		pipeline_dependency_modules.emplace_back(modules);
+		pipeline_dependencies.push_back(deps);
+		pipeline_dependencies.back().modules = modules;
+	}
+
+	void notify_pipeline_sub_state(Hash pipeline_hash, Hash sub_state_hash) override
+	{
+		pipeline_sub_states[pipeline_hash].push_back(sub_state_hash);
 	}
 
 	bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *, VkSampler *sampler) override
@@ -273,6 +318,8 @@ struct PruneReplayer : StateCreatorInterface
 				accessed_render_passes.insert((Hash) create_info->renderPass);
 				for (uint32_t stage = 0; stage < create_info->stageCount; stage++)
 					accessed_shader_modules.insert((Hash) create_info->pStages[stage].module);
+				for (auto sub_state : pipeline_sub_states[hash])
+					accessed_pipeline_sub_states.insert(sub_state);
 				accessed_graphics_pipelines.insert(hash);
 			}
 		}
@@ -313,6 +360,61 @@ static bool copy_accessed_types(DatabaseInterface &input_db,
 	return true;
 }
 
+static bool write_application_link_tables(DatabaseInterface &output_db,
+                                          const unordered_map<Hash, vector<StateRecorderApplicationLink>> &tables,
+                                          unsigned *per_tag_written)
+{
+	per_tag_written[RESOURCE_APPLICATION_LINK_TABLE] = tables.size();
+	for (auto &table : tables)
+	{
+		uint8_t *serialized;
+		size_t serialized_size;
+		Hash table_hash;
+		if (!StateRecorder::serialize_application_link_table(table.first, table.second.data(), table.second.size(),
+		                                                     &serialized, &serialized_size, &table_hash))
+			return false;
+
+		bool ret = output_db.write_entry(RESOURCE_APPLICATION_LINK_TABLE, table_hash, serialized, serialized_size,
+		                                 PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT);
+		StateRecorder::free_serialized(serialized);
+		if (!ret)
+			return false;
+	}
+	return true;
+}
+
+// Entries for pipelines which were pruned are dropped, and entries are only written once.
+static bool write_pipeline_dependencies(DatabaseInterface &output_db, const PruneReplayer &prune_replayer,
+                                        unsigned *per_tag_written)
+{
+	vector<PipelineDependencies> dependencies;
+	unordered_set<Hash> seen_graphics, seen_compute;
+	for (auto &deps : prune_replayer.pipeline_dependencies)
+	{
+		bool graphics = deps.tag == RESOURCE_GRAPHICS_PIPELINE;
+		auto &accessed = graphics ? prune_replayer.accessed_graphics_pipelines : prune_replayer.accessed_compute_pipelines;
+		auto &seen = graphics ? seen_graphics : seen_compute;
+		if (accessed.count(deps.hash) && seen.insert(deps.hash).second)
+			dependencies.push_back(deps);
+	}
+
+	if (dependencies.empty())
+		return true;
+
+	uint8_t *serialized;
+	size_t serialized_size;
+	Hash index_hash;
+	if (!StateRecorder::serialize_pipeline_dependencies(dependencies.data(), dependencies.size(),
+	                                                    &serialized, &serialized_size, &index_hash))
+		return false;
+
+	bool ret = output_db.write_entry(RESOURCE_PIPELINE_DEPENDENCIES, index_hash, serialized, serialized_size,
+	                                 PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT);
+	StateRecorder::free_serialized(serialized);
+	per_tag_written[RESOURCE_PIPELINE_DEPENDENCIES] = 1;
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	CLICallbacks cbs;
@@ -413,13 +515,18 @@ int main(int argc, char *argv[])
 	static const ResourceTag playback_order[] = {
 		RESOURCE_APPLICATION_INFO,
 		RESOURCE_APPLICATION_BLOB_LINK,
+		RESOURCE_APPLICATION_LINK_TABLE,
 		RESOURCE_SHADER_MODULE,
 		RESOURCE_SAMPLER,
 		RESOURCE_DESCRIPTOR_SET_LAYOUT,
 		RESOURCE_PIPELINE_LAYOUT,
 		RESOURCE_RENDER_PASS,
+		RESOURCE_PIPELINE_SUB_STATE,
 		RESOURCE_GRAPHICS_PIPELINE,
 		RESOURCE_COMPUTE_PIPELINE,
+		RESOURCE_PIPELINE_FEEDBACK,
+		RESOURCE_PIPELINE_USAGE,
+		RESOURCE_PIPELINE_DEPENDENCIES,
 	};
 
 	unsigned per_tag_read[RESOURCE_COUNT] = {};
@@ -435,6 +542,11 @@ int main(int argc, char *argv[])
 		"Graphics Pipeline",
 		"Compute Pipeline",
 		"Application Blob Link",
+		"Pipeline Sub-State",
+		"Application Link Table",
+		"Pipeline Feedback",
+		"Pipeline Usage",
+		"Pipeline Dependencies",
 	};
 
 	vector<uint8_t> state_json;
@@ -480,6 +592,8 @@ int main(int argc, char *argv[])
 
 			prune_replayer.has_application_info_for_blob = false;
 			prune_replayer.blob_belongs_to_application_info = false;
+			prune_replayer.parsing_application_link_table = tag == RESOURCE_APPLICATION_LINK_TABLE;
+			prune_replayer.current_blob_hash = hash;
 			if (!replayer.parse(prune_replayer, input_db.get(), state_json.data(), state_json.size()))
 				LOGE("Failed to parse blob (tag: %d, hash: 0x%" PRIx64 ").\n", tag, hash);
 
@@ -508,12 +622,16 @@ int main(int argc, char *argv[])
 		// In this mode we're only interesting in emitting the shader modules we did not emit for whatever reason.
 		// A handy debug option in some scenarios.
 		prune_replayer.filtered_blob_hashes[RESOURCE_APPLICATION_BLOB_LINK].clear();
+		prune_replayer.application_link_tables.clear();
 		prune_replayer.accessed_samplers.clear();
 		prune_replayer.accessed_descriptor_sets.clear();
 		prune_replayer.accessed_render_passes.clear();
 		prune_replayer.accessed_pipeline_layouts.clear();
 		prune_replayer.accessed_graphics_pipelines.clear();
 		prune_replayer.accessed_compute_pipelines.clear();
+		prune_replayer.accessed_pipeline_sub_states.clear();
+		prune_replayer.accessed_pipeline_feedback.clear();
+		prune_replayer.accessed_pipeline_usage.clear();
 
 		size_t hash_count = 0;
 		if (!input_db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &hash_count, nullptr))
@@ -545,6 +663,12 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (!write_application_link_tables(*output_db, prune_replayer.application_link_tables, per_tag_written))
+	{
+		LOGE("Failed to write APPLICATION_LINK_TABLEs.\n");
+		return EXIT_FAILURE;
+	}
+
 	if (!copy_accessed_types(*input_db, *output_db, state_json,
 	                         prune_replayer.accessed_samplers, RESOURCE_SAMPLER,
 	                         per_tag_written))
@@ -601,6 +725,36 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (!copy_accessed_types(*input_db, *output_db, state_json,
+	                         prune_replayer.accessed_pipeline_sub_states, RESOURCE_PIPELINE_SUB_STATE,
+	                         per_tag_written))
+	{
+		LOGE("Failed to copy PIPELINE_SUB_STATEs.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!copy_accessed_types(*input_db, *output_db, state_json,
+	                         prune_replayer.accessed_pipeline_feedback, RESOURCE_PIPELINE_FEEDBACK,
+	                         per_tag_written))
+	{
+		LOGE("Failed to copy PIPELINE_FEEDBACKs.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!copy_accessed_types(*input_db, *output_db, state_json,
+	                         prune_replayer.accessed_pipeline_usage, RESOURCE_PIPELINE_USAGE,
+	                         per_tag_written))
+	{
+		LOGE("Failed to copy PIPELINE_USAGEs.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!write_pipeline_dependencies(*output_db, prune_replayer, per_tag_written))
+	{
+		LOGE("Failed to write PIPELINE_DEPENDENCIES.\n");
+		return EXIT_FAILURE;
+	}
+
 	for (auto tag : playback_order)
 		LOGI("Pruned %s entries: %u -> %u entries\n", tag_names[tag], per_tag_read[tag], per_tag_written[tag]);
 }
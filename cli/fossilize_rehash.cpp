@@ -34,7 +34,7 @@ using namespace std;
 
 static void print_help()
 {
-	LOGI("Usage: fossilize-rehash [--input-db path] [--output-db path] [--application hash]\n");
+	LOGI("Usage: fossilize-rehash [--input-db path] [--output-db path] [--application hash] [--hash-scheme fnv1|striped]\n");
 }
 
 template <typename T>
@@ -134,6 +134,16 @@ int main(int argc, char *argv[])
 		rehash_replayer.filter_application_hash = strtoull(parser.next_string(), nullptr, 16);
 		rehash_replayer.should_filter_application_hash = true;
 	});
+	cbs.add("--hash-scheme", [&](CLIParser &parser) {
+		const char *name = parser.next_string();
+		HashScheme scheme;
+		if (!Hashing::parse_hash_scheme(name, &scheme))
+		{
+			LOGE("Unknown hash scheme: %s\n", name);
+			exit(EXIT_FAILURE);
+		}
+		recorder.set_hash_scheme(scheme);
+	});
 
 	cbs.error_handler = [] { print_help(); };
 
@@ -43,8 +43,9 @@
 #include <unordered_set>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <chrono>	// VALVE
-#include <queue>	// VALVE
+#include <deque>	// VALVE
 #include <thread>	// VALVE
 #include <mutex>	// VALVE
 #include <condition_variable> // VALVE
@@ -54,7 +55,15 @@
 #include <algorithm>
 #include <utility>
 #include <map>
+#include <list>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #ifdef FOSSILIZE_REPLAYER_SPIRV_VAL
 #include "spirv-tools/libspirv.hpp"
@@ -65,6 +74,8 @@ using namespace std;
 
 //#define SIMULATE_UNSTABLE_DRIVER
 //#define SIMULATE_SPURIOUS_DEADLOCK
+//#define SIMULATE_CRASHING_PIPELINES 256
+//#define SIMULATE_PIPELINE_COMPILE_US 500
 
 #ifdef SIMULATE_UNSTABLE_DRIVER
 #include <random>
@@ -152,23 +163,40 @@ void spurious_deadlock()
 }
 #endif
 
-// Unstable, but deterministic.
-template <typename BidirectionalItr, typename UnaryPredicate>
-static BidirectionalItr unstable_remove_if(BidirectionalItr first, BidirectionalItr last, UnaryPredicate &&p)
+#ifdef SIMULATE_PIPELINE_COMPILE_US
+// Stands in for driver compile time with --null-device, so scheduling can be measured on any host.
+// Sleeping workers do not compete for cores, so this models a machine with a core per worker.
+// The cost varies between 0.25x and 2x of SIMULATE_PIPELINE_COMPILE_US depending on the hash.
+static void simulate_pipeline_compile(Fossilize::Hash hash)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(SIMULATE_PIPELINE_COMPILE_US * (1 + (hash % 8)) / 4));
+}
+#endif
+
+#ifdef SIMULATE_CRASHING_PIPELINES
+// Deterministic variant of SIMULATE_UNSTABLE_DRIVER used by the crash recovery test.
+// Every pipeline about to be compiled is appended to FOSSILIZE_REPLAY_ATTEMPT_LOG,
+// and pipelines whose hash is a multiple of SIMULATE_CRASHING_PIPELINES crash the process.
+static void simulate_crashing_pipeline(Fossilize::Hash hash)
 {
-	while (first != last)
+	const char *path = getenv("FOSSILIZE_REPLAY_ATTEMPT_LOG");
+	if (path)
 	{
-		if (p(*first))
+		FILE *file = fopen(path, "a");
+		if (file)
 		{
-			--last;
-			std::swap(*first, *last);
+			fprintf(file, "%016" PRIx64 "\n", hash);
+			fclose(file);
 		}
-		else
-			++first;
 	}
 
-	return first;
+	if ((hash % SIMULATE_CRASHING_PIPELINES) == 0)
+	{
+		LOGE("Simulating a crash in pipeline %016" PRIx64 " ...\n", hash);
+		abort();
+	}
 }
+#endif
 
 static unique_ptr<DatabaseInterface> create_database(const vector<const char *> &databases)
 {
@@ -198,10 +226,286 @@ enum MemoryConstants
 	NUM_PIPELINE_MEMORY_CONTEXTS = NUM_MEMORY_CONTEXTS - 2
 };
 
-struct EnqueuedWork
+// Pipelines are replayed in chunks of at most this many.
+// The shader module cache is pruned after every NUM_PIPELINE_MEMORY_CONTEXTS chunks.
+static const unsigned NUM_PIPELINES_PER_CHUNK = 1024;
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "Atomic size mismatch. This type likely requires a lock to work.");
+
+// A range of pipeline indices [begin, end) claimed by a process, packed as begin | (end << 32).
+// Zero means nothing is claimed.
+struct SharedWorkQueueClaim
+{
+	std::atomic<uint64_t> graphics;
+	std::atomic<uint64_t> compute;
+};
+
+// Pipeline indices shared between the processes of a multi-process replay.
+// Instead of replaying a fixed slice, processes claim small batches until the queue runs dry,
+// so a process which happens to get cheap pipelines does not sit idle while another one lags behind.
+// The master process sets this up in shared memory before forking.
+struct SharedWorkQueue
+{
+	std::atomic<uint32_t> next_graphics_index;
+	std::atomic<uint32_t> next_compute_index;
+	uint32_t end_graphics_index;
+	uint32_t end_compute_index;
+	uint32_t num_processes;
+	uint32_t padding;
+
+	// Every pipeline memory context of a process replays at most one batch at a time. The claim is recorded here
+	// before it is taken from the queue, so the master process can hand what is left of it to the restarted process
+	// if a child crashes.
+	SharedWorkQueueClaim *get_claims(unsigned process_index)
+	{
+		return reinterpret_cast<SharedWorkQueueClaim *>(this + 1) + process_index * NUM_PIPELINE_MEMORY_CONTEXTS;
+	}
+
+	static size_t get_size(unsigned processes)
+	{
+		return sizeof(SharedWorkQueue) + processes * NUM_PIPELINE_MEMORY_CONTEXTS * sizeof(SharedWorkQueueClaim);
+	}
+
+	static uint64_t pack_range(uint32_t begin, uint32_t end)
+	{
+		return begin < end ? (uint64_t(begin) | (uint64_t(end) << 32)) : 0;
+	}
+
+	static void unpack_range(uint64_t range, uint32_t &begin, uint32_t &end)
+	{
+		begin = uint32_t(range);
+		end = uint32_t(range >> 32);
+	}
+
+	bool claim(ResourceTag tag, SharedWorkQueueClaim &claimed, uint32_t &begin, uint32_t &end)
+	{
+		static const uint32_t MIN_BATCH_SIZE = 16;
+		static const uint32_t MAX_BATCH_SIZE = NUM_PIPELINES_PER_CHUNK;
+
+		auto &next_index = tag == RESOURCE_GRAPHICS_PIPELINE ? next_graphics_index : next_compute_index;
+		auto &claimed_range = tag == RESOURCE_GRAPHICS_PIPELINE ? claimed.graphics : claimed.compute;
+		uint32_t end_index = tag == RESOURCE_GRAPHICS_PIPELINE ? end_graphics_index : end_compute_index;
+
+		uint32_t begin_index = next_index.load(std::memory_order_relaxed);
+		while (begin_index < end_index)
+		{
+			// Batches shrink as the queue drains, so the processes finish at roughly the same time.
+			uint32_t batch_size = (end_index - begin_index) / (4 * NUM_PIPELINE_MEMORY_CONTEXTS * num_processes);
+			batch_size = std::max(std::min(batch_size, MAX_BATCH_SIZE), MIN_BATCH_SIZE);
+			uint32_t batch_end = std::min(end_index, begin_index + batch_size);
+
+			// If we crash before the exchange, the range may be replayed twice, but nothing is lost.
+			claimed_range.store(pack_range(begin_index, batch_end), std::memory_order_relaxed);
+			if (next_index.compare_exchange_weak(begin_index, batch_end, std::memory_order_relaxed))
+			{
+				begin = begin_index;
+				end = batch_end;
+				return true;
+			}
+		}
+
+		claimed_range.store(0, std::memory_order_relaxed);
+		return false;
+	}
+
+	uint32_t get_remaining(ResourceTag tag) const
+	{
+		auto &next_index = tag == RESOURCE_GRAPHICS_PIPELINE ? next_graphics_index : next_compute_index;
+		uint32_t end_index = tag == RESOURCE_GRAPHICS_PIPELINE ? end_graphics_index : end_compute_index;
+		uint32_t begin_index = next_index.load(std::memory_order_relaxed);
+		return begin_index < end_index ? end_index - begin_index : 0;
+	}
+};
+static_assert(sizeof(SharedWorkQueue) % alignof(SharedWorkQueueClaim) == 0, "Claims must be aligned.");
+
+// Shader modules of each pipeline in stage order, from the RESOURCE_PIPELINE_DEPENDENCIES blobs written by fossilize-index.
+// Pipeline hashes cover the hashes of their dependencies, so entries cannot go stale. Pipelines without an entry are parsed as usual.
+struct PipelineDependencyIndex : StateCreatorInterface
+{
+	unordered_map<Hash, vector<Hash>> graphics_modules;
+	unordered_map<Hash, vector<Hash>> compute_modules;
+
+	void notify_pipeline_dependencies(const PipelineDependencies &deps) override
+	{
+		auto &modules = deps.tag == RESOURCE_GRAPHICS_PIPELINE ? graphics_modules : compute_modules;
+		modules[deps.hash].assign(deps.modules, deps.modules + deps.module_count);
+	}
+
+	const vector<Hash> *find_modules(ResourceTag tag, Hash hash) const
+	{
+		auto &modules = tag == RESOURCE_GRAPHICS_PIPELINE ? graphics_modules : compute_modules;
+		auto itr = modules.find(hash);
+		return itr != end(modules) ? &itr->second : nullptr;
+	}
+
+	bool empty() const
+	{
+		return graphics_modules.empty() && compute_modules.empty();
+	}
+
+	bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override { return true; }
+	bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override { return true; }
+	bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override { return true; }
+	bool enqueue_create_shader_module(Hash, const VkShaderModuleCreateInfo *, VkShaderModule *) override { return true; }
+	bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override { return true; }
+	bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *, VkPipeline *) override { return true; }
+	bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *) override { return true; }
+};
+
+// Pipelines which completed in earlier runs, so a replay which was interrupted can resume where it left off.
+// All processes of a multi-process replay append to the same file. Every batch of records goes out with a single
+// append, so batches from different processes cannot interleave, and a torn batch at the end fails the check value.
+struct ProgressJournal
 {
-	unsigned order_index;
-	std::function<void()> func;
+	struct Record
+	{
+		Hash hash;
+		uint32_t tag;
+		uint32_t check;
+	};
+
+	// The minimum time between two batches. Checkpoints of a large pipeline cache take longer,
+	// so the interval grows to keep checkpointing at a small fraction of the replay time.
+	enum { FlushIntervalMs = 2000, CheckpointCostFactor = 10 };
+
+	~ProgressJournal()
+	{
+		if (fd >= 0)
+		{
+#ifdef _WIN32
+			_close(fd);
+#else
+			close(fd);
+#endif
+		}
+	}
+
+	static uint32_t compute_check(uint32_t tag, Hash hash)
+	{
+		return uint32_t(hash) ^ uint32_t(hash >> 32) ^ (tag * 0x9e3779b9u) ^ 0x6a726e6cu;
+	}
+
+	// A machine which goes down in the middle of an append can leave a partial record at the end.
+	// Later appends would then be misaligned, so cut the journal back to whole records before resuming.
+	// A missing journal is not an error.
+	static bool truncate_torn_tail(const string &path)
+	{
+#ifdef _WIN32
+		int tail_fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+		if (tail_fd < 0)
+			return errno == ENOENT;
+		__int64 size = _lseeki64(tail_fd, 0, SEEK_END);
+		bool ret = size >= 0;
+		if (ret && (size % sizeof(Record)) != 0)
+			ret = _chsize_s(tail_fd, size - size % sizeof(Record)) == 0 && _commit(tail_fd) == 0;
+		_close(tail_fd);
+#else
+		int tail_fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+		if (tail_fd < 0)
+			return errno == ENOENT;
+		off_t size = lseek(tail_fd, 0, SEEK_END);
+		bool ret = size >= 0;
+		if (ret && (size % sizeof(Record)) != 0)
+			ret = ftruncate(tail_fd, size - size % sizeof(Record)) == 0 && fsync(tail_fd) == 0;
+		close(tail_fd);
+#endif
+		return ret;
+	}
+
+	// A missing journal is not an error, there is just nothing to resume.
+	void load(const string &path)
+	{
+		FILE *file = fopen(path.c_str(), "rb");
+		if (!file)
+			return;
+
+		Record record;
+		while (fread(&record, sizeof(record), 1, file) == 1)
+		{
+			if (record.check != compute_check(record.tag, record.hash))
+				continue;
+			if (record.tag == RESOURCE_GRAPHICS_PIPELINE)
+				completed_graphics.insert(record.hash);
+			else if (record.tag == RESOURCE_COMPUTE_PIPELINE)
+				completed_compute.insert(record.hash);
+		}
+		fclose(file);
+	}
+
+	bool open(const string &path)
+	{
+#ifdef _WIN32
+		fd = _open(path.c_str(), _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+		fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+#endif
+		last_flush_time = chrono::steady_clock::now();
+		return fd >= 0;
+	}
+
+	bool is_open() const
+	{
+		return fd >= 0;
+	}
+
+	// The completed sets do not change after loading, so this can be called from any thread.
+	bool is_completed(ResourceTag tag, Hash hash) const
+	{
+		auto &completed = tag == RESOURCE_GRAPHICS_PIPELINE ? completed_graphics : completed_compute;
+		return completed.count(hash) != 0;
+	}
+
+	void append(ResourceTag tag, const Hash *hashes, size_t count)
+	{
+		lock_guard<mutex> holder(lock);
+		for (size_t i = 0; i < count; i++)
+			if (!is_completed(tag, hashes[i]))
+				pending.push_back({ hashes[i], uint32_t(tag), compute_check(tag, hashes[i]) });
+	}
+
+	// Takes the records which have not been written yet, unless the last flush was too recent.
+	bool take_pending(vector<Record> &records, bool force)
+	{
+		lock_guard<mutex> holder(lock);
+		auto current_time = chrono::steady_clock::now();
+		if (!force && current_time - last_flush_time < flush_interval)
+			return false;
+
+		last_flush_time = current_time;
+		swap(records, pending);
+		pending.clear();
+		return true;
+	}
+
+	// Spaces batches out so that checkpoints which take checkpoint_time stay a small part of the replay.
+	void set_checkpoint_time(chrono::nanoseconds checkpoint_time)
+	{
+		lock_guard<mutex> holder(lock);
+		flush_interval = max<chrono::nanoseconds>(chrono::milliseconds(FlushIntervalMs),
+		                                          checkpoint_time * int(CheckpointCostFactor));
+	}
+
+	bool write(const vector<Record> &records)
+	{
+		if (fd < 0 || records.empty())
+			return true;
+
+		size_t size = records.size() * sizeof(Record);
+#ifdef _WIN32
+		return _write(fd, records.data(), unsigned(size)) == int(size) && _commit(fd) == 0;
+#else
+		return ::write(fd, records.data(), size) == ssize_t(size) && fsync(fd) == 0;
+#endif
+	}
+
+	unordered_set<Hash> completed_graphics;
+	unordered_set<Hash> completed_compute;
+
+	int fd = -1;
+	std::mutex lock;
+	vector<Record> pending;
+	chrono::nanoseconds flush_interval = chrono::milliseconds(FlushIntervalMs);
+	chrono::steady_clock::time_point last_flush_time;
 };
 
 static void on_validation_error(void *userdata);
@@ -243,11 +547,46 @@ struct ThreadedReplayer : StateCreatorInterface
 
 		SharedControlBlock *control_block = nullptr;
 
+		// If set, pipelines are claimed from this queue in batches rather than replayed from a fixed range.
+		SharedWorkQueue *work_queue = nullptr;
+		unsigned process_index = 0;
+
+		// The pipelines a master process splits into contiguous ranges, one per child.
+		// Ordering by cost deals the expensive pipelines out to every range instead of the first one.
+		unsigned split_process_count = 1;
+		unsigned split_start_graphics_index = 0;
+		unsigned split_end_graphics_index = 0;
+		unsigned split_start_compute_index = 0;
+		unsigned split_end_compute_index = 0;
+
+		// Set by a master process which has clustered the pipelines by shader modules once for all of its children.
+		const vector<Hash> *clustered_graphics_hashes = nullptr;
+		const vector<Hash> *clustered_compute_hashes = nullptr;
+
 		void (*on_thread_callback)(void *userdata) = nullptr;
 		void *on_thread_callback_userdata = nullptr;
 		void (*on_validation_error_callback)(ThreadedReplayer *) = nullptr;
 
 		unsigned timeout_seconds = 0;
+
+		// Appends measured pipeline compile times to this archive as RESOURCE_PIPELINE_FEEDBACK entries.
+		string pipeline_feedback_output_path;
+
+		// Appends the hashes of completed pipelines to this file, and skips pipelines which are in it already if resuming.
+		string progress_journal_path;
+		bool resume_progress = false;
+
+		// Archives with RESOURCE_PIPELINE_FEEDBACK entries. If any are given, the most expensive pipelines are replayed first.
+		vector<string> pipeline_cost_paths;
+
+		// Replay pipelines which use the same shader modules close together, so fewer modules are evicted and created again.
+		bool cluster_shader_modules = false;
+
+		// Archives or hash lists of pipelines which have been replayed before. Only the other pipelines are replayed.
+		vector<string> replayed_paths;
+
+		// Reads, decompresses, parses and schedules everything as usual, but never calls into Vulkan.
+		bool benchmark_frontend = false;
 	};
 
 	struct DeferredGraphicsInfo
@@ -270,8 +609,87 @@ struct ThreadedReplayer : StateCreatorInterface
 		static ResourceTag get_tag() { return RESOURCE_COMPUTE_PIPELINE; }
 	};
 
+	// Pipelines are replayed as a dependency graph. A pipeline is compiled once it has been parsed,
+	// the shader modules it uses have been created, and its parent pipeline, if any, has been compiled.
+	// Whichever worker resolves the last dependency enqueues the compile.
+	struct ReplayChunk;
+	struct PipelineNode;
+
+	struct PipelineDependency
+	{
+		bool compiled = false;
+		bool valid = false;
+		std::vector<PipelineNode *> waiters;
+	};
+
+	struct PipelineNode
+	{
+		PipelineNode()
+		{
+			pending_dependencies.store(0, std::memory_order_relaxed);
+		}
+
+		std::atomic<unsigned> pending_dependencies;
+		ReplayChunk *chunk = nullptr;
+		// Index into the chunk, or the replay index for parents outside the replay range.
+		unsigned index = 0;
+		Hash hash = 0;
+		ResourceTag tag = RESOURCE_COUNT;
+		bool missing_parent = false;
+		// Entry of this pipeline in the graph's dependencies. Entries are never erased, so this saves a lookup per use.
+		PipelineDependency *dependency = nullptr;
+		// Shader modules stay pinned in the cache until the pipeline has been compiled.
+		std::vector<Hash> shader_modules;
+	};
+
+	// Pipelines are parsed in chunks which own a pipeline memory context until all their pipelines are done.
+	struct ReplayChunk
+	{
+		ReplayChunk()
+		{
+			outstanding.store(0, std::memory_order_relaxed);
+			completed_count.store(0, std::memory_order_relaxed);
+		}
+
+		ResourceTag tag = RESOURCE_COUNT;
+		unsigned hash_offset = 0;
+		unsigned count = 0;
+		unsigned memory_context_index = 0;
+		std::unique_ptr<PipelineNode[]> nodes;
+		std::atomic<unsigned> outstanding;
+
+		// Pipelines complete out of order. Every pipeline before completed_count is done,
+		// so a process which crashes can be resumed from there without losing any.
+		std::unique_ptr<bool[]> completed;
+		std::atomic<unsigned> completed_count;
+	};
+
+	struct ShaderModuleDependency
+	{
+		bool enqueued = false;
+		bool ready = false;
+		unsigned users = 0;
+		std::vector<PipelineNode *> waiters;
+	};
+
+	template <typename DerivedInfo>
+	struct ReplayGraph
+	{
+		std::vector<DerivedInfo> *deferred = nullptr;
+		std::unordered_map<Hash, DerivedInfo> *parents = nullptr;
+		std::unordered_map<Hash, VkPipeline> *pipelines = nullptr;
+		const std::vector<Hash> *hashes = nullptr;
+		unsigned start_index = 0;
+
+		std::vector<std::unique_ptr<ReplayChunk>> chunks;
+
+		std::unordered_map<Hash, PipelineDependency> dependencies;
+		std::unordered_map<Hash, std::unique_ptr<PipelineNode>> parent_nodes;
+	};
+
 	struct PipelineWorkItem
 	{
+		PipelineNode *node = nullptr;
 		Hash hash = 0;
 		ResourceTag tag = RESOURCE_COUNT;
 		unsigned index = 0;
@@ -314,6 +732,8 @@ struct ThreadedReplayer : StateCreatorInterface
 
 		bool force_outside_range = false;
 		bool triggered_validation_error = false;
+
+		std::vector<PipelineFeedback> pipeline_feedback;
 	};
 
 	ThreadedReplayer(const VulkanDevice::Options &device_opts_, const Options &opts_)
@@ -329,6 +749,7 @@ struct ThreadedReplayer : StateCreatorInterface
 		compute_pipeline_count.store(0);
 		shader_module_count.store(0);
 		shader_module_evicted_count.store(0);
+		resumed_pipeline_count.store(0);
 		thread_total_ns.store(0);
 		total_idle_ns.store(0);
 		total_peak_memory.store(0);
@@ -337,7 +758,38 @@ struct ThreadedReplayer : StateCreatorInterface
 
 		shader_module_total_compressed_size.store(0);
 		shader_module_total_size.store(0);
+		blob_read_ns.store(0);
+		blob_read_size.store(0);
+		blob_decompressed_size.store(0);
+		pipeline_parse_ns.store(0);
+		shader_module_parse_ns.store(0);
+		pipeline_parse_count.store(0);
+		shader_module_parse_count.store(0);
+		pending_work_items.store(0);
+		sleeping_worker_threads.store(0);
+		shutting_down.store(false);
+		remaining_replay_chunks.store(0);
+		completed_replay_chunks.store(0);
+		for (unsigned i = 0; i < NUM_MEMORY_CONTEXTS; i++)
+		{
+			queued_count[i].store(0);
+			completed_count[i].store(0);
+		}
+
+		graphics_graph.deferred = deferred_graphics;
+		graphics_graph.parents = &graphics_parents;
+		graphics_graph.pipelines = &graphics_pipelines;
+		compute_graph.deferred = deferred_compute;
+		compute_graph.parents = &compute_parents;
+		compute_graph.pipelines = &compute_pipelines;
+
 		per_thread_data.resize(num_worker_threads + 1);
+		work_queues.resize(std::max(num_worker_threads, 1u));
+		for (auto &queue : work_queues)
+		{
+			queue.reset(new WorkQueue);
+			queue->count.store(0);
+		}
 
 		// Could potentially overflow on 32-bit.
 #if ((SIZE_MAX / (1024 * 1024)) < UINT_MAX)
@@ -405,7 +857,7 @@ struct ThreadedReplayer : StateCreatorInterface
 		// Make sure all threads have started so we can poke around the per thread allocators from
 		// the main thread when the memory contexts in each thread have been drained.
 		{
-			unique_lock<mutex> holder(pipeline_work_queue_mutex);
+			unique_lock<mutex> holder(work_done_mutex);
 			work_done_condition[0].wait(holder, [&]() -> bool {
 				return thread_initialized_count == num_worker_threads;
 			});
@@ -421,23 +873,40 @@ struct ThreadedReplayer : StateCreatorInterface
 	void sync_worker_memory_context(unsigned index)
 	{
 		assert(index < NUM_MEMORY_CONTEXTS);
-		unique_lock<mutex> lock(pipeline_work_queue_mutex);
+		unique_lock<mutex> lock(work_done_mutex);
+
+		// Load completed first. Workers enqueue successors before a work item is counted as completed,
+		// so a context cannot appear drained while it still has work queued up.
+		auto drained = [&]() -> bool {
+			unsigned completed = completed_count[index].load(std::memory_order_acquire);
+			return queued_count[index].load(std::memory_order_relaxed) == completed;
+		};
+
+		wait_for_worker_progress(lock, work_done_condition[index], drained);
+	}
+
+	unsigned get_total_completed_count() const
+	{
+		unsigned count = 0;
+		for (auto &completed : completed_count)
+			count += completed.load(std::memory_order_relaxed);
+		return count;
+	}
 
-		if (queued_count[index] == completed_count[index])
+	template <typename Predicate>
+	void wait_for_worker_progress(unique_lock<mutex> &lock, condition_variable &cond, const Predicate &pred)
+	{
+		if (pred())
 			return;
 
 		if (opts.timeout_seconds != 0)
 		{
-			bool signalled;
-			unsigned current_completed = completed_count[index];
-			do
+			// Workers only signal when they are done, so sample progress whenever the wait times out.
+			unsigned current_completed = get_total_completed_count();
+			while (!cond.wait_for(lock, std::chrono::seconds(opts.timeout_seconds), pred))
 			{
-				signalled = work_done_condition[index].wait_for(lock, std::chrono::seconds(opts.timeout_seconds),
-				                                                [&]() -> bool
-				                                                {
-					                                                return current_completed != completed_count[index];
-				                                                });
-				if (!signalled && completed_count[index] == current_completed)
+				unsigned completed = get_total_completed_count();
+				if (completed == current_completed)
 				{
 #ifndef NO_ROBUST_REPLAYER
 					timeout_handler();
@@ -447,20 +916,36 @@ struct ThreadedReplayer : StateCreatorInterface
 #endif
 				}
 
-				current_completed = completed_count[index];
-			} while (queued_count[index] != completed_count[index]);
+				current_completed = completed;
+			}
+		}
+		else
+			cond.wait(lock, pred);
+	}
+
+	void record_frontend_stats(const PipelineWorkItem &work_item, size_t decompressed_size, uint64_t read_ns, uint64_t parse_ns)
+	{
+		size_t compressed_size = 0;
+		if (global_database->read_entry(work_item.tag, work_item.hash, &compressed_size, nullptr, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+			blob_read_size.fetch_add(compressed_size, std::memory_order_relaxed);
+		blob_decompressed_size.fetch_add(decompressed_size, std::memory_order_relaxed);
+		blob_read_ns.fetch_add(read_ns, std::memory_order_relaxed);
+
+		if (work_item.tag == RESOURCE_SHADER_MODULE)
+		{
+			shader_module_parse_ns.fetch_add(parse_ns, std::memory_order_relaxed);
+			shader_module_parse_count.fetch_add(1, std::memory_order_relaxed);
 		}
 		else
 		{
-			work_done_condition[index].wait(lock, [&]() -> bool
-			{
-				return queued_count[index] == completed_count[index];
-			});
+			pipeline_parse_ns.fetch_add(parse_ns, std::memory_order_relaxed);
+			pipeline_parse_count.fetch_add(1, std::memory_order_relaxed);
 		}
 	}
 
 	bool run_parse_work_item(StateReplayer &replayer, vector<uint8_t> &buffer, const PipelineWorkItem &work_item)
 	{
+		auto read_start_time = chrono::steady_clock::now();
 		size_t json_size = 0;
 		if (!global_database->read_entry(work_item.tag, work_item.hash, &json_size, nullptr, PAYLOAD_READ_CONCURRENT_BIT))
 		{
@@ -481,7 +966,18 @@ struct ThreadedReplayer : StateCreatorInterface
 		per_thread.force_outside_range = work_item.force_outside_range;
 		per_thread.memory_context_index = work_item.memory_context_index;
 
-		if (!replayer.parse(*this, global_database, buffer.data(), buffer.size()))
+		auto parse_start_time = chrono::steady_clock::now();
+		bool parsed = replayer.parse(*this, global_database, buffer.data(), buffer.size());
+
+		if (opts.benchmark_frontend)
+		{
+			auto parse_end_time = chrono::steady_clock::now();
+			record_frontend_stats(work_item, json_size,
+			                      chrono::duration_cast<chrono::nanoseconds>(parse_start_time - read_start_time).count(),
+			                      chrono::duration_cast<chrono::nanoseconds>(parse_end_time - parse_start_time).count());
+		}
+
+		if (!parsed)
 		{
 			LOGE("Failed to parse blob (tag: %d, hash: 0x%016" PRIx64 ").\n", work_item.tag, work_item.hash);
 
@@ -507,7 +1003,9 @@ struct ThreadedReplayer : StateCreatorInterface
 		if (work_item.tag == RESOURCE_SHADER_MODULE)
 		{
 			// No reason to retain memory in this allocator anymore.
+			// Forget the module as well, so it can be parsed again if it gets evicted from the cache.
 			replayer.get_allocator().reset();
+			replayer.forget_handle_references();
 
 			// Feed shader module statistics.
 			shader_module_total_size.fetch_add(json_size, std::memory_order_relaxed);
@@ -518,6 +1016,75 @@ struct ThreadedReplayer : StateCreatorInterface
 		return true;
 	}
 
+	void record_pipeline_feedback(ResourceTag tag, Hash hash, uint64_t duration_ns,
+	                              const VkPipelineCreationFeedbackEXT &driver_feedback)
+	{
+		PipelineFeedback feedback = {};
+		feedback.tag = tag;
+		feedback.hash = hash;
+		feedback.count = 1;
+		feedback.min_duration_ns = duration_ns;
+		feedback.max_duration_ns = duration_ns;
+		feedback.total_duration_ns = duration_ns;
+
+		if ((driver_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) != 0)
+		{
+			feedback.valid_feedback_count = 1;
+			if ((driver_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) != 0)
+				feedback.cache_hit_count = 1;
+			if ((driver_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_BASE_PIPELINE_ACCELERATION_BIT_EXT) != 0)
+				feedback.base_pipeline_acceleration_count = 1;
+		}
+
+		get_per_thread_data().pipeline_feedback.push_back(feedback);
+	}
+
+	// Must be called after the worker threads have been torn down.
+	bool write_pipeline_feedback()
+	{
+		unordered_map<Hash, PipelineFeedback> graphics_feedback;
+		unordered_map<Hash, PipelineFeedback> compute_feedback;
+		for (auto &data : per_thread_data)
+		{
+			for (auto &info : data.pipeline_feedback)
+			{
+				auto &feedback = info.tag == RESOURCE_GRAPHICS_PIPELINE ? graphics_feedback : compute_feedback;
+				merge_pipeline_feedback(feedback[info.hash], info);
+			}
+		}
+
+		unique_ptr<DatabaseInterface> db(create_stream_archive_database(opts.pipeline_feedback_output_path.c_str(),
+		                                                                DatabaseMode::Append));
+		if (!db->prepare())
+			return false;
+
+		// Every run appends its own entries, which readers combine.
+		Hash seed = Hash(chrono::system_clock::now().time_since_epoch().count()) ^ opts.start_graphics_index ^
+		            (Hash(opts.start_compute_index) << 32);
+
+		for (auto *feedback : { &graphics_feedback, &compute_feedback })
+		{
+			for (auto &itr : *feedback)
+			{
+				uint8_t *serialized = nullptr;
+				size_t serialized_size = 0;
+				Hash feedback_hash = 0;
+				if (!StateRecorder::serialize_pipeline_feedback(itr.second, seed, &serialized, &serialized_size,
+				                                                &feedback_hash))
+					return false;
+
+				bool ret = db->write_entry(RESOURCE_PIPELINE_FEEDBACK, feedback_hash, serialized, serialized_size,
+				                           PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT);
+				StateRecorder::free_serialized(serialized);
+				if (!ret)
+					return false;
+			}
+		}
+
+		db->flush();
+		return true;
+	}
+
 	void get_pipeline_stats(ResourceTag tag, Hash hash, VkPipeline pipeline)
 	{
 		VkPipelineInfoKHR pipeline_info = { VK_STRUCTURE_TYPE_PIPELINE_INFO_KHR };
@@ -645,6 +1212,24 @@ struct ThreadedReplayer : StateCreatorInterface
 			return false;
 	}
 
+	// Handles only need to be unique and non-null when nothing is created.
+	template <typename T>
+	static T fake_handle(Hash hash)
+	{
+		return (T)hash;
+	}
+
+	// Pipelines are not compiled when benchmarking the frontend. Parents still get a handle,
+	// so their derived pipelines resolve the base pipeline like they would otherwise.
+	void complete_frontend_benchmark_pipeline(const PipelineWorkItem &work_item, VkPipelineCreateFlags flags)
+	{
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		if (!opts.ignore_derived_pipelines && (flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT) != 0)
+			pipeline = fake_handle<VkPipeline>(work_item.hash);
+		*work_item.hash_map_entry.pipeline = pipeline;
+		*work_item.output.pipeline = pipeline;
+	}
+
 	void run_creation_work_item(const PipelineWorkItem &work_item)
 	{
 		switch (work_item.tag)
@@ -697,6 +1282,15 @@ struct ThreadedReplayer : StateCreatorInterface
 				break;
 			}
 
+			if (opts.benchmark_frontend)
+			{
+				complete_frontend_benchmark_pipeline(work_item, work_item.create_info.graphics_create_info->flags);
+				graphics_pipeline_count.fetch_add(1, std::memory_order_relaxed);
+				if (opts.control_block)
+					opts.control_block->successful_graphics.fetch_add(1, std::memory_order_relaxed);
+				break;
+			}
+
 			if (!device->get_feature_filter().graphics_pipeline_is_supported(work_item.create_info.graphics_create_info))
 			{
 				*work_item.output.pipeline = VK_NULL_HANDLE;
@@ -718,6 +1312,12 @@ struct ThreadedReplayer : StateCreatorInterface
 #ifdef SIMULATE_UNSTABLE_DRIVER
 				spurious_crash();
 #endif
+#ifdef SIMULATE_CRASHING_PIPELINES
+				simulate_crashing_pipeline(work_item.hash);
+#endif
+#ifdef SIMULATE_PIPELINE_COMPILE_US
+				simulate_pipeline_compile(work_item.hash);
+#endif
 
 				VkPipelineCreationFeedbackEXT feedbacks[16] = {};
 				VkPipelineCreationFeedbackEXT primary_feedback = {};
@@ -738,6 +1338,9 @@ struct ThreadedReplayer : StateCreatorInterface
 					graphics_pipeline_ns.fetch_add(duration_ns, std::memory_order_relaxed);
 					graphics_pipeline_count.fetch_add(1, std::memory_order_relaxed);
 
+					if (!opts.pipeline_feedback_output_path.empty())
+						record_pipeline_feedback(work_item.tag, work_item.hash, duration_ns, primary_feedback);
+
 					if (opts.pipeline_stats && i == 0)
 						get_pipeline_stats(work_item.tag, work_item.hash, *work_item.output.pipeline);
 
@@ -837,6 +1440,15 @@ struct ThreadedReplayer : StateCreatorInterface
 				break;
 			}
 
+			if (opts.benchmark_frontend)
+			{
+				complete_frontend_benchmark_pipeline(work_item, work_item.create_info.compute_create_info->flags);
+				compute_pipeline_count.fetch_add(1, std::memory_order_relaxed);
+				if (opts.control_block)
+					opts.control_block->successful_compute.fetch_add(1, std::memory_order_relaxed);
+				break;
+			}
+
 			if (!device->get_feature_filter().compute_pipeline_is_supported(work_item.create_info.compute_create_info))
 			{
 				*work_item.output.pipeline = VK_NULL_HANDLE;
@@ -857,6 +1469,12 @@ struct ThreadedReplayer : StateCreatorInterface
 
 #ifdef SIMULATE_UNSTABLE_DRIVER
 				spurious_crash();
+#endif
+#ifdef SIMULATE_CRASHING_PIPELINES
+				simulate_crashing_pipeline(work_item.hash);
+#endif
+#ifdef SIMULATE_PIPELINE_COMPILE_US
+				simulate_pipeline_compile(work_item.hash);
 #endif
 				VkPipelineCreationFeedbackEXT feedbacks = {};
 				VkPipelineCreationFeedbackEXT primary_feedback = {};
@@ -878,6 +1496,9 @@ struct ThreadedReplayer : StateCreatorInterface
 					compute_pipeline_ns.fetch_add(duration_ns, std::memory_order_relaxed);
 					compute_pipeline_count.fetch_add(1, std::memory_order_relaxed);
 
+					if (!opts.pipeline_feedback_output_path.empty())
+						record_pipeline_feedback(work_item.tag, work_item.hash, duration_ns, primary_feedback);
+
 					if (opts.pipeline_stats && i == 0)
 						get_pipeline_stats(work_item.tag, work_item.hash, *work_item.output.pipeline);
 
@@ -955,7 +1576,7 @@ struct ThreadedReplayer : StateCreatorInterface
 		get_per_thread_data().per_thread_replayers = per_thread_replayer;
 		// Let main thread know that the per thread replayers have been initialized correctly.
 		{
-			lock_guard<mutex> lock(pipeline_work_queue_mutex);
+			lock_guard<mutex> lock(work_done_mutex);
 			thread_initialized_count++;
 			work_done_condition[0].notify_one();
 		}
@@ -966,39 +1587,41 @@ struct ThreadedReplayer : StateCreatorInterface
 		{
 			PipelineWorkItem work_item;
 			auto idle_start_time = chrono::steady_clock::now();
-			{
-				unique_lock<mutex> lock(pipeline_work_queue_mutex);
-				work_available_condition.wait(lock, [&]() -> bool {
-					return shutting_down || !pipeline_work_queue.empty();
-				});
-
-				if (shutting_down)
-					break;
-
-				work_item = pipeline_work_queue.front();
-				pipeline_work_queue.pop();
-			}
+			if (!acquire_work_item(thread_index, work_item))
+				break;
 
 			auto idle_end_time = chrono::steady_clock::now();
 			auto duration_ns = chrono::duration_cast<chrono::nanoseconds>(idle_end_time - idle_start_time).count();
 			idle_ns += duration_ns;
 
+			// Resolve dependencies before counting the work item as completed, so that anything this enqueues
+			// is accounted for when the main thread checks whether a context has drained.
 			if (work_item.parse_only)
+			{
 				run_parse_work_item(per_thread_replayer[work_item.memory_context_index], json_buffer, work_item);
+				if (work_item.tag == RESOURCE_SHADER_MODULE)
+					notify_shader_module_ready(work_item.hash);
+				else if (work_item.node)
+					notify_pipeline_parsed(work_item.node);
+			}
 			else
+			{
 				run_creation_work_item(work_item);
+				if (work_item.node)
+					notify_pipeline_compiled(work_item.node);
+			}
 
 			idle_start_time = chrono::steady_clock::now();
 			{
 				unsigned context_index = work_item.memory_context_index;
-				lock_guard<mutex> lock(pipeline_work_queue_mutex);
-				completed_count[context_index]++;
+				unsigned completed = completed_count[context_index].fetch_add(1, std::memory_order_acq_rel) + 1;
 
-				// Makes sense to signal main thread now.
-				// If we have a timeout, we need to keep the dispatcher thread aware of the progress,
-				// so wake it up after each work item is complete.
-				if (opts.timeout_seconds != 0 || (completed_count[context_index] == queued_count[context_index]))
+				// Only the main thread waits, and only for a context to drain.
+				if (completed == queued_count[context_index].load(std::memory_order_relaxed))
+				{
+					lock_guard<mutex> lock(work_done_mutex);
 					work_done_condition[context_index].notify_one();
+				}
 			}
 
 			idle_end_time = chrono::steady_clock::now();
@@ -1018,30 +1641,126 @@ struct ThreadedReplayer : StateCreatorInterface
 		total_peak_memory.fetch_add(peak_memory, std::memory_order_relaxed);
 	}
 
-	void flush_pipeline_cache()
+	bool write_pipeline_cache()
 	{
-		if (device && pipeline_cache)
-		{
-			if (!opts.on_disk_pipeline_cache_path.empty())
-			{
-				size_t pipeline_cache_size = 0;
-				if (vkGetPipelineCacheData(device->get_device(), pipeline_cache, &pipeline_cache_size, nullptr) == VK_SUCCESS)
-				{
-					vector<uint8_t> pipeline_buffer(pipeline_cache_size);
-					if (vkGetPipelineCacheData(device->get_device(), pipeline_cache, &pipeline_cache_size, pipeline_buffer.data()) == VK_SUCCESS)
-					{
-						// This isn't safe to do in a signal handler, but it's unlikely to be a problem in practice.
-						FILE *file = fopen(opts.on_disk_pipeline_cache_path.c_str(), "wb");
-						if (!file || fwrite(pipeline_buffer.data(), 1, pipeline_buffer.size(), file) != pipeline_buffer.size())
-							LOGE("Failed to write pipeline cache data to disk.\n");
-						if (file)
-							fclose(file);
-					}
-				}
+		size_t pipeline_cache_size = 0;
+		if (vkGetPipelineCacheData(device->get_device(), pipeline_cache, &pipeline_cache_size, nullptr) != VK_SUCCESS)
+			return false;
+
+		vector<uint8_t> pipeline_buffer(pipeline_cache_size);
+		if (vkGetPipelineCacheData(device->get_device(), pipeline_cache, &pipeline_cache_size, pipeline_buffer.data()) != VK_SUCCESS)
+			return false;
+
+		// The cache is also written while replaying, so never leave a partially written cache behind.
+		// The journal relies on the cache being on disk, so the data is synced before the rename,
+		// and the directory after it, so the rename itself survives a crash.
+		string tmp_path = opts.on_disk_pipeline_cache_path + ".tmp";
+		FILE *file = fopen(tmp_path.c_str(), "wb");
+		if (!file)
+			return false;
+
+		bool written = fwrite(pipeline_buffer.data(), 1, pipeline_cache_size, file) == pipeline_cache_size &&
+		               fflush(file) == 0;
+#ifdef _WIN32
+		written = written && _commit(_fileno(file)) == 0;
+#else
+		written = written && fsync(fileno(file)) == 0;
+#endif
+		if (fclose(file) != 0 || !written)
+			return false;
+
+#ifdef _WIN32
+		// There is no directory handle to sync on Windows, the rename is as durable as the file system makes it.
+		remove(opts.on_disk_pipeline_cache_path.c_str());
+		return rename(tmp_path.c_str(), opts.on_disk_pipeline_cache_path.c_str()) == 0;
+#else
+		if (rename(tmp_path.c_str(), opts.on_disk_pipeline_cache_path.c_str()) != 0)
+			return false;
+
+		int dir_fd = ::open(Path::basedir(opts.on_disk_pipeline_cache_path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd < 0)
+			return false;
+		bool synced = fsync(dir_fd) == 0;
+		close(dir_fd);
+		return synced;
+#endif
+	}
+
+	// Journaled pipelines must be in the pipeline cache on disk, so pending journal records are written
+	// after the cache. Crash handlers do not journal, as they cannot safely take the journal lock.
+	void flush_pipeline_cache(bool journal_progress = true)
+	{
+		vector<ProgressJournal::Record> records;
+		if (journal_progress)
+			progress_journal.take_pending(records, true);
+
+		bool cache_written = true;
+		if (device && pipeline_cache)
+		{
+			if (!opts.on_disk_pipeline_cache_path.empty())
+			{
+				// This isn't safe to do in a signal handler, but it's unlikely to be a problem in practice.
+				cache_written = write_pipeline_cache();
+				if (!cache_written)
+					LOGE("Failed to write pipeline cache data to disk.\n");
 			}
 			vkDestroyPipelineCache(device->get_device(), pipeline_cache, nullptr);
 			pipeline_cache = VK_NULL_HANDLE;
 		}
+
+		if (cache_written && !progress_journal.write(records))
+			LOGE("Failed to write progress journal.\n");
+	}
+
+	// Pipelines of a completed chunk are journaled in batches.
+	// With an on-disk pipeline cache, the cache is checkpointed before every batch.
+	void journal_replay_chunk(const ReplayChunk &chunk)
+	{
+		if (!progress_journal.is_open())
+			return;
+
+		auto &hashes = chunk.tag == RESOURCE_GRAPHICS_PIPELINE ? *graphics_graph.hashes : *compute_graph.hashes;
+		progress_journal.append(chunk.tag, hashes.data() + chunk.hash_offset, chunk.count);
+
+		// If another thread is checkpointing, these records go out with the next checkpoint.
+		unique_lock<mutex> holder(progress_checkpoint_lock, try_to_lock);
+		if (!holder.owns_lock())
+			return;
+
+		vector<ProgressJournal::Record> records;
+		if (!progress_journal.take_pending(records, false) || records.empty())
+			return;
+
+		if (pipeline_cache && !opts.on_disk_pipeline_cache_path.empty())
+		{
+			auto start_time = chrono::steady_clock::now();
+			if (!write_pipeline_cache())
+			{
+				LOGE("Failed to checkpoint pipeline cache, progress is not journaled.\n");
+				return;
+			}
+			progress_journal.set_checkpoint_time(chrono::steady_clock::now() - start_time);
+		}
+
+		if (!progress_journal.write(records))
+			LOGE("Failed to write progress journal.\n");
+	}
+
+	bool open_progress_journal()
+	{
+		if (opts.resume_progress)
+		{
+			progress_journal.load(opts.progress_journal_path);
+			LOGI("Resuming replay, %u graphics and %u compute pipelines completed earlier.\n",
+			     unsigned(progress_journal.completed_graphics.size()), unsigned(progress_journal.completed_compute.size()));
+		}
+
+		if (!progress_journal.open(opts.progress_journal_path))
+		{
+			LOGE("Failed to open progress journal %s.\n", opts.progress_journal_path.c_str());
+			return false;
+		}
+		return true;
 	}
 
 	void flush_validation_cache()
@@ -1074,8 +1793,8 @@ struct ThreadedReplayer : StateCreatorInterface
 	{
 		// Signal that it's time for threads to die.
 		{
-			lock_guard<mutex> lock(pipeline_work_queue_mutex);
-			shutting_down = true;
+			lock_guard<mutex> lock(worker_sleep_mutex);
+			shutting_down.store(true);
 			work_available_condition.notify_all();
 		}
 
@@ -1091,6 +1810,13 @@ struct ThreadedReplayer : StateCreatorInterface
 		flush_pipeline_cache();
 		flush_validation_cache();
 
+		// Nothing was created when benchmarking the frontend.
+		if (!device)
+		{
+			shader_modules.delete_cache([](Hash, VkShaderModule) {});
+			return;
+		}
+
 		for (auto &sampler : samplers)
 			if (sampler.second)
 				vkDestroySampler(device->get_device(), sampler.second, nullptr);
@@ -1198,6 +1924,12 @@ struct ThreadedReplayer : StateCreatorInterface
 		{
 			// Now we can init the device with correct app info.
 			device_was_init = true;
+			if (opts.benchmark_frontend)
+			{
+				LOGI("Benchmarking the replay frontend, no Vulkan device is created.\n");
+				return;
+			}
+
 			device.reset(new VulkanDevice);
 			device_opts.application_info = app;
 			device_opts.features = features;
@@ -1345,6 +2077,13 @@ struct ThreadedReplayer : StateCreatorInterface
 
 	bool enqueue_create_sampler(Hash index, const VkSamplerCreateInfo *create_info, VkSampler *sampler) override
 	{
+		if (opts.benchmark_frontend)
+		{
+			*sampler = fake_handle<VkSampler>(index);
+			samplers[index] = *sampler;
+			return true;
+		}
+
 		if (!device->get_feature_filter().sampler_is_supported(create_info))
 		{
 			LOGE("Sampler %016" PRIx64 " is not supported. Skipping.\n", index);
@@ -1363,6 +2102,13 @@ struct ThreadedReplayer : StateCreatorInterface
 
 	bool enqueue_create_descriptor_set_layout(Hash index, const VkDescriptorSetLayoutCreateInfo *create_info, VkDescriptorSetLayout *layout) override
 	{
+		if (opts.benchmark_frontend)
+		{
+			*layout = fake_handle<VkDescriptorSetLayout>(index);
+			layouts[index] = *layout;
+			return true;
+		}
+
 		if (!device->get_feature_filter().descriptor_set_layout_is_supported(create_info))
 		{
 			LOGE("Descriptor set layout %016" PRIx64 " is not supported. Skipping.\n", index);
@@ -1381,6 +2127,13 @@ struct ThreadedReplayer : StateCreatorInterface
 
 	bool enqueue_create_pipeline_layout(Hash index, const VkPipelineLayoutCreateInfo *create_info, VkPipelineLayout *layout) override
 	{
+		if (opts.benchmark_frontend)
+		{
+			*layout = fake_handle<VkPipelineLayout>(index);
+			pipeline_layouts[index] = *layout;
+			return true;
+		}
+
 		if (!device->get_feature_filter().pipeline_layout_is_supported(create_info))
 		{
 			LOGE("Pipeline layout %016" PRIx64 " is not supported. Skipping.\n", index);
@@ -1399,6 +2152,13 @@ struct ThreadedReplayer : StateCreatorInterface
 
 	bool enqueue_create_render_pass(Hash index, const VkRenderPassCreateInfo *create_info, VkRenderPass *render_pass) override
 	{
+		if (opts.benchmark_frontend)
+		{
+			*render_pass = fake_handle<VkRenderPass>(index);
+			render_passes[index] = *render_pass;
+			return true;
+		}
+
 		if (!device->get_feature_filter().render_pass_is_supported(create_info))
 		{
 			LOGE("Render pass %016" PRIx64 " is not supported. Skipping.\n", index);
@@ -1432,7 +2192,7 @@ struct ThreadedReplayer : StateCreatorInterface
 		if (opts.spirv_validate)
 		{
 			auto start_time = chrono::steady_clock::now();
-			spvtools::SpirvTools context(device->get_api_version() >= VK_VERSION_1_1 ? SPV_ENV_VULKAN_1_1 : SPV_ENV_VULKAN_1_0);
+			spvtools::SpirvTools context(!device || device->get_api_version() >= VK_VERSION_1_1 ? SPV_ENV_VULKAN_1_1 : SPV_ENV_VULKAN_1_0);
 			context.SetMessageConsumer([](spv_message_level_t, const char *, const spv_position_t &, const char *message) {
 				LOGE("spirv-val: %s\n", message);
 			});
@@ -1460,6 +2220,18 @@ struct ThreadedReplayer : StateCreatorInterface
 		}
 #endif
 
+		if (opts.benchmark_frontend)
+		{
+			*module = fake_handle<VkShaderModule>(hash);
+			shader_module_count.fetch_add(1, std::memory_order_relaxed);
+			if (opts.control_block)
+				opts.control_block->successful_modules.fetch_add(1, std::memory_order_relaxed);
+
+			lock_guard<mutex> lock(internal_enqueue_mutex);
+			shader_modules.insert_object(hash, *module, create_info->codeSize);
+			return true;
+		}
+
 		if (!device->get_feature_filter().shader_module_is_supported(create_info))
 		{
 			LOGE("Shader module %0" PRIx64 " is not supported on this device.\n", hash);
@@ -1662,7 +2434,7 @@ struct ThreadedReplayer : StateCreatorInterface
 	}
 
 	bool enqueue_pipeline(Hash hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline,
-	                      unsigned index, unsigned memory_context_index)
+	                      unsigned index, unsigned memory_context_index, PipelineNode *node)
 	{
 		PipelineWorkItem work_item = {};
 		work_item.hash = hash;
@@ -1670,6 +2442,7 @@ struct ThreadedReplayer : StateCreatorInterface
 		work_item.output.pipeline = pipeline;
 		work_item.index = index;
 		work_item.memory_context_index = memory_context_index;
+		work_item.node = node;
 
 		if (create_info->stage.module != VK_NULL_HANDLE)
 		{
@@ -1687,7 +2460,7 @@ struct ThreadedReplayer : StateCreatorInterface
 	}
 
 	bool enqueue_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline,
-	                      unsigned index, unsigned memory_context_index)
+	                      unsigned index, unsigned memory_context_index, PipelineNode *node)
 	{
 		bool valid_handles = true;
 		for (uint32_t i = 0; i < create_info->stageCount; i++)
@@ -1700,6 +2473,7 @@ struct ThreadedReplayer : StateCreatorInterface
 		work_item.output.pipeline = pipeline;
 		work_item.index = index;
 		work_item.memory_context_index = memory_context_index;
+		work_item.node = node;
 
 		if (valid_handles)
 		{
@@ -1716,47 +2490,9 @@ struct ThreadedReplayer : StateCreatorInterface
 		return true;
 	}
 
-	bool enqueue_shader_module(VkShaderModule shader_module_hash)
-	{
-		if (enqueued_shader_modules.count(shader_module_hash) == 0)
-		{
-			if (opts.control_block)
-				opts.control_block->total_modules.fetch_add(1, std::memory_order_relaxed);
-
-			PipelineWorkItem work_item;
-			work_item.tag = RESOURCE_SHADER_MODULE;
-			work_item.hash = (Hash) shader_module_hash;
-			work_item.parse_only = true;
-			work_item.memory_context_index = SHADER_MODULE_MEMORY_CONTEXT;
-			enqueue_work_item(work_item);
-			enqueued_shader_modules.insert(shader_module_hash);
-			//LOGI("Queueing up shader module: %016llx.\n", static_cast<unsigned long long>((Hash) shader_module_hash));
-			return true;
-		}
-		else
-		{
-			//LOGI("Not queueing up shader module: %016llx.\n", static_cast<unsigned long long>((Hash) shader_module_hash));
-			return false;
-		}
-	}
-
-	bool enqueue_shader_modules(const VkGraphicsPipelineCreateInfo *info)
-	{
-		bool ret = false;
-		for (uint32_t i = 0; i < info->stageCount; i++)
-			if (enqueue_shader_module(info->pStages[i].module))
-				ret = true;
-		return ret;
-	}
-
-	bool enqueue_shader_modules(const VkComputePipelineCreateInfo *info)
-	{
-		bool ret = enqueue_shader_module(info->stage.module);
-		return ret;
-	}
-
 	void resolve_shader_modules(VkGraphicsPipelineCreateInfo *info)
 	{
+		lock_guard<mutex> lock(internal_enqueue_mutex);
 		for (uint32_t i = 0; i < info->stageCount; i++)
 		{
 			auto result = shader_modules.find_object((Hash) info->pStages[i].module);
@@ -1770,6 +2506,7 @@ struct ThreadedReplayer : StateCreatorInterface
 
 	void resolve_shader_modules(VkComputePipelineCreateInfo *info)
 	{
+		lock_guard<mutex> lock(internal_enqueue_mutex);
 		auto result = shader_modules.find_object((Hash) info->stage.module);
 		if (!result.second)
 		{
@@ -1778,884 +2515,1918 @@ struct ThreadedReplayer : StateCreatorInterface
 		const_cast<VkComputePipelineCreateInfo*>(info)->stage.module = result.first;
 	}
 
-	template <typename DerivedInfo>
-	void sort_deferred_derived_pipelines(vector<DerivedInfo> &derived, vector<DerivedInfo> &deferred)
+	static void get_shader_module_hashes(const VkGraphicsPipelineCreateInfo *info, vector<Hash> &hashes)
 	{
-		sort(begin(deferred), end(deferred), [&](const DerivedInfo &a, const DerivedInfo &b) -> bool {
-			bool a_derived = !a.info || (a.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
-			bool b_derived = !b.info || (b.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
-			if (a_derived == b_derived)
-				return a.index < b.index;
-			else
-				return b_derived;
-		});
-
-		unsigned end_index_non_derived = deferred.size();
-		unsigned index = 0;
-		for (auto &def : deferred)
-		{
-			index++;
-			if (def.info && (def.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) == 0)
-				end_index_non_derived = index;
-		}
-
-		derived.clear();
-		assert(deferred.size() >= end_index_non_derived);
-		derived.reserve(deferred.size() - end_index_non_derived);
-		copy(begin(deferred) + end_index_non_derived, end(deferred), back_inserter(derived));
-		deferred.erase(begin(deferred) + end_index_non_derived, end(deferred));
-
-		auto itr = remove_if(begin(derived), end(derived), [](const DerivedInfo &a) { return a.info == nullptr; });
-		derived.erase(itr, end(derived));
+		for (uint32_t i = 0; i < info->stageCount; i++)
+			hashes.push_back((Hash) info->pStages[i].module);
 	}
 
-	template <typename DerivedInfo>
-	void enqueue_deferred_pipelines(vector<DerivedInfo> *deferred, const unordered_map<Hash, VkPipeline> &pipelines,
-	                                unordered_map<Hash, DerivedInfo> &parents,
-	                                vector<EnqueuedWork> &work, const vector<Hash> &hashes, unsigned start_index)
-	{
-		static const unsigned NUM_PIPELINES_PER_CONTEXT = 1024;
-
-		// Make sure that if we sort by work_index, we get an interleaved execution pattern which
-		// will naturally pipeline.
-		enum PassOrder
-		{
-			PARSE_ENQUEUE_OFFSET = 0,
-			MAINTAIN_SHADER_MODULE_LRU_CACHE = 1,
-			ENQUEUE_SHADER_MODULES_PRIMARY_OFFSET = 2,
-			RESOLVE_SHADER_MODULE_AND_ENQUEUE_PIPELINES_PRIMARY_OFFSET = 3,
-			ENQUEUE_OUT_OF_RANGE_PARENT_PIPELINES = 4,
-			ENQUEUE_SHADER_MODULE_SECONDARY_OFFSET = 5,
-			ENQUEUE_DERIVED_PIPELINES_OFFSET = 6,
-			PASS_COUNT = 7
-		};
-
-		auto outside_range_hashes = make_shared<unordered_set<Hash>>();
-
-		unsigned memory_index = 0;
-		unsigned iteration = 0;
-
-		// This makes sure that we interleave execution of N iterations. Essentially, we get an execution order:
-		// - Pass 0, chunk 0 (context 0)
-		// - Pass 0, chunk 1 (context 1)
-		// - Pass 1, chunk 0 (context 0)
-		// - Pass 1, chunk 1 (context 1)
-		// - ...
-		// - Pass 6, chunk 0 (reclaim memory for context 0)
-		// - Pass 6, chunk 1 (reclaim memory for context 1)
-		// - Pass 7, sync point
-		// - Pass 0, chunk 2 (context 0)
-		// - Pass 1, chunk 3 (context 1)
-
-		const auto get_order_index = [&](unsigned pass) -> unsigned {
-			return (iteration / NUM_PIPELINE_MEMORY_CONTEXTS) * PASS_COUNT * NUM_PIPELINE_MEMORY_CONTEXTS +
-			       pass * NUM_PIPELINE_MEMORY_CONTEXTS +
-			       memory_index;
-		};
-
-		for (unsigned hash_offset = 0; hash_offset < hashes.size(); hash_offset += NUM_PIPELINES_PER_CONTEXT, iteration++)
-		{
-			unsigned left_to_submit = hashes.size() - hash_offset;
-			unsigned to_submit = left_to_submit < NUM_PIPELINES_PER_CONTEXT ? left_to_submit : NUM_PIPELINES_PER_CONTEXT;
-
-			// State which is used between pipeline stages.
-			auto derived = make_shared<vector<DerivedInfo>>();
-
-			// Submit pipelines to be parsed.
-			work.push_back({ get_order_index(PARSE_ENQUEUE_OFFSET),
-			                 [this, &hashes, &pipelines, deferred, memory_index, to_submit, hash_offset]() {
-				                 // Drain old allocators.
-				                 sync_worker_memory_context(memory_index);
-				                 // Reset per memory-context allocators.
-				                 for (auto &data : per_thread_data)
-					                 if (data.per_thread_replayers)
-						                 data.per_thread_replayers[memory_index].get_allocator().reset();
-
-				                 deferred[memory_index].resize(to_submit);
-				                 for (unsigned index = hash_offset; index < hash_offset + to_submit; index++)
-				                 {
-					                 if (pipelines.count(hashes[index]) == 0)
-					                 {
-						                 ThreadedReplayer::PipelineWorkItem work_item;
-						                 work_item.hash = hashes[index];
-						                 work_item.tag = DerivedInfo::get_tag();
-						                 work_item.parse_only = true;
-						                 work_item.memory_context_index = memory_index;
-						                 work_item.index = index - hash_offset;
-
-						                 auto tag = DerivedInfo::get_tag();
-						                 if (opts.control_block)
-						                 {
-							                 if (tag == RESOURCE_GRAPHICS_PIPELINE)
-								                 opts.control_block->total_graphics.fetch_add(1, std::memory_order_relaxed);
-							                 else if (tag == RESOURCE_COMPUTE_PIPELINE)
-								                 opts.control_block->total_compute.fetch_add(1, std::memory_order_relaxed);
-						                 }
-
-						                 enqueue_work_item(work_item);
-					                 }
-					                 else
-					                 {
-						                 // This pipeline has already been processed before in order to resolve parent pipelines.
-						                 // Don't do anything with it this iteration since it has already been compiled.
-						                 deferred[memory_index][index - hash_offset] = {};
-					                 }
-				                 }
-			                 }});
-
-			if (memory_index == 0)
-			{
-				work.push_back({ get_order_index(MAINTAIN_SHADER_MODULE_LRU_CACHE),
-				                 [this]() {
-					                 // Now all worker threads are drained for any work which needs shader modules,
-					                 // so we can maintain the shader module LRU cache while we're parsing new pipelines in parallel.
-					                 shader_modules.prune_cache([this](Hash hash, VkShaderModule module) {
-						                 assert(enqueued_shader_modules.count((VkShaderModule) hash) != 0);
-						                 //LOGI("Removing shader module %016llx.\n", static_cast<unsigned long long>(hash));
-						                 enqueued_shader_modules.erase((VkShaderModule) hash);
-						                 if (module != VK_NULL_HANDLE)
-							                 vkDestroyShaderModule(device->get_device(), module, nullptr);
-
-						                 shader_module_evicted_count.fetch_add(1, std::memory_order_relaxed);
-					                 });
-
-					                 // Need to forget that we have seen an object before so we can replay the same object multiple times.
-					                 for (auto &per_thread : per_thread_data)
-						                 if (per_thread.per_thread_replayers)
-							                 per_thread.per_thread_replayers[SHADER_MODULE_MEMORY_CONTEXT].forget_handle_references();
-				                 }});
-			}
-
-			work.push_back({ get_order_index(ENQUEUE_SHADER_MODULES_PRIMARY_OFFSET),
-			                 [this, derived, deferred, memory_index]() {
-				                 // Make sure all parsing of pipelines is complete for this memory context.
-				                 sync_worker_memory_context(memory_index);
-
-				                 // Enqueue creation of all shader modules which are referenced by the pipelines.
-				                 for (auto &item : deferred[memory_index])
-					                 if (item.info)
-						                 enqueue_shader_modules(item.info);
-
-				                 // There are two primary kinds of pipelines, derived and non-derived. We split compilation in two here.
-				                 // Non-derived pipelines have no dependencies on other pipelines, so we can go ahead,
-				                 // and we force that parent pipeline candidates cannot also be derived, which simplifies a lot of things.
-				                 // While decompressing modules, we can sort the pipeline infos here in parallel.
-				                 sort_deferred_derived_pipelines(*derived, deferred[memory_index]);
-			                 }});
-
-			work.push_back({ get_order_index(RESOLVE_SHADER_MODULE_AND_ENQUEUE_PIPELINES_PRIMARY_OFFSET),
-			                 [this, derived, deferred, memory_index, hash_offset, start_index]() {
-				                 // Make sure all VkShaderModules have been queued and completed.
-				                 // We reserve a special memory context for all shader modules since other memory indices
-				                 // might queue up shader module work which we need in our memory index.
-				                 // Remap VkShaderModule references from hashes to real handles and enqueue all non-derived pipelines for work.
-				                 sync_worker_memory_context(SHADER_MODULE_MEMORY_CONTEXT);
-
-				                 for (auto &item : deferred[memory_index])
-				                 {
-					                 if (item.info)
-					                 {
-						                 resolve_shader_modules(item.info);
-						                 enqueue_pipeline(item.hash, item.info, item.pipeline,
-						                                  item.index + hash_offset + start_index, memory_index);
-					                 }
-				                 }
-			                 }});
-
-			work.push_back({ get_order_index(ENQUEUE_OUT_OF_RANGE_PARENT_PIPELINES),
-			                 [this, &pipelines, derived, outside_range_hashes]() {
-				                 // Figure out which of the parent pipelines we need.
-				                 for (auto &d : *derived)
-				                 {
-					                 if (!d.info)
-						                 continue;
-					                 Hash h = (Hash)d.info->basePipelineHandle;
-
-					                 // pipelines will have an entry if we called enqueue_pipeline() already for this hash,
-					                 // it's not necessarily complete yet!
-					                 bool is_inside_range = pipelines.count(h) != 0;
-
-					                 if (!is_inside_range)
-					                 {
-						                 // We have not seen this parent pipeline before.
-						                 // Make sure this auxillary entry has been parsed and is not seen before.
-						                 if (!outside_range_hashes->count(h))
-						                 {
-							                 PipelineWorkItem work_item;
-							                 work_item.index = d.index;
-							                 work_item.hash = h;
-							                 work_item.parse_only = true;
-							                 work_item.force_outside_range = true;
-							                 work_item.memory_context_index = PARENT_PIPELINE_MEMORY_CONTEXT;
-							                 work_item.tag = DerivedInfo::get_tag();
-							                 outside_range_hashes->insert(h);
-							                 enqueue_work_item(work_item);
-						                 }
-					                 }
-				                 }
-			                 }});
-
-			if (memory_index == 0)
-			{
-				// This is a join-like operation. We need to wait for all parent pipelines and all shader modules to have completed.
-				work.push_back({get_order_index(ENQUEUE_SHADER_MODULE_SECONDARY_OFFSET),
-				                [this, &parents, hash_offset, start_index]()
-				                {
-					                // Wait until all parent pipelines have been parsed.
-					                sync_worker_memory_context(PARENT_PIPELINE_MEMORY_CONTEXT);
-
-					                // Queue up all shader modules if somehow the shader modules used by parent pipelines differ from children ...
-					                for (auto &parent : parents)
-					                {
-						                // If we enqueued something here, we have to wait for shader handles to resolve.
-						                if (parent.second.info)
-							                enqueue_shader_modules(parent.second.info);
-					                }
-
-					                if (opts.control_block)
-					                {
-						                auto tag = DerivedInfo::get_tag();
-						                if (tag == RESOURCE_GRAPHICS_PIPELINE)
-							                opts.control_block->total_graphics.fetch_add(parents.size(),
-							                                                             std::memory_order_relaxed);
-						                else if (tag == RESOURCE_COMPUTE_PIPELINE)
-							                opts.control_block->total_compute.fetch_add(parents.size(),
-							                                                            std::memory_order_relaxed);
-					                }
-
-					                sync_worker_memory_context(SHADER_MODULE_MEMORY_CONTEXT);
-					                // The shader module memory context recycles itself.
-
-					                for (auto &parent : parents)
-					                {
-						                if (parent.second.info)
-						                {
-							                resolve_shader_modules(parent.second.info);
-							                assert((parent.second.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) ==
-							                       0);
-							                enqueue_pipeline(parent.second.hash, parent.second.info,
-							                                 parent.second.pipeline,
-							                                 parent.second.index + hash_offset + start_index,
-							                                 PARENT_PIPELINE_MEMORY_CONTEXT);
-						                }
-					                }
-
-					                parents.clear();
-
-					                // We might be pulling in a parent pipeline from another memory context next iteration,
-					                // so we need to wait for all normal memory contexts.
-					                for (unsigned i = 0; i < NUM_PIPELINE_MEMORY_CONTEXTS; i++)
-						                sync_worker_memory_context(i);
-				                }});
-			}
-
-			work.push_back({ get_order_index(ENQUEUE_DERIVED_PIPELINES_OFFSET),
-			                 [this, &pipelines, derived, memory_index, hash_offset, start_index]() {
-				                 // Go over all pipelines. If there are no further dependencies to resolve, we can go ahead and queue them up.
-				                 // If an entry exists in pipelines, we have queued up that hash earlier, but it might not be done compiling yet.
-				                 auto itr = unstable_remove_if(begin(*derived), end(*derived), [&](const DerivedInfo &info) -> bool {
-					                 if (info.info)
-					                 {
-						                 Hash hash = (Hash)info.info->basePipelineHandle;
-						                 return pipelines.count(hash) != 0;
-					                 }
-					                 else
-						                 return false;
-				                 });
-
-				                 // Wait for parent pipelines to complete.
-				                 // Only needed for first memory index.
-				                 if (memory_index == 0)
-				                 {
-					                 sync_worker_memory_context(PARENT_PIPELINE_MEMORY_CONTEXT);
-
-					                 // Now we have replayed the pipelines, so we can reclaim parent pipeline memory for this iteration.
-					                 for (auto &per_thread : per_thread_data)
-						                 if (per_thread.per_thread_replayers)
-							                 per_thread.per_thread_replayers[PARENT_PIPELINE_MEMORY_CONTEXT].get_allocator().reset();
-				                 }
-
-				                 // Now we can enqueue pipeline compilation with correct pipeline handles.
-				                 for (auto i = itr; i != end(*derived); ++i)
-				                 {
-					                 if (i->info)
-					                 {
-						                 resolve_shader_modules(i->info);
-						                 auto base_itr = pipelines.find((Hash) i->info->basePipelineHandle);
-						                 i->info->basePipelineHandle =
-								                 base_itr != end(pipelines) ? base_itr->second : VK_NULL_HANDLE;
-						                 enqueue_pipeline(i->hash, i->info, i->pipeline,
-						                                  i->index + hash_offset + start_index, memory_index);
-					                 }
-				                 }
-
-				                 // It might be possible that we couldn't resolve some dependencies, log this.
-				                 if (itr != begin(*derived))
-				                 {
-					                 auto skipped_count = unsigned(itr - begin(*derived));
-					                 LOGE("%u pipelines were not compiled because parent pipelines do not exist.\n", skipped_count);
-
-					                 if (opts.control_block)
-					                 {
-						                 auto tag = DerivedInfo::get_tag();
-						                 if (tag == RESOURCE_GRAPHICS_PIPELINE)
-							                 opts.control_block->skipped_graphics.fetch_add(skipped_count, std::memory_order_relaxed);
-						                 else if (tag == RESOURCE_COMPUTE_PIPELINE)
-							                 opts.control_block->skipped_compute.fetch_add(skipped_count, std::memory_order_relaxed);
-					                 }
-				                 }
-			                 }});
-
-			memory_index = (memory_index + 1) % NUM_PIPELINE_MEMORY_CONTEXTS;
-		}
+	static void get_shader_module_hashes(const VkComputePipelineCreateInfo *info, vector<Hash> &hashes)
+	{
+		hashes.push_back((Hash) info->stage.module);
 	}
 
-	void sync_threads() override
+	template <typename CreateInfo>
+	static void force_non_derived(CreateInfo *info)
 	{
-		sync_worker_threads();
+		info->flags &= ~VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+		info->basePipelineHandle = VK_NULL_HANDLE;
+		info->basePipelineIndex = 0;
 	}
 
-	// Support ignoring shader module which are known to cause crashes.
-	void mask_shader_module(Hash hash)
+	void enqueue_shader_module(Hash hash)
 	{
-		masked_shader_modules.insert(hash);
+		if (opts.control_block)
+			opts.control_block->total_modules.fetch_add(1, std::memory_order_relaxed);
+
+		PipelineWorkItem work_item;
+		work_item.tag = RESOURCE_SHADER_MODULE;
+		work_item.hash = hash;
+		work_item.parse_only = true;
+		work_item.memory_context_index = SHADER_MODULE_MEMORY_CONTEXT;
+		enqueue_work_item(work_item);
 	}
 
-	const vector<thread> &get_threads() const
+	void prune_shader_module_cache()
 	{
-		return thread_pool;
+		lock_guard<mutex> holder(replay_graph_mutex);
+		lock_guard<mutex> cache_holder(internal_enqueue_mutex);
+
+		// Modules which pipelines still wait for or have resolved are pinned.
+		shader_modules.prune_cache([this](Hash hash, VkShaderModule module) {
+			shader_module_dependencies.erase(hash);
+			if (module != VK_NULL_HANDLE && device)
+				vkDestroyShaderModule(device->get_device(), module, nullptr);
+			shader_module_evicted_count.fetch_add(1, std::memory_order_relaxed);
+		}, [this](Hash hash) -> bool {
+			auto itr = shader_module_dependencies.find(hash);
+			return itr != end(shader_module_dependencies) && (itr->second.users != 0 || !itr->second.ready);
+		});
 	}
 
-	void emergency_teardown()
+	template <typename DerivedInfo>
+	DerivedInfo get_deferred_info(ReplayGraph<DerivedInfo> &graph, const PipelineNode *node)
 	{
-#ifdef SIMULATE_UNSTABLE_DRIVER
-		spurious_deadlock();
-#endif
-		flush_pipeline_cache();
-		flush_validation_cache();
-		if (validation_whitelist_db)
-			validation_whitelist_db->flush();
-		if (validation_blacklist_db)
-			validation_blacklist_db->flush();
-		device.reset();
+		if (node->chunk)
+			return graph.deferred[node->chunk->memory_context_index][node->index];
+
+		lock_guard<mutex> holder(hash_lock);
+		auto itr = graph.parents->find(node->hash);
+		if (itr != end(*graph.parents))
+			return itr->second;
+		else
+			return {};
 	}
 
-	Options opts;
+	template <typename DerivedInfo>
+	void start_replay_chunk(ReplayGraph<DerivedInfo> &graph, ReplayChunk &chunk)
+	{
+		unsigned memory_index = chunk.memory_context_index;
 
-	std::unordered_map<Hash, VkSampler> samplers;
-	std::unordered_map<Hash, VkDescriptorSetLayout> layouts;
-	std::unordered_map<Hash, VkPipelineLayout> pipeline_layouts;
+		// The previous chunk in this memory context is done, so nothing references its allocations anymore.
+		for (auto &data : per_thread_data)
+			if (data.per_thread_replayers)
+				data.per_thread_replayers[memory_index].get_allocator().reset();
+		graph.deferred[memory_index].assign(chunk.count, DerivedInfo());
 
-	ObjectCache<VkShaderModule> shader_modules;
+		chunk.nodes.reset(new PipelineNode[chunk.count]);
+		chunk.completed.reset(new bool[chunk.count]());
 
-	std::unordered_map<Hash, VkRenderPass> render_passes;
-	std::unordered_map<Hash, VkPipeline> compute_pipelines;
-	std::unordered_map<Hash, VkPipeline> graphics_pipelines;
-	std::unordered_set<Hash> masked_shader_modules;
-	std::unordered_map<VkShaderModule, Hash> shader_module_to_hash;
-	std::unordered_set<VkShaderModule> enqueued_shader_modules;
-	VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
-	VkValidationCacheEXT validation_cache = VK_NULL_HANDLE;
+		// Hold a reference while enqueueing, so the chunk cannot complete underneath us.
+		chunk.outstanding.store(1, std::memory_order_relaxed);
 
-	// VALVE: multi-threaded work queue for replayer
+		vector<PipelineNode *> to_parse;
+		vector<Hash> modules_to_enqueue;
+		to_parse.reserve(chunk.count);
+		{
+			lock_guard<mutex> holder(replay_graph_mutex);
+			for (unsigned i = 0; i < chunk.count; i++)
+			{
+				auto &node = chunk.nodes[i];
+				node.chunk = &chunk;
+				node.index = i;
+				node.hash = (*graph.hashes)[chunk.hash_offset + i];
+				node.tag = DerivedInfo::get_tag();
+
+				// Completed in an earlier run. It is only replayed again if a pipeline derives from it.
+				if (progress_journal.is_completed(node.tag, node.hash))
+				{
+					resumed_pipeline_count.fetch_add(1, std::memory_order_relaxed);
+					chunk.completed[i] = true;
+					continue;
+				}
 
-	void enqueue_work_item(const PipelineWorkItem &item)
-	{
-		lock_guard<mutex> lock(pipeline_work_queue_mutex);
-		pipeline_work_queue.push(item);
-		work_available_condition.notify_one();
-		queued_count[item.memory_context_index]++;
-	}
+				// This pipeline has already been replayed as the parent of a pipeline in an earlier chunk.
+				auto parent = graph.dependencies.insert({ node.hash, {} });
+				if (!parent.second)
+				{
+					chunk.completed[i] = parent.first->second.compiled;
+					continue;
+				}
+				node.dependency = &parent.first->second;
+				to_parse.push_back(&node);
 
-	unsigned num_worker_threads = 0;
-	unsigned loop_count = 0;
+				// With an index, module creation does not have to wait for the pipeline to be parsed.
+				// The modules are pinned until then, so completing chunks cannot evict them in the meantime.
+				auto *modules = dependency_index ? dependency_index->find_modules(node.tag, node.hash) : nullptr;
+				if (!modules)
+					continue;
 
-	unsigned queued_count[NUM_MEMORY_CONTEXTS] = {};
-	unsigned completed_count[NUM_MEMORY_CONTEXTS] = {};
-	unsigned thread_initialized_count = 0;
-	std::condition_variable work_available_condition;
-	std::condition_variable work_done_condition[NUM_MEMORY_CONTEXTS];
+				node.shader_modules = *modules;
+				for (Hash module : *modules)
+				{
+					auto &dep = shader_module_dependencies[module];
+					dep.users++;
+					if (!dep.ready && !dep.enqueued)
+					{
+						dep.enqueued = true;
+						modules_to_enqueue.push_back(module);
+					}
+				}
+			}
 
-	std::vector<std::thread> thread_pool;
-	std::vector<PerThreadData> per_thread_data;
-	std::mutex pipeline_work_queue_mutex;
-	std::mutex internal_enqueue_mutex;
-	std::queue<PipelineWorkItem> pipeline_work_queue;
+			update_completed_pipelines(chunk);
+		}
 
-	std::mutex pipeline_stats_queue_mutex;
-	std::unique_ptr<DatabaseInterface> pipeline_stats_db;
+		for (Hash module : modules_to_enqueue)
+			enqueue_shader_module(module);
 
-	std::mutex validation_db_mutex;
-	std::unique_ptr<DatabaseInterface> validation_whitelist_db;
-	std::unique_ptr<DatabaseInterface> validation_blacklist_db;
+		chunk.outstanding.fetch_add(unsigned(to_parse.size()), std::memory_order_relaxed);
+		for (auto *node : to_parse)
+		{
+			PipelineWorkItem work_item;
+			work_item.hash = node->hash;
+			work_item.tag = node->tag;
+			work_item.parse_only = true;
+			work_item.memory_context_index = memory_index;
+			work_item.index = node->index;
+			work_item.node = node;
 
-	std::mutex hash_lock;
-	std::unordered_map<Hash, DeferredGraphicsInfo> graphics_parents;
-	std::unordered_map<Hash, DeferredComputeInfo> compute_parents;
-	std::vector<DeferredGraphicsInfo> deferred_graphics[NUM_MEMORY_CONTEXTS];
-	std::vector<DeferredComputeInfo> deferred_compute[NUM_MEMORY_CONTEXTS];
+			if (opts.control_block)
+			{
+				if (node->tag == RESOURCE_GRAPHICS_PIPELINE)
+					opts.control_block->total_graphics.fetch_add(1, std::memory_order_relaxed);
+				else if (node->tag == RESOURCE_COMPUTE_PIPELINE)
+					opts.control_block->total_compute.fetch_add(1, std::memory_order_relaxed);
+			}
 
-	// Feed statistics from the worker threads.
-	std::atomic<std::uint64_t> graphics_pipeline_ns;
-	std::atomic<std::uint64_t> compute_pipeline_ns;
-	std::atomic<std::uint64_t> shader_module_ns;
-	std::atomic<std::uint64_t> total_idle_ns;
-	std::atomic<std::uint64_t> thread_total_ns;
-	std::atomic<std::uint32_t> graphics_pipeline_count;
-	std::atomic<std::uint32_t> compute_pipeline_count;
-	std::atomic<std::uint32_t> shader_module_count;
-	std::atomic<std::uint32_t> shader_module_evicted_count;
-	std::atomic<std::uint32_t> pipeline_cache_hits;
-	std::atomic<std::uint32_t> pipeline_cache_misses;
+			enqueue_work_item(work_item);
+		}
 
-	std::atomic<std::uint64_t> shader_module_total_size;
-	std::atomic<std::uint64_t> shader_module_total_compressed_size;
+		release_replay_chunk(chunk);
+	}
 
-	std::atomic<size_t> total_peak_memory;
+	void start_replay_chunk(ReplayChunk &chunk)
+	{
+		if (chunk.tag == RESOURCE_GRAPHICS_PIPELINE)
+			start_replay_chunk(graphics_graph, chunk);
+		else
+			start_replay_chunk(compute_graph, chunk);
+	}
 
-	bool shutting_down = false;
+	void release_replay_chunk(ReplayChunk &chunk)
+	{
+		if (chunk.outstanding.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
 
-	unique_ptr<VulkanDevice> device;
-	bool device_was_init = false;
-	VulkanDevice::Options device_opts;
+		// Every pipeline of the chunk is done, so its nodes are no longer referenced.
+		// Parents which were replayed for an earlier chunk are done by now as well.
+		chunk.nodes.reset();
+		chunk.completed.reset();
+		chunk.completed_count.store(chunk.count, std::memory_order_release);
 
-	// Crash recovery.
-	bool robustness = false;
+		// Prune once per round of memory contexts. Pruning after every chunk evicts modules
+		// which the chunks started next would only create again.
+		if ((completed_replay_chunks.fetch_add(1, std::memory_order_relaxed) + 1) % NUM_PIPELINE_MEMORY_CONTEXTS == 0)
+			prune_shader_module_cache();
+		journal_replay_chunk(chunk);
 
-	const StateReplayer *global_replayer = nullptr;
-	DatabaseInterface *global_database = nullptr;
-};
+		ReplayChunk *next_chunk = nullptr;
+		{
+			lock_guard<mutex> holder(replay_graph_mutex);
+			if (next_replay_chunk < replay_schedule.size())
+			{
+				next_chunk = replay_schedule[next_replay_chunk++];
+				next_chunk->memory_context_index = chunk.memory_context_index;
+			}
+			else if (opts.work_queue)
+				next_chunk = claim_replay_chunk(chunk.memory_context_index);
+		}
 
-static void on_validation_error(void *userdata)
-{
+		if (next_chunk)
+			start_replay_chunk(*next_chunk);
+
+		if (remaining_replay_chunks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			lock_guard<mutex> holder(work_done_mutex);
+			replay_graph_condition.notify_one();
+		}
+	}
+
+	void release_pipeline_dependency(PipelineNode *node)
+	{
+		if (node->pending_dependencies.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+
+		if (node->tag == RESOURCE_GRAPHICS_PIPELINE)
+			submit_pipeline(graphics_graph, node);
+		else
+			submit_pipeline(compute_graph, node);
+	}
+
+	template <typename DerivedInfo>
+	void notify_pipeline_parsed(ReplayGraph<DerivedInfo> &graph, PipelineNode *node)
+	{
+		auto deferred = get_deferred_info(graph, node);
+		if (!deferred.info)
+		{
+			// Parsing failed, or a parent pipeline does not exist in the database.
+			complete_pipeline(graph, node, false);
+			return;
+		}
+
+		if (!node->chunk && opts.control_block)
+		{
+			if (node->tag == RESOURCE_GRAPHICS_PIPELINE)
+				opts.control_block->total_graphics.fetch_add(1, std::memory_order_relaxed);
+			else if (node->tag == RESOURCE_COMPUTE_PIPELINE)
+				opts.control_block->total_compute.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// Hold a reference while adding dependencies, so the pipeline cannot be submitted underneath us.
+		node->pending_dependencies.store(1, std::memory_order_relaxed);
+
+		vector<Hash> modules_to_enqueue;
+		PipelineNode *parent_to_enqueue = nullptr;
+		{
+			lock_guard<mutex> holder(replay_graph_mutex);
+
+			// Release the modules pinned from the dependency index. They are pinned again below.
+			for (Hash module : node->shader_modules)
+				shader_module_dependencies[module].users--;
+			node->shader_modules.clear();
+
+			get_shader_module_hashes(deferred.info, node->shader_modules);
+			for (Hash module : node->shader_modules)
+			{
+				auto &dep = shader_module_dependencies[module];
+				dep.users++;
+				if (!dep.ready)
+				{
+					dep.waiters.push_back(node);
+					node->pending_dependencies.fetch_add(1, std::memory_order_relaxed);
+					if (!dep.enqueued)
+					{
+						dep.enqueued = true;
+						modules_to_enqueue.push_back(module);
+					}
+				}
+			}
+
+			if ((deferred.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
+			{
+				Hash parent = (Hash) deferred.info->basePipelineHandle;
+
+				// Pipelines which others derive from and parents pulled in from outside the range are replayed as non-derived.
+				// Dependency chains stay one level deep, which also rules out cycles.
+				if (!node->chunk || parent == node->hash || !node->dependency->waiters.empty())
+					force_non_derived(deferred.info);
+				else if (parent == 0)
+					node->missing_parent = true;
+				else
+				{
+					auto itr = graph.dependencies.find(parent);
+					if (itr == end(graph.dependencies))
+					{
+						// We have not seen this parent pipeline before, so parse it outside the replay range.
+						itr = graph.dependencies.insert({ parent, {} }).first;
+						auto &parent_node = graph.parent_nodes[parent];
+						parent_node.reset(new PipelineNode);
+						parent_node->hash = parent;
+						parent_node->tag = node->tag;
+						parent_node->index = node->index + node->chunk->hash_offset + graph.start_index;
+						parent_node->dependency = &itr->second;
+						parent_to_enqueue = parent_node.get();
+						outstanding_parent_pipelines++;
+					}
+
+					if (!itr->second.compiled)
+					{
+						itr->second.waiters.push_back(node);
+						node->pending_dependencies.fetch_add(1, std::memory_order_relaxed);
+					}
+					else if (!itr->second.valid)
+						node->missing_parent = true;
+				}
+			}
+		}
+
+		for (Hash module : modules_to_enqueue)
+			enqueue_shader_module(module);
+
+		if (parent_to_enqueue)
+		{
+			PipelineWorkItem work_item;
+			work_item.index = parent_to_enqueue->index;
+			work_item.hash = parent_to_enqueue->hash;
+			work_item.tag = parent_to_enqueue->tag;
+			work_item.parse_only = true;
+			work_item.force_outside_range = true;
+			work_item.memory_context_index = PARENT_PIPELINE_MEMORY_CONTEXT;
+			work_item.node = parent_to_enqueue;
+			enqueue_work_item(work_item);
+		}
+
+		release_pipeline_dependency(node);
+	}
+
+	void notify_pipeline_parsed(PipelineNode *node)
+	{
+		if (node->tag == RESOURCE_GRAPHICS_PIPELINE)
+			notify_pipeline_parsed(graphics_graph, node);
+		else
+			notify_pipeline_parsed(compute_graph, node);
+	}
+
+	void notify_pipeline_compiled(PipelineNode *node)
+	{
+		if (node->tag == RESOURCE_GRAPHICS_PIPELINE)
+			complete_pipeline(graphics_graph, node, true);
+		else
+			complete_pipeline(compute_graph, node, true);
+	}
+
+	void notify_shader_module_ready(Hash hash)
+	{
+		vector<PipelineNode *> waiters;
+		{
+			lock_guard<mutex> holder(replay_graph_mutex);
+			auto &dep = shader_module_dependencies[hash];
+			dep.ready = true;
+			swap(waiters, dep.waiters);
+		}
+
+		for (auto *node : waiters)
+			release_pipeline_dependency(node);
+	}
+
+	template <typename DerivedInfo>
+	void submit_pipeline(ReplayGraph<DerivedInfo> &graph, PipelineNode *node)
+	{
+		auto deferred = get_deferred_info(graph, node);
+		unsigned memory_index;
+		unsigned index;
+
+		if (node->chunk)
+		{
+			memory_index = node->chunk->memory_context_index;
+			index = node->index + node->chunk->hash_offset + graph.start_index;
+		}
+		else
+		{
+			memory_index = PARENT_PIPELINE_MEMORY_CONTEXT;
+			index = node->index;
+			lock_guard<mutex> holder(hash_lock);
+			graph.parents->erase(node->hash);
+		}
+
+		if (node->missing_parent)
+		{
+			LOGE("Pipeline %016" PRIx64 " was not compiled because its parent pipeline does not exist.\n", node->hash);
+			if (opts.control_block)
+			{
+				if (node->tag == RESOURCE_GRAPHICS_PIPELINE)
+					opts.control_block->skipped_graphics.fetch_add(1, std::memory_order_relaxed);
+				else if (node->tag == RESOURCE_COMPUTE_PIPELINE)
+					opts.control_block->skipped_compute.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			complete_pipeline(graph, node, false);
+			return;
+		}
+
+		resolve_shader_modules(deferred.info);
+		if ((deferred.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
+		{
+			// The parent has been compiled by now, but it might have failed.
+			lock_guard<mutex> holder(internal_enqueue_mutex);
+			auto itr = graph.pipelines->find((Hash) deferred.info->basePipelineHandle);
+			deferred.info->basePipelineHandle = itr != end(*graph.pipelines) ? itr->second : VK_NULL_HANDLE;
+		}
+
+		enqueue_pipeline(deferred.hash, deferred.info, deferred.pipeline, index, memory_index, node);
+	}
+
+	template <typename DerivedInfo>
+	void complete_pipeline(ReplayGraph<DerivedInfo> &graph, PipelineNode *node, bool valid)
+	{
+		ReplayChunk *chunk = node->chunk;
+		vector<PipelineNode *> waiters;
+		{
+			lock_guard<mutex> holder(replay_graph_mutex);
+			auto &dep = *node->dependency;
+			dep.compiled = true;
+			dep.valid = valid;
+			swap(waiters, dep.waiters);
+			if (!valid)
+				for (auto *waiter : waiters)
+					waiter->missing_parent = true;
+
+			for (Hash module : node->shader_modules)
+			{
+				auto itr = shader_module_dependencies.find(module);
+				assert(itr != end(shader_module_dependencies) && itr->second.users != 0);
+				itr->second.users--;
+			}
+			vector<Hash>().swap(node->shader_modules);
+
+			if (chunk)
+			{
+				chunk->completed[node->index] = true;
+				update_completed_pipelines(*chunk);
+			}
+			else
+			{
+				graph.parent_nodes.erase(node->hash);
+
+				// No parent pipelines are in flight, so nothing references parent pipeline memory anymore.
+				if (--outstanding_parent_pipelines == 0)
+					for (auto &data : per_thread_data)
+						if (data.per_thread_replayers)
+							data.per_thread_replayers[PARENT_PIPELINE_MEMORY_CONTEXT].get_allocator().reset();
+			}
+		}
+
+		for (auto *waiter : waiters)
+			release_pipeline_dependency(waiter);
+
+		if (chunk)
+			release_replay_chunk(*chunk);
+	}
+
+	// Advances past the pipelines which are done. With a shared work queue, the claim of the chunk's memory context
+	// is trimmed to what is left, so that if this process crashes, the restarted one picks up everything else.
+	// Must be called with replay_graph_mutex held.
+	void update_completed_pipelines(ReplayChunk &chunk)
+	{
+		unsigned count = chunk.completed_count.load(std::memory_order_relaxed);
+		while (count < chunk.count && chunk.completed[count])
+			count++;
+		chunk.completed_count.store(count, std::memory_order_release);
+
+		if (opts.work_queue)
+		{
+			auto &claimed = opts.work_queue->get_claims(opts.process_index)[chunk.memory_context_index];
+			auto &range = chunk.tag == RESOURCE_GRAPHICS_PIPELINE ? claimed.graphics : claimed.compute;
+			range.store(SharedWorkQueue::pack_range(chunk.hash_offset + count, chunk.hash_offset + chunk.count),
+			            std::memory_order_relaxed);
+		}
+	}
+
+	template <typename DerivedInfo>
+	unsigned get_resume_index(const ReplayGraph<DerivedInfo> &graph, unsigned start_index) const
+	{
+		// Replay has not started yet.
+		if (graph.chunks.empty())
+			return start_index;
+
+		for (auto &chunk : graph.chunks)
+		{
+			unsigned count = chunk->completed_count.load(std::memory_order_acquire);
+			if (count < chunk->count)
+				return graph.start_index + chunk->hash_offset + count;
+		}
+
+		return graph.start_index + unsigned(graph.hashes->size());
+	}
+
+	// The first pipeline of a type in this process' range which is not done, while every pipeline before it is.
+	// Called from crash handlers, so it only reads atomics. With a shared work queue, the claims keep track instead.
+	unsigned get_resume_index(ResourceTag tag) const
+	{
+		if (opts.work_queue)
+			return 0;
+		else if (tag == RESOURCE_GRAPHICS_PIPELINE)
+			return get_resume_index(graphics_graph, opts.start_graphics_index);
+		else
+			return get_resume_index(compute_graph, opts.start_compute_index);
+	}
+
+	template <typename DerivedInfo>
+	void init_replay_graph(ReplayGraph<DerivedInfo> &graph, const vector<Hash> &hashes, unsigned start_index)
+	{
+		graph.hashes = &hashes;
+		graph.start_index = start_index;
+		graph.chunks.clear();
+		graph.dependencies.reserve(hashes.size());
+		lock_guard<mutex> holder(internal_enqueue_mutex);
+		graph.pipelines->reserve(hashes.size());
+	}
+
+	template <typename DerivedInfo>
+	ReplayChunk *add_replay_chunk(ReplayGraph<DerivedInfo> &graph, unsigned hash_offset, unsigned count)
+	{
+		unique_ptr<ReplayChunk> chunk(new ReplayChunk);
+		chunk->tag = DerivedInfo::get_tag();
+		chunk->hash_offset = hash_offset;
+		chunk->count = count;
+		graph.chunks.push_back(move(chunk));
+		return graph.chunks.back().get();
+	}
+
+	template <typename DerivedInfo>
+	void build_replay_chunks(ReplayGraph<DerivedInfo> &graph, const vector<Hash> &hashes, unsigned start_index)
+	{
+		init_replay_graph(graph, hashes, start_index);
+		for (unsigned hash_offset = 0; hash_offset < hashes.size(); hash_offset += NUM_PIPELINES_PER_CHUNK)
+			add_replay_chunk(graph, hash_offset, min<unsigned>(unsigned(hashes.size()) - hash_offset, NUM_PIPELINES_PER_CHUNK));
+	}
+
+	ReplayChunk *add_claimed_replay_chunk(ResourceTag tag, uint32_t begin, uint32_t end, unsigned memory_index)
+	{
+		ReplayChunk *chunk;
+		if (tag == RESOURCE_GRAPHICS_PIPELINE)
+		{
+			end = min<uint32_t>(end, uint32_t(graphics_graph.hashes->size()));
+			if (begin >= end)
+				return nullptr;
+			chunk = add_replay_chunk(graphics_graph, begin, end - begin);
+		}
+		else
+		{
+			end = min<uint32_t>(end, uint32_t(compute_graph.hashes->size()));
+			if (begin >= end)
+				return nullptr;
+			chunk = add_replay_chunk(compute_graph, begin, end - begin);
+		}
+
+		chunk->memory_context_index = memory_index;
+		remaining_replay_chunks.fetch_add(1, std::memory_order_relaxed);
+		return chunk;
+	}
+
+	// Takes the next batch from the shared work queue for a pipeline memory context which just became free.
+	// Must be called with replay_graph_mutex held.
+	ReplayChunk *claim_replay_chunk(unsigned memory_index)
+	{
+		auto &queue = *opts.work_queue;
+		auto &claimed = queue.get_claims(opts.process_index)[memory_index];
+
+		// The batch this context replayed last is complete.
+		claimed.graphics.store(0, std::memory_order_relaxed);
+		claimed.compute.store(0, std::memory_order_relaxed);
+
+		// Claim whichever pipeline type has the larger fraction left, so neither waits behind the other.
+		uint64_t graphics_total = queue.end_graphics_index;
+		uint64_t compute_total = queue.end_compute_index;
+		ResourceTag first = RESOURCE_GRAPHICS_PIPELINE;
+		ResourceTag second = RESOURCE_COMPUTE_PIPELINE;
+		if (queue.get_remaining(RESOURCE_GRAPHICS_PIPELINE) * compute_total <
+		    queue.get_remaining(RESOURCE_COMPUTE_PIPELINE) * graphics_total)
+		{
+			swap(first, second);
+		}
+
+		for (auto tag : { first, second })
+		{
+			uint32_t begin, end;
+			while (queue.claim(tag, claimed, begin, end))
+				if (auto *chunk = add_claimed_replay_chunk(tag, begin, end, memory_index))
+					return chunk;
+		}
+
+		return nullptr;
+	}
+
+	// Picks up a batch which a crashed process left behind in our claims.
+	// Must be called with replay_graph_mutex held.
+	ReplayChunk *adopt_replay_chunk(unsigned memory_index)
+	{
+		auto &claimed = opts.work_queue->get_claims(opts.process_index)[memory_index];
+		uint32_t begin, end;
+
+		SharedWorkQueue::unpack_range(claimed.graphics.load(std::memory_order_relaxed), begin, end);
+		if (auto *chunk = add_claimed_replay_chunk(RESOURCE_GRAPHICS_PIPELINE, begin, end, memory_index))
+			return chunk;
+
+		SharedWorkQueue::unpack_range(claimed.compute.load(std::memory_order_relaxed), begin, end);
+		return add_claimed_replay_chunk(RESOURCE_COMPUTE_PIPELINE, begin, end, memory_index);
+	}
+
+	// Starts replaying graphics and compute pipelines in the background. Call wait_replay_pipelines() to finish.
+	void begin_replay_pipelines(const vector<Hash> &graphics_hashes, unsigned graphics_start_index,
+	                            const vector<Hash> &compute_hashes, unsigned compute_start_index)
+	{
+		if (opts.work_queue)
+		{
+			begin_replay_pipelines_from_queue(graphics_hashes, compute_hashes);
+			return;
+		}
+
+		build_replay_chunks(graphics_graph, graphics_hashes, graphics_start_index);
+		build_replay_chunks(compute_graph, compute_hashes, compute_start_index);
+
+		// Interleave graphics and compute chunks in proportion to their counts, so neither workload
+		// waits behind the other, and both share the same pipeline memory contexts.
+		size_t graphics_count = graphics_graph.chunks.size();
+		size_t compute_count = compute_graph.chunks.size();
+		size_t graphics_index = 0;
+		size_t compute_index = 0;
+
+		replay_schedule.clear();
+		while (graphics_index < graphics_count || compute_index < compute_count)
+		{
+			if (compute_index == compute_count ||
+			    (graphics_index < graphics_count && graphics_index * compute_count <= compute_index * graphics_count))
+			{
+				replay_schedule.push_back(graphics_graph.chunks[graphics_index++].get());
+			}
+			else
+				replay_schedule.push_back(compute_graph.chunks[compute_index++].get());
+		}
+
+		remaining_replay_chunks.store(unsigned(replay_schedule.size()));
+		next_replay_chunk = 0;
+
+		// Kick off one chunk per pipeline memory context. Whenever a chunk completes, it starts the next one.
+		vector<ReplayChunk *> initial_chunks;
+		{
+			lock_guard<mutex> holder(replay_graph_mutex);
+			while (next_replay_chunk < replay_schedule.size() && next_replay_chunk < NUM_PIPELINE_MEMORY_CONTEXTS)
+			{
+				auto *chunk = replay_schedule[next_replay_chunk];
+				chunk->memory_context_index = next_replay_chunk++;
+				initial_chunks.push_back(chunk);
+			}
+		}
+
+		for (auto *chunk : initial_chunks)
+			start_replay_chunk(*chunk);
+	}
+
+	// Chunks are claimed from the shared work queue as pipeline memory contexts become free.
+	// The hash lists cover the whole database, since claims use database indices.
+	void begin_replay_pipelines_from_queue(const vector<Hash> &graphics_hashes, const vector<Hash> &compute_hashes)
+	{
+		init_replay_graph(graphics_graph, graphics_hashes, 0);
+		init_replay_graph(compute_graph, compute_hashes, 0);
+		replay_schedule.clear();
+		next_replay_chunk = 0;
+		remaining_replay_chunks.store(0);
+
+		vector<ReplayChunk *> initial_chunks;
+		{
+			lock_guard<mutex> holder(replay_graph_mutex);
+			for (unsigned i = 0; i < NUM_PIPELINE_MEMORY_CONTEXTS; i++)
+			{
+				auto *chunk = adopt_replay_chunk(i);
+				if (!chunk)
+					chunk = claim_replay_chunk(i);
+				if (chunk)
+					initial_chunks.push_back(chunk);
+			}
+		}
+
+		for (auto *chunk : initial_chunks)
+			start_replay_chunk(*chunk);
+	}
+
+	void wait_replay_pipelines()
+	{
+		unique_lock<mutex> lock(work_done_mutex);
+		wait_for_worker_progress(lock, replay_graph_condition, [&]() -> bool {
+			return remaining_replay_chunks.load(std::memory_order_acquire) == 0;
+		});
+	}
+
+	void sync_threads() override
+	{
+		sync_worker_threads();
+	}
+
+	// Support ignoring shader module which are known to cause crashes.
+	void mask_shader_module(Hash hash)
+	{
+		masked_shader_modules.insert(hash);
+	}
+
+	const vector<thread> &get_threads() const
+	{
+		return thread_pool;
+	}
+
+	void emergency_teardown()
+	{
+#ifdef SIMULATE_UNSTABLE_DRIVER
+		spurious_deadlock();
+#endif
+		flush_pipeline_cache(false);
+		flush_validation_cache();
+		if (validation_whitelist_db)
+			validation_whitelist_db->flush();
+		if (validation_blacklist_db)
+			validation_blacklist_db->flush();
+		device.reset();
+	}
+
+	Options opts;
+
+	std::unordered_map<Hash, VkSampler> samplers;
+	std::unordered_map<Hash, VkDescriptorSetLayout> layouts;
+	std::unordered_map<Hash, VkPipelineLayout> pipeline_layouts;
+
+	ObjectCache<VkShaderModule> shader_modules;
+
+	std::unordered_map<Hash, VkRenderPass> render_passes;
+	std::unordered_map<Hash, VkPipeline> compute_pipelines;
+	std::unordered_map<Hash, VkPipeline> graphics_pipelines;
+	std::unordered_set<Hash> masked_shader_modules;
+	std::unordered_map<VkShaderModule, Hash> shader_module_to_hash;
+	VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+	VkValidationCacheEXT validation_cache = VK_NULL_HANDLE;
+
+	// VALVE: multi-threaded work queue for replayer
+
+	// Work is dealt out round-robin to per-worker queues, and workers which run dry steal from the others.
+	// Items are always taken from the front, so work still starts roughly in submission order,
+	// which crash recovery relies on when it resumes from the index of a failed pipeline.
+	struct WorkQueue
+	{
+		std::mutex lock;
+		std::deque<PipelineWorkItem> items;
+		// Mirrors items.size(), so workers looking for work can skip empty queues without locking them.
+		std::atomic<unsigned> count;
+	};
+
+	// Workers resolving dependencies push to their own queue, the main thread deals out round-robin.
+	void enqueue_work_item(const PipelineWorkItem &item)
+	{
+		queued_count[item.memory_context_index].fetch_add(1, std::memory_order_relaxed);
+
+		unsigned queue_index;
+		if (Global::worker_thread_index != 0)
+			queue_index = Global::worker_thread_index - 1;
+		else
+		{
+			queue_index = next_work_queue;
+			next_work_queue = (next_work_queue + 1) % work_queues.size();
+		}
+
+		auto &queue = *work_queues[queue_index];
+		{
+			lock_guard<mutex> lock(queue.lock);
+			queue.items.push_back(item);
+			queue.count.store(unsigned(queue.items.size()), std::memory_order_relaxed);
+			pending_work_items.fetch_add(1);
+		}
+
+		// Pairs with the sleeping worker checking pending_work_items after announcing itself.
+		if (sleeping_worker_threads.load() != 0)
+		{
+			lock_guard<mutex> lock(worker_sleep_mutex);
+			work_available_condition.notify_one();
+		}
+	}
+
+	// Items are counted after they are pushed and claimed before they are popped,
+	// so a worker which claims one is guaranteed to find an item in some queue.
+	// Workers which fail to claim go to sleep without touching any queue.
+	bool claim_work_item()
+	{
+		unsigned count = pending_work_items.load(std::memory_order_relaxed);
+		while (count != 0)
+			if (pending_work_items.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+				return true;
+		return false;
+	}
+
+	bool pop_work_item(unsigned thread_index, PipelineWorkItem &item)
+	{
+		if (!claim_work_item())
+			return false;
+
+		// Look at our own queue first, then steal from the neighbours.
+		// Another claiming worker may take the item we would have found first, so keep going round until one turns up.
+		size_t count = work_queues.size();
+		for (size_t i = 0; ; i++)
+		{
+			auto &queue = *work_queues[(thread_index - 1 + i) % count];
+			if (queue.count.load(std::memory_order_relaxed) == 0)
+				continue;
+
+			lock_guard<mutex> lock(queue.lock);
+			if (!queue.items.empty())
+			{
+				item = queue.items.front();
+				queue.items.pop_front();
+				queue.count.store(unsigned(queue.items.size()), std::memory_order_relaxed);
+				return true;
+			}
+		}
+	}
+
+	bool acquire_work_item(unsigned thread_index, PipelineWorkItem &item)
+	{
+		for (;;)
+		{
+			if (shutting_down.load(std::memory_order_relaxed))
+				return false;
+			if (pop_work_item(thread_index, item))
+				return true;
+
+			unique_lock<mutex> lock(worker_sleep_mutex);
+			sleeping_worker_threads.fetch_add(1);
+			work_available_condition.wait(lock, [&]() -> bool {
+				return shutting_down.load(std::memory_order_relaxed) || pending_work_items.load() != 0;
+			});
+			sleeping_worker_threads.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	unsigned num_worker_threads = 0;
+	unsigned loop_count = 0;
+
+	std::atomic<unsigned> queued_count[NUM_MEMORY_CONTEXTS];
+	std::atomic<unsigned> completed_count[NUM_MEMORY_CONTEXTS];
+	unsigned thread_initialized_count = 0;
+	std::mutex work_done_mutex;
+	std::condition_variable work_done_condition[NUM_MEMORY_CONTEXTS];
+
+	std::vector<std::unique_ptr<WorkQueue>> work_queues;
+	unsigned next_work_queue = 0;
+	std::atomic<unsigned> pending_work_items;
+	std::atomic<unsigned> sleeping_worker_threads;
+	std::mutex worker_sleep_mutex;
+	std::condition_variable work_available_condition;
+
+	std::vector<std::thread> thread_pool;
+	std::vector<PerThreadData> per_thread_data;
+	std::mutex internal_enqueue_mutex;
+
+	std::mutex pipeline_stats_queue_mutex;
+	std::unique_ptr<DatabaseInterface> pipeline_stats_db;
+
+	std::mutex validation_db_mutex;
+	std::unique_ptr<DatabaseInterface> validation_whitelist_db;
+	std::unique_ptr<DatabaseInterface> validation_blacklist_db;
+
+	std::mutex hash_lock;
+	std::unordered_map<Hash, DeferredGraphicsInfo> graphics_parents;
+	std::unordered_map<Hash, DeferredComputeInfo> compute_parents;
+	std::vector<DeferredGraphicsInfo> deferred_graphics[NUM_MEMORY_CONTEXTS];
+	std::vector<DeferredComputeInfo> deferred_compute[NUM_MEMORY_CONTEXTS];
+
+	// Lock order is replay_graph_mutex, then internal_enqueue_mutex.
+	std::mutex replay_graph_mutex;
+	std::condition_variable replay_graph_condition;
+	ReplayGraph<DeferredGraphicsInfo> graphics_graph;
+	ReplayGraph<DeferredComputeInfo> compute_graph;
+	std::unordered_map<Hash, ShaderModuleDependency> shader_module_dependencies;
+	std::vector<ReplayChunk *> replay_schedule;
+	unsigned next_replay_chunk = 0;
+	std::atomic<unsigned> remaining_replay_chunks;
+	std::atomic<unsigned> completed_replay_chunks;
+	unsigned outstanding_parent_pipelines = 0;
+
+	// Feed statistics from the worker threads.
+	std::atomic<std::uint64_t> graphics_pipeline_ns;
+	std::atomic<std::uint64_t> compute_pipeline_ns;
+	std::atomic<std::uint64_t> shader_module_ns;
+	std::atomic<std::uint64_t> total_idle_ns;
+	std::atomic<std::uint64_t> thread_total_ns;
+	std::atomic<std::uint32_t> graphics_pipeline_count;
+	std::atomic<std::uint32_t> compute_pipeline_count;
+	std::atomic<std::uint32_t> shader_module_count;
+	std::atomic<std::uint32_t> shader_module_evicted_count;
+	std::atomic<std::uint32_t> resumed_pipeline_count;
+	std::atomic<std::uint32_t> pipeline_cache_hits;
+	std::atomic<std::uint32_t> pipeline_cache_misses;
+
+	std::atomic<std::uint64_t> shader_module_total_size;
+	std::atomic<std::uint64_t> shader_module_total_compressed_size;
+
+	// Only measured with --benchmark-frontend.
+	std::atomic<std::uint64_t> blob_read_ns;
+	std::atomic<std::uint64_t> blob_read_size;
+	std::atomic<std::uint64_t> blob_decompressed_size;
+	std::atomic<std::uint64_t> pipeline_parse_ns;
+	std::atomic<std::uint64_t> shader_module_parse_ns;
+	std::atomic<std::uint32_t> pipeline_parse_count;
+	std::atomic<std::uint32_t> shader_module_parse_count;
+
+	std::atomic<size_t> total_peak_memory;
+
+	std::atomic<bool> shutting_down;
+
+	unique_ptr<VulkanDevice> device;
+	bool device_was_init = false;
+	VulkanDevice::Options device_opts;
+
+	// Crash recovery.
+	bool robustness = false;
+
+	const StateReplayer *global_replayer = nullptr;
+	DatabaseInterface *global_database = nullptr;
+	const PipelineDependencyIndex *dependency_index = nullptr;
+
+	ProgressJournal progress_journal;
+	std::mutex progress_checkpoint_lock;
+};
+
+static void on_validation_error(void *userdata)
+{
 	auto *replayer = static_cast<ThreadedReplayer *>(userdata);
 
-	auto &per_thread = replayer->get_per_thread_data();
-	per_thread.triggered_validation_error = true;
+	auto &per_thread = replayer->get_per_thread_data();
+	per_thread.triggered_validation_error = true;
+
+	if (per_thread.current_graphics_pipeline)
+		replayer->blacklist_resource(RESOURCE_GRAPHICS_PIPELINE, per_thread.current_graphics_pipeline);
+	if (per_thread.current_compute_pipeline)
+		replayer->blacklist_resource(RESOURCE_COMPUTE_PIPELINE, per_thread.current_compute_pipeline);
+
+	if (replayer->opts.on_validation_error_callback)
+		replayer->opts.on_validation_error_callback(replayer);
+}
+
+static void print_help()
+{
+#ifndef NO_ROBUST_REPLAYER
+#ifdef _WIN32
+#define EXTRA_OPTIONS \
+	"\t[--slave-process]\n" \
+	"\t[--master-process]\n" \
+	"\t[--timeout <seconds>]\n" \
+	"\t[--progress]\n" \
+	"\t[--quiet-slave]\n" \
+	"\t[--shm-name <name>]\n\t[--shm-mutex-name <name>]\n" \
+	"\t[--split-ranges <processes> <graphics start> <graphics end> <compute start> <compute end>]\n"
+#else
+#define EXTRA_OPTIONS \
+	"\t[--slave-process]\n" \
+	"\t[--master-process]\n" \
+	"\t[--timeout <seconds>]\n" \
+	"\t[--progress]\n" \
+	"\t[--quiet-slave]\n" \
+	"\t[--static-process-ranges]\n" \
+	"\t[--shm-fd <fd>]\n"
+#endif
+#else
+#define EXTRA_OPTIONS ""
+#endif
+	LOGI("fossilize-replay\n"
+	     "\t[--help]\n"
+	     "\t[--device-index <index>]\n"
+	     "\t[--enable-validation]\n"
+	     "\t[--enable-pipeline-stats <path>]\n"
+	     "\t[--pipeline-cache]\n"
+	     "\t[--spirv-val]\n"
+	     "\t[--num-threads <count>]\n"
+	     "\t[--loop <count>]\n"
+	     "\t[--on-disk-pipeline-cache <path>]\n"
+	     "\t[--on-disk-validation-cache <path>]\n"
+	     "\t[--on-disk-validation-whitelist <path>]\n"
+	     "\t[--on-disk-validation-blacklist <path>]\n"
+	     "\t[--pipeline-hash <hash>]\n"
+	     "\t[--graphics-pipeline-range <start> <end>]\n"
+	     "\t[--compute-pipeline-range <start> <end>]\n"
+	     "\t[--shader-cache-size <value (MiB)>]\n"
+	     "\t[--ignore-derived-pipelines]\n"
+	     "\t[--log-memory]\n"
+	     "\t[--null-device]\n"
+	     "\t[--timeout-seconds]\n"
+	     "\t[--write-pipeline-feedback <path>]\n"
+	     "\t[--order-by-cost <path>]\n"
+	     "\t[--cluster-shader-modules]\n"
+	     "\t[--progress-journal <path>]\n"
+	     "\t[--resume]\n"
+	     "\t[--skip-replayed <path>]\n"
+	     "\t[--benchmark-frontend]\n"
+	     EXTRA_OPTIONS
+	     "\t<Database>\n");
+}
+
+#ifndef NO_ROBUST_REPLAYER
+static void log_progress(const ExternalReplayer::Progress &progress)
+{
+	LOGI("=================\n");
+	LOGI(" Progress report:\n");
+	LOGI("   Parsed graphics %u / %u\n", progress.graphics.parsed, progress.graphics.total);
+	LOGI("   Parsed compute %u / %u\n", progress.compute.parsed, progress.compute.total);
+	LOGI("   Decompress modules %u / %u, skipped %u, failed validation %u\n",
+	     progress.completed_modules, progress.total_modules, progress.banned_modules, progress.module_validation_failures);
+	LOGI("   Compile graphics %u / %u, skipped %u\n", progress.graphics.completed, progress.graphics.total, progress.graphics.skipped);
+	LOGI("   Compile compute %u / %u, skipped %u\n", progress.compute.completed, progress.compute.total, progress.compute.skipped);
+	LOGI("   Clean crashes %u\n", progress.clean_crashes);
+	LOGI("   Dirty crashes %u\n", progress.dirty_crashes);
+	LOGI("=================\n");
+}
+
+static void log_faulty_modules(ExternalReplayer &replayer)
+{
+	size_t count;
+	if (!replayer.get_faulty_spirv_modules(&count, nullptr))
+		return;
+	vector<Hash> hashes(count);
+	if (!replayer.get_faulty_spirv_modules(&count, hashes.data()))
+		return;
+
+	sort(begin(hashes), end(hashes));
+
+	for (auto &h : hashes)
+		LOGI("Detected faulty SPIR-V module: %016" PRIx64 "\n", h);
+}
+
+static void log_faulty_graphics(ExternalReplayer &replayer)
+{
+	size_t count;
+	if (!replayer.get_graphics_failed_validation(&count, nullptr))
+		return;
+	vector<Hash> hashes(count);
+	if (!replayer.get_graphics_failed_validation(&count, hashes.data()))
+		return;
+
+	sort(begin(hashes), end(hashes));
+
+	for (auto &h : hashes)
+	{
+		LOGI("Graphics pipeline failed validation: %016" PRIx64 "\n", h);
+
+		// Ad-hoc hack to test automatic pruning ideas ...
+		//printf("--skip-graphics %016llx ", static_cast<unsigned long long>(h));
+	}
+
+	vector<unsigned> indices;
+	if (!replayer.get_faulty_graphics_pipelines(&count, nullptr, nullptr))
+		return;
+	indices.resize(count);
+	hashes.resize(count);
+	if (!replayer.get_faulty_graphics_pipelines(&count, indices.data(), hashes.data()))
+		return;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		LOGI("Graphics pipeline crashed or hung: %016" PRIx64 ". Repro with: --graphics-pipeline-range %u %u\n",
+		     hashes[i], indices[i], indices[i] + 1);
+	}
+}
+
+static void log_faulty_compute(ExternalReplayer &replayer)
+{
+	size_t count;
+	if (!replayer.get_compute_failed_validation(&count, nullptr))
+		return;
+	vector<Hash> hashes(count);
+	if (!replayer.get_compute_failed_validation(&count, hashes.data()))
+		return;
+
+	sort(begin(hashes), end(hashes));
+
+	for (auto &h : hashes)
+	{
+		LOGI("Compute pipeline failed validation: %016" PRIx64 "\n", h);
+
+		// Ad-hoc hack to test automatic pruning ideas ...
+		//printf("--skip-compute %016llx ", static_cast<unsigned long long>(h));
+	}
+
+	vector<unsigned> indices;
+	if (!replayer.get_faulty_compute_pipelines(&count, nullptr, nullptr))
+		return;
+	indices.resize(count);
+	hashes.resize(count);
+	if (!replayer.get_faulty_compute_pipelines(&count, indices.data(), hashes.data()))
+		return;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		LOGI("Compute pipeline crashed or hung: %016" PRIx64 ". Repro with: --compute-pipeline-range %u %u\n",
+		     hashes[i], indices[i], indices[i] + 1);
+	}
+}
+
+static int run_progress_process(const VulkanDevice::Options &device_opts,
+                                const ThreadedReplayer::Options &replayer_opts,
+                                const vector<const char *> &databases, int timeout)
+{
+	ExternalReplayer::Options opts = {};
+	opts.on_disk_pipeline_cache = replayer_opts.on_disk_pipeline_cache_path.empty() ?
+	                              nullptr : replayer_opts.on_disk_pipeline_cache_path.c_str();
+	opts.on_disk_validation_cache = replayer_opts.on_disk_validation_cache_path.empty() ?
+	                                nullptr : replayer_opts.on_disk_validation_cache_path.c_str();
+	opts.on_disk_validation_whitelist = replayer_opts.on_disk_validation_whitelist_path.empty() ?
+	                                    nullptr : replayer_opts.on_disk_validation_whitelist_path.c_str();
+	opts.on_disk_validation_blacklist = replayer_opts.on_disk_validation_blacklist_path.empty() ?
+	                                    nullptr : replayer_opts.on_disk_validation_blacklist_path.c_str();
+	opts.pipeline_stats_path = replayer_opts.pipeline_stats_path.empty() ?
+	                           nullptr : replayer_opts.pipeline_stats_path.c_str();
+	opts.pipeline_cache = replayer_opts.pipeline_cache;
+	opts.num_threads = replayer_opts.num_threads;
+	opts.quiet = true;
+	opts.databases = databases.data();
+	opts.num_databases = databases.size();
+	opts.external_replayer_path = nullptr;
+	opts.inherit_process_group = true;
+	opts.spirv_validate = replayer_opts.spirv_validate;
+	opts.device_index = device_opts.device_index;
+	opts.enable_validation = device_opts.enable_validation;
+	opts.ignore_derived_pipelines = replayer_opts.ignore_derived_pipelines;
+	opts.null_device = device_opts.null_device;
+	opts.start_graphics_index = replayer_opts.start_graphics_index;
+	opts.end_graphics_index = replayer_opts.end_graphics_index;
+	opts.start_compute_index = replayer_opts.start_compute_index;
+	opts.end_compute_index = replayer_opts.end_compute_index;
+	opts.use_pipeline_range =
+			(replayer_opts.start_graphics_index != 0) ||
+			(replayer_opts.end_graphics_index != ~0u) ||
+			(replayer_opts.start_compute_index != 0) ||
+			(replayer_opts.end_compute_index != ~0u);
+	opts.timeout_seconds = replayer_opts.timeout_seconds;
+
+	ExternalReplayer replayer;
+	if (!replayer.start(opts))
+	{
+		LOGE("Failed to start external replayer.\n");
+		return EXIT_FAILURE;
+	}
+
+	bool has_killed = false;
+	auto start_time = std::chrono::steady_clock::now();
+
+	for (;;)
+	{
+		if (!has_killed && timeout > 0)
+		{
+			auto current_time = std::chrono::steady_clock::now();
+			auto delta = current_time - start_time;
+			if (std::chrono::duration_cast<std::chrono::seconds>(delta).count() >= timeout)
+			{
+				LOGE("Killing process due to timeout.\n");
+				replayer.kill();
+				has_killed = true;
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		ExternalReplayer::Progress progress = {};
 
-	if (per_thread.current_graphics_pipeline)
-		replayer->blacklist_resource(RESOURCE_GRAPHICS_PIPELINE, per_thread.current_graphics_pipeline);
-	if (per_thread.current_compute_pipeline)
-		replayer->blacklist_resource(RESOURCE_COMPUTE_PIPELINE, per_thread.current_compute_pipeline);
+		if (replayer.is_process_complete(nullptr))
+		{
+			auto result = replayer.poll_progress(progress);
+			if (result != ExternalReplayer::PollResult::ResultNotReady)
+				log_progress(progress);
+			log_faulty_modules(replayer);
+			log_faulty_graphics(replayer);
+			log_faulty_compute(replayer);
+			return replayer.wait();
+		}
 
-	if (replayer->opts.on_validation_error_callback)
-		replayer->opts.on_validation_error_callback(replayer);
+		auto result = replayer.poll_progress(progress);
+
+		switch (result)
+		{
+		case ExternalReplayer::PollResult::Error:
+			return EXIT_FAILURE;
+
+		case ExternalReplayer::PollResult::ResultNotReady:
+			break;
+
+		case ExternalReplayer::PollResult::Complete:
+		case ExternalReplayer::PollResult::Running:
+			log_progress(progress);
+			if (result == ExternalReplayer::PollResult::Complete)
+			{
+				log_faulty_modules(replayer);
+				log_faulty_graphics(replayer);
+				log_faulty_compute(replayer);
+				return replayer.wait();
+			}
+			break;
+		}
+	}
 }
 
-static void print_help()
-{
-#ifndef NO_ROBUST_REPLAYER
-#ifdef _WIN32
-#define EXTRA_OPTIONS \
-	"\t[--slave-process]\n" \
-	"\t[--master-process]\n" \
-	"\t[--timeout <seconds>]\n" \
-	"\t[--progress]\n" \
-	"\t[--quiet-slave]\n" \
-	"\t[--shm-name <name>]\n\t[--shm-mutex-name <name>]\n"
-#else
-#define EXTRA_OPTIONS \
-	"\t[--slave-process]\n" \
-	"\t[--master-process]\n" \
-	"\t[--timeout <seconds>]\n" \
-	"\t[--progress]\n" \
-	"\t[--quiet-slave]\n" \
-	"\t[--shm-fd <fd>]\n"
-#endif
-#else
-#define EXTRA_OPTIONS ""
+static void log_process_memory();
 #endif
-	LOGI("fossilize-replay\n"
-	     "\t[--help]\n"
-	     "\t[--device-index <index>]\n"
-	     "\t[--enable-validation]\n"
-	     "\t[--enable-pipeline-stats <path>]\n"
-	     "\t[--pipeline-cache]\n"
-	     "\t[--spirv-val]\n"
-	     "\t[--num-threads <count>]\n"
-	     "\t[--loop <count>]\n"
-	     "\t[--on-disk-pipeline-cache <path>]\n"
-	     "\t[--on-disk-validation-cache <path>]\n"
-	     "\t[--on-disk-validation-whitelist <path>]\n"
-	     "\t[--on-disk-validation-blacklist <path>]\n"
-	     "\t[--pipeline-hash <hash>]\n"
-	     "\t[--graphics-pipeline-range <start> <end>]\n"
-	     "\t[--compute-pipeline-range <start> <end>]\n"
-	     "\t[--shader-cache-size <value (MiB)>]\n"
-	     "\t[--ignore-derived-pipelines]\n"
-	     "\t[--log-memory]\n"
-	     "\t[--null-device]\n"
-	     "\t[--timeout-seconds]\n"
-	     EXTRA_OPTIONS
-	     "\t<Database>\n");
-}
 
-#ifndef NO_ROBUST_REPLAYER
-static void log_progress(const ExternalReplayer::Progress &progress)
+static bool parse_json_stats(const std::string &foz_path, rapidjson::Document &doc)
 {
-	LOGI("=================\n");
-	LOGI(" Progress report:\n");
-	LOGI("   Parsed graphics %u / %u\n", progress.graphics.parsed, progress.graphics.total);
-	LOGI("   Parsed compute %u / %u\n", progress.compute.parsed, progress.compute.total);
-	LOGI("   Decompress modules %u / %u, skipped %u, failed validation %u\n",
-	     progress.completed_modules, progress.total_modules, progress.banned_modules, progress.module_validation_failures);
-	LOGI("   Compile graphics %u / %u, skipped %u\n", progress.graphics.completed, progress.graphics.total, progress.graphics.skipped);
-	LOGI("   Compile compute %u / %u, skipped %u\n", progress.compute.completed, progress.compute.total, progress.compute.skipped);
-	LOGI("   Clean crashes %u\n", progress.clean_crashes);
-	LOGI("   Dirty crashes %u\n", progress.dirty_crashes);
-	LOGI("=================\n");
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(foz_path.c_str(), DatabaseMode::ReadOnly));
+	if (!db)
+		return false;
+	if (!db->prepare())
+		return false;
+
+	static const ResourceTag stat_tags[] = {
+		RESOURCE_GRAPHICS_PIPELINE,
+		RESOURCE_COMPUTE_PIPELINE,
+	};
+
+	doc.SetArray();
+
+	std::vector<char> json_buffer;
+
+	for (auto &tag : stat_tags)
+	{
+		size_t num_hashes = 0;
+		if (!db->get_hash_list_for_resource_tag(tag, &num_hashes, nullptr))
+			return false;
+		std::vector<Hash> hashes(num_hashes);
+		if (!db->get_hash_list_for_resource_tag(tag, &num_hashes, hashes.data()))
+			return false;
+
+		for (auto &hash : hashes)
+		{
+			rapidjson::Document tmp_doc;
+			size_t json_size = 0;
+			if (!db->read_entry(tag, hash, &json_size, nullptr, 0))
+				continue;
+			json_buffer.resize(json_size);
+			if (!db->read_entry(tag, hash, &json_size, json_buffer.data(), 0))
+				continue;
+			json_buffer.push_back('\0');
+
+			tmp_doc.Parse(rapidjson::StringRef(json_buffer.data()));
+			if (tmp_doc.HasParseError())
+				continue;
+
+			rapidjson::Value v;
+			v.CopyFrom(tmp_doc, doc.GetAllocator());
+			doc.PushBack(v, doc.GetAllocator());
+		}
+	}
+
+	return true;
 }
 
-static void log_faulty_modules(ExternalReplayer &replayer)
+static void stats_to_csv(const std::string &stats_path, rapidjson::Document &doc)
 {
-	size_t count;
-	if (!replayer.get_faulty_spirv_modules(&count, nullptr))
-		return;
-	vector<Hash> hashes(count);
-	if (!replayer.get_faulty_spirv_modules(&count, hashes.data()))
+	std::vector<std::string> header;
+	std::unordered_map<std::string, size_t> columns;
+	std::vector<std::map<size_t, std::string>> rows;
+
+	header.push_back("Database");
+	header.push_back("Pipeline type");
+	header.push_back("Pipeline hash");
+	header.push_back("Executable name");
+
+	for (auto itr = doc.Begin(); itr != doc.End(); itr++)
+	{
+		std::map<size_t, std::string> row;
+
+		auto &st = *itr;
+
+		row[0] = st["db_path"].GetString();
+		row[1] = st["pipeline_type"].GetString();
+		row[2] = st["pipeline"].GetString();
+
+		auto &execs = st["executables"];
+		for (auto e_itr = execs.Begin(); e_itr != execs.End(); e_itr++)
+		{
+			auto &exec = *e_itr;
+			row[3] = exec["executable_name"].GetString();
+			for (auto st_itr = exec["stats"].Begin(); st_itr != exec["stats"].End(); st_itr++)
+			{
+				auto &stat = *st_itr;
+				std::string key = stat["name"].GetString();
+				size_t insert_at;
+
+				auto col = columns.find(key);
+				if (col == columns.end())
+				{
+					insert_at = header.size();
+					columns[key] = insert_at;
+					header.push_back(key);
+				}
+				else
+				{
+					insert_at = col->second;
+				}
+
+				row[insert_at] = stat["value"].GetString();
+			}
+
+			rows.push_back(row);
+		}
+	}
+
+	FILE *fp = fopen(stats_path.c_str(), "w");
+	if (!fp)
 		return;
 
-	sort(begin(hashes), end(hashes));
+	size_t colnumber = 0;
+	for (auto &h : header)
+		fprintf(fp, "%s%s", h.c_str(), ++colnumber < header.size() ? "," : "\n");
+
+	for (auto &r : rows)
+	{
+		colnumber = 0;
+		for (size_t i = 0; i < header.size(); i++)
+		{
+			auto col = r.find(i);
+			fprintf(fp, "%s%s", col == r.end() ? "" : col->second.c_str(), ++colnumber < header.size() ? "," : "\n");
+		}
+	}
+
+	fclose(fp);
+}
+
+#ifndef NO_ROBUST_REPLAYER
+static void dump_stats(const std::string &stats_path, const std::vector<std::string> &foz_paths)
+{
+	rapidjson::Document doc;
+	doc.SetArray();
+	auto &alloc = doc.GetAllocator();
+
+	for (auto &sp : foz_paths)
+	{
+		rapidjson::Document tmp_doc;
+		if (!parse_json_stats(sp, tmp_doc))
+			continue;
+
+		doc.Reserve(doc.Size() + tmp_doc.Size(), alloc);
+		for (auto itr = tmp_doc.Begin(); itr != tmp_doc.End(); itr++)
+		{
+			rapidjson::Value v;
+			v.CopyFrom(*itr, alloc);
+			doc.PushBack(v, alloc);
+		}
+		remove(sp.c_str());
+	}
 
-	for (auto &h : hashes)
-		LOGI("Detected faulty SPIR-V module: %016" PRIx64 "\n", h);
+	stats_to_csv(stats_path, doc);
 }
+#endif
 
-static void log_faulty_graphics(ExternalReplayer &replayer)
+static void dump_stats(const std::string &stats_path)
 {
-	size_t count;
-	if (!replayer.get_graphics_failed_validation(&count, nullptr))
-		return;
-	vector<Hash> hashes(count);
-	if (!replayer.get_graphics_failed_validation(&count, hashes.data()))
+	rapidjson::Document doc;
+	auto foz_path = stats_path + ".__tmp.foz";
+
+	if (!parse_json_stats(foz_path, doc))
 		return;
+	stats_to_csv(stats_path, doc);
+	remove(foz_path.c_str());
+}
 
-	sort(begin(hashes), end(hashes));
+#ifndef NO_ROBUST_REPLAYER
+static void install_trivial_crash_handlers(ThreadedReplayer &replayer);
+#endif
 
-	for (auto &h : hashes)
+struct PipelineCostCollector : StateCreatorInterface
+{
+	unordered_map<Hash, PipelineFeedback> graphics_feedback;
+	unordered_map<Hash, PipelineFeedback> compute_feedback;
+
+	void notify_pipeline_feedback(const PipelineFeedback &info) override
 	{
-		LOGI("Graphics pipeline failed validation: %016" PRIx64 "\n", h);
+		if (info.tag == RESOURCE_GRAPHICS_PIPELINE)
+			merge_pipeline_feedback(graphics_feedback[info.hash], info);
+		else if (info.tag == RESOURCE_COMPUTE_PIPELINE)
+			merge_pipeline_feedback(compute_feedback[info.hash], info);
+	}
 
-		// Ad-hoc hack to test automatic pruning ideas ...
-		//printf("--skip-graphics %016llx ", static_cast<unsigned long long>(h));
+	bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override { return true; }
+	bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override { return true; }
+	bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override { return true; }
+	bool enqueue_create_shader_module(Hash, const VkShaderModuleCreateInfo *, VkShaderModule *) override { return true; }
+	bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override { return true; }
+	bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *, VkPipeline *) override { return true; }
+	bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *) override { return true; }
+
+	const unordered_map<Hash, PipelineFeedback> &get_feedback(ResourceTag tag) const
+	{
+		return tag == RESOURCE_GRAPHICS_PIPELINE ? graphics_feedback : compute_feedback;
 	}
+};
 
-	vector<unsigned> indices;
-	if (!replayer.get_faulty_graphics_pipelines(&count, nullptr, nullptr))
-		return;
-	indices.resize(count);
-	hashes.resize(count);
-	if (!replayer.get_faulty_graphics_pipelines(&count, indices.data(), hashes.data()))
-		return;
+static bool load_pipeline_costs(const vector<string> &paths, PipelineCostCollector &collector)
+{
+	StateReplayer replayer;
+	vector<Hash> hashes;
+	vector<uint8_t> blob;
 
-	for (unsigned i = 0; i < count; i++)
+	for (auto &path : paths)
 	{
-		LOGI("Graphics pipeline crashed or hung: %016" PRIx64 ". Repro with: --graphics-pipeline-range %u %u\n",
-		     hashes[i], indices[i], indices[i] + 1);
+		unique_ptr<DatabaseInterface> db(create_database(path.c_str(), DatabaseMode::ReadOnly));
+		if (!db || !db->prepare())
+		{
+			LOGE("Failed to open pipeline costs in %s.\n", path.c_str());
+			return false;
+		}
+
+		size_t hash_count = 0;
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_PIPELINE_FEEDBACK, &hash_count, nullptr))
+			return false;
+		hashes.resize(hash_count);
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_PIPELINE_FEEDBACK, &hash_count, hashes.data()))
+			return false;
+
+		for (auto hash : hashes)
+		{
+			size_t blob_size = 0;
+			if (!db->read_entry(RESOURCE_PIPELINE_FEEDBACK, hash, &blob_size, nullptr, 0))
+				return false;
+			blob.resize(blob_size);
+			if (!db->read_entry(RESOURCE_PIPELINE_FEEDBACK, hash, &blob_size, blob.data(), 0))
+				return false;
+			if (!replayer.parse(collector, nullptr, blob.data(), blob.size()))
+				return false;
+		}
 	}
+
+	return true;
 }
 
-static void log_faulty_compute(ExternalReplayer &replayer)
+static bool load_pipeline_dependency_index(DatabaseInterface &db, PipelineDependencyIndex &index)
 {
-	size_t count;
-	if (!replayer.get_compute_failed_validation(&count, nullptr))
-		return;
-	vector<Hash> hashes(count);
-	if (!replayer.get_compute_failed_validation(&count, hashes.data()))
-		return;
+	StateReplayer replayer;
+	vector<uint8_t> blob;
 
-	sort(begin(hashes), end(hashes));
+	size_t hash_count = 0;
+	if (!db.get_hash_list_for_resource_tag(RESOURCE_PIPELINE_DEPENDENCIES, &hash_count, nullptr))
+		return false;
+	vector<Hash> hashes(hash_count);
+	if (!db.get_hash_list_for_resource_tag(RESOURCE_PIPELINE_DEPENDENCIES, &hash_count, hashes.data()))
+		return false;
 
-	for (auto &h : hashes)
+	for (auto hash : hashes)
 	{
-		LOGI("Compute pipeline failed validation: %016" PRIx64 "\n", h);
-
-		// Ad-hoc hack to test automatic pruning ideas ...
-		//printf("--skip-compute %016llx ", static_cast<unsigned long long>(h));
+		size_t blob_size = 0;
+		if (!db.read_entry(RESOURCE_PIPELINE_DEPENDENCIES, hash, &blob_size, nullptr, 0))
+			return false;
+		blob.resize(blob_size);
+		if (!db.read_entry(RESOURCE_PIPELINE_DEPENDENCIES, hash, &blob_size, blob.data(), 0))
+			return false;
+		if (!replayer.parse(index, nullptr, blob.data(), blob.size()))
+			return false;
 	}
 
-	vector<unsigned> indices;
-	if (!replayer.get_faulty_compute_pipelines(&count, nullptr, nullptr))
-		return;
-	indices.resize(count);
-	hashes.resize(count);
-	if (!replayer.get_faulty_compute_pipelines(&count, indices.data(), hashes.data()))
-		return;
+	return true;
+}
 
-	for (unsigned i = 0; i < count; i++)
+// Pipelines which have been replayed before, e.g. from an earlier version of the same archive.
+struct ReplayedPipelineSet
+{
+	unordered_set<Hash> graphics;
+	unordered_set<Hash> compute;
+
+	const unordered_set<Hash> &get(ResourceTag tag) const
 	{
-		LOGI("Compute pipeline crashed or hung: %016" PRIx64 ". Repro with: --compute-pipeline-range %u %u\n",
-		     hashes[i], indices[i], indices[i] + 1);
+		return tag == RESOURCE_GRAPHICS_PIPELINE ? graphics : compute;
 	}
-}
 
-static int run_progress_process(const VulkanDevice::Options &device_opts,
-                                const ThreadedReplayer::Options &replayer_opts,
-                                const vector<const char *> &databases, int timeout)
+	bool empty() const
+	{
+		return graphics.empty() && compute.empty();
+	}
+};
+
+// A hash list has one hexadecimal hash per line, as printed by fossilize-list. Other lines are ignored.
+// The list does not say which type of pipeline a hash belongs to, so it applies to both.
+// An empty list is valid and skips nothing.
+static bool load_replayed_hash_list(const string &path, ReplayedPipelineSet &replayed)
 {
-	ExternalReplayer::Options opts = {};
-	opts.on_disk_pipeline_cache = replayer_opts.on_disk_pipeline_cache_path.empty() ?
-	                              nullptr : replayer_opts.on_disk_pipeline_cache_path.c_str();
-	opts.on_disk_validation_cache = replayer_opts.on_disk_validation_cache_path.empty() ?
-	                                nullptr : replayer_opts.on_disk_validation_cache_path.c_str();
-	opts.on_disk_validation_whitelist = replayer_opts.on_disk_validation_whitelist_path.empty() ?
-	                                    nullptr : replayer_opts.on_disk_validation_whitelist_path.c_str();
-	opts.on_disk_validation_blacklist = replayer_opts.on_disk_validation_blacklist_path.empty() ?
-	                                    nullptr : replayer_opts.on_disk_validation_blacklist_path.c_str();
-	opts.pipeline_stats_path = replayer_opts.pipeline_stats_path.empty() ?
-	                           nullptr : replayer_opts.pipeline_stats_path.c_str();
-	opts.pipeline_cache = replayer_opts.pipeline_cache;
-	opts.num_threads = replayer_opts.num_threads;
-	opts.quiet = true;
-	opts.databases = databases.data();
-	opts.num_databases = databases.size();
-	opts.external_replayer_path = nullptr;
-	opts.inherit_process_group = true;
-	opts.spirv_validate = replayer_opts.spirv_validate;
-	opts.device_index = device_opts.device_index;
-	opts.enable_validation = device_opts.enable_validation;
-	opts.ignore_derived_pipelines = replayer_opts.ignore_derived_pipelines;
-	opts.null_device = device_opts.null_device;
-	opts.start_graphics_index = replayer_opts.start_graphics_index;
-	opts.end_graphics_index = replayer_opts.end_graphics_index;
-	opts.start_compute_index = replayer_opts.start_compute_index;
-	opts.end_compute_index = replayer_opts.end_compute_index;
-	opts.use_pipeline_range =
-			(replayer_opts.start_graphics_index != 0) ||
-			(replayer_opts.end_graphics_index != ~0u) ||
-			(replayer_opts.start_compute_index != 0) ||
-			(replayer_opts.end_compute_index != ~0u);
-	opts.timeout_seconds = replayer_opts.timeout_seconds;
+	// load_buffer_from_file() cannot tell a missing file from an empty one.
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+	fclose(file);
 
-	ExternalReplayer replayer;
-	if (!replayer.start(opts))
+	auto buffer = load_buffer_from_file(path.c_str());
+	buffer.push_back('\0');
+
+	auto *line = reinterpret_cast<const char *>(buffer.data());
+	while (*line != '\0')
 	{
-		LOGE("Failed to start external replayer.\n");
-		return EXIT_FAILURE;
+		char *end_ptr = nullptr;
+		Hash hash = strtoull(line, &end_ptr, 16);
+		if (end_ptr - line == 16)
+		{
+			replayed.graphics.insert(hash);
+			replayed.compute.insert(hash);
+		}
+
+		line = strchr(line, '\n');
+		if (!line)
+			break;
+		line++;
 	}
 
-	bool has_killed = false;
-	auto start_time = std::chrono::steady_clock::now();
+	return true;
+}
 
-	for (;;)
+static bool load_replayed_pipelines(const vector<string> &paths, ReplayedPipelineSet &replayed)
+{
+	vector<Hash> hashes;
+
+	for (auto &path : paths)
 	{
-		if (!has_killed && timeout > 0)
+		if (Path::ext(path) == "txt")
 		{
-			auto current_time = std::chrono::steady_clock::now();
-			auto delta = current_time - start_time;
-			if (std::chrono::duration_cast<std::chrono::seconds>(delta).count() >= timeout)
+			if (!load_replayed_hash_list(path, replayed))
 			{
-				LOGE("Killing process due to timeout.\n");
-				replayer.kill();
-				has_killed = true;
+				LOGE("Failed to load replayed pipelines from %s.\n", path.c_str());
+				return false;
 			}
+			continue;
 		}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
-		ExternalReplayer::Progress progress = {};
+		unique_ptr<DatabaseInterface> db(create_database(path.c_str(), DatabaseMode::ReadOnly));
+		if (!db || !db->prepare())
+		{
+			LOGE("Failed to open replayed pipelines in %s.\n", path.c_str());
+			return false;
+		}
 
-		if (replayer.is_process_complete(nullptr))
+		for (auto tag : { RESOURCE_GRAPHICS_PIPELINE, RESOURCE_COMPUTE_PIPELINE })
 		{
-			auto result = replayer.poll_progress(progress);
-			if (result != ExternalReplayer::PollResult::ResultNotReady)
-				log_progress(progress);
-			log_faulty_modules(replayer);
-			log_faulty_graphics(replayer);
-			log_faulty_compute(replayer);
-			return replayer.wait();
+			size_t hash_count = 0;
+			if (!db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+				return false;
+			hashes.resize(hash_count);
+			if (!db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+				return false;
+
+			auto &set = tag == RESOURCE_GRAPHICS_PIPELINE ? replayed.graphics : replayed.compute;
+			set.insert(begin(hashes), end(hashes));
 		}
+	}
 
-		auto result = replayer.poll_progress(progress);
+	return true;
+}
 
-		switch (result)
-		{
-		case ExternalReplayer::PollResult::Error:
-			return EXIT_FAILURE;
+// Gets the pipelines of a type which remain to be replayed, in database order.
+// Pipeline ranges index into this list, so every process of a multi-process replay must build it the same way.
+static bool get_remaining_pipeline_hashes(DatabaseInterface &db, ResourceTag tag, const ReplayedPipelineSet &replayed,
+                                          vector<Hash> &hashes, unsigned *skipped_count = nullptr)
+{
+	size_t hash_count = 0;
+	if (!db.get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+		return false;
+	hashes.resize(hash_count);
+	if (!db.get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+		return false;
 
-		case ExternalReplayer::PollResult::ResultNotReady:
-			break;
+	auto &replayed_hashes = replayed.get(tag);
+	if (!replayed_hashes.empty())
+	{
+		hashes.erase(remove_if(begin(hashes), end(hashes), [&](Hash hash) {
+			return replayed_hashes.count(hash) != 0;
+		}), end(hashes));
+	}
 
-		case ExternalReplayer::PollResult::Complete:
-		case ExternalReplayer::PollResult::Running:
-			log_progress(progress);
-			if (result == ExternalReplayer::PollResult::Complete)
-			{
-				log_faulty_modules(replayer);
-				log_faulty_graphics(replayer);
-				log_faulty_compute(replayer);
-				return replayer.wait();
-			}
-			break;
+	if (skipped_count)
+		*skipped_count = unsigned(hash_count - hashes.size());
+	return true;
+}
+
+// Pipelines without recorded costs are assumed to cost as much as the average of those with costs.
+static uint64_t get_average_pipeline_cost(const unordered_map<Hash, PipelineFeedback> &feedback, const vector<Hash> &hashes,
+                                          unsigned *known_count)
+{
+	uint64_t total_cost = 0;
+	unsigned count = 0;
+	for (auto hash : hashes)
+	{
+		auto itr = feedback.find(hash);
+		if (itr != end(feedback) && itr->second.count != 0)
+		{
+			total_cost += itr->second.total_duration_ns / itr->second.count;
+			count++;
 		}
 	}
+
+	if (known_count)
+		*known_count = count;
+	return count ? total_cost / count : 0;
 }
 
-static void log_process_memory();
-#endif
+static uint64_t get_pipeline_cost(const unordered_map<Hash, PipelineFeedback> &feedback, Hash hash, uint64_t default_cost)
+{
+	auto itr = feedback.find(hash);
+	if (itr != end(feedback) && itr->second.count != 0)
+		return itr->second.total_duration_ns / itr->second.count;
+	else
+		return default_cost;
+}
 
-static bool parse_json_stats(const std::string &foz_path, rapidjson::Document &doc)
+// Longest job first. Pipeline indices refer to this order, so every process of a multi-process replay must sort
+// the full hash list the same way before carving out its range.
+static void sort_hashes_by_cost(vector<Hash> &hashes, const unordered_map<Hash, PipelineFeedback> &feedback,
+                                const char *tag_name)
 {
-	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(foz_path.c_str(), DatabaseMode::ReadOnly));
-	if (!db)
-		return false;
-	if (!db->prepare())
-		return false;
+	unsigned known_count = 0;
+	uint64_t average_cost = get_average_pipeline_cost(feedback, hashes, &known_count);
+	LOGI("Ordering %s by cost, %u of %u pipelines have recorded costs.\n",
+	     tag_name, known_count, unsigned(hashes.size()));
+
+	vector<pair<uint64_t, Hash>> costs;
+	costs.reserve(hashes.size());
+	for (auto hash : hashes)
+		costs.push_back({ get_pipeline_cost(feedback, hash, average_cost), hash });
+
+	// The hash list is sorted, so equally expensive pipelines keep a deterministic order.
+	stable_sort(begin(costs), end(costs), [](const pair<uint64_t, Hash> &a, const pair<uint64_t, Hash> &b) {
+		return a.first > b.first;
+	});
 
-	static const ResourceTag stat_tags[] = {
-		RESOURCE_GRAPHICS_PIPELINE,
-		RESOURCE_COMPUTE_PIPELINE,
-	};
+	for (size_t i = 0; i < costs.size(); i++)
+		hashes[i] = costs[i].second;
+}
 
-	doc.SetArray();
+// A master process hands out [start, end) in contiguous ranges, the same way as here.
+// Deal the cost ordered pipelines round robin into those ranges, so every child starts with its share
+// of the expensive pipelines rather than the first child getting all of them.
+static void interleave_hashes_for_split(vector<Hash> &hashes, unsigned start, unsigned end, unsigned processes)
+{
+	end = min(end, unsigned(hashes.size()));
+	start = min(start, end);
+	unsigned count = end - start;
+
+	vector<Hash> dealt(count);
+	unsigned dealt_count = 0;
+	for (unsigned round = 0; dealt_count < count; round++)
+	{
+		for (unsigned i = 0; i < processes && dealt_count < count; i++)
+		{
+			unsigned range_start = (i * count) / processes;
+			unsigned range_end = ((i + 1) * count) / processes;
+			if (round < range_end - range_start)
+				dealt[range_start + round] = hashes[start + dealt_count++];
+		}
+	}
+
+	copy(dealt.begin(), dealt.end(), hashes.begin() + start);
+}
+
+// Records the shader modules of the pipeline which was parsed last, in stage order.
+// Shader module handles are not resolved, so they hold the module hashes.
+struct ShaderModuleUsageCollector : StateCreatorInterface
+{
+	vector<Hash> modules;
+
+	bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *) override
+	{
+		modules.push_back((Hash) create_info->stage.module);
+		return true;
+	}
+
+	bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *) override
+	{
+		for (uint32_t i = 0; i < create_info->stageCount; i++)
+			modules.push_back((Hash) create_info->pStages[i].module);
+		return true;
+	}
+
+	// Static objects are only parsed through this when nothing has been replayed, and pipelines only need
+	// to look up a non-null handle, so the hashes will do.
+	bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *, VkSampler *sampler) override
+	{
+		*sampler = (VkSampler) hash;
+		return true;
+	}
+
+	bool enqueue_create_descriptor_set_layout(Hash hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *layout) override
+	{
+		*layout = (VkDescriptorSetLayout) hash;
+		return true;
+	}
+
+	bool enqueue_create_pipeline_layout(Hash hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *layout) override
+	{
+		*layout = (VkPipelineLayout) hash;
+		return true;
+	}
+
+	bool enqueue_create_render_pass(Hash hash, const VkRenderPassCreateInfo *, VkRenderPass *render_pass) override
+	{
+		*render_pass = (VkRenderPass) hash;
+		return true;
+	}
+
+	bool enqueue_create_shader_module(Hash, const VkShaderModuleCreateInfo *, VkShaderModule *) override { return true; }
+};
 
-	std::vector<char> json_buffer;
+// Counts shader modules which would have to be created again after being evicted, if the pipelines are replayed in this order.
+// Like the replayer, the cache is pruned to its target size after every NUM_PIPELINE_MEMORY_CONTEXTS chunks.
+// Chunks which run concurrently are not modelled, so this is an estimate.
+static unsigned estimate_shader_module_recreations(const vector<const vector<Hash> *> &pipeline_modules,
+                                                   const unordered_map<Hash, size_t> &module_sizes,
+                                                   size_t target_size)
+{
+	list<Hash> lru;
+	unordered_map<Hash, list<Hash>::iterator> cached;
+	unordered_set<Hash> created;
+	size_t total_size = 0;
+	unsigned recreations = 0;
 
-	for (auto &tag : stat_tags)
+	for (size_t i = 0; i < pipeline_modules.size(); i++)
 	{
-		size_t num_hashes = 0;
-		if (!db->get_hash_list_for_resource_tag(tag, &num_hashes, nullptr))
-			return false;
-		std::vector<Hash> hashes(num_hashes);
-		if (!db->get_hash_list_for_resource_tag(tag, &num_hashes, hashes.data()))
-			return false;
-
-		for (auto &hash : hashes)
+		for (Hash module : *pipeline_modules[i])
 		{
-			rapidjson::Document tmp_doc;
-			size_t json_size = 0;
-			if (!db->read_entry(tag, hash, &json_size, nullptr, 0))
-				continue;
-			json_buffer.resize(json_size);
-			if (!db->read_entry(tag, hash, &json_size, json_buffer.data(), 0))
+			auto itr = cached.find(module);
+			if (itr != end(cached))
+			{
+				lru.splice(begin(lru), lru, itr->second);
 				continue;
-			json_buffer.push_back('\0');
+			}
 
-			tmp_doc.Parse(rapidjson::StringRef(json_buffer.data()));
-			if (tmp_doc.HasParseError())
-				continue;
+			if (!created.insert(module).second)
+				recreations++;
+			lru.push_front(module);
+			cached[module] = begin(lru);
+			total_size += module_sizes.find(module)->second;
+		}
 
-			rapidjson::Value v;
-			v.CopyFrom(tmp_doc, doc.GetAllocator());
-			doc.PushBack(v, doc.GetAllocator());
+		if ((i + 1) % (NUM_PIPELINES_PER_CHUNK * NUM_PIPELINE_MEMORY_CONTEXTS) == 0)
+		{
+			while (total_size > target_size && !lru.empty())
+			{
+				total_size -= module_sizes.find(lru.back())->second;
+				cached.erase(lru.back());
+				lru.pop_back();
+			}
 		}
 	}
 
-	return true;
+	return recreations;
 }
 
-static void stats_to_csv(const std::string &stats_path, rapidjson::Document &doc)
+// Sorts pipelines by their shader modules in stage order, so pipelines which share modules end up in the same chunk,
+// and the chunk can reuse the modules from the cache.
+// Pipelines which are in the dependency index do not have to be parsed.
+static bool cluster_hashes_by_shader_modules(vector<Hash> &hashes, ResourceTag tag, const char *tag_name,
+                                             DatabaseInterface &db, const StateReplayer &static_replayer,
+                                             const PipelineDependencyIndex &dependency_index,
+                                             size_t shader_cache_size)
 {
-	std::vector<std::string> header;
-	std::unordered_map<std::string, size_t> columns;
-	std::vector<std::map<size_t, std::string>> rows;
+	if (hashes.empty())
+		return true;
 
-	header.push_back("Database");
-	header.push_back("Pipeline type");
-	header.push_back("Pipeline hash");
-	header.push_back("Executable name");
+	auto start_time = chrono::steady_clock::now();
+	StateReplayer replayer;
+	replayer.set_resolve_derivative_pipeline_handles(false);
+	replayer.set_resolve_shader_module_handles(false);
+	replayer.copy_handle_references(static_replayer);
+
+	ShaderModuleUsageCollector collector;
+	vector<vector<Hash>> modules(hashes.size());
+	unordered_map<Hash, size_t> module_sizes;
+	vector<uint8_t> state_json;
+	unsigned parsed_count = 0;
 
-	for (auto itr = doc.Begin(); itr != doc.End(); itr++)
+	for (size_t i = 0; i < hashes.size(); i++)
 	{
-		std::map<size_t, std::string> row;
-
-		auto &st = *itr;
-
-		row[0] = st["db_path"].GetString();
-		row[1] = st["pipeline_type"].GetString();
-		row[2] = st["pipeline"].GetString();
-
-		auto &execs = st["executables"];
-		for (auto e_itr = execs.Begin(); e_itr != execs.End(); e_itr++)
+		auto *indexed_modules = dependency_index.find_modules(tag, hashes[i]);
+		if (indexed_modules)
+			modules[i] = *indexed_modules;
+		else
 		{
-			auto &exec = *e_itr;
-			row[3] = exec["executable_name"].GetString();
-			for (auto st_itr = exec["stats"].Begin(); st_itr != exec["stats"].End(); st_itr++)
-			{
-				auto &stat = *st_itr;
-				std::string key = stat["name"].GetString();
-				size_t insert_at;
+			size_t state_json_size = 0;
+			if (!db.read_entry(tag, hashes[i], &state_json_size, nullptr, PAYLOAD_READ_NO_FLAGS))
+				return false;
+			state_json.resize(state_json_size);
+			if (!db.read_entry(tag, hashes[i], &state_json_size, state_json.data(), PAYLOAD_READ_NO_FLAGS))
+				return false;
 
-				auto col = columns.find(key);
-				if (col == columns.end())
-				{
-					insert_at = header.size();
-					columns[key] = insert_at;
-					header.push_back(key);
-				}
-				else
-				{
-					insert_at = col->second;
-				}
+			// Pipelines which fail to parse will fail in replay as well. Where they end up does not matter.
+			collector.modules.clear();
+			if (replayer.parse(collector, &db, state_json.data(), state_json.size()))
+				modules[i] = collector.modules;
+			replayer.get_allocator().reset();
+			parsed_count++;
+		}
 
-				row[insert_at] = stat["value"].GetString();
-			}
+		for (Hash module : modules[i])
+		{
+			if (module_sizes.count(module))
+				continue;
 
-			rows.push_back(row);
+			size_t module_size = 0;
+			if (!db.read_entry(RESOURCE_SHADER_MODULE, module, &module_size, nullptr, PAYLOAD_READ_NO_FLAGS))
+				module_size = 0;
+			module_sizes[module] = module_size;
 		}
 	}
 
-	FILE *fp = fopen(stats_path.c_str(), "w");
-	if (!fp)
-		return;
+	vector<unsigned> order(hashes.size());
+	vector<const vector<Hash> *> ordered_modules(hashes.size());
+	for (unsigned i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+		ordered_modules[i] = &modules[i];
+	}
 
-	size_t colnumber = 0;
-	for (auto &h : header)
-		fprintf(fp, "%s%s", h.c_str(), ++colnumber < header.size() ? "," : "\n");
+	unsigned database_order_recreations =
+			estimate_shader_module_recreations(ordered_modules, module_sizes, shader_cache_size);
 
-	for (auto &r : rows)
+	stable_sort(begin(order), end(order), [&](unsigned a, unsigned b) {
+		return modules[a] < modules[b];
+	});
+
+	vector<Hash> clustered_hashes(hashes.size());
+	for (size_t i = 0; i < order.size(); i++)
 	{
-		colnumber = 0;
-		for (size_t i = 0; i < header.size(); i++)
-		{
-			auto col = r.find(i);
-			fprintf(fp, "%s%s", col == r.end() ? "" : col->second.c_str(), ++colnumber < header.size() ? "," : "\n");
-		}
+		clustered_hashes[i] = hashes[order[i]];
+		ordered_modules[i] = &modules[order[i]];
 	}
+	hashes = move(clustered_hashes);
 
-	fclose(fp);
+	unsigned clustered_recreations =
+			estimate_shader_module_recreations(ordered_modules, module_sizes, shader_cache_size);
+
+	auto duration = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_time).count();
+	LOGI("Clustered %s by shader modules in %.3f s (%u of %u pipelines parsed).\n",
+	     tag_name, 1e-9 * double(duration), parsed_count, unsigned(hashes.size()));
+	LOGI("  Estimated shader module re-creations: %u in database order, %u clustered (%d avoided).\n",
+	     database_order_recreations, clustered_recreations,
+	     int(database_order_recreations) - int(clustered_recreations));
+	return true;
 }
 
-#ifndef NO_ROBUST_REPLAYER
-static void dump_stats(const std::string &stats_path, const std::vector<std::string> &foz_paths)
+// Clusters the pipelines of both types up front, so the child processes of a master process can take the order as is
+// rather than each parsing every pipeline again.
+static bool cluster_hashes_for_child_processes(DatabaseInterface &db, vector<Hash> &graphics_hashes,
+                                               vector<Hash> &compute_hashes, size_t shader_cache_size)
 {
-	rapidjson::Document doc;
-	doc.SetArray();
-	auto &alloc = doc.GetAllocator();
+	PipelineDependencyIndex dependency_index;
+	if (!load_pipeline_dependency_index(db, dependency_index))
+	{
+		LOGE("Failed to load pipeline dependency index, ignoring it.\n");
+		dependency_index.graphics_modules.clear();
+		dependency_index.compute_modules.clear();
+	}
 
-	for (auto &sp : foz_paths)
+	// Nothing has been replayed, so parse the objects pipelines refer to without creating them.
+	StateReplayer static_replayer;
+	static_replayer.set_resolve_derivative_pipeline_handles(false);
+	static_replayer.set_resolve_shader_module_handles(false);
+	ShaderModuleUsageCollector collector;
+	vector<Hash> hashes;
+	vector<uint8_t> state_json;
+
+	static const ResourceTag static_tags[] = {
+		RESOURCE_SAMPLER,
+		RESOURCE_DESCRIPTOR_SET_LAYOUT,
+		RESOURCE_PIPELINE_LAYOUT,
+		RESOURCE_RENDER_PASS,
+	};
+
+	for (auto tag : static_tags)
 	{
-		rapidjson::Document tmp_doc;
-		if (!parse_json_stats(sp, tmp_doc))
-			continue;
+		size_t hash_count = 0;
+		if (!db.get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			return false;
+		hashes.resize(hash_count);
+		if (!db.get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+			return false;
 
-		doc.Reserve(doc.Size() + tmp_doc.Size(), alloc);
-		for (auto itr = tmp_doc.Begin(); itr != tmp_doc.End(); itr++)
+		for (auto hash : hashes)
 		{
-			rapidjson::Value v;
-			v.CopyFrom(*itr, alloc);
-			doc.PushBack(v, alloc);
+			size_t state_json_size = 0;
+			if (!db.read_entry(tag, hash, &state_json_size, nullptr, PAYLOAD_READ_NO_FLAGS))
+				return false;
+			state_json.resize(state_json_size);
+			if (!db.read_entry(tag, hash, &state_json_size, state_json.data(), PAYLOAD_READ_NO_FLAGS))
+				return false;
+
+			// Pipelines which use objects that fail to parse will fail in replay as well.
+			if (!static_replayer.parse(collector, &db, state_json.data(), state_json.size()))
+				LOGE("Failed to parse blob (tag: %d, hash: %016" PRIx64 ").\n", tag, hash);
 		}
-		remove(sp.c_str());
 	}
 
-	stats_to_csv(stats_path, doc);
+	return cluster_hashes_by_shader_modules(graphics_hashes, RESOURCE_GRAPHICS_PIPELINE, "Graphics Pipeline", db,
+	                                        static_replayer, dependency_index, shader_cache_size) &&
+	       cluster_hashes_by_shader_modules(compute_hashes, RESOURCE_COMPUTE_PIPELINE, "Compute Pipeline", db,
+	                                        static_replayer, dependency_index, shader_cache_size);
 }
-#endif
 
-static void dump_stats(const std::string &stats_path)
+// Longest job first list scheduling of the pipelines onto the worker threads.
+// This ignores parent pipelines and shader module creation, so it is a lower bound in practice.
+static double predict_pipeline_makespan(const PipelineCostCollector &collector,
+                                        const vector<Hash> &graphics_hashes, const vector<Hash> &compute_hashes,
+                                        unsigned num_threads)
 {
-	rapidjson::Document doc;
-	auto foz_path = stats_path + ".__tmp.foz";
+	vector<uint64_t> costs;
+	costs.reserve(graphics_hashes.size() + compute_hashes.size());
 
-	if (!parse_json_stats(foz_path, doc))
-		return;
-	stats_to_csv(stats_path, doc);
-	remove(foz_path.c_str());
-}
+	uint64_t average_cost = get_average_pipeline_cost(collector.graphics_feedback, graphics_hashes, nullptr);
+	for (auto hash : graphics_hashes)
+		costs.push_back(get_pipeline_cost(collector.graphics_feedback, hash, average_cost));
+	average_cost = get_average_pipeline_cost(collector.compute_feedback, compute_hashes, nullptr);
+	for (auto hash : compute_hashes)
+		costs.push_back(get_pipeline_cost(collector.compute_feedback, hash, average_cost));
 
-#ifndef NO_ROBUST_REPLAYER
-static void install_trivial_crash_handlers(ThreadedReplayer &replayer);
-#endif
+	sort(begin(costs), end(costs), [](uint64_t a, uint64_t b) { return a > b; });
+
+	vector<uint64_t> thread_loads(max(num_threads, 1u));
+	for (auto cost : costs)
+		*min_element(begin(thread_loads), end(thread_loads)) += cost;
+
+	return 1e-9 * double(*max_element(begin(thread_loads), end(thread_loads)));
+}
 
 static int run_normal_process(ThreadedReplayer &replayer, const vector<const char *> &databases)
 {
@@ -2663,6 +4434,9 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	auto start_create_archive = chrono::steady_clock::now();
 	auto resolver = create_database(databases);
 
+	if (!replayer.opts.progress_journal_path.empty() && !replayer.open_progress_journal())
+		return EXIT_FAILURE;
+
 	auto end_create_archive = chrono::steady_clock::now();
 
 	auto start_prepare = chrono::steady_clock::now();
@@ -2679,9 +4453,38 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	replayer.global_replayer = &state_replayer;
 	replayer.global_database = resolver.get();
 
+	PipelineDependencyIndex dependency_index;
+	if (!load_pipeline_dependency_index(*resolver, dependency_index))
+	{
+		LOGE("Failed to load pipeline dependency index, ignoring it.\n");
+		dependency_index.graphics_modules.clear();
+		dependency_index.compute_modules.clear();
+	}
+	else if (!dependency_index.empty())
+	{
+		LOGI("Loaded dependency index for %u graphics and %u compute pipelines.\n",
+		     unsigned(dependency_index.graphics_modules.size()), unsigned(dependency_index.compute_modules.size()));
+		replayer.dependency_index = &dependency_index;
+	}
+
 	vector<Hash> resource_hashes;
 	vector<uint8_t> state_json;
 
+	bool order_by_cost = !replayer.opts.pipeline_cost_paths.empty() && replayer.opts.pipeline_hash == 0;
+	PipelineCostCollector pipeline_costs;
+	if (order_by_cost && !load_pipeline_costs(replayer.opts.pipeline_cost_paths, pipeline_costs))
+	{
+		LOGE("Failed to load pipeline costs.\n");
+		return EXIT_FAILURE;
+	}
+
+	ReplayedPipelineSet replayed_pipelines;
+	if (!load_replayed_pipelines(replayer.opts.replayed_paths, replayed_pipelines))
+	{
+		LOGE("Failed to load replayed pipelines.\n");
+		return EXIT_FAILURE;
+	}
+
 	static const ResourceTag initial_playback_order[] = {
 		RESOURCE_APPLICATION_INFO, // This will create the device, etc.
 		RESOURCE_SAMPLER, // Trivial, run in main thread.
@@ -2810,25 +4613,27 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	{
 		for (auto &tag : threaded_playback_order)
 		{
-			size_t tag_total_size = 0;
-			size_t tag_total_size_compressed = 0;
-			size_t resource_hash_count = 0;
+			vector<Hash> *hashes = tag == RESOURCE_GRAPHICS_PIPELINE ? &graphics_hashes : &compute_hashes;
 
-			if (!resolver->get_hash_list_for_resource_tag(tag, &resource_hash_count, nullptr))
+			// Ranges and work queue batches refer to the pipelines which remain after skipping replayed ones.
+			unsigned skipped_count = 0;
+			if (!get_remaining_pipeline_hashes(*resolver, tag, replayed_pipelines, *hashes, &skipped_count))
 			{
 				LOGE("Failed to get list of resource hashes.\n");
 				return EXIT_FAILURE;
 			}
 
-			unsigned start_index = 0;
-			unsigned end_index = resource_hash_count;
+			if (!replayed_pipelines.empty())
+			{
+				LOGI("Skipping %u entries of %s which were replayed before, %u remain.\n",
+				     skipped_count, tag_names[tag], unsigned(hashes->size()));
+			}
 
-			vector<Hash> *hashes = nullptr;
+			unsigned start_index = 0;
+			unsigned end_index = hashes->size();
 
 			if (tag == RESOURCE_GRAPHICS_PIPELINE)
 			{
-				hashes = &graphics_hashes;
-
 				end_index = min(end_index, replayer.opts.end_graphics_index);
 				start_index = max(start_index, replayer.opts.start_graphics_index);
 				start_index = min(end_index, start_index);
@@ -2837,41 +4642,90 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 			}
 			else if (tag == RESOURCE_COMPUTE_PIPELINE)
 			{
-				hashes = &compute_hashes;
-
 				end_index = min(end_index, replayer.opts.end_compute_index);
 				start_index = max(start_index, replayer.opts.start_compute_index);
 				start_index = min(end_index, start_index);
 				compute_start_index = start_index;
 			}
 
-			assert(hashes);
-			hashes->resize(resource_hash_count);
+			auto *clustered_hashes = tag == RESOURCE_GRAPHICS_PIPELINE ?
+			                         replayer.opts.clustered_graphics_hashes : replayer.opts.clustered_compute_hashes;
 
-			if (!resolver->get_hash_list_for_resource_tag(tag, &resource_hash_count, hashes->data()))
+			if (replayer.opts.cluster_shader_modules && clustered_hashes)
 			{
-				LOGE("Failed to get list of resource hashes.\n");
+				// The master process skipped the same replayed pipelines, so this is the same set in clustered order.
+				*hashes = *clustered_hashes;
+			}
+			else if (replayer.opts.cluster_shader_modules &&
+			         !cluster_hashes_by_shader_modules(*hashes, tag, tag_names[tag], *resolver, state_replayer,
+			                                           dependency_index, replayer.shader_modules.get_target_size()))
+			{
+				LOGE("Failed to cluster pipelines by shader modules.\n");
 				return EXIT_FAILURE;
 			}
 
+			// Cost order takes precedence. Equally expensive pipelines stay clustered.
+			if (order_by_cost)
+				sort_hashes_by_cost(*hashes, pipeline_costs.get_feedback(tag), tag_names[tag]);
+
+			if (order_by_cost && replayer.opts.split_process_count > 1)
+			{
+				if (tag == RESOURCE_GRAPHICS_PIPELINE)
+				{
+					interleave_hashes_for_split(*hashes, replayer.opts.split_start_graphics_index,
+					                            replayer.opts.split_end_graphics_index,
+					                            replayer.opts.split_process_count);
+				}
+				else
+				{
+					interleave_hashes_for_split(*hashes, replayer.opts.split_start_compute_index,
+					                            replayer.opts.split_end_compute_index,
+					                            replayer.opts.split_process_count);
+				}
+			}
+
+			// Batches are claimed by database index, so keep the full list.
+			if (replayer.opts.work_queue)
+				continue;
+
 			move(begin(*hashes) + start_index, begin(*hashes) + end_index, begin(*hashes));
 			hashes->erase(begin(*hashes) + (end_index - start_index), end(*hashes));
+		}
+	}
+
+	// Done parsing static objects.
+	state_replayer.get_allocator().reset();
+
+	// With a shared work queue, we don't know up front which pipelines this process will end up replaying.
+	bool replays_fixed_range = !replayer.opts.work_queue;
+
+	double predicted_makespan = 0.0;
+	if (order_by_cost && replays_fixed_range)
+	{
+		predicted_makespan = predict_pipeline_makespan(pipeline_costs, graphics_hashes, compute_hashes,
+		                                               replayer.opts.num_threads);
+	}
+
+	auto start_replay_pipelines = chrono::steady_clock::now();
+	replayer.begin_replay_pipelines(graphics_hashes, graphics_start_index, compute_hashes, compute_start_index);
 
-			for (auto &hash : *hashes)
+	// Gather size statistics while the workers are busy replaying.
+	auto gather_size_statistics = [&]() -> bool {
+		for (auto &tag : threaded_playback_order)
+		{
+			size_t tag_total_size = 0;
+			size_t tag_total_size_compressed = 0;
+			auto &hashes = tag == RESOURCE_GRAPHICS_PIPELINE ? graphics_hashes : compute_hashes;
+
+			for (auto &hash : hashes)
 			{
 				size_t state_json_size = 0;
 				if (!resolver->read_entry(tag, hash, &state_json_size, nullptr, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
-				{
-					LOGE("Failed to load blob from cache.\n");
-					return EXIT_FAILURE;
-				}
+					return false;
 				tag_total_size_compressed += state_json_size;
 
 				if (!resolver->read_entry(tag, hash, &state_json_size, nullptr, 0))
-				{
-					LOGE("Failed to load blob from cache.\n");
-					return EXIT_FAILURE;
-				}
+					return false;
 				tag_total_size += state_json_size;
 			}
 
@@ -2879,36 +4733,37 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 			     uint64_t(tag_total_size),
 			     uint64_t(tag_total_size_compressed));
 		}
-	}
 
-	// Done parsing static objects.
-	state_replayer.get_allocator().reset();
+		return true;
+	};
 
-	vector<EnqueuedWork> graphics_workload;
-	vector<EnqueuedWork> compute_workload;
-	replayer.enqueue_deferred_pipelines(replayer.deferred_graphics, replayer.graphics_pipelines, replayer.graphics_parents,
-	                                    graphics_workload,
-	                                    graphics_hashes, graphics_start_index);
-	replayer.enqueue_deferred_pipelines(replayer.deferred_compute, replayer.compute_pipelines, replayer.compute_parents,
-	                                    compute_workload, compute_hashes,
-	                                    compute_start_index);
-
-	sort(begin(graphics_workload), end(graphics_workload), [](const EnqueuedWork &a, const EnqueuedWork &b) {
-		return a.order_index < b.order_index;
-	});
-	sort(begin(compute_workload), end(compute_workload), [](const EnqueuedWork &a, const EnqueuedWork &b) {
-		return a.order_index < b.order_index;
-	});
+	// Size statistics would compete with the workers for the archive, so the frontend benchmark skips them.
+	if (replayer.opts.pipeline_hash == 0 && replays_fixed_range && !replayer.opts.benchmark_frontend &&
+	    !gather_size_statistics())
+	{
+		LOGE("Failed to load blob from cache.\n");
+		// The workers reference the database and hash lists, so stop them before those go away.
+		replayer.tear_down_threads();
+		return EXIT_FAILURE;
+	}
 
-	for (auto &work : graphics_workload)
-		work.func();
-	for (auto &work : compute_workload)
-		work.func();
+	replayer.wait_replay_pipelines();
 
 	// VALVE: drain all outstanding pipeline compiles
 	replayer.sync_worker_threads();
 	replayer.tear_down_threads();
 
+	auto replay_pipelines_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_replay_pipelines).count();
+
+	if (order_by_cost && replays_fixed_range)
+	{
+		LOGI("Replaying pipelines took %.3f s, predicted %.3f s from recorded costs.\n",
+		     1e-9 * double(replay_pipelines_ns), predicted_makespan);
+	}
+
+	if (!replayer.opts.pipeline_feedback_output_path.empty() && !replayer.write_pipeline_feedback())
+		LOGE("Failed to write pipeline feedback to %s.\n", replayer.opts.pipeline_feedback_output_path.c_str());
+
 	LOGI("Total binary size for %s: %" PRIu64 " (%" PRIu64 " compressed)\n", tag_names[RESOURCE_SHADER_MODULE],
 	     uint64_t(replayer.shader_module_total_size.load()),
 	     uint64_t(replayer.shader_module_total_compressed_size.load()));
@@ -2929,7 +4784,7 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	LOGI("Opening archive took %ld ms:\n", elapsed_ms_read_archive);
 	LOGI("Parsing archive took %ld ms:\n", elapsed_ms_prepare);
 
-	if (replayer.opts.pipeline_cache && replayer.device->pipeline_feedback_enabled())
+	if (replayer.opts.pipeline_cache && replayer.device && replayer.device->pipeline_feedback_enabled())
 	{
 		LOGI("Pipeline cache hits reported: %u\n", replayer.pipeline_cache_hits.load());
 		LOGI("Pipeline cache misses reported: %u\n", replayer.pipeline_cache_misses.load());
@@ -2942,6 +4797,9 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	LOGI("Shader cache evicted %u shader modules in total\n",
 	     replayer.shader_module_evicted_count.load());
 
+	if (replayer.opts.resume_progress)
+		LOGI("Skipped %u pipelines which completed in an earlier run\n", replayer.resumed_pipeline_count.load());
+
 	LOGI("Playing back %u graphics pipelines took %.3f s (accumulated time)\n",
 	     replayer.graphics_pipeline_count.load(),
 	     replayer.graphics_pipeline_ns.load() * 1e-9);
@@ -2959,6 +4817,33 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	LOGI("Total peak memory consumption by parser: %.3f MB.\n",
 	     (replayer.total_peak_memory.load() + state_replayer.get_allocator().get_peak_memory_consumption()) * 1e-6);
 
+	if (replayer.opts.benchmark_frontend)
+	{
+		const auto per_second = [](uint64_t amount, uint64_t ns) -> double {
+			return ns ? 1e9 * double(amount) / double(ns) : 0.0;
+		};
+
+		uint64_t read_ns = replayer.blob_read_ns.load();
+		uint64_t thread_ns = replayer.thread_total_ns.load();
+		uint64_t busy_ns = thread_ns - min(thread_ns, replayer.total_idle_ns.load());
+		unsigned parsed_blobs = replayer.pipeline_parse_count.load() + replayer.shader_module_parse_count.load();
+
+		// Stage throughput is per worker thread, as stage times are accumulated over all workers.
+		LOGI("Frontend throughput per worker thread:\n");
+		LOGI("  read:              %9.1f MB/s (%.1f MB)\n",
+		     1e-6 * per_second(replayer.blob_read_size.load(), read_ns), 1e-6 * double(replayer.blob_read_size.load()));
+		LOGI("  decompressed:      %9.1f MB/s (%.1f MB)\n",
+		     1e-6 * per_second(replayer.blob_decompressed_size.load(), read_ns), 1e-6 * double(replayer.blob_decompressed_size.load()));
+		LOGI("  pipelines parsed:  %9.0f blobs/s (%u)\n",
+		     per_second(replayer.pipeline_parse_count.load(), replayer.pipeline_parse_ns.load()), replayer.pipeline_parse_count.load());
+		LOGI("  modules decoded:   %9.0f modules/s (%u)\n",
+		     per_second(replayer.shader_module_parse_count.load(), replayer.shader_module_parse_ns.load()), replayer.shader_module_parse_count.load());
+		LOGI("Frontend processed %u blobs in %.3f s, %.0f blobs/s.\n",
+		     parsed_blobs, 1e-9 * double(replay_pipelines_ns), per_second(parsed_blobs, replay_pipelines_ns));
+		LOGI("Worker utilization: %.1f %% over %u threads.\n",
+		     thread_ns ? 100.0 * double(busy_ns) / double(thread_ns) : 0.0, replayer.num_worker_threads);
+	}
+
 	LOGI("Replayed %lu objects in %ld ms:\n", total_size, elapsed_ms);
 	LOGI("  samplers:              %7lu\n", (unsigned long)replayer.samplers.size());
 	LOGI("  descriptor set layouts:%7lu\n", (unsigned long)replayer.layouts.size());
@@ -2970,6 +4855,19 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	return EXIT_SUCCESS;
 }
 
+// Child processes write feedback to <stem>.N.foz rather than <path>.N,
+// so the extension still tells readers like --order-by-cost and fossilize-list that it is an archive.
+static string get_child_pipeline_feedback_path(const string &path, unsigned index)
+{
+	if (index == 0)
+		return path;
+
+	auto ext = Path::ext(Path::basename(path));
+	if (ext.empty())
+		return path + "." + to_string(index);
+	return path.substr(0, path.size() - ext.size()) + to_string(index) + "." + ext;
+}
+
 // The implementations are drastically different.
 // To simplify build system, just include implementation inline here.
 #ifndef NO_ROBUST_REPLAYER
@@ -3000,6 +4898,7 @@ int main(int argc, char *argv[])
 	const char *shm_mutex_name = nullptr;
 #else
 	int shmem_fd = -1;
+	bool static_process_ranges = false;
 #endif
 #endif
 
@@ -3057,8 +4956,16 @@ int main(int argc, char *argv[])
 #ifdef _WIN32
 	cbs.add("--shm-name", [&](CLIParser &parser) { shm_name = parser.next_string(); });
 	cbs.add("--shm-mutex-name", [&](CLIParser &parser) { shm_mutex_name = parser.next_string(); });
+	cbs.add("--split-ranges", [&](CLIParser &parser) {
+		replayer_opts.split_process_count = parser.next_uint();
+		replayer_opts.split_start_graphics_index = parser.next_uint();
+		replayer_opts.split_end_graphics_index = parser.next_uint();
+		replayer_opts.split_start_compute_index = parser.next_uint();
+		replayer_opts.split_end_compute_index = parser.next_uint();
+	});
 #else
 	cbs.add("--shmem-fd", [&](CLIParser &parser) { shmem_fd = parser.next_uint(); });
+	cbs.add("--static-process-ranges", [&](CLIParser &) { static_process_ranges = true; });
 #endif
 #endif
 
@@ -3067,6 +4974,15 @@ int main(int argc, char *argv[])
 	cbs.add("--log-memory", [&](CLIParser &) { log_memory = true; });
 	cbs.add("--null-device", [&](CLIParser &) { opts.null_device = true; });
 	cbs.add("--timeout-seconds", [&](CLIParser &parser) { replayer_opts.timeout_seconds = parser.next_uint(); });
+	cbs.add("--write-pipeline-feedback", [&](CLIParser &parser) {
+		replayer_opts.pipeline_feedback_output_path = parser.next_string();
+	});
+	cbs.add("--order-by-cost", [&](CLIParser &parser) { replayer_opts.pipeline_cost_paths.push_back(parser.next_string()); });
+	cbs.add("--cluster-shader-modules", [&](CLIParser &) { replayer_opts.cluster_shader_modules = true; });
+	cbs.add("--progress-journal", [&](CLIParser &parser) { replayer_opts.progress_journal_path = parser.next_string(); });
+	cbs.add("--resume", [&](CLIParser &) { replayer_opts.resume_progress = true; });
+	cbs.add("--skip-replayed", [&](CLIParser &parser) { replayer_opts.replayed_paths.push_back(parser.next_string()); });
+	cbs.add("--benchmark-frontend", [&](CLIParser &) { replayer_opts.benchmark_frontend = true; });
 
 	cbs.error_handler = [] { print_help(); };
 
@@ -3118,6 +5034,53 @@ int main(int argc, char *argv[])
 	if (!replayer_opts.pipeline_stats_path.empty())
 		replayer_opts.pipeline_stats = true;
 
+	if (replayer_opts.resume_progress && replayer_opts.progress_journal_path.empty())
+	{
+		LOGE("--resume requires --progress-journal.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (replayer_opts.benchmark_frontend && replayer_opts.pipeline_stats)
+	{
+		LOGE("--enable-pipeline-stats cannot be used together with --benchmark-frontend.\n");
+		return EXIT_FAILURE;
+	}
+
+	// Nothing is compiled, so there is neither progress nor compile time to record.
+	if (replayer_opts.benchmark_frontend && !replayer_opts.progress_journal_path.empty())
+	{
+		LOGE("--progress-journal cannot be used together with --benchmark-frontend.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (replayer_opts.benchmark_frontend && !replayer_opts.pipeline_feedback_output_path.empty())
+	{
+		LOGE("--write-pipeline-feedback cannot be used together with --benchmark-frontend.\n");
+		return EXIT_FAILURE;
+	}
+
+	// A replay which does not resume starts a new journal. Child processes append to the journal of their master.
+	bool new_progress_journal = !replayer_opts.progress_journal_path.empty() && !replayer_opts.resume_progress;
+#ifndef NO_ROBUST_REPLAYER
+	new_progress_journal = new_progress_journal && !slave_process;
+#endif
+	if (new_progress_journal && !write_buffer_to_file(replayer_opts.progress_journal_path.c_str(), nullptr, 0))
+	{
+		LOGE("Failed to create progress journal %s.\n", replayer_opts.progress_journal_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	// Done once before any child process appends to the journal.
+	bool resume_progress_journal = replayer_opts.resume_progress;
+#ifndef NO_ROBUST_REPLAYER
+	resume_progress_journal = resume_progress_journal && !slave_process;
+#endif
+	if (resume_progress_journal && !ProgressJournal::truncate_torn_tail(replayer_opts.progress_journal_path))
+	{
+		LOGE("Failed to repair progress journal %s.\n", replayer_opts.progress_journal_path.c_str());
+		return EXIT_FAILURE;
+	}
+
 #ifndef FOSSILIZE_REPLAYER_SPIRV_VAL
 	if (replayer_opts.spirv_validate)
 		LOGE("--spirv-val is used, but SPIRV-Tools support was not enabled in fossilize-replay. Will be ignored.\n");
@@ -3134,7 +5097,7 @@ int main(int argc, char *argv[])
 #ifdef _WIN32
 		ret = run_master_process(opts, replayer_opts, databases, quiet_slave, shm_name, shm_mutex_name);
 #else
-		ret = run_master_process(opts, replayer_opts, databases, quiet_slave, shmem_fd);
+		ret = run_master_process(opts, replayer_opts, databases, quiet_slave, static_process_ranges, shmem_fd);
 #endif
 	}
 	else if (slave_process)
@@ -72,6 +72,11 @@ static VulkanDevice::Options device_options;
 static bool quiet_slave;
 
 static SharedControlBlock *control_block;
+static SharedWorkQueue *work_queue;
+
+// Pipelines in clustered order, computed once and inherited by every child process.
+static vector<Hash> clustered_graphics_hashes;
+static vector<Hash> clustered_compute_hashes;
 }
 
 struct ProcessProgress
@@ -89,6 +94,7 @@ struct ProcessProgress
 
 	bool process_once();
 	bool process_shutdown(int wstatus);
+	bool requeue_crashed_batches();
 	bool start_child_process();
 	void parse(const char *cmd);
 
@@ -136,15 +142,25 @@ void ProcessProgress::parse(const char *cmd)
 	else if (strncmp(cmd, "GRAPHICS", 8) == 0)
 	{
 		char *end = nullptr;
-		graphics_progress = int(strtol(cmd + 8, &end, 0));
+		int crashed_progress = int(strtol(cmd + 8, &end, 0));
+		graphics_progress = crashed_progress;
 		if (end)
 		{
-			Hash graphics_pipeline = strtoull(end, nullptr, 16);
-			// graphics_progress tells us where to start on next iteration, but -1 was actually the pipeline index that crashed.
-			if (Global::control_block && graphics_progress > 0 && graphics_pipeline != 0)
+			char *hash_end = nullptr;
+			Hash graphics_pipeline = strtoull(end, &hash_end, 16);
+
+			// Other pipelines before the one which crashed might not be done yet,
+			// so start the next iteration from the first pipeline which is not, if the child tells us.
+			char *resume_end = nullptr;
+			int resume_progress = int(strtol(hash_end, &resume_end, 0));
+			if (resume_end != hash_end)
+				graphics_progress = resume_progress;
+
+			// crashed_progress - 1 was the pipeline index that crashed.
+			if (Global::control_block && crashed_progress > 0 && graphics_pipeline != 0)
 			{
 				char buffer[ControlBlockMessageSize];
-				sprintf(buffer, "GRAPHICS %d %" PRIx64 "\n", graphics_progress - 1, graphics_pipeline);
+				sprintf(buffer, "GRAPHICS %d %" PRIx64 "\n", crashed_progress - 1, graphics_pipeline);
 				futex_wrapper_lock(&Global::control_block->futex_lock);
 				shared_control_block_write(Global::control_block, buffer, sizeof(buffer));
 				futex_wrapper_unlock(&Global::control_block->futex_lock);
@@ -154,15 +170,25 @@ void ProcessProgress::parse(const char *cmd)
 	else if (strncmp(cmd, "COMPUTE", 7) == 0)
 	{
 		char *end = nullptr;
-		compute_progress = int(strtol(cmd + 7, &end, 0));
+		int crashed_progress = int(strtol(cmd + 7, &end, 0));
+		compute_progress = crashed_progress;
 		if (end)
 		{
-			Hash compute_pipeline = strtoull(end, nullptr, 16);
-			// compute_progress tells us where to start on next iteration, but -1 was actually the pipeline index that crashed.
-			if (Global::control_block && compute_progress > 0 && compute_pipeline)
+			char *hash_end = nullptr;
+			Hash compute_pipeline = strtoull(end, &hash_end, 16);
+
+			// Other pipelines before the one which crashed might not be done yet,
+			// so start the next iteration from the first pipeline which is not, if the child tells us.
+			char *resume_end = nullptr;
+			int resume_progress = int(strtol(hash_end, &resume_end, 0));
+			if (resume_end != hash_end)
+				compute_progress = resume_progress;
+
+			// crashed_progress - 1 was the pipeline index that crashed.
+			if (Global::control_block && crashed_progress > 0 && compute_pipeline)
 			{
 				char buffer[ControlBlockMessageSize];
-				sprintf(buffer, "COMPUTE %d %" PRIx64 "\n", compute_progress - 1, compute_pipeline);
+				sprintf(buffer, "COMPUTE %d %" PRIx64 "\n", crashed_progress - 1, compute_pipeline);
 				futex_wrapper_lock(&Global::control_block->futex_lock);
 				shared_control_block_write(Global::control_block, buffer, sizeof(buffer));
 				futex_wrapper_unlock(&Global::control_block->futex_lock);
@@ -261,6 +287,18 @@ bool ProcessProgress::process_shutdown(int wstatus)
 	if (Global::control_block)
 		Global::control_block->clean_process_deaths.fetch_add(1, std::memory_order_relaxed);
 
+	if (Global::work_queue)
+	{
+		if (!requeue_crashed_batches())
+		{
+			LOGE("Process index %u (PID: %d) crashed, but there is nothing more to replay.\n", index, wait_pid);
+			return false;
+		}
+
+		LOGE("Process index %u (PID: %d) crashed, but will retry.\n", index, wait_pid);
+		return true;
+	}
+
 	start_graphics_index = uint32_t(graphics_progress);
 	start_compute_index = uint32_t(compute_progress);
 	if (start_graphics_index >= end_graphics_index && start_compute_index >= end_compute_index)
@@ -277,6 +315,23 @@ bool ProcessProgress::process_shutdown(int wstatus)
 	}
 }
 
+// The claims of a crashed child stay in the work queue, and the restarted child replays them before claiming more.
+// The child trims its claims as pipelines complete, so they start at the first pipeline which is not done.
+// The pipeline which crashed is replayed again, but its shader modules are masked now, so it is skipped.
+bool ProcessProgress::requeue_crashed_batches()
+{
+	auto *claims = Global::work_queue->get_claims(index);
+	bool has_claims = false;
+
+	for (unsigned i = 0; i < NUM_PIPELINE_MEMORY_CONTEXTS; i++)
+		if (claims[i].graphics.load(std::memory_order_relaxed) || claims[i].compute.load(std::memory_order_relaxed))
+			has_claims = true;
+
+	return has_claims ||
+	       Global::work_queue->get_remaining(RESOURCE_GRAPHICS_PIPELINE) != 0 ||
+	       Global::work_queue->get_remaining(RESOURCE_COMPUTE_PIPELINE) != 0;
+}
+
 static void send_faulty_modules_and_close(int fd)
 {
 	for (auto &m : Global::faulty_spirv_modules)
@@ -294,7 +349,8 @@ bool ProcessProgress::start_child_process()
 	graphics_progress = -1;
 	compute_progress = -1;
 
-	if (start_graphics_index >= end_graphics_index &&
+	if (!Global::work_queue &&
+	    start_graphics_index >= end_graphics_index &&
 	    start_compute_index >= end_compute_index)
 	{
 		// Nothing to do.
@@ -373,6 +429,8 @@ bool ProcessProgress::start_child_process()
 		copy_opts.start_compute_index = start_compute_index;
 		copy_opts.end_compute_index = end_compute_index;
 		copy_opts.control_block = Global::control_block;
+		copy_opts.work_queue = Global::work_queue;
+		copy_opts.process_index = index;
 		if (!copy_opts.on_disk_pipeline_cache_path.empty() && index != 0)
 		{
 			copy_opts.on_disk_pipeline_cache_path += ".";
@@ -391,16 +449,42 @@ bool ProcessProgress::start_child_process()
 			copy_opts.pipeline_stats_path += std::to_string(index);
 		}
 
+		if (!copy_opts.pipeline_feedback_output_path.empty())
+		{
+			copy_opts.pipeline_feedback_output_path =
+					get_child_pipeline_feedback_path(copy_opts.pipeline_feedback_output_path, index);
+		}
+
 		exit(run_slave_process(Global::device_options, copy_opts, Global::databases));
 	}
 	else
 		return false;
 }
 
+static SharedWorkQueue *create_shared_work_queue(unsigned processes,
+                                                 unsigned graphics_offset, unsigned num_graphics_pipelines,
+                                                 unsigned compute_offset, unsigned num_compute_pipelines)
+{
+	// Anonymous shared memory is inherited by the child processes through fork().
+	void *mapped = mmap(nullptr, SharedWorkQueue::get_size(processes), PROT_READ | PROT_WRITE,
+	                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED)
+		return nullptr;
+
+	memset(mapped, 0, SharedWorkQueue::get_size(processes));
+	auto *queue = static_cast<SharedWorkQueue *>(mapped);
+	queue->next_graphics_index.store(graphics_offset, std::memory_order_relaxed);
+	queue->next_compute_index.store(compute_offset, std::memory_order_relaxed);
+	queue->end_graphics_index = graphics_offset + num_graphics_pipelines;
+	queue->end_compute_index = compute_offset + num_compute_pipelines;
+	queue->num_processes = processes;
+	return queue;
+}
+
 static int run_master_process(const VulkanDevice::Options &opts,
                               const ThreadedReplayer::Options &replayer_opts,
                               const vector<const char *> &databases,
-                              bool quiet_slave, int shmem_fd)
+                              bool quiet_slave, bool static_process_ranges, int shmem_fd)
 {
 	Global::quiet_slave = quiet_slave;
 	Global::device_options = opts;
@@ -454,19 +538,47 @@ static int run_master_process(const VulkanDevice::Options &opts,
 			return EXIT_FAILURE;
 		}
 
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &num_graphics_pipelines, nullptr))
+		// Children skip the same replayed pipelines, so split what remains.
+		ReplayedPipelineSet replayed_pipelines;
+		if (!load_replayed_pipelines(replayer_opts.replayed_paths, replayed_pipelines))
+		{
+			LOGE("Failed to load replayed pipelines.\n");
+			return EXIT_FAILURE;
+		}
+
+		vector<Hash> graphics_hashes;
+		if (!get_remaining_pipeline_hashes(*db, RESOURCE_GRAPHICS_PIPELINE, replayed_pipelines, graphics_hashes))
 		{
 			for (auto &path : databases)
 				LOGE("Failed to parse database %s.\n", path);
 			return EXIT_FAILURE;
 		}
+		num_graphics_pipelines = graphics_hashes.size();
 
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &num_compute_pipelines, nullptr))
+		vector<Hash> compute_hashes;
+		if (!get_remaining_pipeline_hashes(*db, RESOURCE_COMPUTE_PIPELINE, replayed_pipelines, compute_hashes))
 		{
 			for (auto &path : databases)
 				LOGE("Failed to parse database %s.\n", path);
 			return EXIT_FAILURE;
 		}
+		num_compute_pipelines = compute_hashes.size();
+
+		// Cluster once here rather than in every child and every restart of a child.
+		if (replayer_opts.cluster_shader_modules && replayer_opts.pipeline_hash == 0)
+		{
+			size_t shader_cache_size = size_t(Global::base_replayer_options.shader_cache_size_mb) * 1024 * 1024;
+			if (!cluster_hashes_for_child_processes(*db, graphics_hashes, compute_hashes, shader_cache_size))
+			{
+				LOGE("Failed to cluster pipelines by shader modules.\n");
+				return EXIT_FAILURE;
+			}
+
+			Global::clustered_graphics_hashes = move(graphics_hashes);
+			Global::clustered_compute_hashes = move(compute_hashes);
+			Global::base_replayer_options.clustered_graphics_hashes = &Global::clustered_graphics_hashes;
+			Global::base_replayer_options.clustered_compute_hashes = &Global::clustered_compute_hashes;
+		}
 	}
 
 	if (Global::control_block)
@@ -536,6 +648,27 @@ static int run_master_process(const VulkanDevice::Options &opts,
 		compute_pipeline_offset = replayer_opts.start_compute_index;
 	}
 
+	// Let the children pull pipelines from a shared queue. Fixed ranges per process are the fallback.
+	// Replaying a single pipeline hash does not look at ranges at all.
+	if (!static_process_ranges && replayer_opts.pipeline_hash == 0)
+	{
+		Global::work_queue = create_shared_work_queue(processes,
+		                                              graphics_pipeline_offset, unsigned(num_graphics_pipelines),
+		                                              compute_pipeline_offset, unsigned(num_compute_pipelines));
+		if (!Global::work_queue)
+			LOGE("Failed to map shared work queue, falling back to fixed pipeline ranges per process.\n");
+	}
+
+	if (!Global::work_queue)
+	{
+		auto &split_opts = Global::base_replayer_options;
+		split_opts.split_process_count = processes;
+		split_opts.split_start_graphics_index = graphics_pipeline_offset;
+		split_opts.split_end_graphics_index = graphics_pipeline_offset + unsigned(num_graphics_pipelines);
+		split_opts.split_start_compute_index = compute_pipeline_offset;
+		split_opts.split_end_compute_index = compute_pipeline_offset + unsigned(num_compute_pipelines);
+	}
+
 	// fork() and pipe() strategy.
 	for (unsigned i = 0; i < processes; i++)
 	{
@@ -651,6 +784,12 @@ static int run_master_process(const VulkanDevice::Options &opts,
 		}
 	}
 
+	if (Global::work_queue)
+	{
+		munmap(Global::work_queue, SharedWorkQueue::get_size(processes));
+		Global::work_queue = nullptr;
+	}
+
 	if (Global::control_block)
 		Global::control_block->progress_complete.store(1, std::memory_order_release);
 
@@ -692,12 +831,15 @@ static void crash_handler(ThreadedReplayer &replayer, ThreadedReplayer::PerThrea
 			_exit(2);
 	}
 
-	// Report where we stopped, so we can continue.
-	sprintf(buffer, "GRAPHICS %d %" PRIx64 "\n", per_thread.current_graphics_index, per_thread.current_graphics_pipeline);
+	// Report where we stopped, so we can continue. Pipelines do not complete in index order,
+	// so also report the first pipeline which is not done, and resume from there.
+	sprintf(buffer, "GRAPHICS %d %" PRIx64 " %u\n", per_thread.current_graphics_index, per_thread.current_graphics_pipeline,
+	        replayer.get_resume_index(RESOURCE_GRAPHICS_PIPELINE));
 	if (!write_all(crash_fd, buffer))
 		_exit(2);
 
-	sprintf(buffer, "COMPUTE %d %" PRIx64 "\n", per_thread.current_compute_index, per_thread.current_compute_pipeline);
+	sprintf(buffer, "COMPUTE %d %" PRIx64 " %u\n", per_thread.current_compute_index, per_thread.current_compute_pipeline,
+	        replayer.get_resume_index(RESOURCE_COMPUTE_PIPELINE));
 	if (!write_all(crash_fd, buffer))
 		_exit(2);
 
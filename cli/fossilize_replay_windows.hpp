@@ -147,15 +147,25 @@ void ProcessProgress::parse(const char *cmd)
 	else if (strncmp(cmd, "GRAPHICS", 8) == 0)
 	{
 		char *end = nullptr;
-		graphics_progress = int(strtol(cmd + 8, &end, 0));
+		int crashed_progress = int(strtol(cmd + 8, &end, 0));
+		graphics_progress = crashed_progress;
 		if (end)
 		{
-			Hash graphics_pipeline = strtoull(end, nullptr, 16);
-			// graphics_progress tells us where to start on next iteration, but -1 was actually the pipeline index that crashed.
-			if (Global::control_block && graphics_progress > 0 && graphics_pipeline != 0)
+			char *hash_end = nullptr;
+			Hash graphics_pipeline = strtoull(end, &hash_end, 16);
+
+			// Other pipelines before the one which crashed might not be done yet,
+			// so start the next iteration from the first pipeline which is not, if the child tells us.
+			char *resume_end = nullptr;
+			int resume_progress = int(strtol(hash_end, &resume_end, 0));
+			if (resume_end != hash_end)
+				graphics_progress = resume_progress;
+
+			// crashed_progress - 1 was the pipeline index that crashed.
+			if (Global::control_block && crashed_progress > 0 && graphics_pipeline != 0)
 			{
 				char buffer[ControlBlockMessageSize];
-				sprintf(buffer, "GRAPHICS %d %" PRIx64 "\n", graphics_progress - 1, graphics_pipeline);
+				sprintf(buffer, "GRAPHICS %d %" PRIx64 "\n", crashed_progress - 1, graphics_pipeline);
 
 				if (WaitForSingleObject(Global::shared_mutex, INFINITE) == WAIT_OBJECT_0)
 				{
@@ -168,15 +178,25 @@ void ProcessProgress::parse(const char *cmd)
 	else if (strncmp(cmd, "COMPUTE", 7) == 0)
 	{
 		char *end = nullptr;
-		compute_progress = int(strtol(cmd + 7, &end, 0));
+		int crashed_progress = int(strtol(cmd + 7, &end, 0));
+		compute_progress = crashed_progress;
 		if (end)
 		{
-			Hash compute_pipeline = strtoull(end, nullptr, 16);
-			// compute_progress tells us where to start on next iteration, but -1 was actually the pipeline index that crashed.
-			if (Global::control_block && compute_progress > 0 && compute_pipeline)
+			char *hash_end = nullptr;
+			Hash compute_pipeline = strtoull(end, &hash_end, 16);
+
+			// Other pipelines before the one which crashed might not be done yet,
+			// so start the next iteration from the first pipeline which is not, if the child tells us.
+			char *resume_end = nullptr;
+			int resume_progress = int(strtol(hash_end, &resume_end, 0));
+			if (resume_end != hash_end)
+				compute_progress = resume_progress;
+
+			// crashed_progress - 1 was the pipeline index that crashed.
+			if (Global::control_block && crashed_progress > 0 && compute_pipeline)
 			{
 				char buffer[ControlBlockMessageSize];
-				sprintf(buffer, "COMPUTE %d %" PRIx64 "\n", compute_progress - 1, compute_pipeline);
+				sprintf(buffer, "COMPUTE %d %" PRIx64 "\n", crashed_progress - 1, compute_pipeline);
 
 				if (WaitForSingleObject(Global::shared_mutex, INFINITE) == WAIT_OBJECT_0)
 				{
@@ -482,6 +502,60 @@ bool ProcessProgress::start_child_process()
 		cmdline += std::to_string(Global::base_replayer_options.timeout_seconds);
 	}
 
+	if (!Global::base_replayer_options.pipeline_feedback_output_path.empty())
+	{
+		cmdline += " --write-pipeline-feedback ";
+		cmdline += "\"";
+		cmdline += get_child_pipeline_feedback_path(Global::base_replayer_options.pipeline_feedback_output_path, index);
+		cmdline += "\"";
+	}
+
+	for (auto &path : Global::base_replayer_options.pipeline_cost_paths)
+	{
+		cmdline += " --order-by-cost ";
+		cmdline += "\"";
+		cmdline += path;
+		cmdline += "\"";
+	}
+
+	if (Global::base_replayer_options.cluster_shader_modules)
+		cmdline += " --cluster-shader-modules";
+
+	if (!Global::base_replayer_options.pipeline_cost_paths.empty())
+	{
+		cmdline += " --split-ranges ";
+		cmdline += to_string(Global::base_replayer_options.split_process_count);
+		cmdline += " ";
+		cmdline += to_string(Global::base_replayer_options.split_start_graphics_index);
+		cmdline += " ";
+		cmdline += to_string(Global::base_replayer_options.split_end_graphics_index);
+		cmdline += " ";
+		cmdline += to_string(Global::base_replayer_options.split_start_compute_index);
+		cmdline += " ";
+		cmdline += to_string(Global::base_replayer_options.split_end_compute_index);
+	}
+
+	if (Global::base_replayer_options.benchmark_frontend)
+		cmdline += " --benchmark-frontend";
+
+	for (auto &path : Global::base_replayer_options.replayed_paths)
+	{
+		cmdline += " --skip-replayed ";
+		cmdline += "\"";
+		cmdline += path;
+		cmdline += "\"";
+	}
+
+	if (!Global::base_replayer_options.progress_journal_path.empty())
+	{
+		cmdline += " --progress-journal ";
+		cmdline += "\"";
+		cmdline += Global::base_replayer_options.progress_journal_path;
+		cmdline += "\"";
+		if (Global::base_replayer_options.resume_progress)
+			cmdline += " --resume";
+	}
+
 	// Create custom named pipes which can be inherited by our child processes.
 	SECURITY_ATTRIBUTES attrs = {};
 	attrs.bInheritHandle = TRUE;
@@ -714,19 +788,40 @@ static int run_master_process(const VulkanDevice::Options &opts,
 			return EXIT_FAILURE;
 		}
 
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &num_graphics_pipelines, nullptr))
+		// Children skip the same replayed pipelines, so split what remains.
+		ReplayedPipelineSet replayed_pipelines;
+		if (!load_replayed_pipelines(replayer_opts.replayed_paths, replayed_pipelines))
+		{
+			LOGE("Failed to load replayed pipelines.\n");
+			return EXIT_FAILURE;
+		}
+
+		vector<Hash> hashes;
+		if (!get_remaining_pipeline_hashes(*db, RESOURCE_GRAPHICS_PIPELINE, replayed_pipelines, hashes))
 		{
 			for (auto &path : databases)
 				LOGE("Failed to parse database %s.\n", path);
 			return EXIT_FAILURE;
 		}
+		num_graphics_pipelines = hashes.size();
 
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &num_compute_pipelines, nullptr))
+		if (!get_remaining_pipeline_hashes(*db, RESOURCE_COMPUTE_PIPELINE, replayed_pipelines, hashes))
 		{
 			for (auto &path : databases)
 				LOGE("Failed to parse database %s.\n", path);
 			return EXIT_FAILURE;
 		}
+		num_compute_pipelines = hashes.size();
+
+		// Children are not forked, so they cannot inherit a clustered order, and each of them clusters on its own.
+		// That is cheap with a dependency index, but otherwise every child parses every pipeline once more.
+		size_t index_count = 0;
+		if (replayer_opts.cluster_shader_modules &&
+		    db->get_hash_list_for_resource_tag(RESOURCE_PIPELINE_DEPENDENCIES, &index_count, nullptr) &&
+		    index_count == 0)
+		{
+			LOGI("Every child process parses all pipelines to cluster them. Run fossilize-index on the archive to avoid this.\n");
+		}
 	}
 
 	if (Global::control_block)
@@ -753,6 +848,13 @@ static int run_master_process(const VulkanDevice::Options &opts,
 		compute_pipeline_offset = replayer_opts.start_compute_index;
 	}
 
+	auto &split_opts = Global::base_replayer_options;
+	split_opts.split_process_count = processes;
+	split_opts.split_start_graphics_index = unsigned(graphics_pipeline_offset);
+	split_opts.split_end_graphics_index = unsigned(graphics_pipeline_offset + num_graphics_pipelines);
+	split_opts.split_start_compute_index = unsigned(compute_pipeline_offset);
+	split_opts.split_end_compute_index = unsigned(compute_pipeline_offset + num_compute_pipelines);
+
 	// CreateProcess for our children.
 	for (unsigned i = 0; i < processes; i++)
 	{
@@ -895,12 +997,15 @@ static void crash_handler(ThreadedReplayer &replayer, ThreadedReplayer::PerThrea
 			ExitProcess(2);
 	}
 
-	// Report where we stopped, so we can continue.
-	sprintf(buffer, "GRAPHICS %d %" PRIx64 "\n", per_thread.current_graphics_index, per_thread.current_graphics_pipeline);
+	// Report where we stopped, so we can continue. Pipelines do not complete in index order,
+	// so also report the first pipeline which is not done, and resume from there.
+	sprintf(buffer, "GRAPHICS %d %" PRIx64 " %u\n", per_thread.current_graphics_index, per_thread.current_graphics_pipeline,
+	        replayer.get_resume_index(RESOURCE_GRAPHICS_PIPELINE));
 	if (!write_all(crash_handle, buffer))
 		ExitProcess(2);
 
-	sprintf(buffer, "COMPUTE %d %" PRIx64 "\n", per_thread.current_compute_index, per_thread.current_compute_pipeline);
+	sprintf(buffer, "COMPUTE %d %" PRIx64 " %u\n", per_thread.current_compute_index, per_thread.current_compute_pipeline,
+	        replayer.get_resume_index(RESOURCE_COMPUTE_PIPELINE));
 	if (!write_all(crash_handle, buffer))
 		ExitProcess(2);
 
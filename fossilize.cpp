@@ -29,7 +29,9 @@
 #include "fossilize.hpp"
 #include <algorithm>
 #include <unordered_map>
-#include <queue>
+#include <unordered_set>
+#include <deque>
+#include <memory>
 #include <string.h>
 #include "varint.hpp"
 #include "path.hpp"
@@ -38,6 +40,10 @@
 #include "fossilize_errors.hpp"
 #include "fossilize_application_filter.hpp"
 
+#ifdef __linux__
+#include "platform/futex_wrapper_linux.hpp"
+#endif
+
 #define RAPIDJSON_HAS_STDSTRING 1
 #include "rapidjson/document.h"
 #include "rapidjson/prettywriter.h"
@@ -63,11 +69,29 @@ public:
 	{
 	}
 
+	explicit Hasher(HashScheme scheme_)
+		: scheme(scheme_)
+	{
+		if (scheme == HASH_SCHEME_STRIPED)
+		{
+			lanes[0] = h + prime1 + prime2;
+			lanes[1] = h + prime2;
+			lanes[2] = h;
+			lanes[3] = h - prime1;
+		}
+	}
+
 	Hasher() = default;
 
 	template <typename T>
 	inline void data(const T *data_, size_t size)
 	{
+		if (scheme == HASH_SCHEME_STRIPED)
+		{
+			stripes(data_, size);
+			return;
+		}
+
 		size /= sizeof(*data_);
 		for (size_t i = 0; i < size; i++)
 			h = (h * 0x100000001b3ull) ^ data_[i];
@@ -75,7 +99,13 @@ public:
 
 	inline void u32(uint32_t value)
 	{
-		h = (h * 0x100000001b3ull) ^ value;
+		if (scheme == HASH_SCHEME_STRIPED)
+		{
+			auto &lane = lanes[step_count++ & 3];
+			lane = mix(lane, value);
+		}
+		else
+			h = (h * 0x100000001b3ull) ^ value;
 	}
 
 	inline void s32(int32_t value)
@@ -123,11 +153,105 @@ public:
 
 	inline Hash get() const
 	{
-		return h;
+		if (scheme == HASH_SCHEME_STRIPED)
+			return finalize_lanes();
+		else
+			return h;
 	}
 
 private:
 	Hash h = 0xcbf29ce484222325ull;
+	HashScheme scheme = HASH_SCHEME_FNV1;
+
+	// State for HASH_SCHEME_STRIPED, the mixing functions are modelled after xxHash64.
+	// Words are distributed round-robin over four independent lanes, so consecutive multiplies do not
+	// depend on each other, and bulk data is consumed as 32 byte stripes, one 64-bit word per lane.
+	enum : uint64_t
+	{
+		prime1 = 0x9e3779b185ebca87ull,
+		prime2 = 0xc2b2ae3d27d4eb4full,
+		prime3 = 0x165667b19e3779f9ull,
+		prime4 = 0x85ebca77c2b2ae63ull
+	};
+
+	uint64_t lanes[4] = {};
+	uint64_t step_count = 0;
+
+	static inline uint64_t rotl(uint64_t v, unsigned amount)
+	{
+		return (v << amount) | (v >> (64 - amount));
+	}
+
+	static inline uint64_t mix(uint64_t acc, uint64_t input)
+	{
+		acc += input * prime2;
+		acc = rotl(acc, 31);
+		return acc * prime1;
+	}
+
+	void stripes(const void *data_, size_t size)
+	{
+		auto *ptr = static_cast<const uint8_t *>(data_);
+		uint32_t word;
+
+		// Realign to the first lane, so full stripes can be consumed straight from memory.
+		while ((step_count & 3) && size >= sizeof(word))
+		{
+			memcpy(&word, ptr, sizeof(word));
+			u32(word);
+			ptr += sizeof(word);
+			size -= sizeof(word);
+		}
+
+		uint64_t stripe[4];
+		while (size >= sizeof(stripe))
+		{
+			memcpy(stripe, ptr, sizeof(stripe));
+			lanes[0] = mix(lanes[0], stripe[0]);
+			lanes[1] = mix(lanes[1], stripe[1]);
+			lanes[2] = mix(lanes[2], stripe[2]);
+			lanes[3] = mix(lanes[3], stripe[3]);
+			step_count += 4;
+			ptr += sizeof(stripe);
+			size -= sizeof(stripe);
+		}
+
+		while (size >= sizeof(word))
+		{
+			memcpy(&word, ptr, sizeof(word));
+			u32(word);
+			ptr += sizeof(word);
+			size -= sizeof(word);
+		}
+
+		// Zero-pad the tail, but mix in its length so padding cannot alias real data.
+		if (size)
+		{
+			word = 0;
+			memcpy(&word, ptr, size);
+			u32(word);
+			u32(uint32_t(size));
+		}
+	}
+
+	Hash finalize_lanes() const
+	{
+		uint64_t acc = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+		for (auto lane : lanes)
+		{
+			acc ^= mix(0, lane);
+			acc = acc * prime1 + prime4;
+		}
+
+		acc += step_count;
+
+		acc ^= acc >> 33;
+		acc *= prime2;
+		acc ^= acc >> 29;
+		acc *= prime3;
+		acc ^= acc >> 32;
+		return acc;
+	}
 };
 
 template <typename T>
@@ -145,6 +269,15 @@ static Value uint64_string(uint64_t value, Allocator &alloc)
 	return Value(str, alloc);
 }
 
+enum { ApplicationLinkTableEntrySize = sizeof(uint32_t) + sizeof(Hash) };
+enum { PipelineUsageEntrySize = sizeof(uint32_t) + sizeof(Hash) + sizeof(uint64_t) };
+enum { PipelineDependenciesEntrySize = 2 * sizeof(uint32_t) + 4 * sizeof(Hash) };
+enum { MaxApplicationLinkTableEntries = 64 * 1024 };
+enum { MaxStagingArenaItems = 256 };
+enum { MaxInFlightRecordJobsPerWorker = 16 };
+enum { MaxQueueDepthSamples = 4096 };
+enum { MaxDeferredRecordJobs = 16 * 1024 };
+
 struct StateReplayer::Impl
 {
 	bool parse(StateCreatorInterface &iface, DatabaseInterface *resolver, const void *buffer, size_t size) FOSSILIZE_WARN_UNUSED;
@@ -158,6 +291,11 @@ struct StateReplayer::Impl
 	std::unordered_map<Hash, VkPipeline> replayed_compute_pipelines;
 	std::unordered_map<Hash, VkPipeline> replayed_graphics_pipelines;
 
+	// Interned pipeline sub-states are retained as JSON rather than parsed structs,
+	// since callers may reset the allocator between parses.
+	Document::AllocatorType interned_sub_state_allocator;
+	std::unordered_map<Hash, Value> interned_sub_states;
+
 	void copy_handle_references(const Impl &impl);
 	void forget_handle_references();
 	bool parse_samplers(StateCreatorInterface &iface, const Value &samplers) FOSSILIZE_WARN_UNUSED;
@@ -169,8 +307,18 @@ struct StateReplayer::Impl
 	bool parse_graphics_pipelines(StateCreatorInterface &iface, DatabaseInterface *resolver, const Value &pipelines) FOSSILIZE_WARN_UNUSED;
 	bool parse_compute_pipeline(StateCreatorInterface &iface, DatabaseInterface *resolver, const Value &pipelines, const Value &member) FOSSILIZE_WARN_UNUSED;
 	bool parse_graphics_pipeline(StateCreatorInterface &iface, DatabaseInterface *resolver, const Value &pipelines, const Value &member) FOSSILIZE_WARN_UNUSED;
-	bool parse_application_info(StateCreatorInterface &iface, const Value &app_info, const Value &pdf_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_application_info(StateCreatorInterface &iface, const Value &app_info, const Value &pdf_info, HashScheme scheme) FOSSILIZE_WARN_UNUSED;
 	bool parse_application_info_link(StateCreatorInterface &iface, const Value &link) FOSSILIZE_WARN_UNUSED;
+	bool parse_application_link_table(StateCreatorInterface &iface, const Value &table,
+	                                  const uint8_t *buffer, size_t size) FOSSILIZE_WARN_UNUSED;
+	bool parse_pipeline_sub_states(const Value &sub_states) FOSSILIZE_WARN_UNUSED;
+	bool parse_pipeline_feedback(StateCreatorInterface &iface, const Value &feedback) FOSSILIZE_WARN_UNUSED;
+	bool parse_pipeline_usage(StateCreatorInterface &iface, const Value &usage,
+	                          const uint8_t *buffer, size_t size) FOSSILIZE_WARN_UNUSED;
+	bool parse_pipeline_dependencies(StateCreatorInterface &iface, const Value &dependencies,
+	                                 const uint8_t *buffer, size_t size) FOSSILIZE_WARN_UNUSED;
+	bool resolve_pipeline_sub_state(StateCreatorInterface &iface, DatabaseInterface *resolver, Hash pipeline_hash,
+	                                const char *name, const Value &value, const Value **out_state) FOSSILIZE_WARN_UNUSED;
 
 	bool parse_push_constant_ranges(const Value &ranges, const VkPushConstantRange **out_ranges) FOSSILIZE_WARN_UNUSED;
 	bool parse_set_layouts(const Value &layouts, const VkDescriptorSetLayout **out_layouts) FOSSILIZE_WARN_UNUSED;
@@ -219,11 +367,313 @@ struct StateReplayer::Impl
 	T *copy(const T *src, size_t count);
 };
 
+// Staging memory for create infos which record_* calls hand over to the recording thread.
+// An arena is only ever used by one calling thread at a time, which copies into it without holding any lock.
+// Many small items are packed into the same arena, which is reset once the recording thread has consumed all of them.
+struct StagingArena
+{
+	ScratchAllocator allocator;
+	unsigned pending_items = 0;
+	bool acquired = false;
+	// Sealed arenas take no more items until they are drained.
+	bool sealed = false;
+	// How much of pinned_staging_memory is accounted to this arena.
+	size_t pinned_memory = 0;
+};
+
 struct WorkItem
 {
 	uint64_t handle;
 	void *create_info;
 	Hash custom_hash;
+	StagingArena *arena;
+	// For objects the database already has, create_info is null, and only the handle is mapped to custom_hash.
+	// For destroyed objects, create_info is null, forget is set, and the handle is unmapped.
+	// RESOURCE_APPLICATION_INFO (zero) otherwise.
+	ResourceTag known_tag;
+	bool forget;
+	// If set, create_info points to a WorkItemBatch in the same arena.
+	bool batch;
+	// If set, create_info points to a PipelineUsageBatch in the same arena.
+	bool usage;
+};
+
+struct PipelineUsageBatch
+{
+	VkPipeline *pipelines;
+	uint32_t *bind_counts;
+	uint32_t count;
+};
+
+// Pipelines from one vkCreate*Pipelines call. Every item is accounted as a separate arena item.
+struct WorkItemBatch
+{
+	WorkItem *items;
+	uint32_t count;
+};
+
+// Hashes which the database had when recording started.
+// Once published, it is immutable and can be read from any thread.
+struct KnownHashSnapshot
+{
+	std::vector<Hash> hashes[RESOURCE_COUNT];
+
+	bool contains(ResourceTag tag, Hash hash) const
+	{
+		return std::binary_search(hashes[tag].begin(), hashes[tag].end(), hash);
+	}
+};
+
+// Hands work items from application threads to the recording thread.
+// Items go through a bounded lock-free ring, based on Dmitry Vyukov's bounded MPMC queue,
+// and producers only make a syscall if the consumer is parked because it ran out of work.
+// Recording must never block application threads, so if the ring is full, items spill into a locked overflow list.
+// While the overflow list is in use, every producer appends to it, so items are still consumed in order.
+// There must only be one consumer.
+class RecordQueue
+{
+public:
+	RecordQueue()
+		: cells(new Cell[Capacity])
+	{
+		for (size_t i = 0; i < Capacity; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	void push(const WorkItem &item)
+	{
+		if (overflowing.load(std::memory_order_acquire) || !try_push_ring(item))
+		{
+			std::lock_guard<std::mutex> lock(overflow_lock);
+			overflow.push_back(item);
+			overflowing.store(true, std::memory_order_release);
+		}
+
+		// Pairs with the fence in wait_for_items(), so either we observe the consumer as parked,
+		// or the consumer observes our item before parking.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (parked.load(std::memory_order_relaxed) && parked.exchange(0))
+			wake_consumer();
+	}
+
+	bool try_pop(WorkItem &item)
+	{
+		if (overflow_batch_index < overflow_batch.size())
+		{
+			item = overflow_batch[overflow_batch_index++];
+			return true;
+		}
+
+		if (try_pop_ring(item))
+			return true;
+
+		// Everything in the overflow list is newer than what was in the ring.
+		if (overflowing.load(std::memory_order_acquire))
+		{
+			overflow_batch.clear();
+			overflow_batch_index = 0;
+			{
+				std::lock_guard<std::mutex> lock(overflow_lock);
+				std::swap(overflow, overflow_batch);
+				overflowing.store(false, std::memory_order_release);
+			}
+
+			if (!overflow_batch.empty())
+			{
+				item = overflow_batch[overflow_batch_index++];
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Parks the calling consumer until an item is available, or until deadline has passed if non-null.
+	// Returns true if an item is available.
+	bool wait_for_items(const std::chrono::steady_clock::time_point *deadline)
+	{
+		for (;;)
+		{
+			if (has_items())
+				return true;
+
+			parked.store(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (has_items())
+			{
+				parked.store(0, std::memory_order_relaxed);
+				return true;
+			}
+
+			if (deadline)
+			{
+				auto now = std::chrono::steady_clock::now();
+				if (now >= *deadline)
+				{
+					parked.store(0, std::memory_order_relaxed);
+					return has_items();
+				}
+				park_consumer(std::chrono::duration_cast<std::chrono::nanoseconds>(*deadline - now).count());
+			}
+			else
+				park_consumer(-1);
+
+			parked.store(0, std::memory_order_relaxed);
+		}
+	}
+
+private:
+	bool try_push_ring(const WorkItem &item)
+	{
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		Cell *cell;
+		for (;;)
+		{
+			cell = &cells[pos & (Capacity - 1)];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(seq) - intptr_t(pos);
+			if (diff == 0)
+			{
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+
+		cell->item = item;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool try_pop_ring(WorkItem &item)
+	{
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell *cell = &cells[pos & (Capacity - 1)];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+			if (diff == 0)
+			{
+				if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					item = cell->item;
+					cell->sequence.store(pos + Capacity, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+private:
+	enum { Capacity = 4096 };
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		WorkItem item;
+	};
+	std::unique_ptr<Cell[]> cells;
+	std::atomic<size_t> enqueue_pos = { 0 };
+	std::atomic<size_t> dequeue_pos = { 0 };
+
+	// Non-zero while the consumer is parked, or about to park.
+	std::atomic<int> parked = { 0 };
+
+	std::mutex overflow_lock;
+	std::vector<WorkItem> overflow;
+	std::atomic<bool> overflowing = { false };
+
+	// Only touched by the consumer.
+	std::vector<WorkItem> overflow_batch;
+	size_t overflow_batch_index = 0;
+
+	bool has_items() const
+	{
+		if (overflow_batch_index < overflow_batch.size() || overflowing.load(std::memory_order_acquire))
+			return true;
+
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		size_t seq = cells[pos & (Capacity - 1)].sequence.load(std::memory_order_acquire);
+		return intptr_t(seq) - intptr_t(pos + 1) >= 0;
+	}
+
+#ifdef __linux__
+	static_assert(sizeof(std::atomic<int>) == sizeof(int), "Futex word must be a plain int.");
+
+	void park_consumer(int64_t timeout_ns)
+	{
+		struct timespec timeout;
+		timeout.tv_sec = time_t(timeout_ns / 1000000000);
+		timeout.tv_nsec = long(timeout_ns % 1000000000);
+		futex_wrapper_wait_private(reinterpret_cast<int *>(&parked), 1, timeout_ns >= 0 ? &timeout : nullptr);
+	}
+
+	void wake_consumer()
+	{
+		futex_wrapper_wake_private(reinterpret_cast<int *>(&parked), 1);
+	}
+#else
+	std::mutex park_lock;
+	std::condition_variable park_cv;
+
+	void park_consumer(int64_t timeout_ns)
+	{
+		std::unique_lock<std::mutex> lock(park_lock);
+		auto predicate = [this]() { return parked.load(std::memory_order_relaxed) == 0; };
+		if (timeout_ns >= 0)
+			park_cv.wait_for(lock, std::chrono::nanoseconds(timeout_ns), predicate);
+		else
+			park_cv.wait(lock, predicate);
+	}
+
+	void wake_consumer()
+	{
+		// Taking the lock makes sure the consumer is either not yet checking its predicate, or already waiting.
+		{
+			std::lock_guard<std::mutex> lock(park_lock);
+		}
+		park_cv.notify_one();
+	}
+#endif
+};
+
+struct SerializedSubState
+{
+	Hash hash;
+	std::vector<uint8_t> blob;
+};
+
+// A database entry which is serialized, and possibly compressed, off the recording thread.
+// The recording thread writes jobs to the database in the order they were submitted.
+struct RecordJob
+{
+	ResourceTag tag = RESOURCE_COUNT;
+	Hash hash = 0;
+	const void *create_info = nullptr;
+	// The staging arena item is retired once the job is written.
+	StagingArena *arena = nullptr;
+	PayloadWriteFlags payload_flags = 0;
+
+	// Holds the remapped copy of the create info, and scratch memory for serialization.
+	ScratchAllocator allocator;
+
+	std::vector<uint8_t> blob;
+	std::vector<uint8_t> encoded_blob;
+	// Interned pipeline sub-states which are new to this session. They are written ahead of the pipeline.
+	std::vector<SerializedSubState> sub_states;
+	// Size of the blob and sub-states before they were encoded.
+	size_t serialized_size = 0;
+	bool success = false;
+	// Guarded by record_job_lock.
+	bool done = false;
 };
 
 struct StateRecorder::Impl
@@ -233,7 +683,36 @@ struct StateRecorder::Impl
 	void record_end();
 
 	ScratchAllocator allocator;
-	ScratchAllocator temp_allocator;
+	// Free arenas are neither acquired nor sealed.
+	std::mutex staging_arena_lock;
+	std::vector<std::unique_ptr<StagingArena>> staging_arenas;
+	std::vector<StagingArena *> free_staging_arenas;
+
+	// Memory held by arenas with items the recording thread has yet to consume.
+	// Once it exceeds the budget, application threads wait for the recording thread to catch up.
+	size_t staging_memory_budget = 0;
+	size_t pinned_staging_memory = 0;
+	size_t peak_pinned_staging_memory = 0;
+	bool staging_memory_consumer_active = false;
+	std::condition_variable staging_memory_cv;
+	void set_staging_memory_consumer_active(bool active);
+	void unpin_staging_memory(StagingArena *arena);
+
+	StagingArena *acquire_staging_arena();
+	void release_staging_arena(StagingArena *arena, unsigned queued_items);
+	void retire_staging_arena_item(StagingArena *arena);
+	void push_work_item(const WorkItem &item);
+	void push_work_item_batch(StagingArena *arena, WorkItemBatch *batch);
+	void push_known_work_item(ResourceTag tag, uint64_t handle, Hash hash);
+	void record_known_object(const WorkItem &item);
+	void push_forget_work_item(ResourceTag tag, uint64_t handle);
+	void forget_object(const WorkItem &item);
+
+	bool early_duplicate_check = false;
+	// Application threads might still read older snapshots, so they are kept until teardown.
+	std::vector<std::unique_ptr<KnownHashSnapshot>> known_hash_snapshots;
+	std::atomic<const KnownHashSnapshot *> known_hashes = { nullptr };
+	void publish_known_hashes();
 	DatabaseInterface *database_iface = nullptr;
 	ApplicationInfoFilter *application_info_filter = nullptr;
 
@@ -256,6 +735,7 @@ struct StateRecorder::Impl
 	VkApplicationInfo *application_info = nullptr;
 	VkPhysicalDeviceFeatures2 *physical_device_features = nullptr;
 	StateRecorderApplicationFeatureHash application_feature_hash = {};
+	HashScheme hash_scheme = HASH_SCHEME_FNV1;
 
 	bool copy_descriptor_set_layout(const VkDescriptorSetLayoutCreateInfo *create_info, ScratchAllocator &alloc, VkDescriptorSetLayoutCreateInfo **out_info) FOSSILIZE_WARN_UNUSED;
 	bool copy_pipeline_layout(const VkPipelineLayoutCreateInfo *create_info, ScratchAllocator &alloc, VkPipelineLayoutCreateInfo **out_info) FOSSILIZE_WARN_UNUSED;
@@ -315,25 +795,120 @@ struct StateRecorder::Impl
 	bool serialize_application_info(std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
 	bool serialize_application_blob_link(Hash hash, ResourceTag tag, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
 	Hash get_application_link_hash(ResourceTag tag, Hash hash) const;
-	bool register_application_link_hash(ResourceTag tag, Hash hash, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
+	bool register_application_link_hash(ResourceTag tag, Hash hash, std::vector<uint8_t> &blob) FOSSILIZE_WARN_UNUSED;
+	bool flush_application_link_table(std::vector<uint8_t> &blob) FOSSILIZE_WARN_UNUSED;
+	void load_application_link_tables();
+	void accumulate_pipeline_feedback(VkPipeline pipeline, const VkPipelineCreationFeedbackEXT &feedback);
+	bool flush_pipeline_feedback(std::vector<uint8_t> &blob) FOSSILIZE_WARN_UNUSED;
+	void accumulate_pipeline_usage(const PipelineUsageBatch &batch);
+	bool flush_pipeline_usage(std::vector<uint8_t> &blob) FOSSILIZE_WARN_UNUSED;
 	bool serialize_sampler(Hash hash, const VkSamplerCreateInfo &create_info, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
 	bool serialize_descriptor_set_layout(Hash hash, const VkDescriptorSetLayoutCreateInfo &create_info, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
 	bool serialize_pipeline_layout(Hash hash, const VkPipelineLayoutCreateInfo &create_info, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
 	bool serialize_render_pass(Hash hash, const VkRenderPassCreateInfo &create_info, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
 	bool serialize_shader_module(Hash hash, const VkShaderModuleCreateInfo &create_info, std::vector<uint8_t> &blob, ScratchAllocator &allocator) const FOSSILIZE_WARN_UNUSED;
-	bool serialize_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo &create_info, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
+	bool serialize_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo &create_info, std::vector<uint8_t> &blob,
+	                                 std::vector<SerializedSubState> &sub_states) FOSSILIZE_WARN_UNUSED;
+	bool serialize_pipeline_sub_state(Hash hash, const char *name, const Value &state, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
+	bool intern_pipeline_sub_states(Value &pipeline, Document::AllocatorType &alloc,
+	                                std::vector<SerializedSubState> &sub_states) FOSSILIZE_WARN_UNUSED;
 	bool serialize_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo &create_info, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
 
 	std::mutex record_lock;
-	std::condition_variable record_cv;
-	std::queue<WorkItem> record_queue;
+	RecordQueue record_queue;
 	std::thread worker_thread;
 
+	// Optional workers which serialize and compress database entries for the recording thread.
+	// Hashing, remapping and database writes stay on the recording thread, in order.
+	unsigned record_worker_count = 0;
+	std::vector<std::thread> record_workers;
+	std::mutex record_job_lock;
+	std::condition_variable record_job_cv;
+	std::condition_variable record_job_done_cv;
+	std::deque<RecordJob *> record_job_queue;
+	bool record_workers_exit = false;
+	// Compress on the workers, and write raw payloads.
+	bool encode_raw_payloads = false;
+
+	// Only touched by the recording thread.
+	std::vector<std::unique_ptr<RecordJob>> record_jobs;
+	std::vector<RecordJob *> free_record_jobs;
+	std::deque<RecordJob *> in_flight_record_jobs;
+
+	// Sub-states which are already in the database. Written by the recording thread, read by workers.
+	std::mutex sub_state_lock;
+	std::unordered_set<Hash> committed_sub_states;
+
+	void start_record_workers();
+	void stop_record_workers();
+	void record_worker_task();
+	RecordJob *acquire_record_job();
+	void release_record_job(RecordJob *job);
+	void submit_record_job(RecordJob *job, ResourceTag tag, Hash hash, const void *create_info,
+	                       StagingArena *arena, PayloadWriteFlags payload_flags);
+	void start_record_job(RecordJob *job);
+	void execute_record_job(RecordJob &job);
+	bool commit_record_jobs(size_t max_in_flight);
+
+	// Token buckets for database writes, which hold up to one second worth of tokens.
+	uint32_t rate_limit_objects = 0;
+	uint64_t rate_limit_bytes = 0;
+	double object_tokens = 0.0;
+	double byte_tokens = 0.0;
+	std::chrono::steady_clock::time_point rate_limit_refill_time;
+	// Jobs over the rate limit, in submission order. They own deep copies of their create infos.
+	std::deque<RecordJob *> deferred_record_jobs;
+	void reset_rate_limit();
+	bool take_record_job_token();
+	void defer_record_job(RecordJob *job);
+	bool submit_deferred_record_jobs(bool idle);
+
+	uint32_t sampling_slice = 0;
+	uint32_t sampling_slice_count = 1;
+	// Derived pipelines are sampled by the hash of the pipeline at the root of their derivation chain.
+	std::unordered_map<Hash, Hash> sampling_roots;
+	bool sample_pipeline(Hash hash, VkPipeline base_pipeline);
+
+	// Accumulated by the recording thread, and copied to published_statistics every now and then.
+	bool statistics = false;
+	std::atomic<uint64_t> queued_work_items = { 0 };
+	uint64_t consumed_work_items = 0;
+	StateRecorderStatistics recording_statistics = {};
+	std::chrono::steady_clock::time_point statistics_start;
+	std::chrono::steady_clock::time_point next_statistics_sample;
+	std::chrono::steady_clock::duration statistics_sample_interval = std::chrono::milliseconds(50);
+	mutable std::mutex statistics_lock;
+	StateRecorderStatistics published_statistics = {};
+	std::vector<StateRecorderQueueDepthSample> queue_depth_samples;
+	void begin_work_item_statistics(std::chrono::steady_clock::time_point now);
+	void publish_statistics(std::chrono::steady_clock::time_point now);
+	bool database_has_entry(ResourceTag tag, Hash hash);
+
 	bool compression = false;
 	bool checksum = false;
+	bool intern_sub_states = false;
+	bool application_link_table = false;
+
+	// Links which are registered, but not yet written as part of a RESOURCE_APPLICATION_LINK_TABLE blob.
+	std::vector<StateRecorderApplicationLink> pending_application_links;
+	std::unordered_set<Hash> registered_application_links;
+
+	// Feedback is combined per pipeline over the whole session, and written once when recording ends.
+	// Usage which has not been written yet. Every flush writes a new blob.
+	// Both are keyed by a per-recorder seed, so sessions do not collide.
+	std::unordered_map<Hash, PipelineFeedback> pending_pipeline_feedback;
+	std::unordered_map<Hash, StateRecorderPipelineUsage> pending_pipeline_usage;
+	Hash metadata_seed = 0;
+	uint64_t pipeline_usage_flush_count = 0;
+	bool logged_unrecorded_pipeline_feedback = false;
 
 	void record_task(StateRecorder *recorder, bool looping);
 
+	// Items of the batch which the recording thread is working through.
+	std::vector<WorkItem> record_batch;
+	size_t record_batch_index = 0;
+	bool pop_work_item(WorkItem &item);
+
 	template <typename T>
 	T *copy(const T *src, size_t count, ScratchAllocator &alloc);
 	bool copy_pnext_chain(const void *pNext, ScratchAllocator &alloc, const void **out_pnext) FOSSILIZE_WARN_UNUSED;
@@ -349,7 +924,7 @@ static inline T api_object_cast(U obj)
 
 namespace Hashing
 {
-static Hash compute_hash_application_info(const VkApplicationInfo &info)
+static Hash compute_hash_application_info(const VkApplicationInfo &info, HashScheme scheme)
 {
 	Hasher h;
 	h.u32(info.applicationVersion);
@@ -366,6 +941,11 @@ static Hash compute_hash_application_info(const VkApplicationInfo &info)
 	else
 		h.u32(0);
 
+	// Keeps application hashes of FNV-1 archives stable,
+	// while archives using any other scheme get their own application hash.
+	if (scheme != HASH_SCHEME_FNV1)
+		h.u32(scheme);
+
 	return h.get();
 }
 
@@ -377,11 +957,18 @@ static Hash compute_hash_physical_device_features(const VkPhysicalDeviceFeatures
 }
 
 StateRecorderApplicationFeatureHash compute_application_feature_hash(const VkApplicationInfo *info,
-                                                                     const VkPhysicalDeviceFeatures2 *features)
+                                                                     const VkPhysicalDeviceFeatures2 *features,
+                                                                     HashScheme scheme)
 {
 	StateRecorderApplicationFeatureHash hash = {};
 	if (info)
-		hash.application_info_hash = compute_hash_application_info(*info);
+		hash.application_info_hash = compute_hash_application_info(*info, scheme);
+	else if (scheme != HASH_SCHEME_FNV1)
+	{
+		Hasher h;
+		h.u32(scheme);
+		hash.application_info_hash = h.get();
+	}
 	if (features)
 		hash.physical_device_features_hash = compute_hash_physical_device_features(*features);
 	return hash;
@@ -419,9 +1006,9 @@ static Hash compute_hash_application_info_link(Hash app_hash, ResourceTag tag, H
 	return h.get();
 }
 
-bool compute_hash_sampler(const VkSamplerCreateInfo &sampler, Hash *out_hash)
+bool compute_hash_sampler(const VkSamplerCreateInfo &sampler, Hash *out_hash, HashScheme scheme)
 {
-	Hasher h;
+	Hasher h(scheme);
 
 	h.u32(sampler.flags);
 	h.f32(sampler.maxAnisotropy);
@@ -448,7 +1035,7 @@ static bool hash_pnext_chain(const StateRecorder *recorder, Hasher &h, const voi
 
 bool compute_hash_descriptor_set_layout(const StateRecorder &recorder, const VkDescriptorSetLayoutCreateInfo &layout, Hash *out_hash)
 {
-	Hasher h;
+	Hasher h(recorder.get_hash_scheme());
 
 	h.u32(layout.bindingCount);
 	h.u32(layout.flags);
@@ -483,7 +1070,7 @@ bool compute_hash_descriptor_set_layout(const StateRecorder &recorder, const VkD
 
 bool compute_hash_pipeline_layout(const StateRecorder &recorder, const VkPipelineLayoutCreateInfo &layout, Hash *out_hash)
 {
-	Hasher h;
+	Hasher h(recorder.get_hash_scheme());
 
 	h.u32(layout.setLayoutCount);
 	for (uint32_t i = 0; i < layout.setLayoutCount; i++)
@@ -514,9 +1101,9 @@ bool compute_hash_pipeline_layout(const StateRecorder &recorder, const VkPipelin
 	return true;
 }
 
-bool compute_hash_shader_module(const VkShaderModuleCreateInfo &create_info, Hash *out_hash)
+bool compute_hash_shader_module(const VkShaderModuleCreateInfo &create_info, Hash *out_hash, HashScheme scheme)
 {
-	Hasher h;
+	Hasher h(scheme);
 	h.data(create_info.pCode, create_info.codeSize);
 	h.u32(create_info.flags);
 	*out_hash = h.get();
@@ -692,7 +1279,7 @@ static bool hash_pnext_chain(const StateRecorder *recorder, Hasher &h, const voi
 
 bool compute_hash_graphics_pipeline(const StateRecorder &recorder, const VkGraphicsPipelineCreateInfo &create_info, Hash *out_hash)
 {
-	Hasher h;
+	Hasher h(recorder.get_hash_scheme());
 	Hash hash;
 
 	h.u32(create_info.flags);
@@ -1037,7 +1624,7 @@ bool compute_hash_graphics_pipeline(const StateRecorder &recorder, const VkGraph
 
 bool compute_hash_compute_pipeline(const StateRecorder &recorder, const VkComputePipelineCreateInfo &create_info, Hash *out_hash)
 {
-	Hasher h;
+	Hasher h(recorder.get_hash_scheme());
 	Hash hash;
 
 	if (!recorder.get_hash_for_pipeline_layout(create_info.layout, &hash))
@@ -1142,9 +1729,9 @@ static void hash_subpass(Hasher &h, const VkSubpassDescription &subpass)
 		h.u32(0);
 }
 
-bool compute_hash_render_pass(const VkRenderPassCreateInfo &create_info, Hash *out_hash)
+bool compute_hash_render_pass(const VkRenderPassCreateInfo &create_info, Hash *out_hash, HashScheme scheme)
 {
-	Hasher h;
+	Hasher h(scheme);
 
 	h.u32(create_info.attachmentCount);
 	h.u32(create_info.dependencyCount);
@@ -1174,6 +1761,41 @@ bool compute_hash_render_pass(const VkRenderPassCreateInfo &create_info, Hash *o
 	*out_hash = h.get();
 	return true;
 }
+
+const char *get_hash_scheme_name(HashScheme scheme)
+{
+	switch (scheme)
+	{
+	case HASH_SCHEME_FNV1:
+		return "fnv1";
+	case HASH_SCHEME_STRIPED:
+		return "striped";
+	default:
+		return "unknown";
+	}
+}
+
+bool parse_hash_scheme(const char *name, HashScheme *scheme)
+{
+	for (unsigned i = 0; i < HASH_SCHEME_COUNT; i++)
+	{
+		if (strcmp(name, get_hash_scheme_name(HashScheme(i))) == 0)
+		{
+			*scheme = HashScheme(i);
+			return true;
+		}
+	}
+
+	char *end = nullptr;
+	unsigned long value = strtoul(name, &end, 0);
+	if (end != name && *end == '\0' && value < HASH_SCHEME_COUNT)
+	{
+		*scheme = HashScheme(value);
+		return true;
+	}
+
+	return false;
+}
 }
 
 static uint8_t *decode_base64(ScratchAllocator &allocator, const char *data, size_t length)
@@ -1496,7 +2118,8 @@ bool StateReplayer::Impl::parse_descriptor_set_layouts(StateCreatorInterface &if
 	return true;
 }
 
-bool StateReplayer::Impl::parse_application_info(StateCreatorInterface &iface, const Value &app_info, const Value &pdf_info)
+bool StateReplayer::Impl::parse_application_info(StateCreatorInterface &iface, const Value &app_info, const Value &pdf_info,
+                                                 HashScheme scheme)
 {
 	if (app_info.HasMember("apiVersion") && pdf_info.HasMember("robustBufferAccess"))
 	{
@@ -1528,14 +2151,14 @@ bool StateReplayer::Impl::parse_application_info(StateCreatorInterface &iface, c
 
 		auto hash =
 				Hashing::compute_combined_application_feature_hash(
-						Hashing::compute_application_feature_hash(app, pdf));
+						Hashing::compute_application_feature_hash(app, pdf, scheme));
 		iface.set_application_info(hash, app, pdf);
 	}
 	else
 	{
 		auto hash =
 				Hashing::compute_combined_application_feature_hash(
-						Hashing::compute_application_feature_hash(nullptr, nullptr));
+						Hashing::compute_application_feature_hash(nullptr, nullptr, scheme));
 		iface.set_application_info(hash, nullptr, nullptr);
 	}
 
@@ -1552,77 +2175,232 @@ bool StateReplayer::Impl::parse_application_info_link(StateCreatorInterface &ifa
 	return true;
 }
 
-bool StateReplayer::Impl::parse_samplers(StateCreatorInterface &iface, const Value &samplers)
+bool StateReplayer::Impl::parse_application_link_table(StateCreatorInterface &iface, const Value &table,
+                                                        const uint8_t *buffer, size_t size)
 {
-	auto *infos = allocator.allocate_n_cleared<VkSamplerCreateInfo>(samplers.MemberCount());
+	Hash application_hash = string_to_uint64(table["application"].GetString());
+	uint64_t link_count = table["linkCount"].GetUint64();
 
-	unsigned index = 0;
-	for (auto itr = samplers.MemberBegin(); itr != samplers.MemberEnd(); ++itr)
+	if (!buffer || size / ApplicationLinkTableEntrySize < link_count)
 	{
-		Hash hash = string_to_uint64(itr->name.GetString());
-		if (replayed_samplers.count(hash))
-			continue;
-		auto &obj = itr->value;
-		auto &info = infos[index];
-		info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		LOGE("Application link table is truncated.\n");
+		return false;
+	}
 
-		info.addressModeU = static_cast<VkSamplerAddressMode>(obj["addressModeU"].GetUint());
-		info.addressModeV = static_cast<VkSamplerAddressMode>(obj["addressModeV"].GetUint());
-		info.addressModeW = static_cast<VkSamplerAddressMode>(obj["addressModeW"].GetUint());
-		info.anisotropyEnable = obj["anisotropyEnable"].GetUint();
-		info.borderColor = static_cast<VkBorderColor>(obj["borderColor"].GetUint());
-		info.compareEnable = obj["compareEnable"].GetUint();
-		info.compareOp = static_cast<VkCompareOp>(obj["compareOp"].GetUint());
-		info.flags = obj["flags"].GetUint();
-		info.magFilter = static_cast<VkFilter>(obj["magFilter"].GetUint());
-		info.minFilter = static_cast<VkFilter>(obj["minFilter"].GetUint());
-		info.maxAnisotropy = obj["maxAnisotropy"].GetFloat();
-		info.mipmapMode = static_cast<VkSamplerMipmapMode>(obj["mipmapMode"].GetUint());
-		info.maxLod = obj["maxLod"].GetFloat();
-		info.minLod = obj["minLod"].GetFloat();
-		info.mipLodBias = obj["mipLodBias"].GetFloat();
-		info.unnormalizedCoordinates = obj["unnormalizedCoordinates"].GetUint();
+	for (uint64_t i = 0; i < link_count; i++, buffer += ApplicationLinkTableEntrySize)
+	{
+		uint32_t tag = 0;
+		for (unsigned j = 0; j < 4; j++)
+			tag |= uint32_t(buffer[j]) << (8 * j);
+		Hash hash = 0;
+		for (unsigned j = 0; j < 8; j++)
+			hash |= Hash(buffer[4 + j]) << (8 * j);
 
-		if (!iface.enqueue_create_sampler(hash, &info, &replayed_samplers[hash]))
+		if (tag >= RESOURCE_COUNT)
 		{
-			LOGE("Failed to create sampler.\n");
+			LOGE("Invalid tag %u in application link table.\n", tag);
 			return false;
 		}
+
+		Hash link_hash = Hashing::compute_hash_application_info_link(application_hash, ResourceTag(tag), hash);
+		iface.notify_application_info_link(link_hash, application_hash, ResourceTag(tag), hash);
 	}
 
-	iface.notify_replayed_resources_for_type();
 	return true;
 }
 
-bool StateReplayer::Impl::parse_render_pass_attachments(const Value &attachments, const VkAttachmentDescription **out_attachments)
+bool StateReplayer::Impl::parse_pipeline_feedback(StateCreatorInterface &iface, const Value &feedback)
 {
-	auto *infos = allocator.allocate_n_cleared<VkAttachmentDescription>(attachments.Size());
-	auto *ret = infos;
-
-	for (auto itr = attachments.Begin(); itr != attachments.End(); ++itr, infos++)
+	PipelineFeedback info = {};
+	info.tag = ResourceTag(feedback["tag"].GetUint());
+	if (info.tag != RESOURCE_GRAPHICS_PIPELINE && info.tag != RESOURCE_COMPUTE_PIPELINE)
 	{
-		auto &obj = *itr;
-		infos->flags = obj["flags"].GetUint();
-		infos->finalLayout = static_cast<VkImageLayout>(obj["finalLayout"].GetUint());
-		infos->initialLayout = static_cast<VkImageLayout>(obj["initialLayout"].GetUint());
-		infos->format = static_cast<VkFormat>(obj["format"].GetUint());
-		infos->loadOp = static_cast<VkAttachmentLoadOp>(obj["loadOp"].GetUint());
-		infos->storeOp = static_cast<VkAttachmentStoreOp>(obj["storeOp"].GetUint());
-		infos->stencilLoadOp = static_cast<VkAttachmentLoadOp>(obj["stencilLoadOp"].GetUint());
-		infos->stencilStoreOp = static_cast<VkAttachmentStoreOp>(obj["stencilStoreOp"].GetUint());
-		infos->samples = static_cast<VkSampleCountFlagBits>(obj["samples"].GetUint());
+		LOGE("Invalid tag %u in pipeline feedback.\n", unsigned(info.tag));
+		return false;
 	}
 
-	*out_attachments = ret;
+	info.hash = string_to_uint64(feedback["hash"].GetString());
+	info.count = feedback["count"].GetUint64();
+	info.min_duration_ns = feedback["minDurationNs"].GetUint64();
+	info.max_duration_ns = feedback["maxDurationNs"].GetUint64();
+	info.total_duration_ns = feedback["totalDurationNs"].GetUint64();
+	info.valid_feedback_count = feedback["validFeedbackCount"].GetUint64();
+	info.cache_hit_count = feedback["cacheHitCount"].GetUint64();
+	info.base_pipeline_acceleration_count = feedback["basePipelineAccelerationCount"].GetUint64();
+	iface.notify_pipeline_feedback(info);
 	return true;
 }
 
-bool StateReplayer::Impl::parse_render_pass_dependencies(const Value &dependencies, const VkSubpassDependency **out_deps)
+bool StateReplayer::Impl::parse_pipeline_usage(StateCreatorInterface &iface, const Value &usage,
+                                                const uint8_t *buffer, size_t size)
 {
-	auto *infos = allocator.allocate_n_cleared<VkSubpassDependency>(dependencies.Size());
-	auto *ret = infos;
+	Hash application_hash = string_to_uint64(usage["application"].GetString());
+	uint64_t entry_count = usage["entryCount"].GetUint64();
 
-	for (auto itr = dependencies.Begin(); itr != dependencies.End(); ++itr, infos++)
+	if (!buffer || size / PipelineUsageEntrySize < entry_count)
+	{
+		LOGE("Pipeline usage is truncated.\n");
+		return false;
+	}
+
+	for (uint64_t i = 0; i < entry_count; i++, buffer += PipelineUsageEntrySize)
+	{
+		uint32_t tag = 0;
+		for (unsigned j = 0; j < 4; j++)
+			tag |= uint32_t(buffer[j]) << (8 * j);
+		Hash hash = 0;
+		for (unsigned j = 0; j < 8; j++)
+			hash |= Hash(buffer[4 + j]) << (8 * j);
+		uint64_t bind_count = 0;
+		for (unsigned j = 0; j < 8; j++)
+			bind_count |= uint64_t(buffer[12 + j]) << (8 * j);
+
+		if (tag != RESOURCE_GRAPHICS_PIPELINE && tag != RESOURCE_COMPUTE_PIPELINE)
+		{
+			LOGE("Invalid tag %u in pipeline usage.\n", tag);
+			return false;
+		}
+
+		iface.notify_pipeline_usage(application_hash, { ResourceTag(tag), hash, bind_count });
+	}
+
+	return true;
+}
+
+static uint64_t read_le(const uint8_t *buffer, unsigned bytes)
+{
+	uint64_t value = 0;
+	for (unsigned j = 0; j < bytes; j++)
+		value |= uint64_t(buffer[j]) << (8 * j);
+	return value;
+}
+
+bool StateReplayer::Impl::parse_pipeline_dependencies(StateCreatorInterface &iface, const Value &dependencies,
+                                                       const uint8_t *buffer, size_t size)
+{
+	uint64_t entry_count = dependencies["entryCount"].GetUint64();
+
+	if (!buffer || size / PipelineDependenciesEntrySize < entry_count)
+	{
+		LOGE("Pipeline dependencies are truncated.\n");
+		return false;
+	}
+
+	vector<Hash> modules;
+	for (uint64_t i = 0; i < entry_count; i++)
+	{
+		if (size < PipelineDependenciesEntrySize)
+		{
+			LOGE("Pipeline dependencies are truncated.\n");
+			return false;
+		}
+
+		PipelineDependencies deps = {};
+		uint32_t tag = uint32_t(read_le(buffer, 4));
+		deps.module_count = uint32_t(read_le(buffer + 4, 4));
+		deps.hash = read_le(buffer + 8, 8);
+		deps.layout = read_le(buffer + 16, 8);
+		deps.render_pass = read_le(buffer + 24, 8);
+		deps.base_pipeline = read_le(buffer + 32, 8);
+		buffer += PipelineDependenciesEntrySize;
+		size -= PipelineDependenciesEntrySize;
+
+		if (tag != RESOURCE_GRAPHICS_PIPELINE && tag != RESOURCE_COMPUTE_PIPELINE)
+		{
+			LOGE("Invalid tag %u in pipeline dependencies.\n", tag);
+			return false;
+		}
+		deps.tag = ResourceTag(tag);
+
+		if (size / sizeof(Hash) < deps.module_count)
+		{
+			LOGE("Pipeline dependencies are truncated.\n");
+			return false;
+		}
+
+		modules.resize(deps.module_count);
+		for (uint32_t j = 0; j < deps.module_count; j++, buffer += sizeof(Hash))
+			modules[j] = read_le(buffer, 8);
+		size -= deps.module_count * sizeof(Hash);
+		deps.modules = modules.data();
+
+		iface.notify_pipeline_dependencies(deps);
+	}
+
+	return true;
+}
+
+bool StateReplayer::Impl::parse_samplers(StateCreatorInterface &iface, const Value &samplers)
+{
+	auto *infos = allocator.allocate_n_cleared<VkSamplerCreateInfo>(samplers.MemberCount());
+
+	unsigned index = 0;
+	for (auto itr = samplers.MemberBegin(); itr != samplers.MemberEnd(); ++itr)
+	{
+		Hash hash = string_to_uint64(itr->name.GetString());
+		if (replayed_samplers.count(hash))
+			continue;
+		auto &obj = itr->value;
+		auto &info = infos[index];
+		info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+
+		info.addressModeU = static_cast<VkSamplerAddressMode>(obj["addressModeU"].GetUint());
+		info.addressModeV = static_cast<VkSamplerAddressMode>(obj["addressModeV"].GetUint());
+		info.addressModeW = static_cast<VkSamplerAddressMode>(obj["addressModeW"].GetUint());
+		info.anisotropyEnable = obj["anisotropyEnable"].GetUint();
+		info.borderColor = static_cast<VkBorderColor>(obj["borderColor"].GetUint());
+		info.compareEnable = obj["compareEnable"].GetUint();
+		info.compareOp = static_cast<VkCompareOp>(obj["compareOp"].GetUint());
+		info.flags = obj["flags"].GetUint();
+		info.magFilter = static_cast<VkFilter>(obj["magFilter"].GetUint());
+		info.minFilter = static_cast<VkFilter>(obj["minFilter"].GetUint());
+		info.maxAnisotropy = obj["maxAnisotropy"].GetFloat();
+		info.mipmapMode = static_cast<VkSamplerMipmapMode>(obj["mipmapMode"].GetUint());
+		info.maxLod = obj["maxLod"].GetFloat();
+		info.minLod = obj["minLod"].GetFloat();
+		info.mipLodBias = obj["mipLodBias"].GetFloat();
+		info.unnormalizedCoordinates = obj["unnormalizedCoordinates"].GetUint();
+
+		if (!iface.enqueue_create_sampler(hash, &info, &replayed_samplers[hash]))
+		{
+			LOGE("Failed to create sampler.\n");
+			return false;
+		}
+	}
+
+	iface.notify_replayed_resources_for_type();
+	return true;
+}
+
+bool StateReplayer::Impl::parse_render_pass_attachments(const Value &attachments, const VkAttachmentDescription **out_attachments)
+{
+	auto *infos = allocator.allocate_n_cleared<VkAttachmentDescription>(attachments.Size());
+	auto *ret = infos;
+
+	for (auto itr = attachments.Begin(); itr != attachments.End(); ++itr, infos++)
+	{
+		auto &obj = *itr;
+		infos->flags = obj["flags"].GetUint();
+		infos->finalLayout = static_cast<VkImageLayout>(obj["finalLayout"].GetUint());
+		infos->initialLayout = static_cast<VkImageLayout>(obj["initialLayout"].GetUint());
+		infos->format = static_cast<VkFormat>(obj["format"].GetUint());
+		infos->loadOp = static_cast<VkAttachmentLoadOp>(obj["loadOp"].GetUint());
+		infos->storeOp = static_cast<VkAttachmentStoreOp>(obj["storeOp"].GetUint());
+		infos->stencilLoadOp = static_cast<VkAttachmentLoadOp>(obj["stencilLoadOp"].GetUint());
+		infos->stencilStoreOp = static_cast<VkAttachmentStoreOp>(obj["stencilStoreOp"].GetUint());
+		infos->samples = static_cast<VkSampleCountFlagBits>(obj["samples"].GetUint());
+	}
+
+	*out_attachments = ret;
+	return true;
+}
+
+bool StateReplayer::Impl::parse_render_pass_dependencies(const Value &dependencies, const VkSubpassDependency **out_deps)
+{
+	auto *infos = allocator.allocate_n_cleared<VkSubpassDependency>(dependencies.Size());
+	auto *ret = infos;
+
+	for (auto itr = dependencies.Begin(); itr != dependencies.End(); ++itr, infos++)
 	{
 		auto &obj = *itr;
 		infos->dependencyFlags = obj["dependencyFlags"].GetUint();
@@ -2335,6 +3113,77 @@ bool StateReplayer::Impl::parse_stages(StateCreatorInterface &iface, DatabaseInt
 	return true;
 }
 
+bool StateReplayer::Impl::parse_pipeline_sub_states(const Value &sub_states)
+{
+	for (auto itr = sub_states.MemberBegin(); itr != sub_states.MemberEnd(); ++itr)
+	{
+		Hash hash = string_to_uint64(itr->name.GetString());
+		if (interned_sub_states.count(hash))
+			continue;
+
+		Value state;
+		state.CopyFrom(itr->value, interned_sub_state_allocator);
+		interned_sub_states.emplace(hash, std::move(state));
+	}
+
+	return true;
+}
+
+bool StateReplayer::Impl::resolve_pipeline_sub_state(StateCreatorInterface &iface, DatabaseInterface *resolver,
+                                                     Hash pipeline_hash, const char *name, const Value &value,
+                                                     const Value **out_state)
+{
+	if (!value.IsString())
+	{
+		*out_state = &value;
+		return true;
+	}
+
+	Hash hash = string_to_uint64(value.GetString());
+	iface.notify_pipeline_sub_state(pipeline_hash, hash);
+
+	auto itr = interned_sub_states.find(hash);
+	if (itr == end(interned_sub_states))
+	{
+		size_t external_state_size = 0;
+		if (!resolver || !resolver->read_entry(RESOURCE_PIPELINE_SUB_STATE, hash, &external_state_size, nullptr,
+		                                       PAYLOAD_READ_NO_FLAGS))
+		{
+			log_missing_resource("Pipeline sub-state", hash);
+			return false;
+		}
+
+		vector<uint8_t> external_state(external_state_size);
+
+		if (!resolver->read_entry(RESOURCE_PIPELINE_SUB_STATE, hash, &external_state_size, external_state.data(),
+		                          PAYLOAD_READ_NO_FLAGS))
+		{
+			log_missing_resource("Pipeline sub-state", hash);
+			return false;
+		}
+
+		if (!this->parse(iface, resolver, external_state.data(), external_state.size()))
+			return false;
+
+		itr = interned_sub_states.find(hash);
+		if (itr == end(interned_sub_states))
+		{
+			log_missing_resource("Pipeline sub-state", hash);
+			return false;
+		}
+	}
+
+	auto state_itr = itr->second.FindMember(name);
+	if (state_itr == itr->second.MemberEnd())
+	{
+		LOGE("Pipeline sub-state %016" PRIx64 " does not contain %s.\n", hash, name);
+		return false;
+	}
+
+	*out_state = &state_itr->value;
+	return true;
+}
+
 bool StateReplayer::Impl::parse_graphics_pipeline(StateCreatorInterface &iface, DatabaseInterface *resolver, const Value &pipelines, const Value &member)
 {
 	Hash hash = string_to_uint64(member.GetString());
@@ -2450,41 +3299,71 @@ bool StateReplayer::Impl::parse_graphics_pipeline(StateCreatorInterface &iface,
 			return false;
 	}
 
+	// Fixed-function state is either inline, or a reference to an interned sub-state.
+	const Value *state;
+
 	if (obj.HasMember("rasterizationState"))
-		if (!parse_rasterization_state(obj["rasterizationState"], &info.pRasterizationState))
+	{
+		if (!resolve_pipeline_sub_state(iface, resolver, hash, "rasterizationState", obj["rasterizationState"], &state) ||
+		    !parse_rasterization_state(*state, &info.pRasterizationState))
 			return false;
+	}
 
 	if (obj.HasMember("tessellationState"))
-		if (!parse_tessellation_state(obj["tessellationState"], &info.pTessellationState))
+	{
+		if (!resolve_pipeline_sub_state(iface, resolver, hash, "tessellationState", obj["tessellationState"], &state) ||
+		    !parse_tessellation_state(*state, &info.pTessellationState))
 			return false;
+	}
 
 	if (obj.HasMember("colorBlendState"))
-		if (!parse_color_blend_state(obj["colorBlendState"], &info.pColorBlendState))
+	{
+		if (!resolve_pipeline_sub_state(iface, resolver, hash, "colorBlendState", obj["colorBlendState"], &state) ||
+		    !parse_color_blend_state(*state, &info.pColorBlendState))
 			return false;
+	}
 
 	if (obj.HasMember("depthStencilState"))
-		if (!parse_depth_stencil_state(obj["depthStencilState"], &info.pDepthStencilState))
+	{
+		if (!resolve_pipeline_sub_state(iface, resolver, hash, "depthStencilState", obj["depthStencilState"], &state) ||
+		    !parse_depth_stencil_state(*state, &info.pDepthStencilState))
 			return false;
+	}
 
 	if (obj.HasMember("dynamicState"))
-		if (!parse_dynamic_state(obj["dynamicState"], &info.pDynamicState))
+	{
+		if (!resolve_pipeline_sub_state(iface, resolver, hash, "dynamicState", obj["dynamicState"], &state) ||
+		    !parse_dynamic_state(*state, &info.pDynamicState))
 			return false;
+	}
 
 	if (obj.HasMember("viewportState"))
-		if (!parse_viewport_state(obj["viewportState"], &info.pViewportState))
+	{
+		if (!resolve_pipeline_sub_state(iface, resolver, hash, "viewportState", obj["viewportState"], &state) ||
+		    !parse_viewport_state(*state, &info.pViewportState))
 			return false;
+	}
 
 	if (obj.HasMember("multisampleState"))
-		 if (!parse_multisample_state(obj["multisampleState"], &info.pMultisampleState))
-		 	return false;
+	{
+		if (!resolve_pipeline_sub_state(iface, resolver, hash, "multisampleState", obj["multisampleState"], &state) ||
+		    !parse_multisample_state(*state, &info.pMultisampleState))
+			return false;
+	}
 
 	if (obj.HasMember("inputAssemblyState"))
-		if (!parse_input_assembly_state(obj["inputAssemblyState"], &info.pInputAssemblyState))
+	{
+		if (!resolve_pipeline_sub_state(iface, resolver, hash, "inputAssemblyState", obj["inputAssemblyState"], &state) ||
+		    !parse_input_assembly_state(*state, &info.pInputAssemblyState))
 			return false;
+	}
 
 	if (obj.HasMember("vertexInputState"))
-		if (!parse_vertex_input_state(obj["vertexInputState"], &info.pVertexInputState))
+	{
+		if (!resolve_pipeline_sub_state(iface, resolver, hash, "vertexInputState", obj["vertexInputState"], &state) ||
+		    !parse_vertex_input_state(*state, &info.pVertexInputState))
 			return false;
+	}
 
 	if (!iface.enqueue_create_graphics_pipeline(hash, &info, &replayed_graphics_pipelines[hash]))
 	{
@@ -2868,15 +3747,30 @@ bool StateReplayer::Impl::parse(StateCreatorInterface &iface, DatabaseInterface
 	}
 
 	int version = doc["version"].GetInt();
-	if (version > FOSSILIZE_FORMAT_VERSION || version < FOSSILIZE_FORMAT_MIN_COMPAT_VERSION)
+	if (version > FOSSILIZE_FORMAT_MAX_VERSION || version < FOSSILIZE_FORMAT_MIN_COMPAT_VERSION)
 	{
 		LOGE("JSON version mismatches.");
 		return false;
 	}
 
 	if (doc.HasMember("applicationInfo") && doc.HasMember("physicalDeviceFeatures"))
-		if (!parse_application_info(iface, doc["applicationInfo"], doc["physicalDeviceFeatures"]))
+	{
+		// Archives which predate hash schemes are implicitly FNV-1.
+		auto scheme = HASH_SCHEME_FNV1;
+		if (doc.HasMember("hashScheme"))
+		{
+			unsigned value = doc["hashScheme"].GetUint();
+			if (value >= HASH_SCHEME_COUNT)
+			{
+				LOGE("Unknown hash scheme %u.\n", value);
+				return false;
+			}
+			scheme = HashScheme(value);
+		}
+
+		if (!parse_application_info(iface, doc["applicationInfo"], doc["physicalDeviceFeatures"], scheme))
 			return false;
+	}
 
 	if (doc.HasMember("application"))
 		iface.set_current_application_info(string_to_uint64(doc["application"].GetString()));
@@ -2885,6 +3779,22 @@ bool StateReplayer::Impl::parse(StateCreatorInterface &iface, DatabaseInterface
 		if (!parse_application_info_link(iface, doc["link"]))
 			return false;
 
+	if (doc.HasMember("applicationLinkTable"))
+		if (!parse_application_link_table(iface, doc["applicationLinkTable"], varint_buffer, varint_size))
+			return false;
+
+	if (doc.HasMember("pipelineFeedback"))
+		if (!parse_pipeline_feedback(iface, doc["pipelineFeedback"]))
+			return false;
+
+	if (doc.HasMember("pipelineUsage"))
+		if (!parse_pipeline_usage(iface, doc["pipelineUsage"], varint_buffer, varint_size))
+			return false;
+
+	if (doc.HasMember("pipelineDependencies"))
+		if (!parse_pipeline_dependencies(iface, doc["pipelineDependencies"], varint_buffer, varint_size))
+			return false;
+
 	if (doc.HasMember("shaderModules"))
 		if (!parse_shader_modules(iface, doc["shaderModules"], varint_buffer, varint_size))
 			return false;
@@ -2909,6 +3819,10 @@ bool StateReplayer::Impl::parse(StateCreatorInterface &iface, DatabaseInterface
 		if (!parse_compute_pipelines(iface, resolver, doc["computePipelines"]))
 			return false;
 
+	if (doc.HasMember("pipelineSubStates"))
+		if (!parse_pipeline_sub_states(doc["pipelineSubStates"]))
+			return false;
+
 	if (doc.HasMember("graphicsPipelines"))
 		if (!parse_graphics_pipelines(iface, resolver, doc["graphicsPipelines"]))
 			return false;
@@ -3188,11 +4102,17 @@ void ScratchAllocator::reset()
 	}
 }
 
-size_t ScratchAllocator::get_peak_memory_consumption() const
+size_t ScratchAllocator::get_memory_consumption() const
 {
 	size_t current_size = 0;
 	for (auto &block : impl->blocks)
 		current_size += block.blob.size();
+	return current_size;
+}
+
+size_t ScratchAllocator::get_peak_memory_consumption() const
+{
+	size_t current_size = get_memory_consumption();
 
 	if (impl->peak_history_size > current_size)
 		return impl->peak_history_size;
@@ -3215,6 +4135,96 @@ void StateRecorder::set_database_enable_compression(bool enable)
 	impl->compression = enable;
 }
 
+void StateRecorder::set_database_enable_sub_state_interning(bool enable)
+{
+	impl->intern_sub_states = enable;
+}
+
+void StateRecorder::set_database_enable_application_link_table(bool enable)
+{
+	impl->application_link_table = enable;
+}
+
+void StateRecorder::set_database_worker_thread_count(unsigned count)
+{
+	impl->record_worker_count = count;
+}
+
+void StateRecorder::set_database_enable_early_duplicate_check(bool enable)
+{
+	impl->early_duplicate_check = enable;
+}
+
+void StateRecorder::set_staging_memory_budget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(impl->staging_arena_lock);
+	impl->staging_memory_budget = bytes;
+}
+
+size_t StateRecorder::get_peak_staging_memory_consumption() const
+{
+	std::lock_guard<std::mutex> lock(impl->staging_arena_lock);
+	return impl->peak_pinned_staging_memory;
+}
+
+void StateRecorder::set_database_rate_limit(uint32_t objects_per_second, uint64_t bytes_per_second)
+{
+	impl->rate_limit_objects = objects_per_second;
+	impl->rate_limit_bytes = bytes_per_second;
+}
+
+void StateRecorder::set_database_sampling(uint32_t slice, uint32_t slice_count)
+{
+	if (slice_count == 0 || slice >= slice_count)
+	{
+		LOGE("Sampling slice %u is out of range for %u slices, recording everything.\n", slice, slice_count);
+		slice = 0;
+		slice_count = 1;
+	}
+
+	impl->sampling_slice = slice;
+	impl->sampling_slice_count = slice_count;
+}
+
+void StateRecorder::set_enable_statistics(bool enable)
+{
+	impl->statistics = enable;
+	impl->statistics_start = std::chrono::steady_clock::now();
+	impl->next_statistics_sample = impl->statistics_start;
+}
+
+void StateRecorder::get_statistics(StateRecorderStatistics *stats) const
+{
+	std::lock_guard<std::mutex> lock(impl->statistics_lock);
+	*stats = impl->published_statistics;
+}
+
+void StateRecorder::get_queue_depth_samples(size_t *count, StateRecorderQueueDepthSample *samples) const
+{
+	std::lock_guard<std::mutex> lock(impl->statistics_lock);
+	if (samples)
+	{
+		size_t to_copy = std::min(*count, impl->queue_depth_samples.size());
+		std::copy(impl->queue_depth_samples.begin(), impl->queue_depth_samples.begin() + to_copy, samples);
+		*count = to_copy;
+	}
+	else
+		*count = impl->queue_depth_samples.size();
+}
+
+void StateRecorder::set_hash_scheme(HashScheme scheme)
+{
+	std::lock_guard<std::mutex> lock(impl->record_lock);
+	impl->hash_scheme = scheme;
+	impl->application_feature_hash.application_info_hash =
+			Hashing::compute_application_feature_hash(impl->application_info, nullptr, scheme).application_info_hash;
+}
+
+HashScheme StateRecorder::get_hash_scheme() const
+{
+	return impl->hash_scheme;
+}
+
 bool StateRecorder::record_application_info(const VkApplicationInfo &info)
 {
 	if (info.pNext)
@@ -3226,7 +4236,8 @@ bool StateRecorder::record_application_info(const VkApplicationInfo &info)
 	std::lock_guard<std::mutex> lock(impl->record_lock);
 	if (!impl->copy_application_info(&info, impl->allocator, &impl->application_info))
 		return false;
-	impl->application_feature_hash.application_info_hash = Hashing::compute_hash_application_info(*impl->application_info);
+	impl->application_feature_hash.application_info_hash =
+			Hashing::compute_hash_application_info(*impl->application_info, impl->hash_scheme);
 	return true;
 }
 
@@ -3265,14 +4276,26 @@ bool StateRecorder::record_sampler(VkSampler sampler, const VkSamplerCreateInfo
 			log_error_pnext_chain("pNext in VkSamplerCreateInfo not supported.", create_info.pNext);
 			return false;
 		}
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+
+		// Objects the database already has are not copied. The hash is reused by the recording thread otherwise.
+		auto *known = impl->known_hashes.load(std::memory_order_acquire);
+		if (known && (custom_hash != 0 || Hashing::compute_hash_sampler(create_info, &custom_hash, impl->hash_scheme)) &&
+		    known->contains(RESOURCE_SAMPLER, custom_hash))
+		{
+			impl->push_known_work_item(RESOURCE_SAMPLER, api_object_cast<uint64_t>(sampler), custom_hash);
+			return true;
+		}
+
+		auto *arena = impl->acquire_staging_arena();
 
 		VkSamplerCreateInfo *new_info = nullptr;
-		if (!impl->copy_sampler(&create_info, impl->temp_allocator, &new_info))
+		if (!impl->copy_sampler(&create_info, arena->allocator, &new_info))
+		{
+			impl->release_staging_arena(arena, 0);
 			return false;
+		}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(sampler), new_info, custom_hash});
-		impl->record_cv.notify_one();
+		impl->push_work_item({api_object_cast<uint64_t>(sampler), new_info, custom_hash, arena});
 	}
 
 	// Thread is not running, drain the queue ourselves.
@@ -3286,14 +4309,16 @@ bool StateRecorder::record_descriptor_set_layout(VkDescriptorSetLayout set_layou
                                                  Hash custom_hash)
 {
 	{
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+		auto *arena = impl->acquire_staging_arena();
 
 		VkDescriptorSetLayoutCreateInfo *new_info = nullptr;
-		if (!impl->copy_descriptor_set_layout(&create_info, impl->temp_allocator, &new_info))
+		if (!impl->copy_descriptor_set_layout(&create_info, arena->allocator, &new_info))
+		{
+			impl->release_staging_arena(arena, 0);
 			return false;
+		}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(set_layout), new_info, custom_hash});
-		impl->record_cv.notify_one();
+		impl->push_work_item({api_object_cast<uint64_t>(set_layout), new_info, custom_hash, arena});
 	}
 
 	// Thread is not running, drain the queue ourselves.
@@ -3312,14 +4337,16 @@ bool StateRecorder::record_pipeline_layout(VkPipelineLayout pipeline_layout, con
 			log_error_pnext_chain("pNext in VkPipelineLayoutCreateInfo not supported.", create_info.pNext);
 			return false;
 		}
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+		auto *arena = impl->acquire_staging_arena();
 
 		VkPipelineLayoutCreateInfo *new_info = nullptr;
-		if (!impl->copy_pipeline_layout(&create_info, impl->temp_allocator, &new_info))
+		if (!impl->copy_pipeline_layout(&create_info, arena->allocator, &new_info))
+		{
+			impl->release_staging_arena(arena, 0);
 			return false;
+		}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(pipeline_layout), new_info, custom_hash});
-		impl->record_cv.notify_one();
+		impl->push_work_item({api_object_cast<uint64_t>(pipeline_layout), new_info, custom_hash, arena});
 	}
 
 	// Thread is not running, drain the queue ourselves.
@@ -3339,14 +4366,16 @@ bool StateRecorder::record_graphics_pipeline(VkPipeline pipeline, const VkGraphi
 			log_error_pnext_chain("pNext in VkGraphicsPipelineCreateInfo not supported.", create_info.pNext);
 			return false;
 		}
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+		auto *arena = impl->acquire_staging_arena();
 
 		VkGraphicsPipelineCreateInfo *new_info = nullptr;
-		if (!impl->copy_graphics_pipeline(&create_info, impl->temp_allocator, base_pipelines, base_pipeline_count, &new_info))
+		if (!impl->copy_graphics_pipeline(&create_info, arena->allocator, base_pipelines, base_pipeline_count, &new_info))
+		{
+			impl->release_staging_arena(arena, 0);
 			return false;
+		}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(pipeline), new_info, custom_hash});
-		impl->record_cv.notify_one();
+		impl->push_work_item({api_object_cast<uint64_t>(pipeline), new_info, custom_hash, arena});
 	}
 
 	// Thread is not running, drain the queue ourselves.
@@ -3366,14 +4395,16 @@ bool StateRecorder::record_compute_pipeline(VkPipeline pipeline, const VkCompute
 			log_error_pnext_chain("pNext in VkComputePipelineCreateInfo not supported.", create_info.pNext);
 			return false;
 		}
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+		auto *arena = impl->acquire_staging_arena();
 
 		VkComputePipelineCreateInfo *new_info = nullptr;
-		if (!impl->copy_compute_pipeline(&create_info, impl->temp_allocator, base_pipelines, base_pipeline_count, &new_info))
+		if (!impl->copy_compute_pipeline(&create_info, arena->allocator, base_pipelines, base_pipeline_count, &new_info))
+		{
+			impl->release_staging_arena(arena, 0);
 			return false;
+		}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(pipeline), new_info, custom_hash});
-		impl->record_cv.notify_one();
+		impl->push_work_item({api_object_cast<uint64_t>(pipeline), new_info, custom_hash, arena});
 	}
 
 	// Thread is not running, drain the queue ourselves.
@@ -3383,18 +4414,118 @@ bool StateRecorder::record_compute_pipeline(VkPipeline pipeline, const VkCompute
 	return true;
 }
 
+bool StateRecorder::record_graphics_pipelines(const VkPipeline *pipelines, const VkGraphicsPipelineCreateInfo *create_infos,
+                                              uint32_t count)
+{
+	bool ret = true;
+	{
+		auto *arena = impl->acquire_staging_arena();
+		auto *batch = arena->allocator.allocate<WorkItemBatch>();
+		auto *items = arena->allocator.allocate_n<WorkItem>(count);
+		if (!batch || (count && !items))
+		{
+			impl->release_staging_arena(arena, 0);
+			return false;
+		}
+		batch->items = items;
+		batch->count = 0;
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (create_infos[i].pNext)
+			{
+				log_error_pnext_chain("pNext in VkGraphicsPipelineCreateInfo not supported.", create_infos[i].pNext);
+				ret = false;
+				continue;
+			}
+
+			VkGraphicsPipelineCreateInfo *new_info = nullptr;
+			if (!impl->copy_graphics_pipeline(&create_infos[i], arena->allocator, pipelines, count, &new_info))
+			{
+				ret = false;
+				continue;
+			}
+
+			batch->items[batch->count++] = { api_object_cast<uint64_t>(pipelines[i]), new_info, 0, arena };
+		}
+
+		impl->push_work_item_batch(arena, batch);
+	}
+
+	// Thread is not running, drain the queue ourselves.
+	if (!impl->worker_thread.joinable())
+		impl->record_task(this, false);
+
+	return ret;
+}
+
+bool StateRecorder::record_compute_pipelines(const VkPipeline *pipelines, const VkComputePipelineCreateInfo *create_infos,
+                                             uint32_t count)
+{
+	bool ret = true;
+	{
+		auto *arena = impl->acquire_staging_arena();
+		auto *batch = arena->allocator.allocate<WorkItemBatch>();
+		auto *items = arena->allocator.allocate_n<WorkItem>(count);
+		if (!batch || (count && !items))
+		{
+			impl->release_staging_arena(arena, 0);
+			return false;
+		}
+		batch->items = items;
+		batch->count = 0;
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (create_infos[i].pNext)
+			{
+				log_error_pnext_chain("pNext in VkComputePipelineCreateInfo not supported.", create_infos[i].pNext);
+				ret = false;
+				continue;
+			}
+
+			VkComputePipelineCreateInfo *new_info = nullptr;
+			if (!impl->copy_compute_pipeline(&create_infos[i], arena->allocator, pipelines, count, &new_info))
+			{
+				ret = false;
+				continue;
+			}
+
+			batch->items[batch->count++] = { api_object_cast<uint64_t>(pipelines[i]), new_info, 0, arena };
+		}
+
+		impl->push_work_item_batch(arena, batch);
+	}
+
+	// Thread is not running, drain the queue ourselves.
+	if (!impl->worker_thread.joinable())
+		impl->record_task(this, false);
+
+	return ret;
+}
+
 bool StateRecorder::record_render_pass(VkRenderPass render_pass, const VkRenderPassCreateInfo &create_info,
                                        Hash custom_hash)
 {
 	{
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+		auto *known = impl->known_hashes.load(std::memory_order_acquire);
+		if (known && (custom_hash != 0 || Hashing::compute_hash_render_pass(create_info, &custom_hash, impl->hash_scheme)) &&
+		    known->contains(RESOURCE_RENDER_PASS, custom_hash))
+		{
+			impl->push_known_work_item(RESOURCE_RENDER_PASS, api_object_cast<uint64_t>(render_pass), custom_hash);
+			return true;
+		}
+
+		auto *arena = impl->acquire_staging_arena();
 
 		VkRenderPassCreateInfo *new_info = nullptr;
-		if (!impl->copy_render_pass(&create_info, impl->temp_allocator, &new_info))
+		if (!impl->copy_render_pass(&create_info, arena->allocator, &new_info))
+		{
+			impl->release_staging_arena(arena, 0);
 			return false;
+		}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(render_pass), new_info, custom_hash});
-		impl->record_cv.notify_one();
+		impl->push_work_item({api_object_cast<uint64_t>(render_pass), new_info, custom_hash, arena});
 	}
 
 	// Thread is not running, drain the queue ourselves.
@@ -3413,14 +4544,85 @@ bool StateRecorder::record_shader_module(VkShaderModule module, const VkShaderMo
 			log_error_pnext_chain("pNext in VkShaderModuleCreateInfo not supported.", create_info.pNext);
 			return false;
 		}
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+
+		auto *known = impl->known_hashes.load(std::memory_order_acquire);
+		if (known && (custom_hash != 0 || Hashing::compute_hash_shader_module(create_info, &custom_hash, impl->hash_scheme)) &&
+		    known->contains(RESOURCE_SHADER_MODULE, custom_hash))
+		{
+			impl->push_known_work_item(RESOURCE_SHADER_MODULE, api_object_cast<uint64_t>(module), custom_hash);
+			return true;
+		}
+
+		auto *arena = impl->acquire_staging_arena();
 
 		VkShaderModuleCreateInfo *new_info = nullptr;
-		if (!impl->copy_shader_module(&create_info, impl->temp_allocator, &new_info))
+		if (!impl->copy_shader_module(&create_info, arena->allocator, &new_info))
+		{
+			impl->release_staging_arena(arena, 0);
+			return false;
+		}
+
+		impl->push_work_item({api_object_cast<uint64_t>(module), new_info, custom_hash, arena});
+	}
+
+	// Thread is not running, drain the queue ourselves.
+	if (!impl->worker_thread.joinable())
+		impl->record_task(this, false);
+
+	return true;
+}
+
+bool StateRecorder::record_pipeline_creation_feedback(VkPipeline pipeline, const VkPipelineCreationFeedbackEXT &feedback)
+{
+	{
+		auto *arena = impl->acquire_staging_arena();
+
+		// The work item is identified by sType like any other create info.
+		auto *info = arena->allocator.allocate_cleared<VkPipelineCreationFeedbackCreateInfoEXT>();
+		auto *pipeline_feedback = arena->allocator.allocate<VkPipelineCreationFeedbackEXT>();
+		if (!info || !pipeline_feedback)
+		{
+			impl->release_staging_arena(arena, 0);
+			return false;
+		}
+
+		*pipeline_feedback = feedback;
+		info->sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+		info->pPipelineCreationFeedback = pipeline_feedback;
+		impl->push_work_item({api_object_cast<uint64_t>(pipeline), info, 0, arena});
+	}
+
+	// Thread is not running, drain the queue ourselves.
+	if (!impl->worker_thread.joinable())
+		impl->record_task(this, false);
+
+	return true;
+}
+
+bool StateRecorder::record_pipeline_usage(const VkPipeline *pipelines, const uint32_t *bind_counts, uint32_t count)
+{
+	if (count == 0)
+		return true;
+
+	{
+		auto *arena = impl->acquire_staging_arena();
+
+		auto *batch = arena->allocator.allocate<PipelineUsageBatch>();
+		auto *new_pipelines = arena->allocator.allocate_n<VkPipeline>(count);
+		auto *new_counts = arena->allocator.allocate_n<uint32_t>(count);
+		if (!batch || !new_pipelines || !new_counts)
+		{
+			impl->release_staging_arena(arena, 0);
 			return false;
+		}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(module), new_info, custom_hash});
-		impl->record_cv.notify_one();
+		memcpy(new_pipelines, pipelines, count * sizeof(*pipelines));
+		memcpy(new_counts, bind_counts, count * sizeof(*bind_counts));
+		*batch = { new_pipelines, new_counts, count };
+
+		WorkItem item = { 0, batch, 0, arena };
+		item.usage = true;
+		impl->push_work_item(item);
 	}
 
 	// Thread is not running, drain the queue ourselves.
@@ -3430,12 +4632,708 @@ bool StateRecorder::record_shader_module(VkShaderModule module, const VkShaderMo
 	return true;
 }
 
+void StateRecorder::forget_descriptor_set_layout(VkDescriptorSetLayout set_layout)
+{
+	// Goes through the queue, so objects created before the destroy call are still resolved.
+	impl->push_forget_work_item(RESOURCE_DESCRIPTOR_SET_LAYOUT, api_object_cast<uint64_t>(set_layout));
+	if (!impl->worker_thread.joinable())
+		impl->record_task(this, false);
+}
+
+void StateRecorder::forget_pipeline_layout(VkPipelineLayout pipeline_layout)
+{
+	impl->push_forget_work_item(RESOURCE_PIPELINE_LAYOUT, api_object_cast<uint64_t>(pipeline_layout));
+	if (!impl->worker_thread.joinable())
+		impl->record_task(this, false);
+}
+
+void StateRecorder::forget_shader_module(VkShaderModule module)
+{
+	impl->push_forget_work_item(RESOURCE_SHADER_MODULE, api_object_cast<uint64_t>(module));
+	if (!impl->worker_thread.joinable())
+		impl->record_task(this, false);
+}
+
+void StateRecorder::forget_pipeline(VkPipeline pipeline)
+{
+	impl->push_forget_work_item(RESOURCE_GRAPHICS_PIPELINE, api_object_cast<uint64_t>(pipeline));
+	if (!impl->worker_thread.joinable())
+		impl->record_task(this, false);
+}
+
+void StateRecorder::forget_render_pass(VkRenderPass render_pass)
+{
+	impl->push_forget_work_item(RESOURCE_RENDER_PASS, api_object_cast<uint64_t>(render_pass));
+	if (!impl->worker_thread.joinable())
+		impl->record_task(this, false);
+}
+
+void StateRecorder::forget_sampler(VkSampler sampler)
+{
+	impl->push_forget_work_item(RESOURCE_SAMPLER, api_object_cast<uint64_t>(sampler));
+	if (!impl->worker_thread.joinable())
+		impl->record_task(this, false);
+}
+
 void StateRecorder::Impl::record_end()
 {
 	// Signal end of recording with empty work item
-	std::lock_guard<std::mutex> lock(record_lock);
-	record_queue.push({ 0, nullptr, 0 });
-	record_cv.notify_one();
+	if (statistics)
+		queued_work_items.fetch_add(1, std::memory_order_relaxed);
+	record_queue.push({ 0, nullptr, 0, nullptr });
+}
+
+StagingArena *StateRecorder::Impl::acquire_staging_arena()
+{
+	std::unique_lock<std::mutex> lock(staging_arena_lock);
+
+	// Backpressure. Only wait while there is a recording thread which will eventually unpin memory.
+	if (staging_memory_budget != 0)
+	{
+		staging_memory_cv.wait(lock, [this]() {
+			return pinned_staging_memory <= staging_memory_budget || !staging_memory_consumer_active;
+		});
+	}
+
+	if (free_staging_arenas.empty())
+	{
+		staging_arenas.emplace_back(new StagingArena);
+		free_staging_arenas.push_back(staging_arenas.back().get());
+	}
+
+	auto *arena = free_staging_arenas.back();
+	free_staging_arenas.pop_back();
+	arena->acquired = true;
+	return arena;
+}
+
+void StateRecorder::Impl::release_staging_arena(StagingArena *arena, unsigned queued_items)
+{
+	std::lock_guard<std::mutex> lock(staging_arena_lock);
+	arena->acquired = false;
+
+	if (queued_items)
+	{
+		size_t memory = arena->allocator.get_memory_consumption();
+		pinned_staging_memory += memory - arena->pinned_memory;
+		arena->pinned_memory = memory;
+		if (pinned_staging_memory > peak_pinned_staging_memory)
+			peak_pinned_staging_memory = pinned_staging_memory;
+
+		// Bounds how much memory an arena can pin while the recording thread is busy.
+		arena->pending_items += queued_items;
+		if (arena->pending_items >= MaxStagingArenaItems)
+		{
+			arena->sealed = true;
+			return;
+		}
+	}
+	else if (arena->pending_items == 0)
+	{
+		arena->allocator.reset();
+		unpin_staging_memory(arena);
+	}
+
+	free_staging_arenas.push_back(arena);
+}
+
+void StateRecorder::Impl::retire_staging_arena_item(StagingArena *arena)
+{
+	std::lock_guard<std::mutex> lock(staging_arena_lock);
+	assert(arena->pending_items != 0);
+	if (--arena->pending_items != 0 || arena->acquired)
+		return;
+
+	arena->allocator.reset();
+	unpin_staging_memory(arena);
+	if (arena->sealed)
+	{
+		arena->sealed = false;
+		free_staging_arenas.push_back(arena);
+	}
+}
+
+void StateRecorder::Impl::unpin_staging_memory(StagingArena *arena)
+{
+	if (arena->pinned_memory == 0)
+		return;
+
+	pinned_staging_memory -= arena->pinned_memory;
+	arena->pinned_memory = 0;
+	if (staging_memory_budget != 0)
+		staging_memory_cv.notify_all();
+}
+
+void StateRecorder::Impl::set_staging_memory_consumer_active(bool active)
+{
+	{
+		std::lock_guard<std::mutex> lock(staging_arena_lock);
+		staging_memory_consumer_active = active;
+	}
+	staging_memory_cv.notify_all();
+}
+
+void StateRecorder::Impl::push_work_item(const WorkItem &item)
+{
+	// Account for the item before it becomes visible to the recording thread.
+	release_staging_arena(item.arena, 1);
+	if (statistics)
+		queued_work_items.fetch_add(1, std::memory_order_relaxed);
+	record_queue.push(item);
+}
+
+void StateRecorder::Impl::push_work_item_batch(StagingArena *arena, WorkItemBatch *batch)
+{
+	release_staging_arena(arena, batch->count);
+	if (batch->count == 0)
+		return;
+
+	if (statistics)
+		queued_work_items.fetch_add(batch->count, std::memory_order_relaxed);
+	WorkItem item = { 0, batch, 0, arena };
+	item.batch = true;
+	record_queue.push(item);
+}
+
+bool StateRecorder::Impl::pop_work_item(WorkItem &item)
+{
+	if (record_batch_index < record_batch.size())
+	{
+		item = record_batch[record_batch_index++];
+		return true;
+	}
+
+	if (!record_queue.try_pop(item))
+		return false;
+	if (!item.batch)
+		return true;
+
+	auto *batch = static_cast<WorkItemBatch *>(item.create_info);
+	record_batch.assign(batch->items, batch->items + batch->count);
+	record_batch_index = 0;
+	item = record_batch[record_batch_index++];
+	return true;
+}
+
+void StateRecorder::Impl::push_known_work_item(ResourceTag tag, uint64_t handle, Hash hash)
+{
+	if (statistics)
+		queued_work_items.fetch_add(1, std::memory_order_relaxed);
+	record_queue.push({ handle, nullptr, hash, nullptr, tag });
+}
+
+void StateRecorder::Impl::record_known_object(const WorkItem &item)
+{
+	switch (item.known_tag)
+	{
+	case RESOURCE_SAMPLER:
+		sampler_to_hash[api_object_cast<VkSampler>(item.handle)] = item.custom_hash;
+		break;
+
+	case RESOURCE_RENDER_PASS:
+		render_pass_to_hash[api_object_cast<VkRenderPass>(item.handle)] = item.custom_hash;
+		break;
+
+	case RESOURCE_SHADER_MODULE:
+		shader_module_to_hash[api_object_cast<VkShaderModule>(item.handle)] = item.custom_hash;
+		break;
+
+	default:
+		break;
+	}
+}
+
+void StateRecorder::Impl::push_forget_work_item(ResourceTag tag, uint64_t handle)
+{
+	WorkItem item = { handle, nullptr, 0, nullptr, tag };
+	item.forget = true;
+	if (statistics)
+		queued_work_items.fetch_add(1, std::memory_order_relaxed);
+	record_queue.push(item);
+}
+
+void StateRecorder::Impl::forget_object(const WorkItem &item)
+{
+	switch (item.known_tag)
+	{
+	case RESOURCE_SAMPLER:
+		sampler_to_hash.erase(api_object_cast<VkSampler>(item.handle));
+		break;
+
+	case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+		descriptor_set_layout_to_hash.erase(api_object_cast<VkDescriptorSetLayout>(item.handle));
+		break;
+
+	case RESOURCE_PIPELINE_LAYOUT:
+		pipeline_layout_to_hash.erase(api_object_cast<VkPipelineLayout>(item.handle));
+		break;
+
+	case RESOURCE_SHADER_MODULE:
+		shader_module_to_hash.erase(api_object_cast<VkShaderModule>(item.handle));
+		break;
+
+	case RESOURCE_RENDER_PASS:
+		render_pass_to_hash.erase(api_object_cast<VkRenderPass>(item.handle));
+		break;
+
+	case RESOURCE_GRAPHICS_PIPELINE:
+	case RESOURCE_COMPUTE_PIPELINE:
+		// The destroy call does not tell us which kind of pipeline it was.
+		graphics_pipeline_to_hash.erase(api_object_cast<VkPipeline>(item.handle));
+		compute_pipeline_to_hash.erase(api_object_cast<VkPipeline>(item.handle));
+		break;
+
+	default:
+		break;
+	}
+}
+
+void StateRecorder::Impl::begin_work_item_statistics(std::chrono::steady_clock::time_point now)
+{
+	consumed_work_items++;
+	uint64_t depth = queued_work_items.load(std::memory_order_relaxed) - consumed_work_items;
+	// Producers count their items before pushing them, but the counter is relaxed.
+	if (int64_t(depth) < 0)
+		depth = 0;
+	if (depth > recording_statistics.max_queue_depth)
+		recording_statistics.max_queue_depth = depth;
+
+	if (now < next_statistics_sample)
+		return;
+
+	std::lock_guard<std::mutex> lock(statistics_lock);
+	if (queue_depth_samples.size() >= MaxQueueDepthSamples)
+	{
+		for (size_t i = 0; i < queue_depth_samples.size() / 2; i++)
+			queue_depth_samples[i] = queue_depth_samples[2 * i];
+		queue_depth_samples.resize(queue_depth_samples.size() / 2);
+		statistics_sample_interval *= 2;
+	}
+
+	uint64_t time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - statistics_start).count();
+	queue_depth_samples.push_back({ time_ns, depth });
+	next_statistics_sample = now + statistics_sample_interval;
+
+	recording_statistics.recording_thread_lifetime_ns = time_ns;
+	published_statistics = recording_statistics;
+}
+
+void StateRecorder::Impl::publish_statistics(std::chrono::steady_clock::time_point now)
+{
+	std::lock_guard<std::mutex> lock(statistics_lock);
+	recording_statistics.recording_thread_lifetime_ns =
+			std::chrono::duration_cast<std::chrono::nanoseconds>(now - statistics_start).count();
+	published_statistics = recording_statistics;
+}
+
+bool StateRecorder::Impl::database_has_entry(ResourceTag tag, Hash hash)
+{
+	bool ret = database_iface->has_entry(tag, hash);
+	recording_statistics.database_lookups[tag]++;
+	if (ret)
+		recording_statistics.database_hits[tag]++;
+	return ret;
+}
+
+void StateRecorder::Impl::publish_known_hashes()
+{
+	std::unique_ptr<KnownHashSnapshot> snapshot(new KnownHashSnapshot);
+
+	// Only objects which can be hashed without remapping any handles can be checked on the calling thread.
+	static const ResourceTag tags[] = { RESOURCE_SAMPLER, RESOURCE_RENDER_PASS, RESOURCE_SHADER_MODULE };
+	for (auto tag : tags)
+	{
+		size_t hash_count = 0;
+		if (!database_iface->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			continue;
+		vector<Hash> hashes(hash_count);
+		if (!database_iface->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+			continue;
+
+		auto &known = snapshot->hashes[tag];
+		known.reserve(hashes.size());
+		for (auto hash : hashes)
+			if (database_iface->has_entry(tag, hash))
+				known.push_back(hash);
+		sort(known.begin(), known.end());
+	}
+
+	known_hashes.store(snapshot.get(), std::memory_order_release);
+	known_hash_snapshots.push_back(std::move(snapshot));
+}
+
+void StateRecorder::Impl::start_record_workers()
+{
+	encode_raw_payloads = record_worker_count != 0 && database_iface->supports_raw_payload_writes();
+	record_workers_exit = false;
+	for (unsigned i = 0; i < record_worker_count; i++)
+		record_workers.emplace_back(&StateRecorder::Impl::record_worker_task, this);
+}
+
+void StateRecorder::Impl::stop_record_workers()
+{
+	{
+		std::lock_guard<std::mutex> lock(record_job_lock);
+		record_workers_exit = true;
+	}
+	record_job_cv.notify_all();
+
+	for (auto &worker : record_workers)
+		worker.join();
+	record_workers.clear();
+}
+
+void StateRecorder::Impl::record_worker_task()
+{
+	for (;;)
+	{
+		RecordJob *job;
+		{
+			std::unique_lock<std::mutex> lock(record_job_lock);
+			record_job_cv.wait(lock, [this]() {
+				return !record_job_queue.empty() || record_workers_exit;
+			});
+
+			if (record_job_queue.empty())
+				break;
+
+			job = record_job_queue.front();
+			record_job_queue.pop_front();
+		}
+
+		execute_record_job(*job);
+
+		{
+			std::lock_guard<std::mutex> lock(record_job_lock);
+			job->done = true;
+		}
+		record_job_done_cv.notify_one();
+	}
+}
+
+RecordJob *StateRecorder::Impl::acquire_record_job()
+{
+	if (free_record_jobs.empty())
+	{
+		record_jobs.emplace_back(new RecordJob);
+		free_record_jobs.push_back(record_jobs.back().get());
+	}
+
+	auto *job = free_record_jobs.back();
+	free_record_jobs.pop_back();
+	return job;
+}
+
+void StateRecorder::Impl::release_record_job(RecordJob *job)
+{
+	job->allocator.reset();
+	job->sub_states.clear();
+	job->create_info = nullptr;
+	job->arena = nullptr;
+	job->serialized_size = 0;
+	job->success = false;
+	job->done = false;
+	free_record_jobs.push_back(job);
+}
+
+void StateRecorder::Impl::submit_record_job(RecordJob *job, ResourceTag tag, Hash hash, const void *create_info,
+                                            StagingArena *arena, PayloadWriteFlags payload_flags)
+{
+	job->tag = tag;
+	job->hash = hash;
+	job->create_info = create_info;
+	job->arena = arena;
+	job->payload_flags = payload_flags;
+
+	// Keep submission order, so nothing new is written while older jobs are deferred.
+	if ((rate_limit_objects || rate_limit_bytes) && (!deferred_record_jobs.empty() || !take_record_job_token()))
+		defer_record_job(job);
+	else
+		start_record_job(job);
+}
+
+void StateRecorder::Impl::start_record_job(RecordJob *job)
+{
+	in_flight_record_jobs.push_back(job);
+
+	if (record_workers.empty())
+	{
+		execute_record_job(*job);
+		job->done = true;
+	}
+	else
+	{
+		{
+			std::lock_guard<std::mutex> lock(record_job_lock);
+			record_job_queue.push_back(job);
+		}
+		record_job_cv.notify_one();
+	}
+}
+
+void StateRecorder::Impl::execute_record_job(RecordJob &job)
+{
+	switch (job.tag)
+	{
+	case RESOURCE_SAMPLER:
+		job.success = serialize_sampler(job.hash, *static_cast<const VkSamplerCreateInfo *>(job.create_info), job.blob);
+		break;
+
+	case RESOURCE_RENDER_PASS:
+		job.success = serialize_render_pass(job.hash, *static_cast<const VkRenderPassCreateInfo *>(job.create_info), job.blob);
+		break;
+
+	case RESOURCE_SHADER_MODULE:
+		job.success = serialize_shader_module(job.hash, *static_cast<const VkShaderModuleCreateInfo *>(job.create_info),
+		                                      job.blob, job.allocator);
+		break;
+
+	case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+		job.success = serialize_descriptor_set_layout(job.hash,
+		                                              *static_cast<const VkDescriptorSetLayoutCreateInfo *>(job.create_info),
+		                                              job.blob);
+		break;
+
+	case RESOURCE_PIPELINE_LAYOUT:
+		job.success = serialize_pipeline_layout(job.hash, *static_cast<const VkPipelineLayoutCreateInfo *>(job.create_info),
+		                                        job.blob);
+		break;
+
+	case RESOURCE_GRAPHICS_PIPELINE:
+		job.success = serialize_graphics_pipeline(job.hash, *static_cast<const VkGraphicsPipelineCreateInfo *>(job.create_info),
+		                                          job.blob, job.sub_states);
+		break;
+
+	case RESOURCE_COMPUTE_PIPELINE:
+		job.success = serialize_compute_pipeline(job.hash, *static_cast<const VkComputePipelineCreateInfo *>(job.create_info),
+		                                         job.blob);
+		break;
+
+	default:
+		job.success = false;
+		break;
+	}
+
+	job.serialized_size = job.success ? job.blob.size() : 0;
+	for (auto &sub_state : job.sub_states)
+		job.serialized_size += sub_state.blob.size();
+
+	if (!encode_raw_payloads)
+		return;
+
+	auto encode = [&job](vector<uint8_t> &blob) -> bool {
+		size_t encoded_size = 0;
+		job.encoded_blob.resize(get_raw_fossilize_db_payload_bound(blob.size()));
+		if (!encode_raw_fossilize_db_payload(blob.data(), blob.size(), job.payload_flags,
+		                                     job.encoded_blob.data(), &encoded_size))
+			return false;
+		job.encoded_blob.resize(encoded_size);
+		std::swap(blob, job.encoded_blob);
+		return true;
+	};
+
+	// A pipeline must not be written without its sub-states.
+	for (auto &sub_state : job.sub_states)
+	{
+		if (!encode(sub_state.blob))
+		{
+			sub_state.blob.clear();
+			job.success = false;
+		}
+	}
+
+	if (job.success)
+		job.success = encode(job.blob);
+}
+
+bool StateRecorder::Impl::commit_record_jobs(size_t max_in_flight)
+{
+	PayloadWriteFlags raw_flags = encode_raw_payloads ? PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT : 0;
+	bool wrote = false;
+
+	while (!in_flight_record_jobs.empty())
+	{
+		auto *job = in_flight_record_jobs.front();
+		if (!record_workers.empty())
+		{
+			std::unique_lock<std::mutex> lock(record_job_lock);
+			if (!job->done)
+			{
+				if (in_flight_record_jobs.size() <= max_in_flight)
+					break;
+				record_job_done_cv.wait(lock, [job]() { return job->done; });
+			}
+		}
+		in_flight_record_jobs.pop_front();
+
+		// Sub-states must be written before the pipeline which references them.
+		PayloadWriteFlags flags = raw_flags ? raw_flags : job->payload_flags;
+		for (auto &sub_state : job->sub_states)
+		{
+			if (sub_state.blob.empty())
+				continue;
+
+			if (!database_iface->has_entry(RESOURCE_PIPELINE_SUB_STATE, sub_state.hash))
+			{
+				database_iface->write_entry(RESOURCE_PIPELINE_SUB_STATE, sub_state.hash,
+				                            sub_state.blob.data(), sub_state.blob.size(), flags);
+				recording_statistics.entries_written++;
+				recording_statistics.bytes_written += sub_state.blob.size();
+				wrote = true;
+			}
+
+			std::lock_guard<std::mutex> lock(sub_state_lock);
+			committed_sub_states.insert(sub_state.hash);
+		}
+
+		if (job->success && !database_iface->has_entry(job->tag, job->hash))
+		{
+			database_iface->write_entry(job->tag, job->hash, job->blob.data(), job->blob.size(), flags);
+			recording_statistics.entries_written++;
+			recording_statistics.bytes_written += job->blob.size();
+			wrote = true;
+		}
+
+		recording_statistics.bytes_serialized += job->serialized_size;
+
+		if (rate_limit_bytes)
+		{
+			for (auto &sub_state : job->sub_states)
+				byte_tokens -= double(sub_state.blob.size());
+			byte_tokens -= double(job->blob.size());
+		}
+
+		if (job->arena)
+			retire_staging_arena_item(job->arena);
+		release_record_job(job);
+	}
+
+	return wrote;
+}
+
+void StateRecorder::Impl::reset_rate_limit()
+{
+	object_tokens = double(rate_limit_objects);
+	byte_tokens = double(rate_limit_bytes);
+	rate_limit_refill_time = std::chrono::steady_clock::now();
+}
+
+bool StateRecorder::Impl::take_record_job_token()
+{
+	auto now = std::chrono::steady_clock::now();
+	double elapsed = std::chrono::duration<double>(now - rate_limit_refill_time).count();
+	rate_limit_refill_time = now;
+
+	if (rate_limit_objects)
+		object_tokens = std::min(object_tokens + elapsed * rate_limit_objects, double(rate_limit_objects));
+	if (rate_limit_bytes)
+		byte_tokens = std::min(byte_tokens + elapsed * double(rate_limit_bytes), double(rate_limit_bytes));
+
+	// Byte costs are only known once jobs are written, so the byte bucket goes into debt instead.
+	if (rate_limit_objects && object_tokens < 1.0)
+		return false;
+	if (rate_limit_bytes && byte_tokens <= 0.0)
+		return false;
+
+	if (rate_limit_objects)
+		object_tokens -= 1.0;
+	return true;
+}
+
+void StateRecorder::Impl::defer_record_job(RecordJob *job)
+{
+	// Jobs might be deferred for a long time, so they must not pin staging memory.
+	// Other create infos are remapped copies which already live in the job allocator.
+	bool copied = true;
+	switch (job->tag)
+	{
+	case RESOURCE_SAMPLER:
+	{
+		VkSamplerCreateInfo *info = nullptr;
+		copied = copy_sampler(static_cast<const VkSamplerCreateInfo *>(job->create_info), job->allocator, &info);
+		job->create_info = info;
+		break;
+	}
+
+	case RESOURCE_RENDER_PASS:
+	{
+		VkRenderPassCreateInfo *info = nullptr;
+		copied = copy_render_pass(static_cast<const VkRenderPassCreateInfo *>(job->create_info), job->allocator, &info);
+		job->create_info = info;
+		break;
+	}
+
+	case RESOURCE_SHADER_MODULE:
+	{
+		VkShaderModuleCreateInfo *info = nullptr;
+		copied = copy_shader_module(static_cast<const VkShaderModuleCreateInfo *>(job->create_info), job->allocator, &info);
+		job->create_info = info;
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	// Rather exceed the rate limit than lose the object.
+	if (!copied)
+	{
+		start_record_job(job);
+		return;
+	}
+
+	if (job->arena)
+		retire_staging_arena_item(job->arena);
+	job->arena = nullptr;
+
+	deferred_record_jobs.push_back(job);
+	recording_statistics.deferred_objects++;
+
+	if (deferred_record_jobs.size() > MaxDeferredRecordJobs)
+	{
+		start_record_job(deferred_record_jobs.front());
+		deferred_record_jobs.pop_front();
+	}
+}
+
+bool StateRecorder::Impl::submit_deferred_record_jobs(bool idle)
+{
+	bool wrote = false;
+	while (!deferred_record_jobs.empty() && (idle || take_record_job_token()))
+	{
+		start_record_job(deferred_record_jobs.front());
+		deferred_record_jobs.pop_front();
+		if (commit_record_jobs(MaxInFlightRecordJobsPerWorker * record_workers.size()))
+			wrote = true;
+	}
+	return wrote;
+}
+
+bool StateRecorder::Impl::sample_pipeline(Hash hash, VkPipeline base_pipeline)
+{
+	if (sampling_slice_count <= 1)
+		return true;
+
+	// A derived pipeline follows the decision for its base pipeline, which has been recorded before it,
+	// so a written pipeline never refers to a base pipeline which was sampled out.
+	if (base_pipeline != VK_NULL_HANDLE)
+	{
+		Hash base_hash = api_object_cast<Hash>(base_pipeline);
+		auto itr = sampling_roots.find(base_hash);
+		Hash root_hash = itr != end(sampling_roots) ? itr->second : base_hash;
+		sampling_roots[hash] = root_hash;
+		hash = root_hash;
+	}
+
+	// Mix the bits, since only a few low bits decide the slice.
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	if (hash % sampling_slice_count == sampling_slice)
+		return true;
+
+	recording_statistics.sampled_out_objects++;
+	return false;
 }
 
 bool StateRecorder::get_hash_for_compute_pipeline_handle(VkPipeline pipeline, Hash *hash) const
@@ -4099,6 +5997,9 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 		// Check here in the worker thread if we should write database entries for this application info.
 		if (application_info_filter)
 			write_database_entries = application_info_filter->test_application_info(application_info);
+
+		if (database_iface && write_database_entries && application_link_table)
+			load_application_link_tables();
 	}
 
 	// Keep a single, pre-allocated buffer.
@@ -4118,55 +6019,114 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 
 	bool need_flush = false;
 
+	if (database_iface && write_database_entries)
+	{
+		if (early_duplicate_check)
+			publish_known_hashes();
+		reset_rate_limit();
+
+		// Metadata blobs from different processes must not collide, even if they hold the same numbers.
+		Hasher seed;
+		seed.u64(uint64_t(std::chrono::system_clock::now().time_since_epoch().count()));
+		seed.u64(uint64_t(reinterpret_cast<uintptr_t>(this)));
+		metadata_seed = seed.get();
+		start_record_workers();
+	}
+
+	// Time spent on the previous work item is accounted once we come back for the next one.
+	bool work_item_active = false;
+	std::chrono::steady_clock::time_point work_item_start;
+
 	for (;;)
 	{
-		WorkItem record_item = {};
+		if (work_item_active)
 		{
-			std::unique_lock<std::mutex> lock(record_lock);
-			if (record_queue.empty())
-				temp_allocator.reset();
+			recording_statistics.recording_thread_busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - work_item_start).count();
+			work_item_active = false;
+		}
 
+		WorkItem record_item = {};
+		if (!pop_work_item(record_item))
+		{
 			// Having this check here allows us to call record_task from a single threaded variant.
 			// This is mostly used for testing purposes.
-			if (!looping && record_queue.empty())
+			if (!looping)
 				break;
 
+			// Write out whatever the workers are still busy with before going idle.
+			if (database_iface && submit_deferred_record_jobs(false))
+				need_flush = true;
+			if (database_iface && commit_record_jobs(0))
+				need_flush = true;
+
+			if (statistics)
+				publish_statistics(std::chrono::steady_clock::now());
+
 			// If we have written something to the database, wake up to flush whatever files are
 			// necessary. Do not flush after every single write, as that might bog down the file system.
 			// Once no new writes have occured for a second, we flush, and go to deep sleep.
-			bool has_data;
-			if (need_flush)
+			// Deferred jobs are written once nothing new has been recorded for the same amount of time.
+			if (need_flush || !deferred_record_jobs.empty())
 			{
-				has_data = record_cv.wait_for(lock, std::chrono::seconds(1),
-				                              [&]()
-				                              {
-					                              return !record_queue.empty();
-				                              });
-			}
-			else
-			{
-				record_cv.wait(lock, [&]()
+				auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+				if (!record_queue.wait_for_items(&deadline))
 				{
-					return !record_queue.empty();
-				});
-				has_data = true;
+					if (database_iface)
+					{
+						submit_deferred_record_jobs(true);
+						commit_record_jobs(0);
+						if (!flush_application_link_table(blob))
+							LOGE("Failed to serialize application link table.\n");
+						if (!flush_pipeline_usage(blob))
+							LOGE("Failed to serialize pipeline usage.\n");
+						database_iface->flush();
+					}
+					need_flush = false;
+				}
 			}
+			else
+				record_queue.wait_for_items(nullptr);
+			continue;
+		}
+
+		if (statistics)
+		{
+			work_item_start = std::chrono::steady_clock::now();
+			work_item_active = true;
+			begin_work_item_statistics(work_item_start);
+		}
+
+		if (record_item.usage)
+		{
+			if (database_iface && write_database_entries)
+				accumulate_pipeline_usage(*static_cast<const PipelineUsageBatch *>(record_item.create_info));
+			retire_staging_arena_item(record_item.arena);
+			continue;
+		}
 
-			if (database_iface && !has_data && need_flush)
+		if (!record_item.create_info)
+		{
+			if (record_item.known_tag == RESOURCE_APPLICATION_INFO)
+				break;
+
+			if (record_item.forget)
 			{
-				database_iface->flush();
-				need_flush = false;
+				forget_object(record_item);
 				continue;
 			}
-			else
-			{
-				record_item = record_queue.front();
-				record_queue.pop();
-			}
+
+			record_known_object(record_item);
+			recording_statistics.early_duplicate_hits[record_item.known_tag]++;
+			if (database_iface && write_database_entries &&
+			    register_application_link_hash(record_item.known_tag, record_item.custom_hash, blob))
+				need_flush = true;
+			continue;
 		}
 
-		if (!record_item.create_info)
-			break;
+		// Copies for the database only need to live as long as the job which serializes them.
+		RecordJob *job = database_iface ? acquire_record_job() : nullptr;
+		ScratchAllocator &item_allocator = job ? job->allocator : allocator;
 
 		switch (reinterpret_cast<VkBaseInStructure *>(record_item.create_info)->sType)
 		{
@@ -4175,7 +6135,7 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 			auto *create_info = reinterpret_cast<VkSamplerCreateInfo *>(record_item.create_info);
 			auto hash = record_item.custom_hash;
 			if (hash == 0)
-				if (!Hashing::compute_hash_sampler(*create_info, &hash))
+				if (!Hashing::compute_hash_sampler(*create_info, &hash, hash_scheme))
 					break;
 
 			sampler_to_hash[api_object_cast<VkSampler>(record_item.handle)] = hash;
@@ -4187,14 +6147,11 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 					if (register_application_link_hash(RESOURCE_SAMPLER, hash, blob))
 						need_flush = true;
 
-					if (!database_iface->has_entry(RESOURCE_SAMPLER, hash))
+					if (!database_has_entry(RESOURCE_SAMPLER, hash))
 					{
-						if (serialize_sampler(hash, *create_info, blob))
-						{
-							database_iface->write_entry(RESOURCE_SAMPLER, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
+						submit_record_job(job, RESOURCE_SAMPLER, hash, create_info, record_item.arena, payload_flags);
+						job = nullptr;
+						record_item.arena = nullptr;
 					}
 				}
 			}
@@ -4216,7 +6173,7 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 			auto *create_info = reinterpret_cast<VkRenderPassCreateInfo *>(record_item.create_info);
 			auto hash = record_item.custom_hash;
 			if (hash == 0)
-				if (!Hashing::compute_hash_render_pass(*create_info, &hash))
+				if (!Hashing::compute_hash_render_pass(*create_info, &hash, hash_scheme))
 					break;
 
 			render_pass_to_hash[api_object_cast<VkRenderPass>(record_item.handle)] = hash;
@@ -4228,14 +6185,11 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 					if (register_application_link_hash(RESOURCE_RENDER_PASS, hash, blob))
 						need_flush = true;
 
-					if (!database_iface->has_entry(RESOURCE_RENDER_PASS, hash))
+					if (!database_has_entry(RESOURCE_RENDER_PASS, hash))
 					{
-						if (serialize_render_pass(hash, *create_info, blob))
-						{
-							database_iface->write_entry(RESOURCE_RENDER_PASS, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
+						submit_record_job(job, RESOURCE_RENDER_PASS, hash, create_info, record_item.arena, payload_flags);
+						job = nullptr;
+						record_item.arena = nullptr;
 					}
 				}
 			}
@@ -4257,7 +6211,7 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 			auto *create_info = reinterpret_cast<VkShaderModuleCreateInfo *>(record_item.create_info);
 			auto hash = record_item.custom_hash;
 			if (hash == 0)
-				if (!Hashing::compute_hash_shader_module(*create_info, &hash))
+				if (!Hashing::compute_hash_shader_module(*create_info, &hash, hash_scheme))
 					break;
 
 			shader_module_to_hash[api_object_cast<VkShaderModule>(record_item.handle)] = hash;
@@ -4269,15 +6223,11 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 					if (register_application_link_hash(RESOURCE_SHADER_MODULE, hash, blob))
 						need_flush = true;
 
-					if (!database_iface->has_entry(RESOURCE_SHADER_MODULE, hash))
+					if (!database_has_entry(RESOURCE_SHADER_MODULE, hash))
 					{
-						if (serialize_shader_module(hash, *create_info, blob, allocator))
-						{
-							database_iface->write_entry(RESOURCE_SHADER_MODULE, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
-						allocator.reset();
+						submit_record_job(job, RESOURCE_SHADER_MODULE, hash, create_info, record_item.arena, payload_flags);
+						job = nullptr;
+						record_item.arena = nullptr;
 					}
 				}
 			}
@@ -4303,7 +6253,7 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 					break;
 
 			VkDescriptorSetLayoutCreateInfo *create_info_copy = nullptr;
-			if (!copy_descriptor_set_layout(create_info, allocator, &create_info_copy))
+			if (!copy_descriptor_set_layout(create_info, item_allocator, &create_info_copy))
 				break;
 			if (!remap_descriptor_set_layout_ci(create_info_copy))
 				break;
@@ -4317,19 +6267,13 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 					if (register_application_link_hash(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash, blob))
 						need_flush = true;
 
-					if (!database_iface->has_entry(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash))
+					if (!database_has_entry(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash))
 					{
-						if (serialize_descriptor_set_layout(hash, *create_info_copy, blob))
-						{
-							database_iface->write_entry(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
+						submit_record_job(job, RESOURCE_DESCRIPTOR_SET_LAYOUT, hash, create_info_copy, record_item.arena, payload_flags);
+						job = nullptr;
+						record_item.arena = nullptr;
 					}
 				}
-
-				// Don't need to keep copied data around, reset the allocator.
-				allocator.reset();
 			}
 			else
 			{
@@ -4350,7 +6294,7 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 					break;
 
 			VkPipelineLayoutCreateInfo *create_info_copy = nullptr;
-			if (!copy_pipeline_layout(create_info, allocator, &create_info_copy))
+			if (!copy_pipeline_layout(create_info, item_allocator, &create_info_copy))
 				break;
 			if (!remap_pipeline_layout_ci(create_info_copy))
 				break;
@@ -4364,19 +6308,13 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 					if (register_application_link_hash(RESOURCE_PIPELINE_LAYOUT, hash, blob))
 						need_flush = true;
 
-					if (!database_iface->has_entry(RESOURCE_PIPELINE_LAYOUT, hash))
+					if (!database_has_entry(RESOURCE_PIPELINE_LAYOUT, hash))
 					{
-						if (serialize_pipeline_layout(hash, *create_info_copy, blob))
-						{
-							database_iface->write_entry(RESOURCE_PIPELINE_LAYOUT, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
+						submit_record_job(job, RESOURCE_PIPELINE_LAYOUT, hash, create_info_copy, record_item.arena, payload_flags);
+						job = nullptr;
+						record_item.arena = nullptr;
 					}
 				}
-
-				// Don't need to keep copied data around, reset the allocator.
-				allocator.reset();
 			}
 			else
 			{
@@ -4396,7 +6334,7 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 					break;
 
 			VkGraphicsPipelineCreateInfo *create_info_copy = nullptr;
-			if (!copy_graphics_pipeline(create_info, allocator, nullptr, 0, &create_info_copy))
+			if (!copy_graphics_pipeline(create_info, item_allocator, nullptr, 0, &create_info_copy))
 				break;
 			if (!remap_graphics_pipeline_ci(create_info_copy))
 				break;
@@ -4405,24 +6343,18 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 
 			if (database_iface)
 			{
-				if (write_database_entries)
+				if (write_database_entries && sample_pipeline(hash, create_info_copy->basePipelineHandle))
 				{
 					if (register_application_link_hash(RESOURCE_GRAPHICS_PIPELINE, hash, blob))
 						need_flush = true;
 
-					if (!database_iface->has_entry(RESOURCE_GRAPHICS_PIPELINE, hash))
+					if (!database_has_entry(RESOURCE_GRAPHICS_PIPELINE, hash))
 					{
-						if (serialize_graphics_pipeline(hash, *create_info_copy, blob))
-						{
-							database_iface->write_entry(RESOURCE_GRAPHICS_PIPELINE, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
+						submit_record_job(job, RESOURCE_GRAPHICS_PIPELINE, hash, create_info_copy, record_item.arena, payload_flags);
+						job = nullptr;
+						record_item.arena = nullptr;
 					}
 				}
-
-				// Don't need to keep copied data around, reset the allocator.
-				allocator.reset();
 			}
 			else
 			{
@@ -4442,7 +6374,7 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 					break;
 
 			VkComputePipelineCreateInfo *create_info_copy = nullptr;
-			if (!copy_compute_pipeline(create_info, allocator, nullptr, 0, &create_info_copy))
+			if (!copy_compute_pipeline(create_info, item_allocator, nullptr, 0, &create_info_copy))
 				break;
 			if (!remap_compute_pipeline_ci(create_info_copy))
 				break;
@@ -4451,24 +6383,18 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 
 			if (database_iface)
 			{
-				if (write_database_entries)
+				if (write_database_entries && sample_pipeline(hash, create_info_copy->basePipelineHandle))
 				{
 					if (register_application_link_hash(RESOURCE_COMPUTE_PIPELINE, hash, blob))
 						need_flush = true;
 
-					if (!database_iface->has_entry(RESOURCE_COMPUTE_PIPELINE, hash))
+					if (!database_has_entry(RESOURCE_COMPUTE_PIPELINE, hash))
 					{
-						if (serialize_compute_pipeline(hash, *create_info_copy, blob))
-						{
-							database_iface->write_entry(RESOURCE_COMPUTE_PIPELINE, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
+						submit_record_job(job, RESOURCE_COMPUTE_PIPELINE, hash, create_info_copy, record_item.arena, payload_flags);
+						job = nullptr;
+						record_item.arena = nullptr;
 					}
 				}
-
-				// Don't need to keep copied data around, reset the allocator.
-				allocator.reset();
 			}
 			else
 			{
@@ -4478,13 +6404,53 @@ void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
 			}
 			break;
 		}
+
+		case VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT:
+		{
+			auto *create_info = reinterpret_cast<VkPipelineCreationFeedbackCreateInfoEXT *>(record_item.create_info);
+			if (database_iface && write_database_entries)
+				accumulate_pipeline_feedback(api_object_cast<VkPipeline>(record_item.handle),
+				                             *create_info->pPipelineCreationFeedback);
+			break;
+		}
+
 		default:
 			break;
 		}
+
+		if (job)
+			release_record_job(job);
+		if (record_item.arena)
+			retire_staging_arena_item(record_item.arena);
+
+		if (database_iface && commit_record_jobs(MaxInFlightRecordJobsPerWorker * record_workers.size()))
+			need_flush = true;
 	}
 
-	if (database_iface)
-		database_iface->flush();
+	if (database_iface)
+	{
+		// Objects recorded from now on are not checked against the database.
+		known_hashes.store(nullptr, std::memory_order_relaxed);
+
+		submit_deferred_record_jobs(true);
+		commit_record_jobs(0);
+		stop_record_workers();
+
+		if (!flush_application_link_table(blob))
+			LOGE("Failed to serialize application link table.\n");
+		if (!flush_pipeline_feedback(blob))
+			LOGE("Failed to serialize pipeline feedback.\n");
+		if (!flush_pipeline_usage(blob))
+			LOGE("Failed to serialize pipeline usage.\n");
+		database_iface->flush();
+	}
+
+	if (statistics)
+		publish_statistics(std::chrono::steady_clock::now());
+
+	// Anything recorded from now on is drained by the calling thread.
+	if (looping)
+		set_staging_memory_consumer_active(false);
 
 	// We no longer need a reference to this.
 	// This should allow us to call init_recording_thread again if we want,
@@ -5390,6 +7356,8 @@ bool StateRecorder::Impl::serialize_application_info(vector<uint8_t> &blob) cons
 	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
 	doc.AddMember("applicationInfo", app_info, alloc);
 	doc.AddMember("physicalDeviceFeatures", pdf_info, alloc);
+	if (hash_scheme != HASH_SCHEME_FNV1)
+		doc.AddMember("hashScheme", uint32_t(hash_scheme), alloc);
 
 	StringBuffer buffer;
 	CustomWriter writer(buffer);
@@ -5405,22 +7373,380 @@ Hash StateRecorder::Impl::get_application_link_hash(ResourceTag tag, Hash hash)
 	return Hashing::compute_hash_application_info_link(application_feature_hash, tag, hash);
 }
 
-bool StateRecorder::Impl::register_application_link_hash(ResourceTag tag, Hash hash, vector<uint8_t> &blob) const
+bool StateRecorder::Impl::register_application_link_hash(ResourceTag tag, Hash hash, vector<uint8_t> &blob)
 {
 	PayloadWriteFlags payload_flags = 0;
 	if (checksum)
 		payload_flags |= PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
 
 	Hash link_hash = get_application_link_hash(tag, hash);
-	if (!database_iface->has_entry(RESOURCE_APPLICATION_BLOB_LINK, link_hash))
+	if (application_link_table)
+	{
+		// Links found in an existing archive are not repeated, either as blob links or in link tables.
+		if (database_iface->has_entry(RESOURCE_APPLICATION_BLOB_LINK, link_hash) ||
+		    !registered_application_links.insert(link_hash).second)
+			return false;
+
+		pending_application_links.push_back({ tag, hash });
+		if (pending_application_links.size() < MaxApplicationLinkTableEntries)
+			return false;
+
+		if (!flush_application_link_table(blob))
+			LOGE("Failed to serialize application link table.\n");
+		return true;
+	}
+	else if (!database_iface->has_entry(RESOURCE_APPLICATION_BLOB_LINK, link_hash))
 	{
 		if (!serialize_application_blob_link(hash, tag, blob))
 			return false;
 		database_iface->write_entry(RESOURCE_APPLICATION_BLOB_LINK, link_hash, blob.data(), blob.size(), payload_flags);
+		recording_statistics.entries_written++;
+		recording_statistics.bytes_serialized += blob.size();
+		recording_statistics.bytes_written += blob.size();
+		return true;
+	}
+	else
+		return false;
+}
+
+void StateRecorder::Impl::load_application_link_tables()
+{
+	struct LinkCollector : StateCreatorInterface
+	{
+		void notify_application_info_link(Hash link_hash, Hash app_hash, ResourceTag, Hash) override
+		{
+			if (app_hash == application_hash)
+				links->insert(link_hash);
+		}
+
+		bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override { return true; }
+		bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override { return true; }
+		bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override { return true; }
+		bool enqueue_create_shader_module(Hash, const VkShaderModuleCreateInfo *, VkShaderModule *) override { return true; }
+		bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override { return true; }
+		bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *, VkPipeline *) override { return true; }
+		bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *) override { return true; }
+
+		Hash application_hash;
+		std::unordered_set<Hash> *links;
+	};
+
+	Hasher h;
+	Hashing::hash_application_feature_info(h, application_feature_hash);
+	LinkCollector collector;
+	collector.application_hash = h.get();
+	collector.links = &registered_application_links;
+
+	size_t hash_count = 0;
+	if (!database_iface->get_hash_list_for_resource_tag(RESOURCE_APPLICATION_LINK_TABLE, &hash_count, nullptr))
+		return;
+	vector<Hash> hashes(hash_count);
+	if (!database_iface->get_hash_list_for_resource_tag(RESOURCE_APPLICATION_LINK_TABLE, &hash_count, hashes.data()))
+		return;
+
+	StateReplayer replayer;
+	vector<uint8_t> blob;
+	for (auto hash : hashes)
+	{
+		size_t blob_size = 0;
+		if (!database_iface->read_entry(RESOURCE_APPLICATION_LINK_TABLE, hash, &blob_size, nullptr, 0))
+			continue;
+		blob.resize(blob_size);
+		if (!database_iface->read_entry(RESOURCE_APPLICATION_LINK_TABLE, hash, &blob_size, blob.data(), 0) ||
+		    !replayer.parse(collector, nullptr, blob.data(), blob.size()))
+		{
+			LOGE("Failed to parse existing application link table %016" PRIx64 ".\n", hash);
+		}
+	}
+}
+
+// The table is a small JSON header, followed by the binary payload after the '\0' terminator.
+// Every link is encoded as a little-endian 32-bit tag followed by a little-endian 64-bit hash.
+static bool serialize_application_link_table(Hash application_hash,
+                                             const StateRecorderApplicationLink *links, size_t link_count,
+                                             vector<uint8_t> &blob, Hash *table_hash)
+{
+	Document doc;
+	doc.SetObject();
+	auto &alloc = doc.GetAllocator();
+
+	doc.AddMember("version", FOSSILIZE_FORMAT_APPLICATION_LINK_TABLE_VERSION, alloc);
+
+	Value table(kObjectType);
+	table.AddMember("application", uint64_string(application_hash, alloc), alloc);
+	table.AddMember("linkCount", uint64_t(link_count), alloc);
+	doc.AddMember("applicationLinkTable", table, alloc);
+
+	StringBuffer buffer;
+	CustomWriter writer(buffer);
+	doc.Accept(writer);
+
+	blob.resize(buffer.GetSize() + 1 + link_count * ApplicationLinkTableEntrySize);
+	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
+	blob[buffer.GetSize()] = '\0';
+
+	Hasher h;
+	h.u64(application_hash);
+	h.u64(link_count);
+
+	uint8_t *entry = blob.data() + buffer.GetSize() + 1;
+	for (size_t i = 0; i < link_count; i++, entry += ApplicationLinkTableEntrySize)
+	{
+		for (unsigned j = 0; j < 4; j++)
+			entry[j] = uint8_t(uint32_t(links[i].tag) >> (8 * j));
+		for (unsigned j = 0; j < 8; j++)
+			entry[4 + j] = uint8_t(links[i].hash >> (8 * j));
+		h.s32(links[i].tag);
+		h.u64(links[i].hash);
+	}
+
+	*table_hash = h.get();
+	return true;
+}
+
+bool StateRecorder::Impl::flush_application_link_table(vector<uint8_t> &blob)
+{
+	if (pending_application_links.empty())
 		return true;
+
+	PayloadWriteFlags payload_flags = 0;
+	if (checksum)
+		payload_flags |= PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+
+	Hasher h;
+	Hashing::hash_application_feature_info(h, application_feature_hash);
+
+	Hash table_hash;
+	bool ret = Fossilize::serialize_application_link_table(h.get(), pending_application_links.data(),
+	                                                       pending_application_links.size(), blob, &table_hash);
+	if (ret)
+	{
+		database_iface->write_entry(RESOURCE_APPLICATION_LINK_TABLE, table_hash, blob.data(), blob.size(), payload_flags);
+		recording_statistics.entries_written++;
+		recording_statistics.bytes_serialized += blob.size();
+		recording_statistics.bytes_written += blob.size();
+	}
+
+	pending_application_links.clear();
+	return ret;
+}
+
+void merge_pipeline_feedback(PipelineFeedback &feedback, const PipelineFeedback &other)
+{
+	if (other.count == 0)
+		return;
+
+	if (feedback.count == 0)
+	{
+		feedback = other;
+		return;
+	}
+
+	feedback.count += other.count;
+	feedback.min_duration_ns = std::min(feedback.min_duration_ns, other.min_duration_ns);
+	feedback.max_duration_ns = std::max(feedback.max_duration_ns, other.max_duration_ns);
+	feedback.total_duration_ns += other.total_duration_ns;
+	feedback.valid_feedback_count += other.valid_feedback_count;
+	feedback.cache_hit_count += other.cache_hit_count;
+	feedback.base_pipeline_acceleration_count += other.base_pipeline_acceleration_count;
+}
+
+void StateRecorder::Impl::accumulate_pipeline_feedback(VkPipeline pipeline, const VkPipelineCreationFeedbackEXT &feedback)
+{
+	PipelineFeedback info = {};
+
+	auto graphics_itr = graphics_pipeline_to_hash.find(pipeline);
+	auto compute_itr = compute_pipeline_to_hash.find(pipeline);
+	if (graphics_itr != end(graphics_pipeline_to_hash))
+	{
+		info.tag = RESOURCE_GRAPHICS_PIPELINE;
+		info.hash = graphics_itr->second;
+	}
+	else if (compute_itr != end(compute_pipeline_to_hash))
+	{
+		info.tag = RESOURCE_COMPUTE_PIPELINE;
+		info.hash = compute_itr->second;
 	}
 	else
+	{
+		// Happens for every pipeline the recorder failed to record, so only mention it once.
+		if (!logged_unrecorded_pipeline_feedback)
+		{
+			LOGI("Ignoring pipeline feedback for pipelines which were not recorded.\n");
+			logged_unrecorded_pipeline_feedback = true;
+		}
+		return;
+	}
+
+	info.count = 1;
+	info.min_duration_ns = feedback.duration;
+	info.max_duration_ns = feedback.duration;
+	info.total_duration_ns = feedback.duration;
+	if ((feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) != 0)
+	{
+		info.valid_feedback_count = 1;
+		if ((feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) != 0)
+			info.cache_hit_count = 1;
+		if ((feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_BASE_PIPELINE_ACCELERATION_BIT_EXT) != 0)
+			info.base_pipeline_acceleration_count = 1;
+	}
+
+	merge_pipeline_feedback(pending_pipeline_feedback[info.hash ^ info.tag], info);
+}
+
+static void serialize_pipeline_feedback(const PipelineFeedback &feedback, vector<uint8_t> &blob)
+{
+	Document doc;
+	doc.SetObject();
+	auto &alloc = doc.GetAllocator();
+
+	doc.AddMember("version", FOSSILIZE_FORMAT_PIPELINE_FEEDBACK_VERSION, alloc);
+
+	Value value(kObjectType);
+	value.AddMember("tag", uint32_t(feedback.tag), alloc);
+	value.AddMember("hash", uint64_string(feedback.hash, alloc), alloc);
+	value.AddMember("count", feedback.count, alloc);
+	value.AddMember("minDurationNs", feedback.min_duration_ns, alloc);
+	value.AddMember("maxDurationNs", feedback.max_duration_ns, alloc);
+	value.AddMember("totalDurationNs", feedback.total_duration_ns, alloc);
+	value.AddMember("validFeedbackCount", feedback.valid_feedback_count, alloc);
+	value.AddMember("cacheHitCount", feedback.cache_hit_count, alloc);
+	value.AddMember("basePipelineAccelerationCount", feedback.base_pipeline_acceleration_count, alloc);
+	doc.AddMember("pipelineFeedback", value, alloc);
+
+	StringBuffer buffer;
+	CustomWriter writer(buffer);
+	doc.Accept(writer);
+
+	blob.resize(buffer.GetSize());
+	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
+}
+
+bool StateRecorder::Impl::flush_pipeline_feedback(vector<uint8_t> &blob)
+{
+	if (pending_pipeline_feedback.empty())
+		return true;
+
+	PayloadWriteFlags payload_flags = 0;
+	if (checksum)
+		payload_flags |= PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+
+	for (auto &feedback : pending_pipeline_feedback)
+	{
+		Fossilize::serialize_pipeline_feedback(feedback.second, blob);
+
+		// Same key as StateRecorder::serialize_pipeline_feedback(), one entry per pipeline and session.
+		Hasher h;
+		h.u64(metadata_seed);
+		h.u32(feedback.second.tag);
+		h.u64(feedback.second.hash);
+
+		if (!database_iface->write_entry(RESOURCE_PIPELINE_FEEDBACK, h.get(), blob.data(), blob.size(), payload_flags))
+			return false;
+
+		recording_statistics.entries_written++;
+		recording_statistics.bytes_serialized += blob.size();
+		recording_statistics.bytes_written += blob.size();
+	}
+
+	pending_pipeline_feedback.clear();
+	return true;
+}
+
+void StateRecorder::Impl::accumulate_pipeline_usage(const PipelineUsageBatch &batch)
+{
+	for (uint32_t i = 0; i < batch.count; i++)
+	{
+		StateRecorderPipelineUsage usage = {};
+
+		auto graphics_itr = graphics_pipeline_to_hash.find(batch.pipelines[i]);
+		auto compute_itr = compute_pipeline_to_hash.find(batch.pipelines[i]);
+		if (graphics_itr != end(graphics_pipeline_to_hash))
+		{
+			usage.tag = RESOURCE_GRAPHICS_PIPELINE;
+			usage.hash = graphics_itr->second;
+		}
+		else if (compute_itr != end(compute_pipeline_to_hash))
+		{
+			usage.tag = RESOURCE_COMPUTE_PIPELINE;
+			usage.hash = compute_itr->second;
+		}
+		else
+			continue;
+
+		auto &pending = pending_pipeline_usage[usage.hash ^ usage.tag];
+		if (pending.bind_count == 0)
+			pending = usage;
+		pending.bind_count += batch.bind_counts[i];
+	}
+}
+
+// Like the application link table, a small JSON header is followed by the binary payload after the '\0' terminator.
+// Every entry is a little-endian 32-bit tag, a 64-bit hash and a 64-bit bind count.
+static void serialize_pipeline_usage(Hash application_hash, const vector<StateRecorderPipelineUsage> &usage,
+                                     vector<uint8_t> &blob)
+{
+	Document doc;
+	doc.SetObject();
+	auto &alloc = doc.GetAllocator();
+
+	doc.AddMember("version", FOSSILIZE_FORMAT_PIPELINE_FEEDBACK_VERSION, alloc);
+
+	Value value(kObjectType);
+	value.AddMember("application", uint64_string(application_hash, alloc), alloc);
+	value.AddMember("entryCount", uint64_t(usage.size()), alloc);
+	doc.AddMember("pipelineUsage", value, alloc);
+
+	StringBuffer buffer;
+	CustomWriter writer(buffer);
+	doc.Accept(writer);
+
+	blob.resize(buffer.GetSize() + 1 + usage.size() * PipelineUsageEntrySize);
+	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
+	blob[buffer.GetSize()] = '\0';
+
+	uint8_t *entry = blob.data() + buffer.GetSize() + 1;
+	for (auto &u : usage)
+	{
+		for (unsigned j = 0; j < 4; j++)
+			entry[j] = uint8_t(uint32_t(u.tag) >> (8 * j));
+		for (unsigned j = 0; j < 8; j++)
+			entry[4 + j] = uint8_t(u.hash >> (8 * j));
+		for (unsigned j = 0; j < 8; j++)
+			entry[12 + j] = uint8_t(u.bind_count >> (8 * j));
+		entry += PipelineUsageEntrySize;
+	}
+}
+
+bool StateRecorder::Impl::flush_pipeline_usage(vector<uint8_t> &blob)
+{
+	if (pending_pipeline_usage.empty())
+		return true;
+
+	PayloadWriteFlags payload_flags = 0;
+	if (checksum)
+		payload_flags |= PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+
+	vector<StateRecorderPipelineUsage> usage;
+	usage.reserve(pending_pipeline_usage.size());
+	for (auto &pending : pending_pipeline_usage)
+		usage.push_back(pending.second);
+	pending_pipeline_usage.clear();
+
+	Hasher h;
+	Hashing::hash_application_feature_info(h, application_feature_hash);
+	Hash application_hash = h.get();
+	serialize_pipeline_usage(application_hash, usage, blob);
+
+	h.u64(metadata_seed);
+	h.u64(pipeline_usage_flush_count++);
+	if (!database_iface->write_entry(RESOURCE_PIPELINE_USAGE, h.get(), blob.data(), blob.size(), payload_flags))
 		return false;
+
+	recording_statistics.entries_written++;
+	recording_statistics.bytes_serialized += blob.size();
+	recording_statistics.bytes_written += blob.size();
+	return true;
 }
 
 bool StateRecorder::Impl::serialize_application_blob_link(Hash hash, ResourceTag tag, vector<uint8_t> &blob) const
@@ -5552,7 +7878,89 @@ bool StateRecorder::Impl::serialize_render_pass(Hash hash, const VkRenderPassCre
 	return true;
 }
 
-bool StateRecorder::Impl::serialize_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo &create_info, vector<uint8_t> &blob) const
+// Members of a serialized graphics pipeline which can be interned as RESOURCE_PIPELINE_SUB_STATE blobs.
+static const char *const pipeline_sub_state_names[] = {
+	"tessellationState",
+	"dynamicState",
+	"multisampleState",
+	"vertexInputState",
+	"rasterizationState",
+	"inputAssemblyState",
+	"colorBlendState",
+	"viewportState",
+	"depthStencilState",
+};
+
+bool StateRecorder::Impl::serialize_pipeline_sub_state(Hash hash, const char *name, const Value &state,
+                                                       vector<uint8_t> &blob) const
+{
+	Document doc;
+	doc.SetObject();
+	auto &alloc = doc.GetAllocator();
+
+	Value value(kObjectType);
+	Value state_copy;
+	state_copy.CopyFrom(state, alloc);
+	value.AddMember(StringRef(name), state_copy, alloc);
+
+	Value serialized_sub_states(kObjectType);
+	serialized_sub_states.AddMember(uint64_string(hash, alloc), value, alloc);
+
+	doc.AddMember("version", FOSSILIZE_FORMAT_INTERNED_SUB_STATE_VERSION, alloc);
+	doc.AddMember("pipelineSubStates", serialized_sub_states, alloc);
+
+	StringBuffer buffer;
+	CustomWriter writer(buffer);
+	doc.Accept(writer);
+
+	blob.resize(buffer.GetSize());
+	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
+	return true;
+}
+
+bool StateRecorder::Impl::intern_pipeline_sub_states(Value &pipeline, Document::AllocatorType &alloc,
+                                                     vector<SerializedSubState> &sub_states)
+{
+	for (auto *name : pipeline_sub_state_names)
+	{
+		auto itr = pipeline.FindMember(name);
+		if (itr == pipeline.MemberEnd())
+			continue;
+
+		// Sub-states are keyed on their canonical JSON form, which always uses the compact writer.
+		StringBuffer buffer;
+		Writer<StringBuffer> writer(buffer);
+		itr->value.Accept(writer);
+
+		Hasher h(hash_scheme);
+		h.string(name);
+		h.data(reinterpret_cast<const uint8_t *>(buffer.GetString()), buffer.GetSize());
+		Hash hash = h.get();
+
+		// Jobs finish out of order, but are committed in order, so every job carries each sub-state
+		// which has not been committed yet, and the recording thread writes the first copy it sees.
+		// This way, a sub-state is always in the database before any pipeline which references it.
+		bool committed;
+		{
+			std::lock_guard<std::mutex> lock(sub_state_lock);
+			committed = committed_sub_states.count(hash) != 0;
+		}
+
+		if (!committed)
+		{
+			sub_states.push_back({ hash, {} });
+			if (!serialize_pipeline_sub_state(hash, name, itr->value, sub_states.back().blob))
+				return false;
+		}
+
+		itr->value = uint64_string(hash, alloc);
+	}
+
+	return true;
+}
+
+bool StateRecorder::Impl::serialize_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo &create_info, vector<uint8_t> &blob,
+                                                      vector<SerializedSubState> &sub_states)
 {
 	Document doc;
 	doc.SetObject();
@@ -5562,10 +7970,18 @@ bool StateRecorder::Impl::serialize_graphics_pipeline(Hash hash, const VkGraphic
 	if (!json_value(create_info, alloc, &value))
 		return false;
 
+	int version = FOSSILIZE_FORMAT_VERSION;
+	if (intern_sub_states && database_iface)
+	{
+		if (!intern_pipeline_sub_states(value, alloc, sub_states))
+			return false;
+		version = FOSSILIZE_FORMAT_INTERNED_SUB_STATE_VERSION;
+	}
+
 	Value serialized_graphics_pipelines(kObjectType);
 	serialized_graphics_pipelines.AddMember(uint64_string(hash, alloc), value, alloc);
 
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
+	doc.AddMember("version", version, alloc);
 	doc.AddMember("graphicsPipelines", serialized_graphics_pipelines, alloc);
 
 	StringBuffer buffer;
@@ -5662,6 +8078,8 @@ bool StateRecorder::serialize(uint8_t **serialized_data, size_t *serialized_size
 
 	doc.AddMember("applicationInfo", app_info, alloc);
 	doc.AddMember("physicalDeviceFeatures", pdf_info, alloc);
+	if (impl->hash_scheme != HASH_SCHEME_FNV1)
+		doc.AddMember("hashScheme", uint32_t(impl->hash_scheme), alloc);
 
 	Value samplers(kObjectType);
 	for (auto &sampler : impl->samplers)
@@ -5746,9 +8164,121 @@ void StateRecorder::free_serialized(uint8_t *serialized)
 	delete[] serialized;
 }
 
+bool StateRecorder::serialize_application_link_table(Hash application_feature_hash,
+                                                     const StateRecorderApplicationLink *links, size_t link_count,
+                                                     uint8_t **serialized_data, size_t *serialized_size,
+                                                     Hash *table_hash)
+{
+	vector<uint8_t> blob;
+	if (!Fossilize::serialize_application_link_table(application_feature_hash, links, link_count, blob, table_hash))
+		return false;
+
+	*serialized_data = new uint8_t[blob.size()];
+	*serialized_size = blob.size();
+	memcpy(*serialized_data, blob.data(), blob.size());
+	return true;
+}
+
+bool StateRecorder::serialize_pipeline_feedback(const PipelineFeedback &feedback, Hash seed,
+                                                uint8_t **serialized_data, size_t *serialized_size,
+                                                Hash *feedback_hash)
+{
+	vector<uint8_t> blob;
+	Fossilize::serialize_pipeline_feedback(feedback, blob);
+
+	Hasher h;
+	h.u64(seed);
+	h.u32(feedback.tag);
+	h.u64(feedback.hash);
+	*feedback_hash = h.get();
+
+	*serialized_data = new uint8_t[blob.size()];
+	*serialized_size = blob.size();
+	memcpy(*serialized_data, blob.data(), blob.size());
+	return true;
+}
+
+static void write_le(uint8_t *buffer, uint64_t value, unsigned bytes)
+{
+	for (unsigned j = 0; j < bytes; j++)
+		buffer[j] = uint8_t(value >> (8 * j));
+}
+
+// Same layout as pipeline usage: a JSON header, '\0', then little-endian binary entries.
+// Every entry is a 32-bit tag, a 32-bit module count, the pipeline, layout, render pass and base pipeline hashes,
+// followed by module_count module hashes.
+bool StateRecorder::serialize_pipeline_dependencies(const PipelineDependencies *dependencies, size_t count,
+                                                    uint8_t **serialized_data, size_t *serialized_size,
+                                                    Hash *index_hash)
+{
+	Document doc;
+	doc.SetObject();
+	auto &alloc = doc.GetAllocator();
+
+	doc.AddMember("version", FOSSILIZE_FORMAT_PIPELINE_DEPENDENCIES_VERSION, alloc);
+
+	Value value(kObjectType);
+	value.AddMember("entryCount", uint64_t(count), alloc);
+	doc.AddMember("pipelineDependencies", value, alloc);
+
+	StringBuffer buffer;
+	CustomWriter writer(buffer);
+	doc.Accept(writer);
+
+	size_t payload_size = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &deps = dependencies[i];
+		if (deps.tag != RESOURCE_GRAPHICS_PIPELINE && deps.tag != RESOURCE_COMPUTE_PIPELINE)
+		{
+			LOGE("Invalid tag %u in pipeline dependencies.\n", unsigned(deps.tag));
+			return false;
+		}
+		payload_size += PipelineDependenciesEntrySize + deps.module_count * sizeof(Hash);
+	}
+
+	size_t size = buffer.GetSize() + 1 + payload_size;
+	auto *blob = new uint8_t[size];
+	memcpy(blob, buffer.GetString(), buffer.GetSize());
+	blob[buffer.GetSize()] = '\0';
+
+	// The key only depends on the indexed content, so indexing the same archive twice is deduplicated.
+	Hasher h;
+	h.u64(count);
+
+	uint8_t *entry = blob + buffer.GetSize() + 1;
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &deps = dependencies[i];
+		write_le(entry, deps.tag, 4);
+		write_le(entry + 4, deps.module_count, 4);
+		write_le(entry + 8, deps.hash, 8);
+		write_le(entry + 16, deps.layout, 8);
+		write_le(entry + 24, deps.render_pass, 8);
+		write_le(entry + 32, deps.base_pipeline, 8);
+		entry += PipelineDependenciesEntrySize;
+		for (uint32_t j = 0; j < deps.module_count; j++, entry += sizeof(Hash))
+			write_le(entry, deps.modules[j], 8);
+
+		h.u32(deps.tag);
+		h.u64(deps.hash);
+		h.u64(deps.layout);
+		h.u64(deps.render_pass);
+		h.u64(deps.base_pipeline);
+		for (uint32_t j = 0; j < deps.module_count; j++)
+			h.u64(deps.modules[j]);
+	}
+
+	*index_hash = h.get();
+	*serialized_data = blob;
+	*serialized_size = size;
+	return true;
+}
+
 void StateRecorder::init_recording_thread(DatabaseInterface *iface)
 {
 	impl->database_iface = iface;
+	impl->set_staging_memory_consumer_active(true);
 	impl->worker_thread = std::thread(&StateRecorder::Impl::record_task, impl, this, true);
 }
 
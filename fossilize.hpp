@@ -77,6 +77,7 @@ public:
 	void *allocate_raw_cleared(size_t size, size_t alignment);
 
 	void reset();
+	size_t get_memory_consumption() const;
 	size_t get_peak_memory_consumption() const;
 
 	// Disable copies (and moves).
@@ -88,6 +89,54 @@ private:
 	Impl *impl;
 };
 
+// How long the driver took to create a pipeline, summed up over one or more creations.
+// Every recorder writes what it saw as separate RESOURCE_PIPELINE_FEEDBACK blobs,
+// so readers combine all blobs for a pipeline with merge_pipeline_feedback().
+struct PipelineFeedback
+{
+	// RESOURCE_GRAPHICS_PIPELINE or RESOURCE_COMPUTE_PIPELINE.
+	ResourceTag tag;
+	Hash hash;
+
+	uint64_t count;
+	uint64_t min_duration_ns;
+	uint64_t max_duration_ns;
+	uint64_t total_duration_ns;
+
+	// Creations which VK_EXT_pipeline_creation_feedback was available for,
+	// and how many of those the driver reported as cache hits or accelerated by a base pipeline.
+	uint64_t valid_feedback_count;
+	uint64_t cache_hit_count;
+	uint64_t base_pipeline_acceleration_count;
+};
+
+void merge_pipeline_feedback(PipelineFeedback &feedback, const PipelineFeedback &other);
+
+// One entry in a RESOURCE_PIPELINE_USAGE blob.
+struct StateRecorderPipelineUsage
+{
+	// RESOURCE_GRAPHICS_PIPELINE or RESOURCE_COMPUTE_PIPELINE.
+	ResourceTag tag;
+	Hash hash;
+	uint64_t bind_count;
+};
+
+// One entry in a RESOURCE_PIPELINE_DEPENDENCIES blob.
+// Lists the objects a pipeline refers to directly, so tools can find them without parsing the pipeline.
+// Hashes are 0 if the pipeline does not refer to such an object.
+struct PipelineDependencies
+{
+	// RESOURCE_GRAPHICS_PIPELINE or RESOURCE_COMPUTE_PIPELINE.
+	ResourceTag tag;
+	Hash hash;
+	Hash layout;
+	Hash render_pass;
+	Hash base_pipeline;
+	// Shader modules in stage order.
+	const Hash *modules;
+	uint32_t module_count;
+};
+
 class StateCreatorInterface
 {
 public:
@@ -108,13 +157,29 @@ public:
 	// This is only called if the blob was hashed using the older method of keying based on application info hash.
 	virtual void set_current_application_info(Hash /*hash*/) {}
 
-	// Called when parsing blobs of type RESOURCE_APPLICATION_BLOB_LINK.
+	// Called when parsing blobs of type RESOURCE_APPLICATION_BLOB_LINK, and once per entry
+	// when parsing blobs of type RESOURCE_APPLICATION_LINK_TABLE.
 	// Marks that a blob of type "tag" and hash "hash" was seen for application hash "application_feature_hash".
 	virtual void notify_application_info_link(Hash /*application_info_link_hash*/,
 	                                          Hash /*application_feature_hash*/,
 	                                          ResourceTag /*blob_tag*/,
 	                                          Hash /*blob_hash*/) {}
 
+	// Called when parsing blobs of type RESOURCE_PIPELINE_FEEDBACK.
+	virtual void notify_pipeline_feedback(const PipelineFeedback & /*feedback*/) {}
+
+	// Called once per entry when parsing blobs of type RESOURCE_PIPELINE_USAGE.
+	// Every recorder writes its own blobs, so counts for the same pipeline should be summed up.
+	virtual void notify_pipeline_usage(Hash /*application_feature_hash*/, const StateRecorderPipelineUsage & /*usage*/) {}
+
+	// Called once per entry when parsing blobs of type RESOURCE_PIPELINE_DEPENDENCIES.
+	// The modules array is only valid during the call.
+	virtual void notify_pipeline_dependencies(const PipelineDependencies & /*dependencies*/) {}
+
+	// Called when a graphics pipeline references an interned sub-state blob of type RESOURCE_PIPELINE_SUB_STATE.
+	// This is called while parsing the pipeline, before it is enqueued.
+	virtual void notify_pipeline_sub_state(Hash /*graphics_pipeline_hash*/, Hash /*sub_state_hash*/) {}
+
 	virtual bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *create_info, VkSampler *sampler) = 0;
 	virtual bool enqueue_create_descriptor_set_layout(Hash hash, const VkDescriptorSetLayoutCreateInfo *create_info, VkDescriptorSetLayout *layout) = 0;
 	virtual bool enqueue_create_pipeline_layout(Hash hash, const VkPipelineLayoutCreateInfo *create_info, VkPipelineLayout *layout) = 0;
@@ -175,6 +240,48 @@ struct StateRecorderApplicationFeatureHash
 	Hash physical_device_features_hash = 0;
 };
 
+// One entry in a RESOURCE_APPLICATION_LINK_TABLE blob.
+struct StateRecorderApplicationLink
+{
+	ResourceTag tag;
+	Hash hash;
+};
+
+// Counters for how much work the recording thread does. Only collected if enabled with set_enable_statistics().
+struct StateRecorderStatistics
+{
+	// Objects the recording thread looked up in the database, and how many of them it already had.
+	uint64_t database_lookups[RESOURCE_COUNT];
+	uint64_t database_hits[RESOURCE_COUNT];
+	// Objects which the early duplicate check found before they were copied.
+	uint64_t early_duplicate_hits[RESOURCE_COUNT];
+
+	uint64_t entries_written;
+	// Size of serialized objects before compression.
+	uint64_t bytes_serialized;
+	// Size of payloads handed to the database. Only includes compression if database worker threads encode payloads.
+	uint64_t bytes_written;
+
+	// Time the recording thread spent on work items, and how long it has been running.
+	uint64_t recording_thread_busy_ns;
+	uint64_t recording_thread_lifetime_ns;
+
+	// Work items which application threads queued up, but the recording thread had not consumed yet.
+	uint64_t max_queue_depth;
+
+	// Pipelines which were not written because of set_database_sampling().
+	uint64_t sampled_out_objects;
+	// Entries which went over set_database_rate_limit(), and were written later.
+	uint64_t deferred_objects;
+};
+
+struct StateRecorderQueueDepthSample
+{
+	// Time since recording started.
+	uint64_t time_ns;
+	uint64_t depth;
+};
+
 class StateRecorder
 {
 public:
@@ -186,6 +293,66 @@ public:
 	void set_database_enable_compression(bool enable);
 	void set_database_enable_checksum(bool enable);
 
+	// Default is false. If true, fixed-function state of graphics pipelines (vertex input, blend, rasterization, etc)
+	// is written once per distinct state as RESOURCE_PIPELINE_SUB_STATE blobs, which pipelines reference by hash.
+	// Object hashes are not affected. Archives written this way need a replayer which understands
+	// FOSSILIZE_FORMAT_INTERNED_SUB_STATE_VERSION. Only affects database output, not serialize().
+	// Call before init_recording_thread.
+	void set_database_enable_sub_state_interning(bool enable);
+
+	// Default is false. If true, application links are collected into a few large RESOURCE_APPLICATION_LINK_TABLE blobs
+	// rather than written as one RESOURCE_APPLICATION_BLOB_LINK blob per object. Pending links are written
+	// whenever the recording thread goes idle, when enough links are queued up, and when recording ends.
+	// Archives written this way need a replayer which understands FOSSILIZE_FORMAT_APPLICATION_LINK_TABLE_VERSION.
+	// Call before init_recording_thread.
+	void set_database_enable_application_link_table(bool enable);
+
+	// Default is 0, where the recording thread serializes and compresses every database entry itself.
+	// Otherwise, serialization and compression are spread over this many extra threads.
+	// Hashing and database writes stay on the recording thread, in the order objects were recorded.
+	// Call before init_recording_thread.
+	void set_database_worker_thread_count(unsigned count);
+
+	// Default is false. If true, record_sampler, record_render_pass and record_shader_module hash the object
+	// on the calling thread, and if the database already had it when recording started, only its handle is queued
+	// instead of a full copy. Objects are not checked until the recording thread has prepared the database.
+	// Call before init_recording_thread.
+	void set_database_enable_early_duplicate_check(bool enable);
+
+	// Default is 0, which is unbounded. Otherwise, once create infos which the recording thread has not consumed yet
+	// take up more than this many bytes of staging memory, record_* calls block until the recording thread catches up.
+	// Only applies while a recording thread is running. Call before init_recording_thread.
+	void set_staging_memory_budget(size_t bytes);
+	// Highest amount of staging memory which was pinned by create infos waiting for the recording thread.
+	size_t get_peak_staging_memory_consumption() const;
+
+	// Default is 0 for both, which is unlimited. Otherwise, database entries are written at this rate at most,
+	// with bursts of up to one second worth. Entries over the limit are deferred until nothing new
+	// has been recorded for a second, or until recording ends. Call before init_recording_thread.
+	void set_database_rate_limit(uint32_t objects_per_second, uint64_t bytes_per_second);
+
+	// Default is slice 0 of 1. Otherwise, only pipelines whose hash falls into the given slice are written,
+	// so recorders with different slices write complementary subsets of the same application.
+	// Objects pipelines depend on are always written, and derived pipelines fall into the slice of their base pipeline,
+	// so every written pipeline can be replayed.
+	// Call before init_recording_thread.
+	void set_database_sampling(uint32_t slice, uint32_t slice_count);
+
+	// Default is false. If true, the recording thread keeps StateRecorderStatistics, and samples the queue depth
+	// a few times per second. Call before init_recording_thread.
+	void set_enable_statistics(bool enable);
+	// Statistics are updated whenever the recording thread goes idle, and at least every sample interval while busy.
+	void get_statistics(StateRecorderStatistics *stats) const;
+	// If samples is null, count is set to the number of samples. Otherwise, up to count samples are copied.
+	// Once too many samples are collected, every other sample is dropped, and the interval doubles.
+	void get_queue_depth_samples(size_t *count, StateRecorderQueueDepthSample *samples) const;
+
+	// Selects the hash function used for every recorded object. Default is HASH_SCHEME_FNV1.
+	// Should be called before any record_* call. The scheme is part of the application feature hash,
+	// so archives recorded with different schemes never share application hashes.
+	void set_hash_scheme(HashScheme scheme);
+	HashScheme get_hash_scheme() const;
+
 	// These methods should only be called at the very beginning of the application lifetime.
 	// It will affect the hash of all create info structures.
 	// These are never recorded in a thread, so it's safe to query the application/feature hash right after calling these methods.
@@ -211,11 +378,43 @@ public:
 	bool record_compute_pipeline(VkPipeline pipeline, const VkComputePipelineCreateInfo &create_info,
 	                             const VkPipeline *base_pipelines, uint32_t base_pipeline_count,
 	                             Hash custom_hash = 0) FOSSILIZE_WARN_UNUSED;
+
+	// Records every pipeline from one vkCreate*Pipelines call, which is cheaper than one call per pipeline.
+	// pipelines and create_infos have count elements, and basePipelineIndex refers to these arrays.
+	// Pipelines which fail to record are skipped, and false is returned.
+	bool record_graphics_pipelines(const VkPipeline *pipelines, const VkGraphicsPipelineCreateInfo *create_infos,
+	                               uint32_t count) FOSSILIZE_WARN_UNUSED;
+	bool record_compute_pipelines(const VkPipeline *pipelines, const VkComputePipelineCreateInfo *create_infos,
+	                              uint32_t count) FOSSILIZE_WARN_UNUSED;
 	bool record_render_pass(VkRenderPass render_pass, const VkRenderPassCreateInfo &create_info,
 	                        Hash custom_hash = 0) FOSSILIZE_WARN_UNUSED;
 	bool record_sampler(VkSampler sampler, const VkSamplerCreateInfo &create_info,
 	                    Hash custom_hash = 0) FOSSILIZE_WARN_UNUSED;
 
+	// Records how long the driver took to create a pipeline which was recorded earlier.
+	// feedback.duration is in nanoseconds. Only set VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT if the flags came from
+	// VK_EXT_pipeline_creation_feedback. Feedback is summed up per pipeline, and written whenever the recording thread flushes.
+	// Without a database, feedback is ignored.
+	bool record_pipeline_creation_feedback(VkPipeline pipeline,
+	                                       const VkPipelineCreationFeedbackEXT &feedback) FOSSILIZE_WARN_UNUSED;
+
+	// Records how often pipelines which were recorded earlier have been bound, e.g. with vkCmdBindPipeline.
+	// Counts are summed up per pipeline, and written as one RESOURCE_PIPELINE_USAGE blob for the application
+	// whenever the recording thread flushes. Pipelines the recorder does not know are ignored, as is everything
+	// without a database.
+	bool record_pipeline_usage(const VkPipeline *pipelines, const uint32_t *bind_counts,
+	                           uint32_t count) FOSSILIZE_WARN_UNUSED;
+
+	// Call when the application destroys an object, so the recorder stops tracking its handle.
+	// Handles can be reused by the driver, and unmapped handles do not grow the recorder without bound.
+	// Objects which were already recorded are unaffected.
+	void forget_descriptor_set_layout(VkDescriptorSetLayout set_layout);
+	void forget_pipeline_layout(VkPipelineLayout pipeline_layout);
+	void forget_shader_module(VkShaderModule module);
+	void forget_pipeline(VkPipeline pipeline);
+	void forget_render_pass(VkRenderPass render_pass);
+	void forget_sampler(VkSampler sampler);
+
 	// Used by hashing functions in Hashing namespace. Should be considered an implementation detail.
 	bool get_hash_for_descriptor_set_layout(VkDescriptorSetLayout layout, Hash *hash) const FOSSILIZE_WARN_UNUSED;
 	bool get_hash_for_pipeline_layout(VkPipelineLayout layout, Hash *hash) const FOSSILIZE_WARN_UNUSED;
@@ -244,6 +443,26 @@ public:
 	bool serialize(uint8_t **serialized, size_t *serialized_size) FOSSILIZE_WARN_UNUSED;
 	static void free_serialized(uint8_t *serialized);
 
+	// Serializes a RESOURCE_APPLICATION_LINK_TABLE blob for the combined application feature hash.
+	// table_hash receives the key the blob should be written with. Free with free_serialized().
+	static bool serialize_application_link_table(Hash application_feature_hash,
+	                                             const StateRecorderApplicationLink *links, size_t link_count,
+	                                             uint8_t **serialized, size_t *serialized_size,
+	                                             Hash *table_hash) FOSSILIZE_WARN_UNUSED;
+
+	// Serializes a RESOURCE_PIPELINE_FEEDBACK blob, for tools which measure pipeline creation themselves.
+	// Pass a seed which is unique to the run, so blobs from different runs do not collide.
+	// feedback_hash receives the key the blob should be written with. Free with free_serialized().
+	static bool serialize_pipeline_feedback(const PipelineFeedback &feedback, Hash seed,
+	                                        uint8_t **serialized, size_t *serialized_size,
+	                                        Hash *feedback_hash) FOSSILIZE_WARN_UNUSED;
+
+	// Serializes a RESOURCE_PIPELINE_DEPENDENCIES blob, for tools which index the pipelines of an archive.
+	// index_hash receives the key the blob should be written with. Free with free_serialized().
+	static bool serialize_pipeline_dependencies(const PipelineDependencies *dependencies, size_t count,
+	                                            uint8_t **serialized, size_t *serialized_size,
+	                                            Hash *index_hash) FOSSILIZE_WARN_UNUSED;
+
 	// Stops the recording thread and joins with it.
 	// Should only be used in emergency situations, e.g. for FOSSILIZE_DUMP_SIGSEGV=1.
 	void tear_down_recording_thread();
@@ -262,14 +481,18 @@ namespace Hashing
 // Computes a base hash which can be used to compute some other hashes without having to create a full StateRecorder.
 // application_info and/or physical_device_features can be nullptr.
 StateRecorderApplicationFeatureHash compute_application_feature_hash(const VkApplicationInfo *application_info,
-                                                                     const VkPhysicalDeviceFeatures2 *physical_device_features);
+                                                                     const VkPhysicalDeviceFeatures2 *physical_device_features,
+                                                                     HashScheme scheme = HASH_SCHEME_FNV1);
 
 Hash compute_combined_application_feature_hash(const StateRecorderApplicationFeatureHash &base_hash);
 
 // Shader modules, samplers and render passes are standalone modules, so they can be hashed in isolation.
-bool compute_hash_shader_module(const VkShaderModuleCreateInfo &create_info, Hash *hash);
-bool compute_hash_sampler(const VkSamplerCreateInfo &create_info, Hash *hash);
-bool compute_hash_render_pass(const VkRenderPassCreateInfo &create_info, Hash *hash);
+bool compute_hash_shader_module(const VkShaderModuleCreateInfo &create_info, Hash *hash,
+                                HashScheme scheme = HASH_SCHEME_FNV1);
+bool compute_hash_sampler(const VkSamplerCreateInfo &create_info, Hash *hash,
+                          HashScheme scheme = HASH_SCHEME_FNV1);
+bool compute_hash_render_pass(const VkRenderPassCreateInfo &create_info, Hash *hash,
+                              HashScheme scheme = HASH_SCHEME_FNV1);
 
 // If you are recording in threaded mode, these must only be called from the recording thread,
 // as the dependent objects might not have been recorded yet, and thus the mapping of dependent objects is unknown.
@@ -278,6 +501,10 @@ bool compute_hash_descriptor_set_layout(const StateRecorder &recorder, const VkD
 bool compute_hash_pipeline_layout(const StateRecorder &recorder, const VkPipelineLayoutCreateInfo &layout, Hash *hash) FOSSILIZE_WARN_UNUSED;
 bool compute_hash_graphics_pipeline(const StateRecorder &recorder, const VkGraphicsPipelineCreateInfo &create_info, Hash *hash) FOSSILIZE_WARN_UNUSED;
 bool compute_hash_compute_pipeline(const StateRecorder &recorder, const VkComputePipelineCreateInfo &create_info, Hash *hash) FOSSILIZE_WARN_UNUSED;
+
+// Scheme names are "fnv1" and "striped". Numeric values are also accepted when parsing.
+const char *get_hash_scheme_name(HashScheme scheme);
+bool parse_hash_scheme(const char *name, HashScheme *scheme) FOSSILIZE_WARN_UNUSED;
 }
 
 }
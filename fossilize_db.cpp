@@ -128,6 +128,11 @@ DatabaseInterface::~DatabaseInterface()
 	delete impl;
 }
 
+bool DatabaseInterface::supports_raw_payload_writes() const
+{
+	return false;
+}
+
 bool DatabaseInterface::test_resource_filter(ResourceTag tag, Hash hash) const
 {
 	if (tag != RESOURCE_SHADER_MODULE && tag != RESOURCE_COMPUTE_PIPELINE && tag != RESOURCE_GRAPHICS_PIPELINE)
@@ -769,13 +774,17 @@ struct StreamArchive : DatabaseInterface
 
 	bool read_entry(ResourceTag tag, Hash hash, size_t *blob_size, void *blob, PayloadReadFlags flags) override
 	{
-		if (!alive || mode != DatabaseMode::ReadOnly)
+		if (!alive)
 			return false;
 
 		auto itr = seen_blobs[tag].find(hash);
 		if (itr == end(seen_blobs[tag]))
 			return false;
 
+		// Entries written by us are not tracked, only entries which were already in the archive can be read back.
+		if (mode != DatabaseMode::ReadOnly && itr->second.offset == 0)
+			return false;
+
 		if (!blob_size)
 			return false;
 
@@ -791,25 +800,19 @@ struct StreamArchive : DatabaseInterface
 		else
 			*blob_size = out_size;
 
-		if (blob)
+		if (blob && mode != DatabaseMode::ReadOnly)
 		{
-			if ((flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) != 0)
-			{
-				// Include the header.
-				ConditionalLockGuard holder(read_lock, (flags & PAYLOAD_READ_CONCURRENT_BIT) != 0);
-				if (fseek(file, itr->second.offset - sizeof(PayloadHeaderRaw), SEEK_SET) < 0)
-					return false;
-
-				size_t read_size = itr->second.header.payload_size + sizeof(PayloadHeaderRaw);
-				if (fread(blob, 1, read_size, file) != read_size)
-					return false;
-			}
-			else
-			{
-				if (!decode_payload(blob, out_size, itr->second, (flags & PAYLOAD_READ_CONCURRENT_BIT) != 0))
-					return false;
-			}
+			// Reading moves the file offset, so restore it for the next append.
+			long append_offset = ftell(file);
+			if (append_offset < 0)
+				return false;
+			bool ret = read_payload(itr->second, blob, flags);
+			if (fseek(file, append_offset, SEEK_SET) < 0)
+				return false;
+			return ret;
 		}
+		else if (blob)
+			return read_payload(itr->second, blob, flags);
 
 		return true;
 	}
@@ -858,6 +861,50 @@ struct StreamArchive : DatabaseInterface
 		convert_to_le(le_output + 12, &header.uncompressed_size, 1);
 	}
 
+	static size_t get_encoded_payload_bound(size_t size)
+	{
+		return sizeof(PayloadHeaderRaw) + std::max<size_t>(mz_compressBound(size), size);
+	}
+
+	static bool encode_payload(const void *blob, size_t size, PayloadWriteFlags flags,
+	                           uint8_t *encoded, size_t *encoded_size)
+	{
+		PayloadHeader header = {};
+		header.uncompressed_size = uint32_t(size);
+		uint8_t *payload = encoded + sizeof(PayloadHeaderRaw);
+
+		if ((flags & PAYLOAD_WRITE_COMPRESS_BIT) != 0)
+		{
+			mz_ulong zsize = mz_compressBound(size);
+			if (mz_compress2(payload, &zsize, static_cast<const unsigned char *>(blob), size,
+			                 (flags & PAYLOAD_WRITE_BEST_COMPRESSION_BIT) != 0 ? MZ_BEST_COMPRESSION : MZ_BEST_SPEED) != MZ_OK)
+				return false;
+
+			header.format = FOSSILIZE_COMPRESSION_DEFLATE;
+			header.payload_size = uint32_t(zsize);
+		}
+		else
+		{
+			memcpy(payload, blob, size);
+			header.format = FOSSILIZE_COMPRESSION_NONE;
+			header.payload_size = uint32_t(size);
+		}
+
+		if ((flags & PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT) != 0)
+			header.crc = uint32_t(mz_crc32(MZ_CRC32_INIT, payload, header.payload_size));
+
+		PayloadHeaderRaw header_raw = {};
+		convert_to_le(header_raw, header);
+		memcpy(encoded, &header_raw, sizeof(header_raw));
+		*encoded_size = sizeof(header_raw) + header.payload_size;
+		return true;
+	}
+
+	bool supports_raw_payload_writes() const override
+	{
+		return mode != DatabaseMode::ReadOnly;
+	}
+
 	bool write_entry(ResourceTag tag, Hash hash, const void *blob, size_t size, PayloadWriteFlags flags) override
 	{
 		if (!alive || mode == DatabaseMode::ReadOnly)
@@ -1085,6 +1132,28 @@ struct StreamArchive : DatabaseInterface
 			return false;
 	}
 
+	bool read_payload(const Entry &entry, void *blob, PayloadReadFlags flags)
+	{
+		if ((flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) != 0)
+		{
+			// Include the header.
+			ConditionalLockGuard holder(read_lock, (flags & PAYLOAD_READ_CONCURRENT_BIT) != 0);
+			if (fseek(file, entry.offset - sizeof(PayloadHeaderRaw), SEEK_SET) < 0)
+				return false;
+
+			size_t read_size = entry.header.payload_size + sizeof(PayloadHeaderRaw);
+			if (fread(blob, 1, read_size, file) != read_size)
+				return false;
+		}
+		else
+		{
+			if (!decode_payload(blob, entry.header.uncompressed_size, entry, (flags & PAYLOAD_READ_CONCURRENT_BIT) != 0))
+				return false;
+		}
+
+		return true;
+	}
+
 	const char *get_db_path_for_hash(ResourceTag tag, Hash hash) override
 	{
 		if (!has_entry(tag, hash))
@@ -1109,6 +1178,17 @@ DatabaseInterface *create_stream_archive_database(const char *path, DatabaseMode
 	return db;
 }
 
+size_t get_raw_fossilize_db_payload_bound(size_t size)
+{
+	return StreamArchive::get_encoded_payload_bound(size);
+}
+
+bool encode_raw_fossilize_db_payload(const void *blob, size_t size, PayloadWriteFlags flags,
+                                     void *encoded, size_t *encoded_size)
+{
+	return StreamArchive::encode_payload(blob, size, flags, static_cast<uint8_t *>(encoded), encoded_size);
+}
+
 DatabaseInterface *create_database(const char *path, DatabaseMode mode)
 {
 	auto ext = Path::ext(path);
@@ -1155,8 +1235,24 @@ struct ConcurrentDatabase : DatabaseInterface
 				return;
 
 			for (auto &hash : hashes)
-				if (test_resource_filter(tag, hash))
-					primed_hashes[i].insert(hash);
+			{
+				if (!test_resource_filter(tag, hash))
+					continue;
+				primed_hashes[i].insert(hash);
+
+				// The recorder reads back existing link tables so it does not repeat links,
+				// so keep them around after the read-only archives are closed.
+				if (mode == DatabaseMode::Append && tag == RESOURCE_APPLICATION_LINK_TABLE &&
+				    !primed_payloads.count(hash))
+				{
+					size_t blob_size = 0;
+					if (!interface.read_entry(tag, hash, &blob_size, nullptr, 0))
+						continue;
+					std::vector<uint8_t> blob(blob_size);
+					if (interface.read_entry(tag, hash, &blob_size, blob.data(), 0))
+						primed_payloads[hash] = std::move(blob);
+				}
+			}
 		}
 	}
 
@@ -1197,7 +1293,24 @@ struct ConcurrentDatabase : DatabaseInterface
 	bool read_entry(ResourceTag tag, Hash hash, size_t *blob_size, void *blob, PayloadReadFlags flags) override
 	{
 		if (mode != DatabaseMode::ReadOnly)
-			return false;
+		{
+			if (tag != RESOURCE_APPLICATION_LINK_TABLE || (flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) != 0 || !blob_size)
+				return false;
+
+			auto itr = primed_payloads.find(hash);
+			if (itr == end(primed_payloads))
+				return false;
+
+			if (blob)
+			{
+				if (*blob_size != itr->second.size())
+					return false;
+				memcpy(blob, itr->second.data(), itr->second.size());
+			}
+			else
+				*blob_size = itr->second.size();
+			return true;
+		}
 
 		if (readonly_interface && readonly_interface->read_entry(tag, hash, blob_size, blob, flags))
 			return true;
@@ -1312,12 +1425,19 @@ struct ConcurrentDatabase : DatabaseInterface
 		return nullptr;
 	}
 
+	bool supports_raw_payload_writes() const override
+	{
+		// Writes always go to a stream archive.
+		return mode == DatabaseMode::Append;
+	}
+
 	std::string base_path;
 	DatabaseMode mode;
 	std::unique_ptr<DatabaseInterface> readonly_interface;
 	std::unique_ptr<DatabaseInterface> writeonly_interface;
 	std::vector<std::unique_ptr<DatabaseInterface>> extra_readonly;
 	std::unordered_set<Hash> primed_hashes[RESOURCE_COUNT];
+	std::unordered_map<Hash, std::vector<uint8_t>> primed_payloads;
 	bool has_prepared_readonly = false;
 	bool need_writeonly_database = true;
 };
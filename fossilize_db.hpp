@@ -105,6 +105,8 @@ public:
 	// First, call with buffer == nullptr to query size.
 	// Then, pass in allocated buffer, *size must match the previously queried size.
 	// The same flags must be passed when just querying size and reading data into buffer.
+	// In Append mode, only entries which were already in the archive when it was prepared can be read.
+	// The concurrent database only supports this for RESOURCE_APPLICATION_LINK_TABLE.
 	virtual bool read_entry(ResourceTag tag, Hash hash, size_t *size, void *buffer, PayloadReadFlags flags) = 0;
 
 	// Writes an entry to database.
@@ -121,6 +123,10 @@ public:
 
 	virtual const char *get_db_path_for_hash(ResourceTag tag, Hash hash) = 0;
 
+	// If true, write_entry() accepts payloads with PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT,
+	// e.g. payloads which were encoded ahead of time with encode_raw_fossilize_db_payload().
+	virtual bool supports_raw_payload_writes() const;
+
 protected:
 	bool test_resource_filter(ResourceTag tag, Hash hash) const;
 	struct Impl;
@@ -132,6 +138,14 @@ DatabaseInterface *create_zip_archive_database(const char *path, DatabaseMode mo
 DatabaseInterface *create_stream_archive_database(const char *path, DatabaseMode mode);
 DatabaseInterface *create_database(const char *path, DatabaseMode mode);
 
+// Encodes a payload into the raw form which stream archives store, compressing and checksumming it according to flags.
+// The result can be written with PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT, which allows compression to happen
+// on a different thread than the one writing to the database.
+// encoded must hold at least get_raw_fossilize_db_payload_bound(size) bytes.
+size_t get_raw_fossilize_db_payload_bound(size_t size);
+bool encode_raw_fossilize_db_payload(const void *blob, size_t size, PayloadWriteFlags flags,
+                                     void *encoded, size_t *encoded_size);
+
 // This is a special kind of database which can be used from multiple independent processes and splits out the database
 // into a read-only part and a write-only part, which is unique for each instance of this database.
 // base_path.foz is the read-only database. If it does not exist, it will not be written to either.
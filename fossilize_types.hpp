@@ -37,13 +37,39 @@ enum ResourceTag
 	RESOURCE_GRAPHICS_PIPELINE = 6,
 	RESOURCE_COMPUTE_PIPELINE = 7,
 	RESOURCE_APPLICATION_BLOB_LINK = 8,
-	RESOURCE_COUNT = 9
+	RESOURCE_PIPELINE_SUB_STATE = 9,
+	RESOURCE_APPLICATION_LINK_TABLE = 10,
+	RESOURCE_PIPELINE_FEEDBACK = 11,
+	RESOURCE_PIPELINE_USAGE = 12,
+	RESOURCE_PIPELINE_DEPENDENCIES = 13,
+	RESOURCE_COUNT = 14
+};
+
+// Hash function used to derive object hashes.
+// The scheme is recorded in the application info of an archive so that it can be replayed consistently.
+enum HashScheme
+{
+	// One 64-bit multiply-xor per 32-bit word. Default, and implied for archives which do not specify a scheme.
+	HASH_SCHEME_FNV1 = 0,
+	// Four independent 64-bit lanes consume 32 bytes per step, finalized with an avalanche mix.
+	HASH_SCHEME_STRIPED = 1,
+	HASH_SCHEME_COUNT
 };
 
 enum
 {
 	FOSSILIZE_FORMAT_VERSION = 6,
-	FOSSILIZE_FORMAT_MIN_COMPAT_VERSION = 5
+	FOSSILIZE_FORMAT_MIN_COMPAT_VERSION = 5,
+	// Only used by blobs which contain or reference interned pipeline sub-states,
+	// so archives which do not use interning remain readable by older versions.
+	FOSSILIZE_FORMAT_INTERNED_SUB_STATE_VERSION = 7,
+	// Only used by RESOURCE_APPLICATION_LINK_TABLE blobs.
+	FOSSILIZE_FORMAT_APPLICATION_LINK_TABLE_VERSION = 8,
+	// Only used by RESOURCE_PIPELINE_FEEDBACK and RESOURCE_PIPELINE_USAGE blobs.
+	FOSSILIZE_FORMAT_PIPELINE_FEEDBACK_VERSION = 9,
+	// Only used by RESOURCE_PIPELINE_DEPENDENCIES blobs.
+	FOSSILIZE_FORMAT_PIPELINE_DEPENDENCIES_VERSION = 10,
+	FOSSILIZE_FORMAT_MAX_VERSION = FOSSILIZE_FORMAT_PIPELINE_DEPENDENCIES_VERSION
 };
 
 using Hash = uint64_t;
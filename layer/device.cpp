@@ -32,13 +32,15 @@ namespace Fossilize
 
 void Device::init(VkPhysicalDevice gpu_, VkDevice device_, Instance *pInstance_,
                   const VkPhysicalDeviceFeatures2 &features,
-                  VkLayerDispatchTable *pTable_)
+                  VkLayerDispatchTable *pTable_,
+                  bool creationFeedback_)
 {
 	gpu = gpu_;
 	device = device_;
 	pInstance = pInstance_;
 	pInstanceTable = pInstance->getTable();
 	pTable = pTable_;
+	creationFeedback = creationFeedback_;
 	recorder = Instance::getStateRecorderForDevice(pInstance->getApplicationInfo(), &features);
 }
 }
@@ -34,7 +34,8 @@ public:
 	void init(VkPhysicalDevice gpu, VkDevice device,
 	          Instance *pInstance,
 	          const VkPhysicalDeviceFeatures2 &features,
-	          VkLayerDispatchTable *pTable);
+	          VkLayerDispatchTable *pTable,
+	          bool creationFeedback);
 
 	VkLayerDispatchTable *getTable()
 	{
@@ -56,6 +57,12 @@ public:
 		return pInstance;
 	}
 
+	// Whether VK_EXT_pipeline_creation_feedback is enabled, so the layer can chain it into pipeline creation.
+	bool supportsCreationFeedback() const
+	{
+		return creationFeedback;
+	}
+
 private:
 	VkPhysicalDevice gpu = VK_NULL_HANDLE;
 	VkDevice device = VK_NULL_HANDLE;
@@ -63,5 +70,6 @@ private:
 	VkLayerDispatchTable *pTable = nullptr;
 	StateRecorder *recorder = nullptr;
 	Instance *pInstance = nullptr;
+	bool creationFeedback = false;
 };
 }
@@ -24,7 +24,14 @@
 #include "utils.hpp"
 #include "device.hpp"
 #include "instance.hpp"
+#include "instrumentation.hpp"
+#include "pipeline_usage.hpp"
 #include <mutex>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
 
 // VALVE: do exports without .def file, see vk_layer.h for definition on non-Windows platforms
 #ifdef _MSC_VER
@@ -60,6 +67,34 @@ static Device *get_device_layer(VkDevice device)
 	return layer;
 }
 
+// Bumped whenever a device goes away, which invalidates every per-thread lookup cache.
+static atomic<uint32_t> deviceGeneration;
+
+static Device *get_command_buffer_layer(VkCommandBuffer cmd)
+{
+	// Command recording is far too hot to take the global lock on every call,
+	// and a thread almost always records for the same device as last time.
+	struct LookupCache
+	{
+		void *key;
+		Device *layer;
+		uint32_t generation;
+	};
+	static thread_local LookupCache cache;
+
+	void *key = getDispatchKey(cmd);
+	uint32_t generation = deviceGeneration.load(memory_order_acquire);
+	if (cache.key != key || cache.generation != generation)
+	{
+		lock_guard<mutex> holder{ globalLock };
+		cache.key = key;
+		cache.layer = getLayerData(key, deviceData);
+		cache.generation = generation;
+	}
+
+	return cache.layer;
+}
+
 static Instance *get_instance_layer(VkPhysicalDevice gpu)
 {
 	lock_guard<mutex> holder{ globalLock };
@@ -82,7 +117,54 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateDevice(VkPhysicalDevice gpu, const V
 	// Advance the link info for the next element on the chain
 	chainInfo->u.pLayerInfo = chainInfo->u.pLayerInfo->pNext;
 
-	auto res = fpCreateDevice(gpu, pCreateInfo, pAllocator, pDevice);
+	// The extension only adds a pNext struct, so enabling it behind the application's back is harmless.
+	bool creationFeedback = false;
+	VkDeviceCreateInfo createInfo = *pCreateInfo;
+	vector<const char *> extensions;
+	if (layer->recordsPipelineFeedback())
+	{
+		extensions.insert(extensions.end(), pCreateInfo->ppEnabledExtensionNames,
+		                  pCreateInfo->ppEnabledExtensionNames + pCreateInfo->enabledExtensionCount);
+		auto extensionItr = find_if(extensions.begin(), extensions.end(), [](const char *name) {
+			return strcmp(name, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME) == 0;
+		});
+
+		// Pipeline creation feedback is core in Vulkan 1.3, so an application targeting 1.3 already covers it.
+		const auto *appInfo = layer->getApplicationInfo();
+		VkPhysicalDeviceProperties gpuProps = {};
+		layer->getTable()->GetPhysicalDeviceProperties(gpu, &gpuProps);
+		bool coreFeedback = appInfo && appInfo->apiVersion >= VK_MAKE_VERSION(1, 3, 0) &&
+		                    gpuProps.apiVersion >= VK_MAKE_VERSION(1, 3, 0);
+
+		if (extensionItr != extensions.end() || coreFeedback)
+			creationFeedback = true;
+		else
+		{
+			uint32_t count = 0;
+			layer->getTable()->EnumerateDeviceExtensionProperties(gpu, nullptr, &count, nullptr);
+			vector<VkExtensionProperties> properties(count);
+			if (count)
+				layer->getTable()->EnumerateDeviceExtensionProperties(gpu, nullptr, &count, properties.data());
+
+			for (auto &prop : properties)
+			{
+				if (strcmp(prop.extensionName, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME) == 0)
+				{
+					extensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+					createInfo.enabledExtensionCount = uint32_t(extensions.size());
+					createInfo.ppEnabledExtensionNames = extensions.data();
+					creationFeedback = true;
+					LOGI("Enabling " VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME " on the device for pipeline feedback.\n");
+					break;
+				}
+			}
+
+			if (!creationFeedback)
+				LOGI(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME " is not supported, timing pipeline creation on the CPU instead.\n");
+		}
+	}
+
+	auto res = fpCreateDevice(gpu, &createInfo, pAllocator, pDevice);
 	if (res != VK_SUCCESS)
 		return res;
 
@@ -99,7 +181,8 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateDevice(VkPhysicalDevice gpu, const V
 	{
 		lock_guard<mutex> holder{globalLock};
 		auto *device = createLayerData(getDispatchKey(*pDevice), deviceData);
-		device->init(gpu, *pDevice, layer, *pdf2, initDeviceTable(*pDevice, fpGetDeviceProcAddr, deviceDispatch));
+		device->init(gpu, *pDevice, layer, *pdf2, initDeviceTable(*pDevice, fpGetDeviceProcAddr, deviceDispatch),
+		             creationFeedback);
 	}
 
 	return VK_SUCCESS;
@@ -140,6 +223,119 @@ static VKAPI_ATTR void VKAPI_CALL DestroyInstance(VkInstance instance, const VkA
 	destroyLayerData(key, instanceData);
 }
 
+static uint32_t getStageCount(const VkGraphicsPipelineCreateInfo &info)
+{
+	return info.stageCount;
+}
+
+static uint32_t getStageCount(const VkComputePipelineCreateInfo &)
+{
+	return 1;
+}
+
+// Times a vkCreate*Pipelines call, and chains VK_EXT_pipeline_creation_feedback into it if the device has it.
+// The recorder always sees the application's create infos, never the copies with our pNext.
+template <typename CreateInfo>
+class PipelineFeedbackCapture
+{
+public:
+	PipelineFeedbackCapture(Device *layer_, const CreateInfo *pCreateInfos_, uint32_t createInfoCount_)
+		: layer(layer_), pCreateInfos(pCreateInfos_), createInfoCount(createInfoCount_)
+	{
+		if (!layer->getInstance()->recordsPipelineFeedback())
+			return;
+
+		enabled = true;
+		if (!layer->supportsCreationFeedback())
+			return;
+
+		uint32_t totalStageCount = 0;
+		for (uint32_t i = 0; i < createInfoCount; i++)
+			totalStageCount += getStageCount(pCreateInfos[i]);
+
+		infos.assign(pCreateInfos, pCreateInfos + createInfoCount);
+		chains.resize(createInfoCount);
+		feedback.resize(createInfoCount);
+		stageFeedback.resize(totalStageCount);
+		applicationFeedback.resize(createInfoCount);
+
+		uint32_t stageOffset = 0;
+		for (uint32_t i = 0; i < createInfoCount; i++)
+		{
+			// Applications may already ask for feedback, and the struct can only appear once.
+			auto *existing = static_cast<const VkPipelineCreationFeedbackCreateInfoEXT *>(
+					findpNext(pCreateInfos[i].pNext, VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT));
+			if (existing)
+			{
+				applicationFeedback[i] = existing->pPipelineCreationFeedback;
+				continue;
+			}
+
+			uint32_t stageCount = getStageCount(pCreateInfos[i]);
+			chains[i] = { VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT };
+			chains[i].pNext = infos[i].pNext;
+			chains[i].pPipelineCreationFeedback = &feedback[i];
+			chains[i].pipelineStageCreationFeedbackCount = stageCount;
+			chains[i].pPipelineStageCreationFeedbacks = stageCount ? &stageFeedback[stageOffset] : nullptr;
+			stageOffset += stageCount;
+			infos[i].pNext = &chains[i];
+		}
+	}
+
+	const CreateInfo *getCreateInfos() const
+	{
+		return infos.empty() ? pCreateInfos : infos.data();
+	}
+
+	void begin()
+	{
+		start = chrono::steady_clock::now();
+	}
+
+	void end()
+	{
+		callDuration = uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+	}
+
+	void record(const VkPipeline *pPipelines)
+	{
+		if (!enabled)
+			return;
+
+		for (uint32_t i = 0; i < createInfoCount; i++)
+		{
+			if (pPipelines[i] == VK_NULL_HANDLE)
+				continue;
+
+			// Without driver feedback, spread the cost of the call evenly.
+			VkPipelineCreationFeedbackEXT pipelineFeedback = { 0, callDuration / createInfoCount };
+			if (!infos.empty())
+			{
+				auto &driverFeedback = applicationFeedback[i] ? *applicationFeedback[i] : feedback[i];
+				if ((driverFeedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) != 0)
+					pipelineFeedback = driverFeedback;
+			}
+
+			if (!layer->getRecorder().record_pipeline_creation_feedback(pPipelines[i], pipelineFeedback))
+				LOGE("Failed to record pipeline creation feedback.\n");
+		}
+	}
+
+private:
+	Device *layer;
+	const CreateInfo *pCreateInfos;
+	uint32_t createInfoCount;
+	bool enabled = false;
+	chrono::steady_clock::time_point start;
+	uint64_t callDuration = 0;
+
+	vector<CreateInfo> infos;
+	vector<VkPipelineCreationFeedbackCreateInfoEXT> chains;
+	vector<VkPipelineCreationFeedbackEXT> feedback;
+	vector<VkPipelineCreationFeedbackEXT> stageFeedback;
+	vector<const VkPipelineCreationFeedbackEXT *> applicationFeedback;
+};
+
 static VKAPI_ATTR VkResult VKAPI_CALL CreateGraphicsPipelinesNormal(Device *layer,
                                                                     VkDevice device, VkPipelineCache pipelineCache,
                                                                     uint32_t createInfoCount,
@@ -147,16 +343,20 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateGraphicsPipelinesNormal(Device *laye
                                                                     const VkAllocationCallbacks *pAllocator,
                                                                     VkPipeline *pPipelines)
 {
+	PipelineFeedbackCapture<VkGraphicsPipelineCreateInfo> feedback(layer, pCreateInfos, createInfoCount);
+
 	// Have to create all pipelines here, in case the application makes use of basePipelineIndex.
-	auto res = layer->getTable()->CreateGraphicsPipelines(device, pipelineCache, createInfoCount, pCreateInfos, pAllocator, pPipelines);
+	feedback.begin();
+	auto res = layer->getTable()->CreateGraphicsPipelines(device, pipelineCache, createInfoCount,
+	                                                      feedback.getCreateInfos(), pAllocator, pPipelines);
+	feedback.end();
 	if (res != VK_SUCCESS)
 		return res;
 
-	for (uint32_t i = 0; i < createInfoCount; i++)
-	{
-		if (!layer->getRecorder().record_graphics_pipeline(pPipelines[i], pCreateInfos[i], pPipelines, createInfoCount))
-			LOGE("Recording graphics pipeline failed.\n");
-	}
+	LayerTimer timer(LAYER_ENTRY_POINT_CREATE_GRAPHICS_PIPELINES);
+	if (!layer->getRecorder().record_graphics_pipelines(pPipelines, pCreateInfos, createInfoCount))
+		LOGE("Recording graphics pipeline failed.\n");
+	feedback.record(pPipelines);
 
 	return VK_SUCCESS;
 }
@@ -169,6 +369,7 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateGraphicsPipelinesParanoid(Device *la
                                                                       const VkAllocationCallbacks *pAllocator,
                                                                       VkPipeline *pPipelines)
 {
+	LayerTimer timer(LAYER_ENTRY_POINT_CREATE_GRAPHICS_PIPELINES);
 	for (uint32_t i = 0; i < createInfoCount; i++)
 	{
 		// Fixup base pipeline index since we unroll the Create call.
@@ -184,13 +385,20 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateGraphicsPipelinesParanoid(Device *la
 		// Have to create all pipelines here, in case the application makes use of basePipelineIndex.
 		// Write arguments in TLS in-case we crash here.
 		Instance::braceForGraphicsPipelineCrash(&layer->getRecorder(), &info);
-		auto res = layer->getTable()->CreateGraphicsPipelines(device, pipelineCache, 1, &info,
+		PipelineFeedbackCapture<VkGraphicsPipelineCreateInfo> feedback(layer, &info, 1);
+		timer.pause();
+		feedback.begin();
+		auto res = layer->getTable()->CreateGraphicsPipelines(device, pipelineCache, 1, feedback.getCreateInfos(),
 		                                                      pAllocator, &pPipelines[i]);
+		feedback.end();
 		Instance::completedPipelineCompilation();
+		timer.resume();
 
 		// Record failing pipelines for repro.
 		if (!layer->getRecorder().record_graphics_pipeline(res == VK_SUCCESS ? pPipelines[i] : VK_NULL_HANDLE, info, nullptr, 0))
 			LOGE("Failed to record graphics pipeline.\n");
+		if (res == VK_SUCCESS)
+			feedback.record(&pPipelines[i]);
 
 		if (res != VK_SUCCESS)
 		{
@@ -231,16 +439,20 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateComputePipelinesNormal(Device *layer
                                                                    const VkAllocationCallbacks *pAllocator,
                                                                    VkPipeline *pPipelines)
 {
+	PipelineFeedbackCapture<VkComputePipelineCreateInfo> feedback(layer, pCreateInfos, createInfoCount);
+
 	// Have to create all pipelines here, in case the application makes use of basePipelineIndex.
-	auto res = layer->getTable()->CreateComputePipelines(device, pipelineCache, createInfoCount, pCreateInfos, pAllocator, pPipelines);
+	feedback.begin();
+	auto res = layer->getTable()->CreateComputePipelines(device, pipelineCache, createInfoCount,
+	                                                     feedback.getCreateInfos(), pAllocator, pPipelines);
+	feedback.end();
 	if (res != VK_SUCCESS)
 		return res;
 
-	for (uint32_t i = 0; i < createInfoCount; i++)
-	{
-		if (!layer->getRecorder().record_compute_pipeline(pPipelines[i], pCreateInfos[i], pPipelines, createInfoCount))
-			LOGE("Failed to record compute pipeline.\n");
-	}
+	LayerTimer timer(LAYER_ENTRY_POINT_CREATE_COMPUTE_PIPELINES);
+	if (!layer->getRecorder().record_compute_pipelines(pPipelines, pCreateInfos, createInfoCount))
+		LOGE("Failed to record compute pipeline.\n");
+	feedback.record(pPipelines);
 
 	return VK_SUCCESS;
 }
@@ -253,6 +465,7 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateComputePipelinesParanoid(Device *lay
                                                                      const VkAllocationCallbacks *pAllocator,
                                                                      VkPipeline *pPipelines)
 {
+	LayerTimer timer(LAYER_ENTRY_POINT_CREATE_COMPUTE_PIPELINES);
 	for (uint32_t i = 0; i < createInfoCount; i++)
 	{
 		// Fixup base pipeline index since we unroll the Create call.
@@ -268,13 +481,20 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateComputePipelinesParanoid(Device *lay
 		// Have to create all pipelines here, in case the application makes use of basePipelineIndex.
 		// Write arguments in TLS in-case we crash here.
 		Instance::braceForComputePipelineCrash(&layer->getRecorder(), &info);
-		auto res = layer->getTable()->CreateComputePipelines(device, pipelineCache, 1, &info,
+		PipelineFeedbackCapture<VkComputePipelineCreateInfo> feedback(layer, &info, 1);
+		timer.pause();
+		feedback.begin();
+		auto res = layer->getTable()->CreateComputePipelines(device, pipelineCache, 1, feedback.getCreateInfos(),
 		                                                     pAllocator, &pPipelines[i]);
+		feedback.end();
 		Instance::completedPipelineCompilation();
+		timer.resume();
 
 		// Record failing pipelines for repro.
 		if (!layer->getRecorder().record_compute_pipeline(res == VK_SUCCESS ? pPipelines[i] : VK_NULL_HANDLE, info, nullptr, 0))
 			LOGE("Failed to record compute pipeline.\n");
+		if (res == VK_SUCCESS)
+			feedback.record(&pPipelines[i]);
 
 		if (res != VK_SUCCESS)
 		{
@@ -319,6 +539,7 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreatePipelineLayout(VkDevice device,
 
 	if (result == VK_SUCCESS)
 	{
+		LayerTimer timer(LAYER_ENTRY_POINT_CREATE_PIPELINE_LAYOUT);
 		if (!layer->getRecorder().record_pipeline_layout(*pLayout, *pCreateInfo))
 			LOGE("Failed to record pipeline layout.\n");
 	}
@@ -336,6 +557,7 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateDescriptorSetLayout(VkDevice device,
 
 	if (result == VK_SUCCESS)
 	{
+		LayerTimer timer(LAYER_ENTRY_POINT_CREATE_DESCRIPTOR_SET_LAYOUT);
 		if (!layer->getRecorder().record_descriptor_set_layout(*pSetLayout, *pCreateInfo))
 			LOGE("Failed to record descriptor set layout.\n");
 	}
@@ -368,6 +590,13 @@ static VKAPI_ATTR void VKAPI_CALL DestroyDevice(VkDevice device, const VkAllocat
 	void *key = getDispatchKey(device);
 	auto *layer = getLayerData(key, deviceData);
 
+	// The peak staging memory is part of the report.
+	Instance::writeInstrumentationReport();
+
+	if (layer->getInstance()->recordsPipelineUsage())
+		PipelineUsage::flushAllThreads();
+	deviceGeneration.fetch_add(1, memory_order_release);
+
 	layer->getTable()->DestroyDevice(device, pAllocator);
 	destroyLayerData(key, deviceData);
 }
@@ -380,6 +609,7 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateSampler(VkDevice device, const VkSam
 
 	if (res == VK_SUCCESS)
 	{
+		LayerTimer timer(LAYER_ENTRY_POINT_CREATE_SAMPLER);
 		if (!layer->getRecorder().record_sampler(*pSampler, *pCreateInfo))
 			LOGE("Failed to record sampler.\n");
 	}
@@ -399,6 +629,7 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateShaderModule(VkDevice device, const
 
 	if (res == VK_SUCCESS)
 	{
+		LayerTimer timer(LAYER_ENTRY_POINT_CREATE_SHADER_MODULE);
 		if (!layer->getRecorder().record_shader_module(*pShaderModule, *pCreateInfo))
 			LOGE("Failed to record shader module.\n");
 	}
@@ -415,12 +646,96 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateRenderPass(VkDevice device, const Vk
 
 	if (res == VK_SUCCESS)
 	{
+		LayerTimer timer(LAYER_ENTRY_POINT_CREATE_RENDER_PASS);
 		if (!layer->getRecorder().record_render_pass(*pRenderPass, *pCreateInfo))
 			LOGE("Failed to record render pass.\n");
 	}
 	return res;
 }
 
+static VKAPI_ATTR void VKAPI_CALL DestroySampler(VkDevice device, VkSampler sampler, const VkAllocationCallbacks *pCallbacks)
+{
+	auto *layer = get_device_layer(device);
+
+	// Forget the handle before the driver is free to hand it out again.
+	if (sampler != VK_NULL_HANDLE)
+	{
+		LayerTimer timer(LAYER_ENTRY_POINT_DESTROY_SAMPLER);
+		layer->getRecorder().forget_sampler(sampler);
+	}
+	layer->getTable()->DestroySampler(device, sampler, pCallbacks);
+}
+
+static VKAPI_ATTR void VKAPI_CALL DestroyShaderModule(VkDevice device, VkShaderModule shaderModule, const VkAllocationCallbacks *pCallbacks)
+{
+	auto *layer = get_device_layer(device);
+
+	if (shaderModule != VK_NULL_HANDLE)
+	{
+		LayerTimer timer(LAYER_ENTRY_POINT_DESTROY_SHADER_MODULE);
+		layer->getRecorder().forget_shader_module(shaderModule);
+	}
+	layer->getTable()->DestroyShaderModule(device, shaderModule, pCallbacks);
+}
+
+static VKAPI_ATTR void VKAPI_CALL DestroyRenderPass(VkDevice device, VkRenderPass renderPass, const VkAllocationCallbacks *pCallbacks)
+{
+	auto *layer = get_device_layer(device);
+
+	if (renderPass != VK_NULL_HANDLE)
+	{
+		LayerTimer timer(LAYER_ENTRY_POINT_DESTROY_RENDER_PASS);
+		layer->getRecorder().forget_render_pass(renderPass);
+	}
+	layer->getTable()->DestroyRenderPass(device, renderPass, pCallbacks);
+}
+
+static VKAPI_ATTR void VKAPI_CALL DestroyPipeline(VkDevice device, VkPipeline pipeline, const VkAllocationCallbacks *pCallbacks)
+{
+	auto *layer = get_device_layer(device);
+
+	if (pipeline != VK_NULL_HANDLE)
+	{
+		LayerTimer timer(LAYER_ENTRY_POINT_DESTROY_PIPELINE);
+		if (layer->getInstance()->recordsPipelineUsage())
+			PipelineUsage::forgetPipeline(pipeline);
+		layer->getRecorder().forget_pipeline(pipeline);
+	}
+	layer->getTable()->DestroyPipeline(device, pipeline, pCallbacks);
+}
+
+static VKAPI_ATTR void VKAPI_CALL DestroyPipelineLayout(VkDevice device, VkPipelineLayout pipelineLayout, const VkAllocationCallbacks *pCallbacks)
+{
+	auto *layer = get_device_layer(device);
+
+	if (pipelineLayout != VK_NULL_HANDLE)
+	{
+		LayerTimer timer(LAYER_ENTRY_POINT_DESTROY_PIPELINE_LAYOUT);
+		layer->getRecorder().forget_pipeline_layout(pipelineLayout);
+	}
+	layer->getTable()->DestroyPipelineLayout(device, pipelineLayout, pCallbacks);
+}
+
+static VKAPI_ATTR void VKAPI_CALL DestroyDescriptorSetLayout(VkDevice device, VkDescriptorSetLayout descriptorSetLayout, const VkAllocationCallbacks *pCallbacks)
+{
+	auto *layer = get_device_layer(device);
+
+	if (descriptorSetLayout != VK_NULL_HANDLE)
+	{
+		LayerTimer timer(LAYER_ENTRY_POINT_DESTROY_DESCRIPTOR_SET_LAYOUT);
+		layer->getRecorder().forget_descriptor_set_layout(descriptorSetLayout);
+	}
+	layer->getTable()->DestroyDescriptorSetLayout(device, descriptorSetLayout, pCallbacks);
+}
+
+static VKAPI_ATTR void VKAPI_CALL CmdBindPipeline(VkCommandBuffer commandBuffer, VkPipelineBindPoint pipelineBindPoint,
+                                                  VkPipeline pipeline)
+{
+	auto *layer = get_command_buffer_layer(commandBuffer);
+	PipelineUsage::countBind(&layer->getRecorder(), pipeline);
+	layer->getTable()->CmdBindPipeline(commandBuffer, pipelineBindPoint, pipeline);
+}
+
 static PFN_vkVoidFunction interceptCoreDeviceCommand(const char *pName)
 {
 	static const struct
@@ -438,6 +753,13 @@ static PFN_vkVoidFunction interceptCoreDeviceCommand(const char *pName)
 		{ "vkCreateSampler", reinterpret_cast<PFN_vkVoidFunction>(CreateSampler) },
 		{ "vkCreateShaderModule", reinterpret_cast<PFN_vkVoidFunction>(CreateShaderModule) },
 		{ "vkCreateRenderPass", reinterpret_cast<PFN_vkVoidFunction>(CreateRenderPass) },
+
+		{ "vkDestroyDescriptorSetLayout", reinterpret_cast<PFN_vkVoidFunction>(DestroyDescriptorSetLayout) },
+		{ "vkDestroyPipelineLayout", reinterpret_cast<PFN_vkVoidFunction>(DestroyPipelineLayout) },
+		{ "vkDestroyPipeline", reinterpret_cast<PFN_vkVoidFunction>(DestroyPipeline) },
+		{ "vkDestroySampler", reinterpret_cast<PFN_vkVoidFunction>(DestroySampler) },
+		{ "vkDestroyShaderModule", reinterpret_cast<PFN_vkVoidFunction>(DestroyShaderModule) },
+		{ "vkDestroyRenderPass", reinterpret_cast<PFN_vkVoidFunction>(DestroyRenderPass) },
 	};
 
 	for (auto &cmd : coreDeviceCommands)
@@ -463,6 +785,10 @@ VK_LAYER_EXPORT VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vkGetDeviceProcAddr(VkD
 		layer = getLayerData(getDispatchKey(device), deviceData);
 	}
 
+	// Only hook command recording when bind counts are actually wanted.
+	if (layer->getInstance()->recordsPipelineUsage() && strcmp(pName, "vkCmdBindPipeline") == 0)
+		return reinterpret_cast<PFN_vkVoidFunction>(CmdBindPipeline);
+
 	return layer->getTable()->GetDeviceProcAddr(device, pName);
 }
 
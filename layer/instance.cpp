@@ -21,10 +21,14 @@
  */
 
 #include "instance.hpp"
+#include "instrumentation.hpp"
+#include "pipeline_usage.hpp"
 #include "utils.hpp"
 #include <mutex>
 #include <unordered_map>
 #include <memory>
+#include <vector>
+#include <random>
 #include "fossilize_application_filter.hpp"
 
 #ifdef _WIN32
@@ -80,6 +84,49 @@ struct Recorder
 };
 static std::unordered_map<Hash, Recorder> globalRecorders;
 
+static void writeInstrumentationReportLocked()
+{
+	std::vector<InstrumentedRecorder> recorders;
+	recorders.reserve(globalRecorders.size());
+	for (auto &entry : globalRecorders)
+		recorders.push_back({ entry.first, entry.second.recorder.get() });
+	Instrumentation::writeReport(recorders.data(), recorders.size());
+}
+
+// Declared after globalRecorders, so this runs before any recorder is destroyed.
+static struct InstrumentationReportAtExit
+{
+	~InstrumentationReportAtExit()
+	{
+		if (!Instrumentation::isEnabled())
+			return;
+
+		// Drain the recording threads first, so the report includes everything.
+		std::lock_guard<std::mutex> lock(recorderLock);
+		for (auto &entry : globalRecorders)
+			entry.second.recorder->tear_down_recording_thread();
+		writeInstrumentationReportLocked();
+	}
+} instrumentationReportAtExit;
+
+// Declared after instrumentationReportAtExit, so bind counters are handed over before recording threads are drained.
+static struct PipelineUsageAtExit
+{
+	~PipelineUsageAtExit()
+	{
+		PipelineUsage::flushAllThreads();
+	}
+} pipelineUsageAtExit;
+
+void Instance::writeInstrumentationReport()
+{
+	if (!Instrumentation::isEnabled())
+		return;
+
+	std::lock_guard<std::mutex> lock(recorderLock);
+	writeInstrumentationReportLocked();
+}
+
 #ifdef ANDROID
 static std::string getSystemProperty(const char *key)
 {
@@ -119,6 +166,161 @@ static std::string getSystemProperty(const char *key)
 #define FOSSILIZE_APPLICATION_INFO_FILTER_PATH_ENV "FOSSILIZE_APPLICATION_INFO_FILTER_PATH"
 #endif
 
+#ifndef FOSSILIZE_HASH_SCHEME_ENV
+#define FOSSILIZE_HASH_SCHEME_ENV "FOSSILIZE_HASH_SCHEME"
+#endif
+
+static HashScheme getHashScheme()
+{
+	auto scheme = HASH_SCHEME_FNV1;
+#ifdef ANDROID
+	auto schemeName = getSystemProperty("debug.fossilize.hash_scheme");
+	if (!schemeName.empty() && !Hashing::parse_hash_scheme(schemeName.c_str(), &scheme))
+		LOGE("Unknown hash scheme \"%s\", using default.\n", schemeName.c_str());
+#else
+	const char *schemeName = getenv(FOSSILIZE_HASH_SCHEME_ENV);
+	if (schemeName && !Hashing::parse_hash_scheme(schemeName, &scheme))
+		LOGE("Unknown hash scheme \"%s\", using default.\n", schemeName);
+#endif
+	return scheme;
+}
+
+#ifndef FOSSILIZE_INTERN_SUB_STATES_ENV
+#define FOSSILIZE_INTERN_SUB_STATES_ENV "FOSSILIZE_INTERN_SUB_STATES"
+#endif
+
+static bool getInternSubStates()
+{
+#ifdef ANDROID
+	auto intern = getSystemProperty("debug.fossilize.intern_sub_states");
+	return !intern.empty() && strtoul(intern.c_str(), nullptr, 0) != 0;
+#else
+	const char *intern = getenv(FOSSILIZE_INTERN_SUB_STATES_ENV);
+	return intern && strtoul(intern, nullptr, 0) != 0;
+#endif
+}
+
+#ifndef FOSSILIZE_APPLICATION_LINK_TABLE_ENV
+#define FOSSILIZE_APPLICATION_LINK_TABLE_ENV "FOSSILIZE_APPLICATION_LINK_TABLE"
+#endif
+
+static bool getApplicationLinkTable()
+{
+#ifdef ANDROID
+	auto table = getSystemProperty("debug.fossilize.application_link_table");
+	return !table.empty() && strtoul(table.c_str(), nullptr, 0) != 0;
+#else
+	const char *table = getenv(FOSSILIZE_APPLICATION_LINK_TABLE_ENV);
+	return table && strtoul(table, nullptr, 0) != 0;
+#endif
+}
+
+#ifndef FOSSILIZE_DATABASE_WORKER_THREADS_ENV
+#define FOSSILIZE_DATABASE_WORKER_THREADS_ENV "FOSSILIZE_DATABASE_WORKER_THREADS"
+#endif
+
+static unsigned getDatabaseWorkerThreads()
+{
+#ifdef ANDROID
+	auto threads = getSystemProperty("debug.fossilize.database_worker_threads");
+	return !threads.empty() ? unsigned(strtoul(threads.c_str(), nullptr, 0)) : 0u;
+#else
+	const char *threads = getenv(FOSSILIZE_DATABASE_WORKER_THREADS_ENV);
+	return threads ? unsigned(strtoul(threads, nullptr, 0)) : 0u;
+#endif
+}
+
+#ifndef FOSSILIZE_EARLY_DUPLICATE_CHECK_ENV
+#define FOSSILIZE_EARLY_DUPLICATE_CHECK_ENV "FOSSILIZE_EARLY_DUPLICATE_CHECK"
+#endif
+
+static bool getEarlyDuplicateCheck()
+{
+#ifdef ANDROID
+	auto check = getSystemProperty("debug.fossilize.early_duplicate_check");
+	return !check.empty() && strtoul(check.c_str(), nullptr, 0) != 0;
+#else
+	const char *check = getenv(FOSSILIZE_EARLY_DUPLICATE_CHECK_ENV);
+	return check && strtoul(check, nullptr, 0) != 0;
+#endif
+}
+
+#ifndef FOSSILIZE_STAGING_MEMORY_BUDGET_MB_ENV
+#define FOSSILIZE_STAGING_MEMORY_BUDGET_MB_ENV "FOSSILIZE_STAGING_MEMORY_BUDGET_MB"
+#endif
+
+static size_t getStagingMemoryBudget()
+{
+#ifdef ANDROID
+	auto budget = getSystemProperty("debug.fossilize.staging_memory_budget_mb");
+	return !budget.empty() ? size_t(strtoul(budget.c_str(), nullptr, 0)) * 1024 * 1024 : 0;
+#else
+	const char *budget = getenv(FOSSILIZE_STAGING_MEMORY_BUDGET_MB_ENV);
+	return budget ? size_t(strtoul(budget, nullptr, 0)) * 1024 * 1024 : 0;
+#endif
+}
+
+#ifndef FOSSILIZE_RATE_LIMIT_OBJECTS_ENV
+#define FOSSILIZE_RATE_LIMIT_OBJECTS_ENV "FOSSILIZE_RATE_LIMIT_OBJECTS"
+#endif
+
+#ifndef FOSSILIZE_RATE_LIMIT_BYTES_ENV
+#define FOSSILIZE_RATE_LIMIT_BYTES_ENV "FOSSILIZE_RATE_LIMIT_BYTES"
+#endif
+
+#ifndef FOSSILIZE_SAMPLING_RATE_ENV
+#define FOSSILIZE_SAMPLING_RATE_ENV "FOSSILIZE_SAMPLING_RATE"
+#endif
+
+#ifndef FOSSILIZE_SAMPLING_SLICE_ENV
+#define FOSSILIZE_SAMPLING_SLICE_ENV "FOSSILIZE_SAMPLING_SLICE"
+#endif
+
+static uint64_t getUnsignedSetting(const char *env, const char *prop)
+{
+#ifdef ANDROID
+	(void)env;
+	auto value = getSystemProperty(prop);
+	return !value.empty() ? strtoull(value.c_str(), nullptr, 0) : 0;
+#else
+	(void)prop;
+	const char *value = getenv(env);
+	return value ? strtoull(value, nullptr, 0) : 0;
+#endif
+}
+
+static bool hasSetting(const char *env, const char *prop)
+{
+#ifdef ANDROID
+	(void)env;
+	return !getSystemProperty(prop).empty();
+#else
+	(void)prop;
+	return getenv(env) != nullptr;
+#endif
+}
+
+static void setupDatabaseSampling(StateRecorder &recorder)
+{
+	recorder.set_database_rate_limit(
+			uint32_t(getUnsignedSetting(FOSSILIZE_RATE_LIMIT_OBJECTS_ENV, "debug.fossilize.rate_limit_objects")),
+			getUnsignedSetting(FOSSILIZE_RATE_LIMIT_BYTES_ENV, "debug.fossilize.rate_limit_bytes"));
+
+	auto rate = uint32_t(getUnsignedSetting(FOSSILIZE_SAMPLING_RATE_ENV, "debug.fossilize.sampling_rate"));
+	if (rate <= 1)
+		return;
+
+	// Without a fixed slice, every process picks its own, so a fleet covers all slices over time.
+	uint32_t slice;
+	if (hasSetting(FOSSILIZE_SAMPLING_SLICE_ENV, "debug.fossilize.sampling_slice"))
+		slice = uint32_t(getUnsignedSetting(FOSSILIZE_SAMPLING_SLICE_ENV, "debug.fossilize.sampling_slice"));
+	else
+		slice = std::random_device()() % rate;
+
+	LOGI("Recording sampling slice %u of %u.\n", slice, rate);
+	recorder.set_database_sampling(slice, rate);
+}
+
 #ifdef FOSSILIZE_LAYER_CAPTURE_SIGSEGV
 static thread_local const VkComputePipelineCreateInfo *tls_compute_create_info = nullptr;
 static thread_local const VkGraphicsPipelineCreateInfo *tls_graphics_create_info = nullptr;
@@ -214,8 +416,21 @@ void Instance::completedPipelineCompilation()
 }
 #endif
 
+#ifndef FOSSILIZE_PIPELINE_FEEDBACK_ENV
+#define FOSSILIZE_PIPELINE_FEEDBACK_ENV "FOSSILIZE_PIPELINE_FEEDBACK"
+#endif
+
+#ifndef FOSSILIZE_PIPELINE_USAGE_ENV
+#define FOSSILIZE_PIPELINE_USAGE_ENV "FOSSILIZE_PIPELINE_USAGE"
+#endif
+
 Instance::Instance()
 {
+	enablePipelineFeedback =
+			getUnsignedSetting(FOSSILIZE_PIPELINE_FEEDBACK_ENV, "debug.fossilize.pipeline_feedback") != 0;
+	enablePipelineUsage =
+			getUnsignedSetting(FOSSILIZE_PIPELINE_USAGE_ENV, "debug.fossilize.pipeline_usage") != 0;
+
 #ifdef FOSSILIZE_LAYER_CAPTURE_SIGSEGV
 #ifdef ANDROID
 	auto sigsegv = getSystemProperty("debug.fossilize.dump_sigsegv");
@@ -237,7 +452,8 @@ Instance::Instance()
 
 StateRecorder *Instance::getStateRecorderForDevice(const VkApplicationInfo *appInfo, const VkPhysicalDeviceFeatures2 *features)
 {
-	auto appInfoFeatureHash = Hashing::compute_application_feature_hash(appInfo, features);
+	auto hashScheme = getHashScheme();
+	auto appInfoFeatureHash = Hashing::compute_application_feature_hash(appInfo, features, hashScheme);
 	auto hash = Hashing::compute_combined_application_feature_hash(appInfoFeatureHash);
 
 	std::lock_guard<std::mutex> lock(recorderLock);
@@ -289,7 +505,15 @@ StateRecorder *Instance::getStateRecorderForDevice(const VkApplicationInfo *appI
 	entry.recorder.reset(recorder);
 	recorder->set_database_enable_compression(true);
 	recorder->set_database_enable_checksum(true);
+	recorder->set_database_enable_sub_state_interning(getInternSubStates());
+	recorder->set_database_enable_application_link_table(getApplicationLinkTable());
+	recorder->set_database_worker_thread_count(getDatabaseWorkerThreads());
+	recorder->set_database_enable_early_duplicate_check(getEarlyDuplicateCheck());
+	recorder->set_staging_memory_budget(getStagingMemoryBudget());
+	setupDatabaseSampling(*recorder);
+	recorder->set_enable_statistics(Instrumentation::isEnabled());
 	recorder->set_application_info_filter(entry.filter.get());
+	recorder->set_hash_scheme(hashScheme);
 	if (appInfo)
 		if (!recorder->record_application_info(*appInfo))
 			LOGE("Failed to record application info.\n");
@@ -56,6 +56,18 @@ public:
 	}
 
 	static StateRecorder *getStateRecorderForDevice(const VkApplicationInfo *appInfo, const VkPhysicalDeviceFeatures2 *features);
+	// Only does anything if instrumentation is enabled.
+	static void writeInstrumentationReport();
+
+	bool recordsPipelineFeedback() const
+	{
+		return enablePipelineFeedback;
+	}
+
+	bool recordsPipelineUsage() const
+	{
+		return enablePipelineUsage;
+	}
 
 #ifdef FOSSILIZE_LAYER_CAPTURE_SIGSEGV
 	bool capturesCrashes() const
@@ -74,6 +86,8 @@ private:
 	VkInstance instance = VK_NULL_HANDLE;
 	VkLayerInstanceDispatchTable *pTable = nullptr;
 	PFN_vkGetInstanceProcAddr gpa = nullptr;
+	bool enablePipelineFeedback = false;
+	bool enablePipelineUsage = false;
 #ifdef FOSSILIZE_LAYER_CAPTURE_SIGSEGV
 	bool enableCrashHandler = false;
 #endif
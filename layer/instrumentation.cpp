@@ -0,0 +1,266 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "instrumentation.hpp"
+#include "utils.hpp"
+#include "fossilize.hpp"
+#include "fossilize_inttypes.h"
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace Fossilize
+{
+#ifndef FOSSILIZE_INSTRUMENTATION_PATH_ENV
+#define FOSSILIZE_INSTRUMENTATION_PATH_ENV "FOSSILIZE_INSTRUMENTATION_PATH"
+#endif
+
+// Bucket N counts calls which took [2^N, 2^(N+1)) nanoseconds. The last bucket also counts anything slower.
+enum { LatencyHistogramBuckets = 32 };
+
+struct EntryPointTimings
+{
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> total_ns;
+	std::atomic<uint64_t> max_ns;
+	std::atomic<uint64_t> histogram[LatencyHistogramBuckets];
+};
+
+// Zero-initialized as it has static storage duration.
+static EntryPointTimings entryPointTimings[LAYER_ENTRY_POINT_COUNT];
+
+static const char *entryPointNames[LAYER_ENTRY_POINT_COUNT] = {
+	"vkCreateDescriptorSetLayout",
+	"vkCreatePipelineLayout",
+	"vkCreateGraphicsPipelines",
+	"vkCreateComputePipelines",
+	"vkCreateSampler",
+	"vkCreateShaderModule",
+	"vkCreateRenderPass",
+	"vkDestroyDescriptorSetLayout",
+	"vkDestroyPipelineLayout",
+	"vkDestroyPipeline",
+	"vkDestroySampler",
+	"vkDestroyShaderModule",
+	"vkDestroyRenderPass",
+};
+
+static const char *resourceTagNames[RESOURCE_COUNT] = {
+	"applicationInfo",
+	"sampler",
+	"descriptorSetLayout",
+	"pipelineLayout",
+	"shaderModule",
+	"renderPass",
+	"graphicsPipeline",
+	"computePipeline",
+	"applicationBlobLink",
+	"pipelineSubState",
+	"applicationLinkTable",
+	"pipelineFeedback",
+	"pipelineUsage",
+	"pipelineDependencies",
+};
+
+static const std::string &getReportPath()
+{
+	static const std::string path = []() -> std::string {
+#ifdef ANDROID
+		char value[256];
+		FILE *file = popen("getprop debug.fossilize.instrumentation_path", "rb");
+		if (!file)
+			return {};
+		size_t len = fread(value, 1, sizeof(value) - 1, file);
+		pclose(file);
+		// Last character is a newline, so remove that.
+		return len > 1 ? std::string(value, len - 1) : std::string();
+#else
+		const char *env = getenv(FOSSILIZE_INSTRUMENTATION_PATH_ENV);
+		return env ? env : "";
+#endif
+	}();
+	return path;
+}
+
+namespace Instrumentation
+{
+bool isEnabled()
+{
+	static const bool enabled = !getReportPath().empty();
+	return enabled;
+}
+
+void addSample(LayerEntryPoint entry, uint64_t ns)
+{
+	auto &timings = entryPointTimings[entry];
+	timings.count.fetch_add(1, std::memory_order_relaxed);
+	timings.total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+	uint64_t current_max = timings.max_ns.load(std::memory_order_relaxed);
+	while (ns > current_max && !timings.max_ns.compare_exchange_weak(current_max, ns, std::memory_order_relaxed))
+		;
+
+	unsigned bucket = 0;
+	while (bucket + 1 < LatencyHistogramBuckets && (ns >> (bucket + 1)) != 0)
+		bucket++;
+	timings.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+static void writeTagCounters(FILE *file, const char *name, const uint64_t *counters)
+{
+	fprintf(file, "\t\t\t\"%s\": {", name);
+	bool first = true;
+	for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
+	{
+		if (!counters[tag])
+			continue;
+		fprintf(file, "%s \"%s\": %" PRIu64, first ? "" : ",", resourceTagNames[tag], counters[tag]);
+		first = false;
+	}
+	fprintf(file, " },\n");
+}
+
+static void writeRecorder(FILE *file, const InstrumentedRecorder &instrumented)
+{
+	StateRecorderStatistics stats;
+	instrumented.recorder->get_statistics(&stats);
+
+	fprintf(file, "\t\t{\n");
+	fprintf(file, "\t\t\t\"applicationHash\": \"%016" PRIx64 "\",\n", instrumented.hash);
+	writeTagCounters(file, "databaseLookups", stats.database_lookups);
+	writeTagCounters(file, "databaseHits", stats.database_hits);
+	writeTagCounters(file, "earlyDuplicateHits", stats.early_duplicate_hits);
+	fprintf(file, "\t\t\t\"entriesWritten\": %" PRIu64 ",\n", stats.entries_written);
+	fprintf(file, "\t\t\t\"bytesSerialized\": %" PRIu64 ",\n", stats.bytes_serialized);
+	fprintf(file, "\t\t\t\"bytesWritten\": %" PRIu64 ",\n", stats.bytes_written);
+	fprintf(file, "\t\t\t\"recordingThreadBusyNs\": %" PRIu64 ",\n", stats.recording_thread_busy_ns);
+	fprintf(file, "\t\t\t\"recordingThreadLifetimeNs\": %" PRIu64 ",\n", stats.recording_thread_lifetime_ns);
+	fprintf(file, "\t\t\t\"maxQueueDepth\": %" PRIu64 ",\n", stats.max_queue_depth);
+	fprintf(file, "\t\t\t\"sampledOutObjects\": %" PRIu64 ",\n", stats.sampled_out_objects);
+	fprintf(file, "\t\t\t\"deferredObjects\": %" PRIu64 ",\n", stats.deferred_objects);
+	fprintf(file, "\t\t\t\"peakStagingMemory\": %" PRIu64 ",\n",
+	        uint64_t(instrumented.recorder->get_peak_staging_memory_consumption()));
+
+	size_t sample_count = 0;
+	instrumented.recorder->get_queue_depth_samples(&sample_count, nullptr);
+	std::vector<StateRecorderQueueDepthSample> samples(sample_count);
+	instrumented.recorder->get_queue_depth_samples(&sample_count, samples.data());
+
+	// Pairs of time since recording started, and queue depth.
+	fprintf(file, "\t\t\t\"queueDepthSamples\": [");
+	for (size_t i = 0; i < sample_count; i++)
+		fprintf(file, "%s[%" PRIu64 ", %" PRIu64 "]", i ? ", " : " ", samples[i].time_ns, samples[i].depth);
+	fprintf(file, " ]\n");
+	fprintf(file, "\t\t}");
+}
+
+bool writeReport(const InstrumentedRecorder *recorders, size_t count)
+{
+	if (!isEnabled())
+		return false;
+
+	FILE *file = fopen(getReportPath().c_str(), "w");
+	if (!file)
+	{
+		LOGE("Failed to open instrumentation report \"%s\" for writing.\n", getReportPath().c_str());
+		return false;
+	}
+
+	fprintf(file, "{\n\t\"entryPoints\": {\n");
+	bool first = true;
+	for (unsigned entry = 0; entry < LAYER_ENTRY_POINT_COUNT; entry++)
+	{
+		auto &timings = entryPointTimings[entry];
+		uint64_t call_count = timings.count.load(std::memory_order_relaxed);
+		if (!call_count)
+			continue;
+
+		fprintf(file, "%s\t\t\"%s\": {\n", first ? "" : ",\n", entryPointNames[entry]);
+		fprintf(file, "\t\t\t\"count\": %" PRIu64 ",\n", call_count);
+		fprintf(file, "\t\t\t\"totalNs\": %" PRIu64 ",\n", timings.total_ns.load(std::memory_order_relaxed));
+		fprintf(file, "\t\t\t\"maxNs\": %" PRIu64 ",\n", timings.max_ns.load(std::memory_order_relaxed));
+
+		// Trailing empty buckets are omitted.
+		unsigned bucket_count = LatencyHistogramBuckets;
+		while (bucket_count && !timings.histogram[bucket_count - 1].load(std::memory_order_relaxed))
+			bucket_count--;
+		fprintf(file, "\t\t\t\"histogramLog2Ns\": [");
+		for (unsigned bucket = 0; bucket < bucket_count; bucket++)
+		{
+			fprintf(file, "%s%" PRIu64, bucket ? ", " : " ",
+			        timings.histogram[bucket].load(std::memory_order_relaxed));
+		}
+		fprintf(file, " ]\n\t\t}");
+		first = false;
+	}
+	fprintf(file, "\n\t},\n\t\"recorders\": [\n");
+
+	for (size_t i = 0; i < count; i++)
+	{
+		writeRecorder(file, recorders[i]);
+		fprintf(file, i + 1 < count ? ",\n" : "\n");
+	}
+	fprintf(file, "\t]\n}\n");
+
+	bool ret = !ferror(file);
+	if (fclose(file) != 0)
+		ret = false;
+	if (!ret)
+		LOGE("Failed to write instrumentation report \"%s\".\n", getReportPath().c_str());
+	return ret;
+}
+}
+
+LayerTimer::LayerTimer(LayerEntryPoint entry_)
+	: entry(entry_), active(Instrumentation::isEnabled())
+{
+	if (active)
+		start = std::chrono::steady_clock::now();
+}
+
+LayerTimer::~LayerTimer()
+{
+	if (active)
+	{
+		pause();
+		Instrumentation::addSample(entry, elapsed_ns);
+	}
+}
+
+void LayerTimer::pause()
+{
+	if (active)
+	{
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		elapsed_ns += uint64_t(ns);
+	}
+}
+
+void LayerTimer::resume()
+{
+	if (active)
+		start = std::chrono::steady_clock::now();
+}
+}
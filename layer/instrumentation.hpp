@@ -0,0 +1,89 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "fossilize_types.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+
+namespace Fossilize
+{
+class StateRecorder;
+
+enum LayerEntryPoint
+{
+	LAYER_ENTRY_POINT_CREATE_DESCRIPTOR_SET_LAYOUT = 0,
+	LAYER_ENTRY_POINT_CREATE_PIPELINE_LAYOUT,
+	LAYER_ENTRY_POINT_CREATE_GRAPHICS_PIPELINES,
+	LAYER_ENTRY_POINT_CREATE_COMPUTE_PIPELINES,
+	LAYER_ENTRY_POINT_CREATE_SAMPLER,
+	LAYER_ENTRY_POINT_CREATE_SHADER_MODULE,
+	LAYER_ENTRY_POINT_CREATE_RENDER_PASS,
+	LAYER_ENTRY_POINT_DESTROY_DESCRIPTOR_SET_LAYOUT,
+	LAYER_ENTRY_POINT_DESTROY_PIPELINE_LAYOUT,
+	LAYER_ENTRY_POINT_DESTROY_PIPELINE,
+	LAYER_ENTRY_POINT_DESTROY_SAMPLER,
+	LAYER_ENTRY_POINT_DESTROY_SHADER_MODULE,
+	LAYER_ENTRY_POINT_DESTROY_RENDER_PASS,
+	LAYER_ENTRY_POINT_COUNT
+};
+
+struct InstrumentedRecorder
+{
+	Hash hash;
+	const StateRecorder *recorder;
+};
+
+// Opt-in measurement of the overhead the layer adds on application threads.
+// Enabled by setting FOSSILIZE_INSTRUMENTATION_PATH, which is where the JSON report is written.
+namespace Instrumentation
+{
+bool isEnabled();
+void addSample(LayerEntryPoint entry, uint64_t ns);
+// The report is rewritten from scratch every time, so the last one contains everything.
+bool writeReport(const InstrumentedRecorder *recorders, size_t count);
+}
+
+// Measures time spent in the layer itself, so calls into the driver must not happen while this is active.
+class LayerTimer
+{
+public:
+	explicit LayerTimer(LayerEntryPoint entry);
+	~LayerTimer();
+
+	// For calls into the driver in the middle of a measured scope.
+	void pause();
+	void resume();
+
+	LayerTimer(const LayerTimer &) = delete;
+	void operator=(const LayerTimer &) = delete;
+
+private:
+	LayerEntryPoint entry;
+	bool active;
+	uint64_t elapsed_ns = 0;
+	std::chrono::steady_clock::time_point start;
+};
+}
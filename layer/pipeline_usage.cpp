@@ -0,0 +1,320 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "pipeline_usage.hpp"
+#include "fossilize.hpp"
+#include "utils.hpp"
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <string.h>
+
+using namespace std;
+
+namespace Fossilize
+{
+namespace PipelineUsage
+{
+// An application rarely binds more than a few hundred distinct pipelines per frame.
+// The table is flushed when half full to keep linear probing short.
+enum
+{
+	TableBits = 10,
+	TableSize = 1 << TableBits,
+	MaxUsedEntries = TableSize / 2,
+	MaxBindsBeforeFlush = 64 * 1024
+};
+
+struct CounterEntry
+{
+	StateRecorder *recorder;
+	VkPipeline pipeline;
+	uint32_t count;
+};
+
+static unsigned getHomeIndex(VkPipeline pipeline)
+{
+	uint64_t key = (uint64_t)pipeline;
+	return unsigned((key * 0x9e3779b97f4a7c15ull) >> (64 - TableBits));
+}
+
+// Hands counts over to their recorders. The recorder can block on its staging memory budget,
+// so this is never called with a table lock held.
+static void recordEntries(vector<CounterEntry> &entries)
+{
+	vector<VkPipeline> pipelines;
+	vector<uint32_t> counts;
+
+	// There is normally only a single recorder, so gather one recorder at a time.
+	while (!entries.empty())
+	{
+		auto *recorder = entries.front().recorder;
+		auto itr = partition(entries.begin(), entries.end(), [recorder](const CounterEntry &entry) {
+			return entry.recorder != recorder;
+		});
+
+		pipelines.clear();
+		counts.clear();
+		for (auto entry = itr; entry != entries.end(); ++entry)
+		{
+			pipelines.push_back(entry->pipeline);
+			counts.push_back(entry->count);
+		}
+		entries.erase(itr, entries.end());
+
+		if (!recorder->record_pipeline_usage(pipelines.data(), counts.data(), uint32_t(pipelines.size())))
+			LOGE("Failed to record pipeline usage.\n");
+	}
+}
+
+class CounterTable;
+
+// Every thread's table, so that destroying a pipeline or a device can drain the counters of all threads.
+// Never destroyed, since tables are flushed from static destructors in other translation units.
+struct TableRegistry
+{
+	mutex lock;
+	vector<CounterTable *> tables;
+	// Counts taken from tables of exiting threads, which are no longer in the registry, but not recorded yet.
+	atomic<unsigned> detachedHandOvers{ 0 };
+};
+
+static TableRegistry &getRegistry()
+{
+	static TableRegistry *registry = new TableRegistry;
+	return *registry;
+}
+
+class CounterTable
+{
+public:
+	CounterTable()
+	{
+		memset(entries, 0, sizeof(entries));
+		auto &registry = getRegistry();
+		lock_guard<mutex> holder{ registry.lock };
+		registry.tables.push_back(this);
+	}
+
+	~CounterTable()
+	{
+		auto &registry = getRegistry();
+		{
+			lock_guard<mutex> holder{ registry.lock };
+			registry.tables.erase(find(registry.tables.begin(), registry.tables.end(), this));
+			take(flushEntries);
+			registry.detachedHandOvers.fetch_add(1, memory_order_relaxed);
+		}
+
+		recordEntries(flushEntries);
+		registry.detachedHandOvers.fetch_sub(1, memory_order_release);
+	}
+
+	void count(StateRecorder *recorder, VkPipeline pipeline)
+	{
+		acquire();
+
+		unsigned index = getHomeIndex(pipeline);
+		for (;;)
+		{
+			auto &entry = entries[index];
+			if (entry.pipeline == pipeline && entry.recorder == recorder)
+			{
+				entry.count++;
+				break;
+			}
+			else if (entry.pipeline == VK_NULL_HANDLE)
+			{
+				entry.recorder = recorder;
+				entry.pipeline = pipeline;
+				entry.count = 1;
+				usedEntries++;
+				break;
+			}
+
+			index = (index + 1) & (TableSize - 1);
+		}
+
+		if (usedEntries < MaxUsedEntries && ++binds < MaxBindsBeforeFlush)
+		{
+			release();
+			return;
+		}
+
+		// Taken before the table lock is released, so that anyone who can no longer find
+		// a count in the table has to wait for it to be recorded.
+		handOverLock.lock();
+		takeLocked(flushEntries);
+		release();
+
+		recordEntries(flushEntries);
+		handOverLock.unlock();
+	}
+
+	// Moves every count out of the table.
+	void take(vector<CounterEntry> &out)
+	{
+		acquire();
+		takeLocked(out);
+		release();
+	}
+
+	// Moves the counts of a single pipeline out of the table.
+	void takePipeline(VkPipeline pipeline, vector<CounterEntry> &out)
+	{
+		acquire();
+
+		unsigned index = getHomeIndex(pipeline);
+		while (entries[index].pipeline != VK_NULL_HANDLE)
+		{
+			if (entries[index].pipeline == pipeline)
+			{
+				out.push_back(entries[index]);
+				removeLocked(index);
+			}
+			else
+				index = (index + 1) & (TableSize - 1);
+		}
+
+		release();
+	}
+
+	// Waits until the owning thread has recorded the counts it took out of the table.
+	void waitForHandOver()
+	{
+		lock_guard<mutex> holder{ handOverLock };
+	}
+
+private:
+	// Only contended while another thread drains this table, and never held while calling into a recorder,
+	// so a spin lock keeps binds cheap.
+	void acquire()
+	{
+		while (busy.test_and_set(memory_order_acquire))
+			this_thread::yield();
+	}
+
+	void release()
+	{
+		busy.clear(memory_order_release);
+	}
+
+	void takeLocked(vector<CounterEntry> &out)
+	{
+		if (usedEntries != 0)
+		{
+			for (auto &entry : entries)
+				if (entry.pipeline != VK_NULL_HANDLE)
+					out.push_back(entry);
+			memset(entries, 0, sizeof(entries));
+		}
+
+		usedEntries = 0;
+		binds = 0;
+	}
+
+	// Backward shift deletion, which keeps every probe sequence intact without tombstones.
+	void removeLocked(unsigned hole)
+	{
+		unsigned index = hole;
+		for (;;)
+		{
+			index = (index + 1) & (TableSize - 1);
+			if (entries[index].pipeline == VK_NULL_HANDLE)
+				break;
+
+			// An entry can move back into the hole unless its home slot lies cyclically in (hole, index].
+			unsigned home = getHomeIndex(entries[index].pipeline);
+			bool stays = hole <= index ? (hole < home && home <= index) : (hole < home || home <= index);
+			if (!stays)
+			{
+				entries[hole] = entries[index];
+				hole = index;
+			}
+		}
+
+		memset(&entries[hole], 0, sizeof(entries[hole]));
+		usedEntries--;
+	}
+
+	atomic_flag busy = ATOMIC_FLAG_INIT;
+	mutex handOverLock;
+	CounterEntry entries[TableSize];
+	unsigned usedEntries = 0;
+	unsigned binds = 0;
+	vector<CounterEntry> flushEntries;
+};
+
+static thread_local CounterTable counterTable;
+
+void countBind(StateRecorder *recorder, VkPipeline pipeline)
+{
+	if (pipeline != VK_NULL_HANDLE)
+		counterTable.count(recorder, pipeline);
+}
+
+// Counts which another thread has taken out of its table must reach the recorder
+// before the caller goes on to destroy the pipeline.
+static void waitForHandOvers(TableRegistry &registry)
+{
+	for (auto *table : registry.tables)
+		table->waitForHandOver();
+	while (registry.detachedHandOvers.load(memory_order_acquire) != 0)
+		this_thread::yield();
+}
+
+void forgetPipeline(VkPipeline pipeline)
+{
+	vector<CounterEntry> taken;
+	auto &registry = getRegistry();
+	{
+		lock_guard<mutex> holder{ registry.lock };
+		for (auto *table : registry.tables)
+			table->takePipeline(pipeline, taken);
+	}
+
+	recordEntries(taken);
+
+	lock_guard<mutex> holder{ registry.lock };
+	waitForHandOvers(registry);
+}
+
+void flushAllThreads()
+{
+	vector<CounterEntry> taken;
+	auto &registry = getRegistry();
+	{
+		lock_guard<mutex> holder{ registry.lock };
+		for (auto *table : registry.tables)
+			table->take(taken);
+	}
+
+	recordEntries(taken);
+
+	lock_guard<mutex> holder{ registry.lock };
+	waitForHandOvers(registry);
+}
+}
+}
@@ -0,0 +1,45 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "vulkan.h"
+
+namespace Fossilize
+{
+class StateRecorder;
+
+// Bind counters are kept per thread and handed over to the recorder in batches,
+// since vkCmdBindPipeline is called far too often to go through the recorder every time.
+namespace PipelineUsage
+{
+void countBind(StateRecorder *recorder, VkPipeline pipeline);
+
+// Hands over what any thread has counted for a pipeline.
+// Must be called before the pipeline handle is destroyed, since the handle value can be reused.
+void forgetPipeline(VkPipeline pipeline);
+
+// Hands over everything any thread has counted so far. Must be called before a device or a recorder goes away.
+void flushAllThreads();
+}
+}
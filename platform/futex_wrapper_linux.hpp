@@ -71,4 +71,16 @@ static inline void futex_wrapper_unlock(int *lock)
 		syscall(SYS_futex, lock, FUTEX_WAKE, 1, 0, 0, 0);
 	}
 }
+
+// Process-private wait and wake, for parking threads on a word which is not shared across processes.
+// Waits only if *addr still equals expected_value. timeout is relative, and can be nullptr to wait forever.
+static inline void futex_wrapper_wait_private(int *addr, int expected_value, const struct timespec *timeout)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected_value, timeout, 0, 0);
+}
+
+static inline void futex_wrapper_wake_private(int *addr, int count)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, 0, 0, 0);
+}
 }
\ No newline at end of file
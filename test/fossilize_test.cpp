@@ -22,11 +22,18 @@
 
 #include "fossilize.hpp"
 #include "fossilize_db.hpp"
+#include "fossilize_inttypes.h"
 #include "fossilize_external_replayer.hpp"
 #include <string.h>
 #include <memory>
 #include <vector>
 #include <string>
+#include <set>
+#include <map>
+#include <tuple>
+#include <thread>
+#include <atomic>
+#include <chrono>
 #include "layer/utils.hpp"
 
 using namespace Fossilize;
@@ -44,8 +51,9 @@ struct ReplayInterface : StateCreatorInterface
 	StateRecorder recorder;
 	Hash feature_hash = 0;
 
-	ReplayInterface()
+	explicit ReplayInterface(HashScheme scheme = HASH_SCHEME_FNV1)
 	{
+		recorder.set_hash_scheme(scheme);
 	}
 
 	void set_application_info(Hash hash, const VkApplicationInfo *info, const VkPhysicalDeviceFeatures2 *features) override
@@ -63,7 +71,7 @@ struct ReplayInterface : StateCreatorInterface
 	bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *create_info, VkSampler *sampler) override
 	{
 		Hash recorded_hash;
-		if (!Hashing::compute_hash_sampler(*create_info, &recorded_hash))
+		if (!Hashing::compute_hash_sampler(*create_info, &recorded_hash, recorder.get_hash_scheme()))
 			return false;
 		if (recorded_hash != hash)
 			return false;
@@ -99,7 +107,7 @@ struct ReplayInterface : StateCreatorInterface
 	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module) override
 	{
 		Hash recorded_hash;
-		if (!Hashing::compute_hash_shader_module(*create_info, &recorded_hash))
+		if (!Hashing::compute_hash_shader_module(*create_info, &recorded_hash, recorder.get_hash_scheme()))
 			return false;
 		if (recorded_hash != hash)
 			return false;
@@ -111,7 +119,7 @@ struct ReplayInterface : StateCreatorInterface
 	bool enqueue_create_render_pass(Hash hash, const VkRenderPassCreateInfo *create_info, VkRenderPass *render_pass) override
 	{
 		Hash recorded_hash;
-		if (!Hashing::compute_hash_render_pass(*create_info, &recorded_hash))
+		if (!Hashing::compute_hash_render_pass(*create_info, &recorded_hash, recorder.get_hash_scheme()))
 			return false;
 		if (recorded_hash != hash)
 			return false;
@@ -1086,6 +1094,1249 @@ static bool test_filter()
 	return true;
 }
 
+static bool test_hash_scheme()
+{
+	VkApplicationInfo app_info = { VK_STRUCTURE_TYPE_APPLICATION_INFO };
+	app_info.pEngineName = "test";
+	app_info.pApplicationName = "testy";
+	app_info.apiVersion = VK_API_VERSION_1_1;
+	VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+
+	auto fnv_hash = Hashing::compute_combined_application_feature_hash(
+			Hashing::compute_application_feature_hash(&app_info, &features, HASH_SCHEME_FNV1));
+	auto striped_hash = Hashing::compute_combined_application_feature_hash(
+			Hashing::compute_application_feature_hash(&app_info, &features, HASH_SCHEME_STRIPED));
+	if (fnv_hash == striped_hash)
+		return false;
+
+	// Hashes must depend on every byte, including a tail which does not fill a 32-bit word.
+	uint32_t code[67];
+	for (unsigned i = 0; i < 67; i++)
+		code[i] = i * 0x9e3779b9u;
+	VkShaderModuleCreateInfo module = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+	module.pCode = code;
+	module.codeSize = sizeof(code) - 1;
+	Hash hash_a, hash_b;
+	if (!Hashing::compute_hash_shader_module(module, &hash_a, HASH_SCHEME_STRIPED))
+		return false;
+	reinterpret_cast<uint8_t *>(code)[module.codeSize - 1] ^= 1;
+	if (!Hashing::compute_hash_shader_module(module, &hash_b, HASH_SCHEME_STRIPED))
+		return false;
+	if (hash_a == hash_b)
+		return false;
+
+	std::vector<uint8_t> res;
+	{
+		StateRecorder recorder;
+		recorder.set_hash_scheme(HASH_SCHEME_STRIPED);
+		if (!recorder.record_application_info(app_info))
+			return false;
+		if (!recorder.record_physical_device_features(features))
+			return false;
+		if (Hashing::compute_combined_application_feature_hash(recorder.get_application_feature_hash()) != striped_hash)
+			return false;
+
+		record_samplers(recorder);
+		record_set_layouts(recorder);
+		record_pipeline_layouts(recorder);
+		record_shader_modules(recorder);
+		record_render_passes(recorder);
+		record_compute_pipelines(recorder);
+		record_graphics_pipelines(recorder);
+
+		uint8_t *serialized;
+		size_t serialized_size;
+		if (!recorder.serialize(&serialized, &serialized_size))
+			return false;
+		res = std::vector<uint8_t>(serialized, serialized + serialized_size);
+		StateRecorder::free_serialized(serialized);
+	}
+
+	// Replaying with the wrong scheme must fail hash verification.
+	{
+		StateReplayer replayer;
+		ReplayInterface iface(HASH_SCHEME_FNV1);
+		if (replayer.parse(iface, nullptr, res.data(), res.size()))
+			return false;
+	}
+
+	StateReplayer replayer;
+	ReplayInterface iface(HASH_SCHEME_STRIPED);
+	if (!replayer.parse(iface, nullptr, res.data(), res.size()))
+		return false;
+	if (iface.feature_hash != striped_hash)
+		return false;
+
+	return true;
+}
+
+static bool test_sub_state_interning()
+{
+	remove(".__test_interned.foz");
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_interned.foz", DatabaseMode::OverWrite));
+		StateRecorder recorder;
+		recorder.set_database_enable_sub_state_interning(true);
+		recorder.init_recording_thread(db.get());
+
+		record_samplers(recorder);
+		record_set_layouts(recorder);
+		record_pipeline_layouts(recorder);
+		record_shader_modules(recorder);
+		record_render_passes(recorder);
+		record_graphics_pipelines(recorder);
+	}
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_interned.foz", DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	size_t sub_state_count = 0;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_PIPELINE_SUB_STATE, &sub_state_count, nullptr))
+		return false;
+	if (sub_state_count == 0)
+		return false;
+
+	// Replaying resolves sub-states through the database, and every pipeline hash must still match.
+	StateReplayer replayer;
+	ReplayInterface iface;
+	static const ResourceTag playback_order[] = {
+		RESOURCE_SAMPLER,
+		RESOURCE_DESCRIPTOR_SET_LAYOUT,
+		RESOURCE_PIPELINE_LAYOUT,
+		RESOURCE_SHADER_MODULE,
+		RESOURCE_RENDER_PASS,
+		RESOURCE_GRAPHICS_PIPELINE,
+	};
+
+	for (auto tag : playback_order)
+	{
+		size_t hash_count = 0;
+		if (!db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			return false;
+		std::vector<Hash> hashes(hash_count);
+		if (!db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+			return false;
+		if (hashes.empty())
+			return false;
+
+		for (auto &hash : hashes)
+		{
+			size_t blob_size = 0;
+			if (!db->read_entry(tag, hash, &blob_size, nullptr, 0))
+				return false;
+			std::vector<uint8_t> blob(blob_size);
+			if (!db->read_entry(tag, hash, &blob_size, blob.data(), 0))
+				return false;
+			if (!replayer.parse(iface, db.get(), blob.data(), blob.size()))
+				return false;
+		}
+	}
+
+	db.reset();
+	remove(".__test_interned.foz");
+	return true;
+}
+
+// Keeps every write in order, so tests can check what a truncated archive would contain.
+struct WriteOrderDatabase : DatabaseInterface
+{
+	struct Write
+	{
+		ResourceTag tag;
+		Hash hash;
+		std::string payload;
+	};
+	std::vector<Write> writes;
+	std::set<std::pair<ResourceTag, Hash>> entries;
+
+	WriteOrderDatabase()
+		: DatabaseInterface(DatabaseMode::OverWrite)
+	{
+	}
+
+	bool prepare() override { return true; }
+	bool read_entry(ResourceTag, Hash, size_t *, void *, PayloadReadFlags) override { return false; }
+	void flush() override {}
+	const char *get_db_path_for_hash(ResourceTag, Hash) override { return nullptr; }
+
+	bool write_entry(ResourceTag tag, Hash hash, const void *buffer, size_t size, PayloadWriteFlags) override
+	{
+		if (entries.insert(std::make_pair(tag, hash)).second)
+			writes.push_back({ tag, hash, std::string(static_cast<const char *>(buffer), size) });
+		return true;
+	}
+
+	bool has_entry(ResourceTag tag, Hash hash) override
+	{
+		return entries.count(std::make_pair(tag, hash)) != 0;
+	}
+
+	bool get_hash_list_for_resource_tag(ResourceTag tag, size_t *num_hashes, Hash *hashes) override
+	{
+		size_t count = 0;
+		for (auto &entry : entries)
+		{
+			if (entry.first != tag)
+				continue;
+			if (hashes)
+				hashes[count] = entry.second;
+			count++;
+		}
+		*num_hashes = count;
+		return true;
+	}
+};
+
+static bool test_sub_state_write_order()
+{
+	// Workers finish jobs out of order, but a sub-state must never be written after a pipeline which uses it.
+	for (unsigned worker_count : { 0u, 4u })
+	{
+		WriteOrderDatabase db;
+		{
+			StateRecorder recorder;
+			recorder.set_database_enable_sub_state_interning(true);
+			recorder.set_database_worker_thread_count(worker_count);
+			recorder.init_recording_thread(&db);
+
+			record_samplers(recorder);
+			record_set_layouts(recorder);
+			record_pipeline_layouts(recorder);
+			record_shader_modules(recorder);
+			record_render_passes(recorder);
+
+			VkPipelineShaderStageCreateInfo stage = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+			stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+			stage.pName = "main";
+			stage.module = fake_handle<VkShaderModule>(5000);
+
+			VkPipelineRasterizationStateCreateInfo rs = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+			VkPipelineMultisampleStateCreateInfo ms = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+			VkGraphicsPipelineCreateInfo pipe = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+			pipe.layout = fake_handle<VkPipelineLayout>(10002);
+			pipe.renderPass = fake_handle<VkRenderPass>(30001);
+			pipe.stageCount = 1;
+			pipe.pStages = &stage;
+			pipe.pRasterizationState = &rs;
+			pipe.pMultisampleState = &ms;
+
+			// Few rasterization states shared by many pipelines.
+			for (unsigned i = 0; i < 256; i++)
+			{
+				rs.lineWidth = float(i % 4);
+				ms.minSampleShading = float(i);
+				if (!recorder.record_graphics_pipeline(fake_handle<VkPipeline>(200000 + i), pipe, nullptr, 0))
+					return false;
+			}
+		}
+
+		// Pipelines refer to interned sub-states by their hash string.
+		const auto hash_string = [](Hash hash) -> std::string {
+			char str[17];
+			sprintf(str, "%016" PRIx64, hash);
+			return str;
+		};
+
+		std::set<std::string> written_sub_states;
+		std::vector<std::string> all_sub_states;
+		for (auto &write : db.writes)
+			if (write.tag == RESOURCE_PIPELINE_SUB_STATE)
+				all_sub_states.push_back(hash_string(write.hash));
+
+		if (all_sub_states.size() < 4)
+			return false;
+
+		unsigned pipeline_count = 0;
+		for (auto &write : db.writes)
+		{
+			if (write.tag == RESOURCE_PIPELINE_SUB_STATE)
+				written_sub_states.insert(hash_string(write.hash));
+			else if (write.tag == RESOURCE_GRAPHICS_PIPELINE)
+			{
+				pipeline_count++;
+				for (auto &sub_state : all_sub_states)
+					if (write.payload.find(sub_state) != std::string::npos && !written_sub_states.count(sub_state))
+						return false;
+			}
+		}
+
+		if (pipeline_count != 256)
+			return false;
+	}
+
+	return true;
+}
+
+static bool record_archive_with_workers(const char *path, unsigned worker_count)
+{
+	remove(path);
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, DatabaseMode::OverWrite));
+	StateRecorder recorder;
+	recorder.set_database_enable_compression(true);
+	recorder.set_database_enable_checksum(true);
+	recorder.set_database_enable_sub_state_interning(true);
+	recorder.set_database_worker_thread_count(worker_count);
+	recorder.init_recording_thread(db.get());
+
+	record_samplers(recorder);
+	record_set_layouts(recorder);
+	record_pipeline_layouts(recorder);
+	record_shader_modules(recorder);
+	record_render_passes(recorder);
+	record_compute_pipelines(recorder);
+	record_graphics_pipelines(recorder);
+	return true;
+}
+
+static bool test_database_worker_threads()
+{
+	if (!record_archive_with_workers(".__test_workers.0.foz", 0))
+		return false;
+	if (!record_archive_with_workers(".__test_workers.3.foz", 3))
+		return false;
+
+	// Entries written by workers must decode to exactly what the recording thread writes by itself.
+	auto reference = std::unique_ptr<DatabaseInterface>(
+			create_stream_archive_database(".__test_workers.0.foz", DatabaseMode::ReadOnly));
+	auto threaded = std::unique_ptr<DatabaseInterface>(
+			create_stream_archive_database(".__test_workers.3.foz", DatabaseMode::ReadOnly));
+	if (!reference->prepare() || !threaded->prepare())
+		return false;
+
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+	{
+		auto tag = static_cast<ResourceTag>(i);
+		size_t hash_count = 0;
+		if (!reference->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			return false;
+		std::vector<Hash> hashes(hash_count);
+		if (!reference->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+			return false;
+
+		size_t threaded_hash_count = 0;
+		if (!threaded->get_hash_list_for_resource_tag(tag, &threaded_hash_count, nullptr))
+			return false;
+		if (threaded_hash_count != hash_count)
+			return false;
+
+		for (auto &hash : hashes)
+		{
+			size_t reference_size = 0, threaded_size = 0;
+			if (!reference->read_entry(tag, hash, &reference_size, nullptr, 0))
+				return false;
+			if (!threaded->read_entry(tag, hash, &threaded_size, nullptr, 0))
+				return false;
+			if (reference_size != threaded_size)
+				return false;
+
+			std::vector<uint8_t> reference_blob(reference_size), threaded_blob(threaded_size);
+			if (!reference->read_entry(tag, hash, &reference_size, reference_blob.data(), 0))
+				return false;
+			if (!threaded->read_entry(tag, hash, &threaded_size, threaded_blob.data(), 0))
+				return false;
+			if (reference_blob != threaded_blob)
+				return false;
+		}
+	}
+
+	reference.reset();
+	threaded.reset();
+	remove(".__test_workers.0.foz");
+	remove(".__test_workers.3.foz");
+	return true;
+}
+
+struct LinkCollector : StateCreatorInterface
+{
+	std::set<std::tuple<Hash, Hash, ResourceTag, Hash>> links;
+
+	void notify_application_info_link(Hash link_hash, Hash app_hash, ResourceTag tag, Hash hash) override
+	{
+		links.insert(std::make_tuple(link_hash, app_hash, tag, hash));
+	}
+
+	bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override { return true; }
+	bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override { return true; }
+	bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override { return true; }
+	bool enqueue_create_shader_module(Hash, const VkShaderModuleCreateInfo *, VkShaderModule *) override { return true; }
+	bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override { return true; }
+	bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *, VkPipeline *) override { return true; }
+	bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *) override { return true; }
+};
+
+static bool record_application_links(DatabaseInterface *db, bool link_table, bool samplers_only = false)
+{
+	StateRecorder recorder;
+	recorder.set_database_enable_application_link_table(link_table);
+
+	VkApplicationInfo app_info = { VK_STRUCTURE_TYPE_APPLICATION_INFO };
+	app_info.pApplicationName = "links";
+	app_info.apiVersion = VK_API_VERSION_1_1;
+	if (!recorder.record_application_info(app_info))
+		return false;
+
+	recorder.init_recording_thread(db);
+
+	record_samplers(recorder);
+	if (samplers_only)
+		return true;
+	record_set_layouts(recorder);
+	record_pipeline_layouts(recorder);
+	record_shader_modules(recorder);
+	record_render_passes(recorder);
+	record_compute_pipelines(recorder);
+	record_graphics_pipelines(recorder);
+	return true;
+}
+
+static bool collect_application_links(bool link_table, LinkCollector &collector)
+{
+	remove(".__test_links.foz");
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_links.foz", DatabaseMode::OverWrite));
+		if (!record_application_links(db.get(), link_table))
+			return false;
+	}
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_links.foz", DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	size_t link_count = 0, table_count = 0;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_APPLICATION_BLOB_LINK, &link_count, nullptr))
+		return false;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_APPLICATION_LINK_TABLE, &table_count, nullptr))
+		return false;
+	if (link_table ? (link_count != 0 || table_count != 1) : (link_count == 0 || table_count != 0))
+		return false;
+
+	StateReplayer replayer;
+	for (auto tag : { RESOURCE_APPLICATION_BLOB_LINK, RESOURCE_APPLICATION_LINK_TABLE })
+	{
+		size_t hash_count = 0;
+		if (!db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			return false;
+		std::vector<Hash> hashes(hash_count);
+		if (!db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+			return false;
+
+		for (auto &hash : hashes)
+		{
+			size_t blob_size = 0;
+			if (!db->read_entry(tag, hash, &blob_size, nullptr, 0))
+				return false;
+			std::vector<uint8_t> blob(blob_size);
+			if (!db->read_entry(tag, hash, &blob_size, blob.data(), 0))
+				return false;
+			if (!replayer.parse(collector, nullptr, blob.data(), blob.size()))
+				return false;
+		}
+	}
+
+	db.reset();
+	remove(".__test_links.foz");
+	return true;
+}
+
+static bool test_application_link_table()
+{
+	// A link table must describe exactly the same links as individual link blobs.
+	LinkCollector blob_links, table_links;
+	if (!collect_application_links(false, blob_links))
+		return false;
+	if (!collect_application_links(true, table_links))
+		return false;
+	if (blob_links.links.empty() || blob_links.links != table_links.links)
+		return false;
+
+	// Recording the same application again must not repeat links which are already in a table.
+	remove(".__test_links.foz");
+	remove(".__test_links.1.foz");
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_links.foz", DatabaseMode::OverWrite));
+		if (!record_application_links(db.get(), true, true))
+			return false;
+	}
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_links.foz", DatabaseMode::Append));
+		if (!record_application_links(db.get(), true))
+			return false;
+	}
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_links", DatabaseMode::Append, nullptr, 0));
+		if (!record_application_links(db.get(), true))
+			return false;
+	}
+
+	struct LinkCounter : LinkCollector
+	{
+		void notify_application_info_link(Hash link_hash, Hash app_hash, ResourceTag tag, Hash hash) override
+		{
+			LinkCollector::notify_application_info_link(link_hash, app_hash, tag, hash);
+			count++;
+		}
+		size_t count = 0;
+	};
+
+	LinkCounter appended_links;
+	StateReplayer replayer;
+	for (auto *path : { ".__test_links.foz", ".__test_links.1.foz" })
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, DatabaseMode::ReadOnly));
+		if (!db->prepare())
+			continue;
+
+		size_t hash_count = 0;
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_APPLICATION_LINK_TABLE, &hash_count, nullptr))
+			return false;
+		std::vector<Hash> hashes(hash_count);
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_APPLICATION_LINK_TABLE, &hash_count, hashes.data()))
+			return false;
+
+		for (auto &hash : hashes)
+		{
+			size_t blob_size = 0;
+			if (!db->read_entry(RESOURCE_APPLICATION_LINK_TABLE, hash, &blob_size, nullptr, 0))
+				return false;
+			std::vector<uint8_t> blob(blob_size);
+			if (!db->read_entry(RESOURCE_APPLICATION_LINK_TABLE, hash, &blob_size, blob.data(), 0))
+				return false;
+			if (!replayer.parse(appended_links, nullptr, blob.data(), blob.size()))
+				return false;
+		}
+	}
+
+	if (appended_links.links != table_links.links || appended_links.count != appended_links.links.size())
+		return false;
+
+	remove(".__test_links.foz");
+	remove(".__test_links.1.foz");
+	return true;
+}
+
+static bool record_application(const char *path, DatabaseMode mode, const char *application_name, bool early_duplicate_check)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, mode));
+	StateRecorder recorder;
+	recorder.set_database_enable_early_duplicate_check(early_duplicate_check);
+
+	VkApplicationInfo app_info = { VK_STRUCTURE_TYPE_APPLICATION_INFO };
+	app_info.pApplicationName = application_name;
+	app_info.apiVersion = VK_API_VERSION_1_1;
+	if (!recorder.record_application_info(app_info))
+		return false;
+
+	recorder.init_recording_thread(db.get());
+
+	// Objects are only checked once the recording thread has opened the archive.
+	if (early_duplicate_check)
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	record_samplers(recorder);
+	record_set_layouts(recorder);
+	record_pipeline_layouts(recorder);
+	record_shader_modules(recorder);
+	record_render_passes(recorder);
+	record_compute_pipelines(recorder);
+	record_graphics_pipelines(recorder);
+	return true;
+}
+
+static bool test_early_duplicate_check()
+{
+	remove(".__test_duplicates.foz");
+	if (!record_application(".__test_duplicates.foz", DatabaseMode::OverWrite, "first", false))
+		return false;
+	if (!record_application(".__test_duplicates.foz", DatabaseMode::Append, "second", true))
+		return false;
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_duplicates.foz", DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	// Objects skipped on the application thread must still be linked to the second application,
+	// and pipelines must still resolve their shader modules and render passes.
+	LinkCollector collector;
+	StateReplayer replayer;
+	size_t hash_count = 0;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_APPLICATION_BLOB_LINK, &hash_count, nullptr))
+		return false;
+	std::vector<Hash> hashes(hash_count);
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_APPLICATION_BLOB_LINK, &hash_count, hashes.data()))
+		return false;
+
+	for (auto &hash : hashes)
+	{
+		size_t blob_size = 0;
+		if (!db->read_entry(RESOURCE_APPLICATION_BLOB_LINK, hash, &blob_size, nullptr, 0))
+			return false;
+		std::vector<uint8_t> blob(blob_size);
+		if (!db->read_entry(RESOURCE_APPLICATION_BLOB_LINK, hash, &blob_size, blob.data(), 0))
+			return false;
+		if (!replayer.parse(collector, nullptr, blob.data(), blob.size()))
+			return false;
+	}
+
+	std::map<Hash, std::set<std::pair<ResourceTag, Hash>>> objects_per_application;
+	for (auto &link : collector.links)
+		objects_per_application[std::get<1>(link)].insert(std::make_pair(std::get<2>(link), std::get<3>(link)));
+
+	db.reset();
+	remove(".__test_duplicates.foz");
+
+	return objects_per_application.size() == 2 &&
+	       !objects_per_application.begin()->second.empty() &&
+	       objects_per_application.begin()->second == objects_per_application.rbegin()->second;
+}
+
+struct SamplerCounter : LinkCollector
+{
+	std::set<Hash> samplers;
+
+	bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *, VkSampler *) override
+	{
+		samplers.insert(hash);
+		return true;
+	}
+};
+
+static bool test_concurrent_recording()
+{
+	// Enough items to fill the ring to the recording thread, so producers spill into the overflow list.
+	const unsigned thread_count = 8;
+	const unsigned samplers_per_thread = 2000;
+
+	StateRecorder recorder;
+	recorder.init_recording_thread(nullptr);
+
+	std::vector<std::thread> threads;
+	std::atomic<bool> success(true);
+	for (unsigned t = 0; t < thread_count; t++)
+	{
+		threads.emplace_back([&, t]() {
+			for (unsigned i = 0; i < samplers_per_thread; i++)
+			{
+				VkSamplerCreateInfo info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+				info.minLod = float(t * samplers_per_thread + i);
+				if (!recorder.record_sampler(fake_handle<VkSampler>(t * samplers_per_thread + i + 1), info))
+					success = false;
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+	if (!success)
+		return false;
+
+	uint8_t *serialized;
+	size_t serialized_size;
+	if (!recorder.serialize(&serialized, &serialized_size))
+		return false;
+
+	StateReplayer replayer;
+	SamplerCounter counter;
+	bool ret = replayer.parse(counter, nullptr, serialized, serialized_size);
+	StateRecorder::free_serialized(serialized);
+	return ret && counter.samplers.size() == thread_count * samplers_per_thread;
+}
+
+static bool test_forget_handles()
+{
+	StateRecorder recorder;
+	VkSamplerCreateInfo info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	if (!recorder.record_sampler(fake_handle<VkSampler>(1), info))
+		return false;
+
+	Hash first_hash = 0;
+	if (!recorder.get_hash_for_sampler(fake_handle<VkSampler>(1), &first_hash))
+		return false;
+
+	recorder.forget_sampler(fake_handle<VkSampler>(1));
+	Hash hash = 0;
+	if (recorder.get_hash_for_sampler(fake_handle<VkSampler>(1), &hash))
+		return false;
+
+	// The driver reuses the handle for a different object.
+	info.minLod = 1.0f;
+	if (!recorder.record_sampler(fake_handle<VkSampler>(1), info))
+		return false;
+	if (!recorder.get_hash_for_sampler(fake_handle<VkSampler>(1), &hash))
+		return false;
+	return hash != first_hash;
+}
+
+static bool test_staging_memory_budget()
+{
+	const unsigned thread_count = 4;
+	const unsigned samplers_per_thread = 4000;
+	const size_t budget = 64 * 1024;
+
+	StateRecorder recorder;
+	recorder.set_staging_memory_budget(budget);
+	recorder.init_recording_thread(nullptr);
+
+	std::vector<std::thread> threads;
+	std::atomic<bool> success(true);
+	for (unsigned t = 0; t < thread_count; t++)
+	{
+		threads.emplace_back([&, t]() {
+			for (unsigned i = 0; i < samplers_per_thread; i++)
+			{
+				VkSamplerCreateInfo info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+				info.minLod = float(t * samplers_per_thread + i);
+				auto sampler = fake_handle<VkSampler>(t * samplers_per_thread + i + 1);
+				if (!recorder.record_sampler(sampler, info))
+					success = false;
+				recorder.forget_sampler(sampler);
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+	recorder.tear_down_recording_thread();
+	if (!success)
+		return false;
+
+	// Every thread can overshoot the budget by about one arena block before it waits.
+	size_t peak = recorder.get_peak_staging_memory_consumption();
+	if (peak == 0 || peak > budget + thread_count * 2 * 64 * 1024)
+		return false;
+
+	// Forgotten objects are still serialized.
+	uint8_t *serialized;
+	size_t serialized_size;
+	if (!recorder.serialize(&serialized, &serialized_size))
+		return false;
+
+	StateReplayer replayer;
+	SamplerCounter counter;
+	bool ret = replayer.parse(counter, nullptr, serialized, serialized_size);
+	StateRecorder::free_serialized(serialized);
+	return ret && counter.samplers.size() == thread_count * samplers_per_thread;
+}
+
+static bool record_archive_statistics(const char *path, DatabaseMode mode, StateRecorderStatistics *stats,
+                                      size_t *sample_count)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, mode));
+	StateRecorder recorder;
+	recorder.set_database_enable_compression(true);
+	recorder.set_enable_statistics(true);
+	recorder.init_recording_thread(db.get());
+
+	record_samplers(recorder);
+	record_set_layouts(recorder);
+	record_pipeline_layouts(recorder);
+	record_shader_modules(recorder);
+	record_render_passes(recorder);
+	record_compute_pipelines(recorder);
+	record_graphics_pipelines(recorder);
+	recorder.tear_down_recording_thread();
+
+	recorder.get_statistics(stats);
+	recorder.get_queue_depth_samples(sample_count, nullptr);
+	return true;
+}
+
+static bool test_recorder_statistics()
+{
+	const char *path = ".__test_statistics.foz";
+	remove(path);
+
+	StateRecorderStatistics stats;
+	size_t sample_count = 0;
+	if (!record_archive_statistics(path, DatabaseMode::OverWrite, &stats, &sample_count))
+		return false;
+
+	if (stats.database_lookups[RESOURCE_SAMPLER] != 2 || stats.database_hits[RESOURCE_SAMPLER] != 0)
+		return false;
+	if (stats.entries_written == 0 || stats.bytes_serialized == 0 || stats.bytes_written == 0)
+		return false;
+	if (stats.recording_thread_busy_ns == 0 || stats.recording_thread_busy_ns > stats.recording_thread_lifetime_ns)
+		return false;
+	if (sample_count == 0)
+		return false;
+
+	// Everything is in the archive already the second time around.
+	if (!record_archive_statistics(path, DatabaseMode::Append, &stats, &sample_count))
+		return false;
+	remove(path);
+
+	for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
+		if (stats.database_lookups[tag] != stats.database_hits[tag])
+			return false;
+	return stats.database_lookups[RESOURCE_GRAPHICS_PIPELINE] != 0 && stats.bytes_serialized == 0;
+}
+
+static std::vector<uint8_t> serialize_compute_pipelines(bool batched)
+{
+	StateRecorder recorder;
+	if (batched)
+		recorder.init_recording_thread(nullptr);
+
+	record_shader_modules(recorder);
+	record_pipeline_layouts(recorder);
+
+	VkComputePipelineCreateInfo infos[3];
+	VkPipeline pipelines[3];
+	for (unsigned i = 0; i < 3; i++)
+	{
+		infos[i] = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+		infos[i].stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		infos[i].stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		infos[i].stage.module = fake_handle<VkShaderModule>(5000 + (i & 1));
+		infos[i].stage.pName = "main";
+		infos[i].layout = fake_handle<VkPipelineLayout>(10001);
+		infos[i].basePipelineIndex = -1;
+		pipelines[i] = fake_handle<VkPipeline>(90000 + i);
+	}
+
+	// Derived from an earlier pipeline in the same call.
+	infos[2].flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+	infos[2].basePipelineIndex = 0;
+
+	if (batched)
+	{
+		if (!recorder.record_compute_pipelines(pipelines, infos, 3))
+			return {};
+		recorder.tear_down_recording_thread();
+	}
+	else
+	{
+		for (unsigned i = 0; i < 3; i++)
+			if (!recorder.record_compute_pipeline(pipelines[i], infos[i], pipelines, 3))
+				return {};
+	}
+
+	uint8_t *serialized;
+	size_t serialized_size;
+	if (!recorder.serialize(&serialized, &serialized_size))
+		return {};
+	std::vector<uint8_t> res(serialized, serialized + serialized_size);
+	StateRecorder::free_serialized(serialized);
+	return res;
+}
+
+static bool test_batched_pipeline_recording()
+{
+	auto single = serialize_compute_pipelines(false);
+	auto batched = serialize_compute_pipelines(true);
+	return !single.empty() && single == batched;
+}
+
+static void record_archive_sampled(const char *path, uint32_t slice, uint32_t slice_count, uint32_t objects_per_second,
+                                   StateRecorderStatistics *stats)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, DatabaseMode::OverWrite));
+	StateRecorder recorder;
+	recorder.set_database_sampling(slice, slice_count);
+	recorder.set_database_rate_limit(objects_per_second, 0);
+	recorder.set_enable_statistics(true);
+	recorder.init_recording_thread(db.get());
+
+	record_samplers(recorder);
+	record_set_layouts(recorder);
+	record_pipeline_layouts(recorder);
+	record_shader_modules(recorder);
+	record_render_passes(recorder);
+	record_compute_pipelines(recorder);
+	record_graphics_pipelines(recorder);
+	recorder.tear_down_recording_thread();
+	recorder.get_statistics(stats);
+}
+
+static bool get_archive_hashes(const char *path, ResourceTag tag, std::vector<Hash> &hashes)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	size_t hash_count = 0;
+	if (!db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+		return false;
+	hashes.resize(hash_count);
+	return db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data());
+}
+
+// Every base pipeline a graphics pipeline in the archive refers to must be in the archive as well.
+static bool archive_has_base_pipelines(const char *path)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	std::vector<Hash> hashes;
+	if (!get_archive_hashes(path, RESOURCE_GRAPHICS_PIPELINE, hashes))
+		return false;
+	std::set<Hash> written(hashes.begin(), hashes.end());
+
+	for (auto &hash : hashes)
+	{
+		size_t blob_size = 0;
+		if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, hash, &blob_size, nullptr, 0))
+			return false;
+		std::string blob(blob_size, '\0');
+		if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, hash, &blob_size, &blob[0], 0))
+			return false;
+
+		static const char key[] = "\"basePipelineHandle\":\"";
+		auto offset = blob.find(key);
+		if (offset == std::string::npos)
+			return false;
+		Hash base_hash = strtoull(blob.c_str() + offset + sizeof(key) - 1, nullptr, 16);
+		if (base_hash != 0 && !written.count(base_hash))
+			return false;
+	}
+
+	return true;
+}
+
+static bool test_database_sampling()
+{
+	const char *path = ".__test_sampling.foz";
+	StateRecorderStatistics stats;
+
+	std::vector<Hash> all_pipelines, all_modules;
+	record_archive_sampled(path, 0, 1, 0, &stats);
+	if (!get_archive_hashes(path, RESOURCE_GRAPHICS_PIPELINE, all_pipelines) ||
+	    !get_archive_hashes(path, RESOURCE_SHADER_MODULE, all_modules))
+		return false;
+	if (all_pipelines.empty() || stats.sampled_out_objects != 0 || stats.deferred_objects != 0)
+		return false;
+
+	// Slices are disjoint, cover everything, and always carry all dependencies, including base pipelines.
+	for (uint32_t slice_count = 2; slice_count <= 4; slice_count++)
+	{
+		std::set<Hash> sampled;
+		uint64_t sampled_out = 0;
+		for (uint32_t slice = 0; slice < slice_count; slice++)
+		{
+			std::vector<Hash> pipelines, modules;
+			record_archive_sampled(path, slice, slice_count, 0, &stats);
+			if (!get_archive_hashes(path, RESOURCE_GRAPHICS_PIPELINE, pipelines) ||
+			    !get_archive_hashes(path, RESOURCE_SHADER_MODULE, modules))
+				return false;
+			if (modules.size() != all_modules.size())
+				return false;
+			if (!archive_has_base_pipelines(path))
+				return false;
+
+			for (auto &hash : pipelines)
+				if (!sampled.insert(hash).second)
+					return false;
+			sampled_out += stats.sampled_out_objects;
+		}
+
+		if (sampled.size() != all_pipelines.size() || sampled_out == 0)
+			return false;
+	}
+
+	// Entries over the rate limit are deferred, but still written by the time recording ends.
+	std::vector<Hash> pipelines;
+	record_archive_sampled(path, 0, 1, 1, &stats);
+	if (!get_archive_hashes(path, RESOURCE_GRAPHICS_PIPELINE, pipelines))
+		return false;
+	remove(path);
+
+	return stats.deferred_objects != 0 && pipelines.size() == all_pipelines.size();
+}
+
+struct FeedbackCollector : LinkCollector
+{
+	std::map<Hash, PipelineFeedback> feedback;
+
+	void notify_pipeline_feedback(const PipelineFeedback &info) override
+	{
+		merge_pipeline_feedback(feedback[info.hash], info);
+	}
+};
+
+static void record_archive_feedback(const char *path, DatabaseMode mode, uint64_t duration_ns, bool wait_for_flush)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, mode));
+	StateRecorder recorder;
+	recorder.init_recording_thread(db.get());
+
+	record_samplers(recorder);
+	record_set_layouts(recorder);
+	record_pipeline_layouts(recorder);
+	record_shader_modules(recorder);
+	record_compute_pipelines(recorder);
+
+	VkPipelineCreationFeedbackEXT feedback = { VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT, duration_ns };
+	if (!recorder.record_pipeline_creation_feedback(fake_handle<VkPipeline>(80000), feedback))
+		abort();
+
+	// The recording thread flushes once it has been idle for a second,
+	// which must not split the feedback of a pipeline into several entries.
+	if (wait_for_flush)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+
+	feedback.flags |= VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT;
+	feedback.duration = duration_ns / 2;
+	if (!recorder.record_pipeline_creation_feedback(fake_handle<VkPipeline>(80000), feedback))
+		abort();
+
+	// Without driver feedback, only the duration counts.
+	feedback = { 0, duration_ns };
+	if (!recorder.record_pipeline_creation_feedback(fake_handle<VkPipeline>(80001), feedback))
+		abort();
+	recorder.tear_down_recording_thread();
+}
+
+static bool test_pipeline_feedback()
+{
+	const char *path = ".__test_feedback.foz";
+	remove(path);
+
+	// Each run writes one entry per pipeline, which readers combine.
+	record_archive_feedback(path, DatabaseMode::OverWrite, 1000, true);
+	record_archive_feedback(path, DatabaseMode::Append, 4000, false);
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	std::vector<Hash> pipelines, blobs;
+	if (!get_archive_hashes(path, RESOURCE_COMPUTE_PIPELINE, pipelines) ||
+	    !get_archive_hashes(path, RESOURCE_PIPELINE_FEEDBACK, blobs))
+		return false;
+	if (pipelines.size() != 2 || blobs.size() != 4)
+		return false;
+
+	FeedbackCollector collector;
+	StateReplayer replayer;
+	std::vector<uint8_t> blob;
+	for (auto hash : blobs)
+	{
+		size_t blob_size = 0;
+		if (!db->read_entry(RESOURCE_PIPELINE_FEEDBACK, hash, &blob_size, nullptr, 0))
+			return false;
+		blob.resize(blob_size);
+		if (!db->read_entry(RESOURCE_PIPELINE_FEEDBACK, hash, &blob_size, blob.data(), 0))
+			return false;
+		if (!replayer.parse(collector, nullptr, blob.data(), blob.size()))
+			return false;
+	}
+	remove(path);
+
+	// Tools can write feedback of their own which parses the same way.
+	PipelineFeedback replayed = {};
+	replayed.tag = RESOURCE_GRAPHICS_PIPELINE;
+	replayed.hash = 0x1234;
+	replayed.count = 1;
+	replayed.min_duration_ns = 300;
+	replayed.max_duration_ns = 300;
+	replayed.total_duration_ns = 300;
+
+	uint8_t *serialized = nullptr;
+	size_t serialized_size = 0;
+	Hash feedback_hash = 0;
+	if (!StateRecorder::serialize_pipeline_feedback(replayed, 1, &serialized, &serialized_size, &feedback_hash))
+		return false;
+	bool parsed = replayer.parse(collector, nullptr, serialized, serialized_size);
+	StateRecorder::free_serialized(serialized);
+	if (!parsed)
+		return false;
+
+	// Another run must not collide with the first.
+	Hash other_feedback_hash = 0;
+	if (!StateRecorder::serialize_pipeline_feedback(replayed, 2, &serialized, &serialized_size, &other_feedback_hash))
+		return false;
+	StateRecorder::free_serialized(serialized);
+	if (other_feedback_hash == feedback_hash)
+		return false;
+
+	auto &replayed_feedback = collector.feedback[replayed.hash];
+	if (replayed_feedback.tag != RESOURCE_GRAPHICS_PIPELINE || replayed_feedback.total_duration_ns != 300)
+		return false;
+	collector.feedback.erase(replayed.hash);
+
+	if (collector.feedback.size() != 2)
+		return false;
+
+	std::set<Hash> recorded_pipelines(pipelines.begin(), pipelines.end());
+	bool found_cached = false;
+	for (auto &itr : collector.feedback)
+	{
+		auto &info = itr.second;
+		if (info.tag != RESOURCE_COMPUTE_PIPELINE || !recorded_pipelines.count(info.hash))
+			return false;
+
+		if (info.count == 4)
+		{
+			if (info.min_duration_ns != 500 || info.max_duration_ns != 4000 || info.total_duration_ns != 7500 ||
+			    info.valid_feedback_count != 4 || info.cache_hit_count != 2)
+				return false;
+			found_cached = true;
+		}
+		else if (info.count != 2 || info.total_duration_ns != 5000 || info.valid_feedback_count != 0)
+			return false;
+	}
+
+	return found_cached;
+}
+
+struct UsageCollector : LinkCollector
+{
+	std::map<Hash, uint64_t> bind_counts;
+
+	void notify_pipeline_usage(Hash, const StateRecorderPipelineUsage &usage) override
+	{
+		bind_counts[usage.hash] += usage.bind_count;
+	}
+};
+
+static void record_archive_usage(const char *path, DatabaseMode mode, uint32_t bind_count)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, mode));
+	StateRecorder recorder;
+	recorder.init_recording_thread(db.get());
+
+	record_samplers(recorder);
+	record_set_layouts(recorder);
+	record_pipeline_layouts(recorder);
+	record_shader_modules(recorder);
+	record_compute_pipelines(recorder);
+
+	// Unknown handles are ignored.
+	const VkPipeline pipelines[] = {
+		fake_handle<VkPipeline>(80000), fake_handle<VkPipeline>(80001), fake_handle<VkPipeline>(12345),
+	};
+	const uint32_t bind_counts[] = { bind_count, 1, 1 };
+	if (!recorder.record_pipeline_usage(pipelines, bind_counts, 3))
+		abort();
+	if (!recorder.record_pipeline_usage(pipelines, bind_counts, 1))
+		abort();
+	recorder.tear_down_recording_thread();
+}
+
+static bool test_pipeline_usage()
+{
+	const char *path = ".__test_usage.foz";
+	remove(path);
+
+	record_archive_usage(path, DatabaseMode::OverWrite, 10);
+	record_archive_usage(path, DatabaseMode::Append, 100);
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	std::vector<Hash> pipelines, blobs;
+	if (!get_archive_hashes(path, RESOURCE_COMPUTE_PIPELINE, pipelines) ||
+	    !get_archive_hashes(path, RESOURCE_PIPELINE_USAGE, blobs))
+		return false;
+	if (pipelines.size() != 2 || blobs.size() != 2)
+		return false;
+
+	UsageCollector collector;
+	StateReplayer replayer;
+	std::vector<uint8_t> blob;
+	for (auto hash : blobs)
+	{
+		size_t blob_size = 0;
+		if (!db->read_entry(RESOURCE_PIPELINE_USAGE, hash, &blob_size, nullptr, 0))
+			return false;
+		blob.resize(blob_size);
+		if (!db->read_entry(RESOURCE_PIPELINE_USAGE, hash, &blob_size, blob.data(), 0))
+			return false;
+		if (!replayer.parse(collector, nullptr, blob.data(), blob.size()))
+			return false;
+	}
+	remove(path);
+
+	if (collector.bind_counts.size() != 2)
+		return false;
+
+	// 2 * 10 + 2 * 100 binds for the first pipeline, 1 + 1 for the second one.
+	std::set<Hash> recorded_pipelines(pipelines.begin(), pipelines.end());
+	std::set<uint64_t> counts;
+	for (auto &itr : collector.bind_counts)
+	{
+		if (!recorded_pipelines.count(itr.first))
+			return false;
+		counts.insert(itr.second);
+	}
+
+	return counts.count(220) && counts.count(2);
+}
+
+struct DependencyCollector : LinkCollector
+{
+	std::vector<PipelineDependencies> entries;
+	std::vector<std::vector<Hash>> modules;
+
+	void notify_pipeline_dependencies(const PipelineDependencies &deps) override
+	{
+		entries.push_back(deps);
+		modules.emplace_back(deps.modules, deps.modules + deps.module_count);
+	}
+};
+
+static bool test_pipeline_dependencies()
+{
+	const Hash graphics_modules[] = { 100, 101 };
+	const Hash compute_module = 102;
+	PipelineDependencies deps[3] = {};
+	deps[0] = { RESOURCE_GRAPHICS_PIPELINE, 1, 10, 20, 0, graphics_modules, 2 };
+	deps[1] = { RESOURCE_GRAPHICS_PIPELINE, 2, 10, 20, 1, graphics_modules, 2 };
+	deps[2] = { RESOURCE_COMPUTE_PIPELINE, 3, 11, 0, 0, &compute_module, 1 };
+
+	uint8_t *serialized = nullptr;
+	size_t serialized_size = 0;
+	Hash index_hash = 0, other_hash = 0;
+	if (!StateRecorder::serialize_pipeline_dependencies(deps, 3, &serialized, &serialized_size, &index_hash))
+		return false;
+	std::vector<uint8_t> blob(serialized, serialized + serialized_size);
+	StateRecorder::free_serialized(serialized);
+
+	// The key only depends on content.
+	if (!StateRecorder::serialize_pipeline_dependencies(deps, 3, &serialized, &serialized_size, &other_hash))
+		return false;
+	StateRecorder::free_serialized(serialized);
+	if (index_hash != other_hash)
+		return false;
+	if (!StateRecorder::serialize_pipeline_dependencies(deps, 2, &serialized, &serialized_size, &other_hash))
+		return false;
+	StateRecorder::free_serialized(serialized);
+	if (index_hash == other_hash)
+		return false;
+
+	DependencyCollector collector;
+	StateReplayer replayer;
+	if (!replayer.parse(collector, nullptr, blob.data(), blob.size()))
+		return false;
+	if (collector.entries.size() != 3)
+		return false;
+
+	for (unsigned i = 0; i < 3; i++)
+	{
+		auto &entry = collector.entries[i];
+		if (entry.tag != deps[i].tag || entry.hash != deps[i].hash || entry.layout != deps[i].layout ||
+		    entry.render_pass != deps[i].render_pass || entry.base_pipeline != deps[i].base_pipeline ||
+		    entry.module_count != deps[i].module_count ||
+		    collector.modules[i] != std::vector<Hash>(deps[i].modules, deps[i].modules + deps[i].module_count))
+		{
+			return false;
+		}
+	}
+
+	// Truncated blobs must be rejected.
+	DependencyCollector truncated;
+	if (replayer.parse(truncated, nullptr, blob.data(), blob.size() - sizeof(Hash)))
+		return false;
+
+	return true;
+}
+
 int main()
 {
 	if (!test_concurrent_database_extra_paths())
@@ -1096,6 +2347,36 @@ int main()
 		return EXIT_FAILURE;
 	if (!test_filter())
 		return EXIT_FAILURE;
+	if (!test_hash_scheme())
+		return EXIT_FAILURE;
+	if (!test_sub_state_interning())
+		return EXIT_FAILURE;
+	if (!test_sub_state_write_order())
+		return EXIT_FAILURE;
+	if (!test_database_worker_threads())
+		return EXIT_FAILURE;
+	if (!test_application_link_table())
+		return EXIT_FAILURE;
+	if (!test_early_duplicate_check())
+		return EXIT_FAILURE;
+	if (!test_concurrent_recording())
+		return EXIT_FAILURE;
+	if (!test_forget_handles())
+		return EXIT_FAILURE;
+	if (!test_staging_memory_budget())
+		return EXIT_FAILURE;
+	if (!test_recorder_statistics())
+		return EXIT_FAILURE;
+	if (!test_batched_pipeline_recording())
+		return EXIT_FAILURE;
+	if (!test_database_sampling())
+		return EXIT_FAILURE;
+	if (!test_pipeline_feedback())
+		return EXIT_FAILURE;
+	if (!test_pipeline_usage())
+		return EXIT_FAILURE;
+	if (!test_pipeline_dependencies())
+		return EXIT_FAILURE;
 
 	std::vector<uint8_t> res;
 	{
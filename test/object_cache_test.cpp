@@ -72,6 +72,20 @@ int main()
 	if (cache.find_object(9999).first != 0)
 		abort();
 
+	// Pinned objects survive pruning even when they are the least recently used.
+	cache.insert_object(10, 10000, 10);
+	cache.insert_object(11, 11000, 10);
+	cache.find_object(3);
+	cache.find_object(17);
+	cache.prune_cache([](Hash, int) {}, [](Hash hash) { return hash == 10; });
+
+	if (cache.find_object(10).first != 10000)
+		abort();
+	if (cache.find_object(11).first != 0)
+		abort();
+	if (cache.get_current_total_size() != 10)
+		abort();
+
 	cache.delete_cache([](Hash, int object) {
 		LOGI("Deleting object: %d\n", object);
 	});
@@ -0,0 +1,227 @@
+/* Copyright (c) 2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Runs a replayer built with SIMULATE_CRASHING_PIPELINES in multi-process mode,
+// and checks that every pipeline was attempted even though some child processes crashed.
+
+#include "fossilize.hpp"
+#include "fossilize_db.hpp"
+#include "fossilize_inttypes.h"
+#include "layer/utils.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <unordered_map>
+
+using namespace Fossilize;
+
+// Must match the SIMULATE_CRASHING_PIPELINES value the replayer is built with.
+static const Hash crash_modulo = 256;
+static const unsigned num_pipelines = 4096;
+static const unsigned num_modules = 512;
+static const char *archive_path = ".__test_replay_crash.foz";
+static const char *attempt_log_path = ".__test_replay_crash.log";
+
+template <typename T>
+static inline T fake_handle(uint64_t value)
+{
+	static_assert(sizeof(T) == sizeof(uint64_t), "Handle size is not 64-bit.");
+	return (T)value;
+}
+
+// Pipelines share modules, so pipelines of both chunks a child process has in flight
+// become ready together and complete out of order.
+// If module_for_pipeline is set, the recorder must not have a recording thread.
+static bool record_pipelines(StateRecorder &recorder, std::unordered_map<Hash, unsigned> *module_for_pipeline)
+{
+	VkPipelineLayoutCreateInfo layout = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	if (!recorder.record_pipeline_layout(fake_handle<VkPipelineLayout>(1), layout))
+		return false;
+
+	for (unsigned i = 0; i < num_modules; i++)
+	{
+		// A bare SPIR-V header, made unique by the generator word.
+		const uint32_t code[] = { 0x07230203, 0x10000, i, 1, 0 };
+		VkShaderModuleCreateInfo module = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+		module.pCode = code;
+		module.codeSize = sizeof(code);
+		if (!recorder.record_shader_module(fake_handle<VkShaderModule>(1000 + i), module))
+			return false;
+	}
+
+	for (unsigned i = 0; i < num_pipelines; i++)
+	{
+		const uint32_t spec_data = i;
+		const VkSpecializationMapEntry spec_entry = { 0, 0, sizeof(spec_data) };
+		VkSpecializationInfo spec = {};
+		spec.mapEntryCount = 1;
+		spec.pMapEntries = &spec_entry;
+		spec.dataSize = sizeof(spec_data);
+		spec.pData = &spec_data;
+
+		VkComputePipelineCreateInfo pipe = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+		pipe.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipe.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipe.stage.module = fake_handle<VkShaderModule>(1000 + i % num_modules);
+		pipe.stage.pName = "main";
+		pipe.stage.pSpecializationInfo = &spec;
+		pipe.layout = fake_handle<VkPipelineLayout>(1);
+		if (!recorder.record_compute_pipeline(fake_handle<VkPipeline>(100000 + i), pipe, nullptr, 0))
+			return false;
+
+		if (module_for_pipeline)
+		{
+			Hash hash = 0;
+			if (!Hashing::compute_hash_compute_pipeline(recorder, pipe, &hash))
+				return false;
+			(*module_for_pipeline)[hash] = i % num_modules;
+		}
+	}
+
+	return true;
+}
+
+static bool record_archive(std::unordered_map<Hash, unsigned> &module_for_pipeline)
+{
+	{
+		StateRecorder recorder;
+		if (!record_pipelines(recorder, &module_for_pipeline))
+			return false;
+	}
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(archive_path, DatabaseMode::OverWrite));
+	if (!db)
+		return false;
+
+	StateRecorder recorder;
+	recorder.init_recording_thread(db.get());
+	return record_pipelines(recorder, nullptr);
+}
+
+static bool get_pipeline_hashes(std::vector<Hash> &hashes)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(archive_path, DatabaseMode::ReadOnly));
+	if (!db || !db->prepare())
+		return false;
+
+	size_t count = 0;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &count, nullptr))
+		return false;
+	hashes.resize(count);
+	return db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &count, hashes.data());
+}
+
+static bool run_replay(const char *replayer, const std::vector<Hash> &expected, bool static_ranges)
+{
+	remove(attempt_log_path);
+	setenv("FOSSILIZE_REPLAY_ATTEMPT_LOG", attempt_log_path, 1);
+
+	std::string cmd = replayer;
+	cmd += " --null-device --master-process --num-threads 2 --quiet-slave";
+	if (static_ranges)
+		cmd += " --static-process-ranges";
+	cmd += " ";
+	cmd += archive_path;
+
+	if (system(cmd.c_str()) != 0)
+	{
+		LOGE("Replayer failed: %s\n", cmd.c_str());
+		return false;
+	}
+
+	std::unordered_set<Hash> attempted;
+	FILE *file = fopen(attempt_log_path, "r");
+	if (!file)
+	{
+		LOGE("No pipelines were attempted.\n");
+		return false;
+	}
+
+	char line[64];
+	while (fgets(line, sizeof(line), file))
+		attempted.insert(strtoull(line, nullptr, 16));
+	fclose(file);
+
+	unsigned missing = 0;
+	for (auto hash : expected)
+	{
+		if (!attempted.count(hash))
+		{
+			LOGE("Pipeline %016" PRIx64 " was never attempted.\n", hash);
+			missing++;
+		}
+	}
+
+	LOGI("%s ranges: %u / %u pipelines attempted.\n", static_ranges ? "Static" : "Dynamic",
+	     unsigned(expected.size()) - missing, unsigned(expected.size()));
+	return missing == 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		LOGE("Usage: replay-crash-test <fossilize-replay-crashing>\n");
+		return EXIT_FAILURE;
+	}
+
+	std::unordered_map<Hash, unsigned> module_for_pipeline;
+	if (!record_archive(module_for_pipeline))
+		return EXIT_FAILURE;
+
+	std::vector<Hash> hashes;
+	if (!get_pipeline_hashes(hashes) || hashes.size() != num_pipelines)
+		return EXIT_FAILURE;
+
+	// After a crash, the master masks the modules of the crashed pipeline,
+	// so every pipeline using those modules is legitimately skipped.
+	std::unordered_set<unsigned> crashed_modules;
+	for (auto hash : hashes)
+	{
+		auto itr = module_for_pipeline.find(hash);
+		if (itr == module_for_pipeline.end())
+			return EXIT_FAILURE;
+		if ((hash % crash_modulo) == 0)
+			crashed_modules.insert(itr->second);
+	}
+
+	// The test is pointless unless some child processes actually crash.
+	if (crashed_modules.empty())
+	{
+		LOGE("No pipeline in the archive triggers a crash.\n");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<Hash> expected;
+	for (auto hash : hashes)
+		if (!crashed_modules.count(module_for_pipeline[hash]))
+			expected.push_back(hash);
+
+	bool success = run_replay(argv[1], expected, false) && run_replay(argv[1], expected, true);
+
+	remove(archive_path);
+	remove(attempt_log_path);
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
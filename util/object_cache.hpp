@@ -48,6 +48,11 @@ public:
 		target_size = size;
 	}
 
+	size_t get_target_size() const
+	{
+		return target_size;
+	}
+
 	std::pair<T, bool> find_object(Hash hash)
 	{
 		auto itr = hash_to_objects.find(hash);
@@ -61,10 +66,21 @@ public:
 	template <typename Deleter>
 	void prune_cache(const Deleter &deleter)
 	{
-		while (total_size > target_size)
+		prune_cache(deleter, [](Hash) { return false; });
+	}
+
+	// Objects for which is_pinned() returns true are kept, even if they are the least recently used ones.
+	template <typename Deleter, typename Pinned>
+	void prune_cache(const Deleter &deleter, const Pinned &is_pinned)
+	{
+		auto itr = lru_cache.rbegin();
+		while (total_size > target_size && itr)
 		{
-			assert(!lru_cache.empty());
-			auto last_used_entry = lru_cache.rbegin();
+			auto last_used_entry = itr;
+			--itr;
+			if (is_pinned(last_used_entry->hash))
+				continue;
+
 			assert(last_used_entry->size <= total_size);
 			total_size -= last_used_entry->size;
 			lru_cache.erase(last_used_entry);